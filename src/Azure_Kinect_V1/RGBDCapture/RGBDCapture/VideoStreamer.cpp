@@ -1,118 +1,109 @@
 #include "VideoStreamer.h"
 #include <iostream>
 
-VideoStreamer::VideoStreamer() : codecContext(nullptr), sws_ctx(nullptr), avFrame(nullptr), packet(nullptr) {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
+VideoStreamer::VideoStreamer(EncoderKind encoderKind, const FrameSourceConfig& sourceConfig)
+    : sourceConfig(sourceConfig), encoderKind(encoderKind), sws_ctx(nullptr), avFrame(nullptr) {
+    initNetwork();
     setupNetwork();
     setupVideo();
 }
 
 VideoStreamer::~VideoStreamer() {
     cleanup();
-    WSACleanup();
+    shutdownNetwork();
 }
 
 void VideoStreamer::setupNetwork() {
-    server.sin_family = AF_INET;
-    server.sin_port = htons(8888);
-    inet_pton(AF_INET, "192.168.1.131", &server.sin_addr);
-    server_size = sizeof(server);
-    sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == SOCKET_ERROR) {
-        std::cerr << "Socket creation failed.\n";
+    if (!transport.open("192.168.1.131", 8888)) {
         exit(1);
     }
 }
 
 void VideoStreamer::setupVideo() {
-    const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    codecContext = avcodec_alloc_context3(codec);
-    codecContext->bit_rate = 1000000;
-    codecContext->width = 1920;
-    codecContext->height = 1080;
-    codecContext->time_base = { 1, 30 };
-    codecContext->framerate = { 30, 1 };
-    codecContext->gop_size = 15;
-    codecContext->max_b_frames = 1;
-    codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
+    source = FrameSource::create(sourceConfig);
+    if (!source) {
+        std::cerr << "Could not open the frame source\n";
+        exit(1);
+    }
+
+    EncoderConfig config;
+    config.codecId = AV_CODEC_ID_H264;
+    config.bitRate = 1000000;
+    config.width = source->width();
+    config.height = source->height();
+    config.fps = source->fps() > 0.0 ? static_cast<int>(source->fps() + 0.5) : 30;
+    config.gopSize = 15;
 
-    if (avcodec_open2(codecContext, codec, NULL) < 0) {
+    encoder = EncoderBackend::create(encoderKind, config);
+    if (!encoder) {
         std::cerr << "Failed to open codec\n";
         exit(1);
     }
+    bandwidth.reset(new BandwidthEstimator(config.bitRate, config.bitRate / 10, config.bitRate * 2));
 
-    sws_ctx = sws_getContext(codecContext->width, codecContext->height, AV_PIX_FMT_BGR24,
-        codecContext->width, codecContext->height, AV_PIX_FMT_YUV420P,
+    sws_ctx = sws_getContext(config.width, config.height, AV_PIX_FMT_BGR24,
+        config.width, config.height, AV_PIX_FMT_YUV420P,
         SWS_BILINEAR, NULL, NULL, NULL);
 
     avFrame = av_frame_alloc();
-    avFrame->format = codecContext->pix_fmt;
-    avFrame->width = codecContext->width;
-    avFrame->height = codecContext->height;
+    avFrame->format = AV_PIX_FMT_YUV420P;
+    avFrame->width = config.width;
+    avFrame->height = config.height;
     av_image_alloc(avFrame->data, avFrame->linesize, avFrame->width, avFrame->height, (AVPixelFormat)avFrame->format, 32);
-
-    packet = av_packet_alloc();
 }
 
 void VideoStreamer::cleanup() {
     av_freep(&avFrame->data[0]);
     av_frame_free(&avFrame);
-    av_packet_free(&packet);
-    avcodec_free_context(&codecContext);
+    encoder.reset();
     sws_freeContext(sws_ctx);
-    closesocket(sock);
-    cv::destroyAllWindows();
+    transport.close();
 }
 
-void VideoStreamer::sendPacketWithTimestamp(SOCKET sock, AVPacket* packet, const sockaddr_in& server, int64_t millis) {
-    size_t new_size = packet->size + sizeof(millis);
-    std::vector<char> new_packet(packet->size + sizeof(millis));
-    memcpy(new_packet.data(), packet->data, packet->size);
-    memcpy(new_packet.data() + packet->size, &millis, sizeof(millis));
-    sendto(sock, new_packet.data(), new_size, 0, (struct sockaddr*)&server, sizeof(server));
+void VideoStreamer::sendPacketWithTimestamp(AVPacket* packet, FrameTiming& timing) {
+    // One datagram per MTU-sized fragment, the whole frame in as few syscalls as possible
+    bool keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+    const std::vector<Fragment>& fragments = packetizer.packetize(packet->data, packet->size, timing.captureMillis, keyframe);
+    transport.sendFragments(fragments);
+    timing.sendNs = steadyNowNs();
+    latency.record(timing);
+
+    // Receiver feedback retargets the encoder from the next frame on
+    bool retarget = bandwidth->onFrameSent(packetizer.lastFrameId(), timing.sendNs, packet->size, fragments.size());
+    uint8_t report[c_maxFeedbackSize];
+    int len;
+    while ((len = transport.receive(report, sizeof(report))) > 0) {
+        retarget = bandwidth->onFeedback(report, len, steadyNowNs()) || retarget;
+    }
+    if (retarget) encoder->setBitrate(bandwidth->targetBitrate());
 }
 
-bool VideoStreamer::encodeAndSendFrames(cv::VideoCapture& cap) {
-    cv::Mat frame;
-    cap >> frame;  // Capture a new frame
-    if (frame.empty()) return false;
+bool VideoStreamer::encodeAndSendFrames() {
+    cv::Mat& frame = captureFrame; // reused, so capture stops allocating once sized
+    if (!source->read(frame)) return false;  // Capture a new frame
     //int frame_count = 0;
-    auto now = std::chrono::system_clock::now();
-    auto duration = now.time_since_epoch();
-    int64_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    FrameTiming timing = FrameTiming::captured();
 
     uint8_t* inData[1] = { frame.data };
     int inLinesize[1] = { static_cast<int>(frame.step) };
     sws_scale(sws_ctx, inData, inLinesize, 0, frame.rows, avFrame->data, avFrame->linesize);
     avFrame->pts = frame_count++;
+    timing.convertNs = steadyNowNs();
 
-    if (avcodec_send_frame(codecContext, avFrame) < 0) {
-        std::cerr << "Error sending frame for encoding\n";
-        return true;
-    }
-
-    while (avcodec_receive_packet(codecContext, packet) == 0) {
-        sendPacketWithTimestamp(sock, packet, server, millis);
-        av_packet_unref(packet);  // Reset packet for the next usage
-    }
+    encoder->encode(avFrame, timing, [this](AVPacket* packet, FrameTiming& packetTiming) {
+        sendPacketWithTimestamp(packet, packetTiming);
+    });
     return true;
 }
 
 int VideoStreamer::run() {
-    cv::VideoCapture cap(0);
-    double width = 1920, height = 1080;
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, width);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, height);
-    if (!cap.isOpened()) {
-        std::cerr << "Cannot open the video camera.\n";
-        return 1;
-    }
-
-    //cv::namedWindow("Live Video", cv::WINDOW_AUTOSIZE);
-    while (true) {
-        if (!encodeAndSendFrames(cap)) break;
-        if (cv::waitKey(5) >= 0) break;
+    // No local window here, so no waitKey either: it slept up to 5 ms on every frame
+    while (encodeAndSendFrames()) {
     }
+    encoder->encode(nullptr, FrameTiming(), [this](AVPacket* packet, FrameTiming& packetTiming) {
+        sendPacketWithTimestamp(packet, packetTiming);
+    });
+    latency.dump(std::cout);
+    bandwidth->dump(std::cout);
     return 0;
 }
@@ -1,8 +1,6 @@
 #ifndef VIDEOSTREAMER_H
 #define VIDEOSTREAMER_H
 
-#include <winsock2.h>
-#include <Ws2tcpip.h>
 #include <opencv2/opencv.hpp>
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -12,14 +10,20 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
-#pragma comment(lib, "ws2_32.lib")
-
 #include <vector>
 #include <chrono>
 
+#include "../../../common/EncoderBackend.h"
+#include "../../../common/Packetizer.h"
+#include "../../../common/UdpTransport.h"
+#include "../../../common/FrameTiming.h"
+#include "../../../common/FrameSource.h"
+#include "../../../common/CongestionControl.h"
+
 class VideoStreamer {
 public:
-    VideoStreamer();
+    explicit VideoStreamer(EncoderKind encoderKind = EncoderKind::Auto,
+        const FrameSourceConfig& sourceConfig = FrameSourceConfig());
     ~VideoStreamer();
     int run();
 
@@ -27,17 +31,21 @@ private:
     void setupNetwork();
     void setupVideo();
     void cleanup();
-    void sendPacketWithTimestamp(SOCKET sock, AVPacket* packet, const sockaddr_in& server, int64_t millis);
-    bool encodeAndSendFrames(cv::VideoCapture& cap);
+    void sendPacketWithTimestamp(AVPacket* packet, FrameTiming& timing);
+    bool encodeAndSendFrames();
 
-    SOCKET sock;
-    struct sockaddr_in server;
-    AVCodecContext* codecContext;
+    FrameSourceConfig sourceConfig;
+    std::unique_ptr<FrameSource> source;
+    EncoderKind encoderKind;
+    std::unique_ptr<EncoderBackend> encoder;
     SwsContext* sws_ctx;
     AVFrame* avFrame;
-    AVPacket* packet;
-    int server_size;
     int frame_count = 0;
+    Packetizer packetizer;
+    UdpSender transport;
+    PipelineLatency latency;
+    std::unique_ptr<BandwidthEstimator> bandwidth;
+    cv::Mat captureFrame;
 };
 
 #endif // VIDEOSTREAMER_H
@@ -10,7 +10,13 @@
 
 #include "VideoStreamer.h"
 
-int main() {
-    VideoStreamer streamer;
+// usage: RGBDCapture [camera[:N]|pattern|y4m:FILE|yuv:FILE[,fps=N|max][,loop][,frames=N]]
+int main(int argc, char** argv) {
+    FrameSourceConfig source;
+    source.width = 1920;
+    source.height = 1080;
+    if (argc > 1 && !source.parse(argv[1])) return 1;
+
+    VideoStreamer streamer(EncoderKind::Auto, source);
     return streamer.run();
 }
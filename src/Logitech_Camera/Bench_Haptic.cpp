@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../common/HapticCodec.h"
+#include "../common/HapticDevice.h"
+#include "../common/HapticTrace.h"
+
+// Reconstruction error of one channel group over a trace
+struct GroupError {
+    std::vector<float> errors;
+
+    double rms() const {
+        double sum = 0.0;
+        for (float e : errors) sum += static_cast<double>(e) * e;
+        return errors.empty() ? 0.0 : std::sqrt(sum / errors.size());
+    }
+
+    double percentile(double p) {
+        if (errors.empty()) return 0.0;
+        std::size_t index = std::min(errors.size() - 1, static_cast<std::size_t>(p / 100.0 * errors.size()));
+        std::nth_element(errors.begin(), errors.begin() + index, errors.end());
+        return errors[index];
+    }
+};
+
+// Runs the codec over the trace with the receiver's reconstruction and prints one row
+static void bench(const std::vector<HapticSample>& trace, double seconds, const DeadbandConfig& config) {
+    DeadbandEncoder encoder(config);
+    HapticPredictor receiver(config.mode);
+    GroupError position, force;
+    position.errors.reserve(trace.size());
+    force.errors.reserve(trace.size());
+
+    for (const HapticSample& sample : trace) {
+        float shown[c_hapticChannels];
+        if (encoder.encode(sample)) {
+            receiver.update(sample);
+            std::copy(sample.values, sample.values + c_hapticChannels, shown);
+        }
+        else {
+            receiver.predict(sample.sequence, shown);
+        }
+        position.errors.push_back(groupDistance(sample.values, shown));
+        force.errors.push_back(groupDistance(sample.values + 3, shown + 3));
+    }
+
+    double reduction = 100.0 * (1.0 - static_cast<double>(encoder.sent()) / trace.size());
+    printf("%-12s %8.3f %10.1f %9.1f%% %12.3f %10.3f %10.3f %12.4f %10.4f %10.4f\n",
+        config.mode == Reconstruction::Hold ? "hold" : "extrapolate", config.deadband, encoder.sent() / seconds,
+        reduction, position.rms(), position.percentile(99.0), position.percentile(100.0), force.rms(),
+        force.percentile(99.0), force.percentile(100.0));
+}
+
+// usage: Bench_Haptic [TRACE.csv|sim[:SEED]] [--deadband K[,K...]] [--reconstruct hold|extrapolate|both] [--seconds S]
+int main(int argc, char** argv) {
+    std::string source = "sim";
+    std::vector<double> deadbands = { 0.02, 0.05, 0.1, 0.2 };
+    std::vector<Reconstruction> modes = { Reconstruction::Hold, Reconstruction::Extrapolate };
+    int simulatedSeconds = 60;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--deadband" && i + 1 < argc) {
+            deadbands.clear();
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ',')) deadbands.push_back(atof(item.c_str()));
+        }
+        else if (arg == "--reconstruct" && i + 1 < argc) {
+            std::string name = argv[++i];
+            Reconstruction mode;
+            if (name == "both") {
+                modes = { Reconstruction::Hold, Reconstruction::Extrapolate };
+            }
+            else if (parseReconstruction(name, mode)) {
+                modes = { mode };
+            }
+            else {
+                std::cerr << "Unknown reconstruction " << name << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--seconds" && i + 1 < argc) simulatedSeconds = atoi(argv[++i]);
+        else if (arg[0] != '-') source = arg;
+    }
+
+    // A recorded trace, or the simulated device sampled at 1 kHz
+    std::vector<HapticSample> trace;
+    if (source.compare(0, 3, "sim") == 0) {
+        std::unique_ptr<HapticDevice> device = HapticDevice::create(source, 1000);
+        if (!device) return 1;
+        trace.resize(static_cast<std::size_t>(simulatedSeconds) * 1000);
+        for (std::size_t i = 0; i < trace.size(); ++i) {
+            trace[i].sequence = static_cast<uint32_t>(i);
+            trace[i].captureUs = static_cast<int64_t>(i) * 1000;
+            device->read(trace[i].values);
+        }
+    }
+    else if (!HapticTrace::load(source, trace)) {
+        return 1;
+    }
+    double seconds = (trace.back().captureUs - trace.front().captureUs) / 1e6;
+    if (seconds <= 0.0) seconds = trace.size() / 1000.0;
+
+    printf("Trace %s: %zu samples, %.1f s, %.0f samples/s\n", source.c_str(), trace.size(), seconds, trace.size() / seconds);
+    printf("%-12s %8s %10s %10s %12s %10s %10s %12s %10s %10s\n", "mode", "deadband", "packets/s", "reduction",
+        "pos rms mm", "p99 mm", "max mm", "force rms N", "p99 N", "max N");
+    for (Reconstruction mode : modes) {
+        for (double k : deadbands) {
+            DeadbandConfig config;
+            config.deadband = k;
+            config.mode = mode;
+            bench(trace, seconds, config);
+        }
+    }
+    return 0;
+}
@@ -1,50 +1,63 @@
 #include <iostream>
-#include <winsock2.h>
-#include <Ws2tcpip.h> 
 #include <opencv2/opencv.hpp>
+#include <chrono>
 
-#pragma comment(lib, "ws2_32.lib") // Link with Winsock library
+#include "../common/Packetizer.h"
+#include "../common/UdpTransport.h"
+#include "../common/FrameSource.h"
+#include "../common/Preview.h"
 
-int main() {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData); // Initialize Winsock
-
-    struct sockaddr_in server;
-    server.sin_family = AF_INET;
-    server.sin_port = htons(8888);
-    inet_pton(AF_INET, "192.168.0.2", &server.sin_addr); 
+// usage: Client [camera[:N]|pattern|y4m:FILE|yuv:FILE[,fps=N|max][,loop][,frames=N]] [--preview-fps N]
+int main(int argc, char** argv) {
+    FrameSourceConfig sourceConfig;
+    int first = 1;
+    if (argc > 1 && std::string(argv[1]).compare(0, 2, "--") != 0) {
+        if (!sourceConfig.parse(argv[1])) return 1;
+        first = 2;
+    }
+    double previewFps = 10.0;  // 0 disables the local preview window
+    for (int i = first; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--preview-fps" && i + 1 < argc) previewFps = atof(argv[++i]);
+        else {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
 
-    int server_size = sizeof(server);
+    initNetwork(); // Initialize Winsock on Windows
 
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == SOCKET_ERROR) {
-        std::cerr << "Socket creation failed.\n";
+    UdpSender transport;
+    if (!transport.open("192.168.0.2", 8888)) {
+        shutdownNetwork();
         return 1;
     }
 
-    cv::VideoCapture cap(0); // Open the default camera
-    if (!cap.isOpened()) {
-        std::cerr << "Cannot open the video camera.\n";
-        closesocket(sock);
-        WSACleanup();
+    std::unique_ptr<FrameSource> source = FrameSource::create(sourceConfig); // the default camera unless told otherwise
+    if (!source) {
+        transport.close();
+        shutdownNetwork();
         return 1;
     }
 
-    cv::namedWindow("Live Video", cv::WINDOW_AUTOSIZE); // Create a window for display.
+    Preview preview("Live Video", previewFps); // Displayed from its own thread, at a reduced rate
+    preview.start();
 
     cv::Mat frame;
+    Packetizer packetizer;
 
     double time_start = static_cast<double>(cv::getTickCount());
     int frame_count = 0;
     double fps = 0.0;
 
     while (true) {
-        cap >> frame; // Capture a new frame
-        if (frame.empty()) break;
+        if (!source->read(frame)) break; // Capture a new frame
+        int64_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
 
         // Display the resulting frame
-        cv::imshow("Live Video", frame);
-        if (cv::waitKey(5) >= 0) break; // Wait for a keystroke in the window
+        preview.offer(frame, millis);
+        if (preview.closeRequested()) break; // A key was pressed in the window
 
         frame_count++;
         if (frame_count % 10 == 0) { // Calculate FPS every 10 frames
@@ -56,13 +69,12 @@ int main() {
         }
         std::vector<uchar> buffer;
         cv::imencode(".jpg", frame, buffer); // Encode frame to JPEG
-        int buffer_size = static_cast<int>(buffer.size()); 
-        sendto(sock, reinterpret_cast<const char*>(buffer.data()), buffer_size, 0,
-            (struct sockaddr*)&server, server_size);
+        // Every JPEG is self-contained, so each one is flagged as a keyframe
+        transport.sendFragments(packetizer.packetize(buffer.data(), buffer.size(), millis, true));
     }
 
-    closesocket(sock);
-    WSACleanup(); // Cleanup Winsock
-    cv::destroyWindow("Live Video"); // Close the display window
+    preview.stop(); // Close the display window
+    transport.close();
+    shutdownNetwork(); // Cleanup Winsock
     return 0;
 }
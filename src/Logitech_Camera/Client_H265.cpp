@@ -1,6 +1,4 @@
 ﻿#include <iostream>
-#include <winsock2.h>
-#include <Ws2tcpip.h>
 #include <opencv2/opencv.hpp>
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -10,75 +8,153 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
-#pragma comment(lib, "ws2_32.lib")
-
-void send_packet_with_timestamp(SOCKET sock, AVPacket* packet, const sockaddr_in& server, int64_t millis) {
-
-    
-
-    //std::cout << sizeof(millis) << std::endl;
-    
-
-
-    size_t new_size = packet->size + sizeof(millis);
+#include "../common/EncoderBackend.h"
+#include "../common/Packetizer.h"
+#include "../common/UdpTransport.h"
+#include "../common/FrameTiming.h"
+#include "../common/FrameSource.h"
+#include "../common/Preview.h"
+#include "../common/CongestionControl.h"
+#include "../common/Rtp.h"
+#include "../common/Fec.h"
+#include "../common/Nack.h"
+#include "../common/PictureLoss.h"
+#include "../common/ClockSync.h"
+
+// Answers NACKs from the cache and queues keyframe requests; returns true when feedback
+// moved the target bitrate
+bool poll_feedback(UdpSender& transport, BandwidthEstimator& bandwidth, RetransmitCache& retransmits,
+    KeyframeRequestHandler& keyframeRequests) {
+    bool retarget = false;
+    uint8_t report[c_maxFeedbackSize];
+    int len;
+    int64_t arrivalUs;
+    while ((len = transport.receive(report, sizeof(report), &arrivalUs)) > 0) {
+        if (report[0] == c_nackMagic) {
+            transport.sendFragments(retransmits.onNack(report, len, steadyNowNs()));
+        }
+        else if (report[0] == c_clockMagic) {
+            uint8_t response[c_clockMessageSize];
+            std::size_t responseLen = answerClockRequest(report, len, arrivalUs, response);
+            if (responseLen) transport.send(response, responseLen);
+        }
+        else if (report[0] == c_pictureLossMagic) {
+            keyframeRequests.onRequest(report, len, steadyNowNs());
+        }
+        else {
+            retarget = bandwidth.onFeedback(report, len, steadyNowNs()) || retarget;
+        }
+    }
+    return retarget;
+}
 
+// Returns true when receiver feedback moved the target bitrate
+bool send_packet_with_timestamp(UdpSender& transport, Packetizer& packetizer, FecEncoder& fec, BandwidthEstimator& bandwidth,
+    RetransmitCache& retransmits, KeyframeRequestHandler& keyframeRequests, AVPacket* packet, FrameTiming& timing) {
+    // A 1080p I-frame is far larger than one datagram: send MTU-sized fragments, batched
+    bool keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+    const std::vector<Fragment>& fragments = packetizer.packetize(packet->data, packet->size, timing.captureMillis, keyframe);
+    transport.sendFragments(fragments);
+    // Repairs right behind, in their own batch as they are sized differently
+    std::size_t bytes = packet->size;
+    const std::vector<Fragment>& repairs = fec.protect(fragments, keyframe);
+    if (!repairs.empty()) {
+        transport.sendFragments(repairs);
+        bytes += repairs.size() * repairs[0].size;
+    }
+    timing.sendNs = steadyNowNs();
+    retransmits.store(fragments, timing.sendNs);
+    if (keyframe) keyframeRequests.onKeyframeSent(packetizer.lastFrameId(), timing.sendNs);
 
-    std::vector<char> new_packet(packet->size + sizeof(millis));
-    memcpy(new_packet.data(), packet->data, packet->size);
-    memcpy(new_packet.data() + packet->size, &millis, sizeof(millis));
+    bool retarget = bandwidth.onFrameSent(packetizer.lastFrameId(), timing.sendNs, bytes, fragments.size());
+    return poll_feedback(transport, bandwidth, retransmits, keyframeRequests) || retarget;
+}
 
 
-    sendto(sock, new_packet.data(), new_size, 0, (struct sockaddr*)&server, sizeof(server));
+// RTP/H.265 (RFC 7798): FU/AP packets with the marker on the last packet of each frame
+void send_rtp_packet(UdpSender& transport, RtpPacketizer<H265Payload>& packetizer, AVPacket* packet, FrameTiming& timing) {
+    transport.sendFragments(packetizer.packetize(packet->data, packet->size, packetizer.timestampFor(timing.captureMillis)));
+    timing.sendNs = steadyNowNs();
 }
 
+// usage: Client_H265 [nvenc|x265] [camera[:N]|pattern|y4m:FILE|yuv:FILE[,fps=N|max][,loop][,frames=N]] [--rtp] [--fec SPEC] [--gop N] [--stream N] [--slices N] [--preview-fps N]
+int main(int argc, char** argv) {
+    FrameSourceConfig sourceConfig;
+    sourceConfig.width = 1920;
+    sourceConfig.height = 1080;
+    EncoderKind kind = EncoderKind::Auto;
+    // The encoder and the source are optional and positional, the flags follow them
+    int first = 1;
+    if (first < argc && std::string(argv[first]).compare(0, 2, "--") != 0) {
+        if (!EncoderBackend::parseKind(argv[first], kind)) {
+            std::cerr << "Unknown encoder " << argv[first] << "\n";
+            return 1;
+        }
+        first++;
+    }
+    if (first < argc && std::string(argv[first]).compare(0, 2, "--") != 0) {
+        if (!sourceConfig.parse(argv[first])) return 1;
+        first++;
+    }
+    bool rtp = false;
+    FecConfig fecConfig;  // e.g. "xor/rs:0.5": XOR rows on delta frames, 50% Reed-Solomon on keyframes
+    int gopSize = 15;     // receivers ask for an IDR on loss, so native streams can use long GOPs
+    int streamId = 0;     // one receiver takes several cameras, told apart by this id
+    int slices = 0;       // a lost fragment costs the receiver one slice, not the picture
+    double previewFps = 10.0;  // 0 disables the local preview window
+    for (int i = first; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--rtp") rtp = true;
+        else if (arg == "--gop" && i + 1 < argc) gopSize = atoi(argv[++i]);
+        else if (arg == "--stream" && i + 1 < argc) streamId = atoi(argv[++i]);
+        else if (arg == "--slices" && i + 1 < argc) slices = atoi(argv[++i]);
+        else if (arg == "--preview-fps" && i + 1 < argc) previewFps = atof(argv[++i]);
+        else if (arg == "--fec" && i + 1 < argc) {
+            if (!fecConfig.parse(argv[++i])) {
+                std::cerr << "Bad FEC spec " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
 
-int main() {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
-
-    struct sockaddr_in server;
-    server.sin_family = AF_INET;
-    server.sin_port = htons(8888);
-    inet_pton(AF_INET, "192.168.0.1", &server.sin_addr);
+    initNetwork();
 
-    int server_size = sizeof(server);
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == SOCKET_ERROR) {
-        std::cerr << "Socket creation failed.\n";
+    UdpSender transport;
+    if (!transport.open("192.168.0.1", 8888)) {
+        shutdownNetwork();
         return 1;
     }
 
-    cv::VideoCapture cap(0); // Open default camera
-    if (!cap.isOpened()) {
-        std::cerr << "Cannot open the video camera.\n";
-        closesocket(sock);
-        WSACleanup();
+    std::unique_ptr<FrameSource> source = FrameSource::create(sourceConfig);
+    if (!source) {
+        transport.close();
+        shutdownNetwork();
         return 1;
     }
 
-    double width = 1920, height = 1080;
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, width);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, height);
+    Preview preview("Live Video", previewFps);
 
-    cv::namedWindow("Live Video", cv::WINDOW_AUTOSIZE);
+    EncoderConfig config;
+    config.codecId = AV_CODEC_ID_HEVC;
+    config.bitRate = 400000; // Set bitrate
+    config.width = source->width();
+    config.height = source->height();
+    config.fps = source->fps() > 0.0 ? static_cast<int>(source->fps() + 0.5) : 30;
+    config.gopSize = gopSize;
+    config.slices = slices;
 
-    const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_HEVC);
-    AVCodecContext* codecContext = avcodec_alloc_context3(codec);
-    codecContext->bit_rate = 400000; // Set bitrate
-    codecContext->width = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
-    codecContext->height = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
-    codecContext->time_base = { 1,30 };
-    codecContext->framerate = { 30, 1 };
-    codecContext->gop_size = 15;
-    codecContext->max_b_frames = 1;
-    codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
-
-    if (avcodec_open2(codecContext, codec, NULL) < 0) {
+    std::unique_ptr<EncoderBackend> encoder = EncoderBackend::create(kind, config);
+    if (!encoder) {
         std::cerr << "Failed to open codec\n";
-        closesocket(sock);
-        WSACleanup();
+        transport.close();
+        shutdownNetwork();
         return 1;
     }
+    AVCodecContext* codecContext = encoder->context();
 
     SwsContext* sws_ctx = sws_getContext(codecContext->width, codecContext->height, AV_PIX_FMT_BGR24,
         codecContext->width, codecContext->height, AV_PIX_FMT_YUV420P,
@@ -89,7 +165,7 @@ int main() {
         std::cerr << "Could not allocate video frame\n";
         exit(1);
     }
-    avFrame->format = codecContext->pix_fmt; // 
+    avFrame->format = AV_PIX_FMT_YUV420P; // backends take software YUV420P, even NVENC
     avFrame->width = codecContext->width;
     avFrame->height = codecContext->height;
 
@@ -100,23 +176,41 @@ int main() {
     }
 
 
-    AVPacket* packet = av_packet_alloc();
-
+    Packetizer packetizer(static_cast<uint8_t>(streamId));
+    FecEncoder fec(fecConfig);
+    RetransmitCache retransmits;
+    KeyframeRequestHandler keyframeRequests;
+    PipelineLatency latency;
+    RtpPacketizer<H265Payload> rtpPacketizer;
+    BandwidthEstimator bandwidth(config.bitRate, config.bitRate / 10, config.bitRate * 2);
+    auto sendPacket = [&](AVPacket* packet, FrameTiming& packetTiming) {
+        if (rtp) {
+            send_rtp_packet(transport, rtpPacketizer, packet, packetTiming);
+        }
+        else if (send_packet_with_timestamp(transport, packetizer, fec, bandwidth, retransmits, keyframeRequests, packet, packetTiming)) {
+            encoder->setBitrate(bandwidth.targetBitrate());
+        }
+        latency.record(packetTiming);
+    };
     int frame_count = 0;
     cv::Mat frame;
+    preview.start();
     while (true) {
-        cap >> frame; // Capture a new frame
+        if (!source->read(frame)) break; // Capture a new frame
+        FrameTiming timing = FrameTiming::captured();
 
+        // NACKs that came in while the camera was busy; the pipelined VideoStreamer
+        // answers them within a millisecond instead
+        if (!rtp && poll_feedback(transport, bandwidth, retransmits, keyframeRequests)) {
+            encoder->setBitrate(bandwidth.targetBitrate());
+        }
+        // Picture loss at the receiver: this frame goes out as an IDR
+        if (keyframeRequests.takeKeyframe(steadyNowNs())) {
+            encoder->requestKeyframe();
+        }
 
-        //get timestamp
-        auto now = std::chrono::system_clock::now();
-        auto duration = now.time_since_epoch();
-        int64_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
-
-        if (frame.empty()) break;
-
-        //cv::imshow("Live Video", frame);
-        if (cv::waitKey(5) >= 0) break;
+        preview.offer(frame, timing.captureMillis);
+        if (preview.closeRequested()) break;
 
         // Convert the image from BGR to YUV
         uint8_t* inData[1] = { frame.data };
@@ -124,28 +218,32 @@ int main() {
         sws_scale(sws_ctx, inData, inLinesize, 0, frame.rows, avFrame->data, avFrame->linesize);
 
         avFrame->pts = frame_count++;
+        timing.convertNs = steadyNowNs();
 
         // Encode the frame
-        if (avcodec_send_frame(codecContext, avFrame) < 0) {
-            std::cerr << "Error sending frame for encoding\n";
+        if (!encoder->encode(avFrame, timing, sendPacket)) {
             continue;
         }
-
-        while (avcodec_receive_packet(codecContext, packet) == 0) {
-            
-            send_packet_with_timestamp(sock, packet, server, millis);
-            av_packet_unref(packet); // Reset packet for the next usage
-        }
     }
 
+    encoder->encode(nullptr, FrameTiming(), sendPacket);
+    preview.stop();
+
+    EncoderStats stats = encoder->stats();
+    std::cout << encoder->name() << ": encode latency avg " << stats.averageMs << " ms, max " << stats.maxMs << " ms\n";
+    TransportStats net = transport.stats();
+    std::cout << "transport: " << net.datagrams << " datagrams in " << net.syscalls << " syscalls\n";
+    latency.dump(std::cout);
+    bandwidth.dump(std::cout);
+    retransmits.dump(std::cout);
+    keyframeRequests.dump(std::cout);
+
     // Cleanup
     av_freep(&avFrame->data[0]);
     av_frame_free(&avFrame);
-    av_packet_free(&packet);
-    avcodec_free_context(&codecContext);
+    encoder.reset();
     sws_freeContext(sws_ctx);
-    closesocket(sock);
-    WSACleanup();
-    cv::destroyWindow("Live Video");
+    transport.close();
+    shutdownNetwork();
     return 0;
 }
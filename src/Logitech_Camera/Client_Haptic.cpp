@@ -0,0 +1,102 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "../common/HapticBundling.h"
+#include "../common/HapticCodec.h"
+#include "../common/HapticDevice.h"
+#include "../common/HapticTransport.h"
+#include "../common/UdpTransport.h"
+
+static std::atomic<bool> s_stop{ false };
+
+static void onInterrupt(int) {
+    s_stop.store(true);
+}
+
+// usage: Client_Haptic [sim[:SEED]] [--host IP] [--port N] [--rate HZ] [--stream N] [--dscp N] [--deadband K] [--reconstruct hold|extrapolate] [--bundle N] [--latency-cap MS] [--duration S]
+int main(int argc, char** argv) {
+    std::string deviceSpec = "sim";
+    const char* host = "192.168.0.1";
+    uint16_t port = c_hapticPort;
+    int durationSeconds = 0;
+    HapticSenderConfig config;
+    DeadbandConfig deadband;
+    bool useDeadband = false;  // only changes the receiver would feel are sent
+    BundleConfig bundle;
+    bool useBundling = false;  // up to N samples per datagram while the receiver sees queueing
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc) port = static_cast<uint16_t>(atoi(argv[++i]));
+        else if (arg == "--rate" && i + 1 < argc) config.rateHz = atoi(argv[++i]);
+        else if (arg == "--stream" && i + 1 < argc) config.streamId = static_cast<uint8_t>(atoi(argv[++i]));
+        else if (arg == "--dscp" && i + 1 < argc) config.dscp = atoi(argv[++i]);
+        else if (arg == "--duration" && i + 1 < argc) durationSeconds = atoi(argv[++i]);
+        else if (arg == "--deadband" && i + 1 < argc) {
+            deadband.deadband = atof(argv[++i]);
+            useDeadband = deadband.deadband > 0.0;
+        }
+        else if (arg == "--bundle" && i + 1 < argc) {
+            bundle.maxSamples = atoi(argv[++i]);
+            useBundling = bundle.maxSamples > 1;
+        }
+        else if (arg == "--latency-cap" && i + 1 < argc) bundle.latencyCapMs = atoi(argv[++i]);
+        else if (arg == "--reconstruct" && i + 1 < argc) {
+            if (!parseReconstruction(argv[++i], deadband.mode)) {
+                std::cerr << "Unknown reconstruction " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        else if (arg[0] != '-') deviceSpec = arg;
+        else {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+    if (config.rateHz <= 0) {
+        std::cerr << "Bad sample rate " << config.rateHz << "\n";
+        return 1;
+    }
+    // A bundle's capture times are 16-bit microsecond offsets from its first sample
+    if (bundle.latencyCapMs < 1 || bundle.latencyCapMs > 60) {
+        std::cerr << "Latency cap must be 1 to 60 ms\n";
+        return 1;
+    }
+    bundle.rateHz = config.rateHz;
+
+    std::unique_ptr<HapticDevice> device = HapticDevice::create(deviceSpec, config.rateHz);
+    if (!device) return 1;
+
+    initNetwork();
+
+    HapticSender sender(*device, config);
+    DeadbandEncoder encoder(deadband);
+    if (useDeadband) sender.setEncoder(&encoder);
+    BundleController bundling(bundle);
+    if (useBundling) sender.setBundling(&bundling);
+    if (!sender.open(host, port)) {
+        shutdownNetwork();
+        return 1;
+    }
+
+    std::signal(SIGINT, onInterrupt);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(durationSeconds);
+    while (!s_stop.load()) {
+        if (!sender.step()) {
+            std::cerr << "Haptic device read failed\n";
+            break;
+        }
+        if (durationSeconds > 0 && std::chrono::steady_clock::now() >= deadline) break;
+    }
+    std::signal(SIGINT, SIG_DFL);
+
+    sender.dump(std::cout);
+    sender.socket().close();
+    shutdownNetwork();
+    return 0;
+}
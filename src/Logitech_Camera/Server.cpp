@@ -1,59 +1,61 @@
 ﻿#include <iostream>
-#include <winsock2.h>
-#include <Ws2tcpip.h>
 #include <opencv2/opencv.hpp>
 
-#pragma comment(lib, "ws2_32.lib") // Link with Winsock library
-
-int main() {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData); // Initialize Winsock
-
-    struct sockaddr_in server, client;
-    int client_size = sizeof(client);
-
-    server.sin_family = AF_INET;
-    server.sin_port = htons(8888);
-    inet_pton(AF_INET, "192.168.0.2", &server.sin_addr); // 
+#include "../common/JpegDecoder.h"
+#include "../common/Packetizer.h"
+#include "../common/ReceivePipeline.h"
+#include "../common/UdpTransport.h"
+
+int main(int argc, char* argv[]) {
+    ReceivePipelineConfig config;
+    config.windowName = "Received Frame";
+    config.printFps = true;
+
+    // --preview WxH: decode at 1/2 or 1/4 size when the window is that much smaller;
+    // --headless, --log <file>, --duration <s> for unattended latency runs
+    JpegDecoder jpeg;
+    for (int i = 1; i < argc; ++i) {
+        int previewWidth = 0, previewHeight = 0;
+        if (parseReceiverOption(argc, argv, i, config)) continue;
+        if (std::string(argv[i]) == "--preview" && i + 1 < argc && sscanf(argv[++i], "%dx%d", &previewWidth, &previewHeight) == 2) {
+            jpeg.setTargetSize(previewWidth, previewHeight);
+        }
+    }
 
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == SOCKET_ERROR) {
-        std::cerr << "Socket creation failed.\n";
+    if (!initNetwork()) {
+        std::cerr << "Network initialisation failed.\n";
         return 1;
     }
 
-    bind(sock, (struct sockaddr*)&server, sizeof(server));
-
-    char buffer[65536];
-    double last_time = static_cast<double>(cv::getTickCount());
-    int frame_count = 0;
-    double fps = 0.0;
-
-    while (true) {
-        int received_len = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr*)&client, &client_size);
-        if (received_len == SOCKET_ERROR) {
-            std::cerr << "Receive failed.\n";
-            break;
-        }
+    UdpReceiver receiver;
+    if (!receiver.open("192.168.0.2", 8888)) {
+        return 1;
+    }
 
-        std::vector<uchar> data(buffer, buffer + received_len);
-        cv::Mat frame = cv::imdecode(data, cv::IMREAD_COLOR); // Decode image
-        if (frame.empty()) continue;
-
-        frame_count++;
-        if (frame_count % 10 == 0) { // Calculate FPS every 10 frames
-            double current_time = static_cast<double>(cv::getTickCount());
-            double delta_time = (current_time - last_time) / cv::getTickFrequency();
-            fps = 10.0 / delta_time;
-            last_time = current_time;
-            std::cout << "FPS: " << fps << std::endl;
+    ReceivePipeline pipeline(config, [&](const EncodedFrame& frame, cv::Mat& image) {
+        return jpeg.decode(frame.data.data(), frame.size, image); // Decode image into the recycled one
+    });
+
+    // Network thread: receive and reassemble, never waits for decoding or display
+    pipeline.run([&]() {
+        uint8_t buffer[65536];
+        Reassembler reassembler;
+        ReassembledFrame assembled;
+        while (pipeline.running()) {
+            int received_len = receiver.receive(buffer, sizeof(buffer), 100);
+            if (received_len < 0) {
+                std::cerr << "Receive failed.\n";
+                pipeline.stop();
+                break;
+            }
+            if (received_len > 0 && reassembler.push(buffer, received_len, assembled)) {
+                pipeline.submit(assembled, steadyNowNs());
+            }
         }
+    });
 
-        cv::imshow("Received Frame", frame);
-        if (cv::waitKey(5) >= 0) break;
-    }
-
-    closesocket(sock);
-    WSACleanup(); // Cleanup Winsock
+    pipeline.dump(std::cout, receiver.stats());
+    receiver.close();
+    shutdownNetwork();
     return 0;
 }
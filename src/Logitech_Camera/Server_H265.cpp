@@ -1,6 +1,7 @@
-﻿#include <iostream>
-#include <winsock2.h>
-#include <Ws2tcpip.h>
+﻿#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
 #include <opencv2/opencv.hpp>
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -10,113 +11,269 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
-#pragma comment(lib, "ws2_32.lib")
+#include "../common/ClockSync.h"
+#include "../common/Concealment.h"
+#include "../common/FrameTiming.h"
+#include "../common/HapticBundling.h"
+#include "../common/HapticCodec.h"
+#include "../common/HapticTransport.h"
+#include "../common/ImageConverter.h"
+#include "../common/MultiStreamReceiver.h"
+#include "../common/Rtp.h"
+#include "../common/SyncEngine.h"
+#include "../common/UdpTransport.h"
 
-int main() {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
+// One H.265 decoder per stream: cameras differ in resolution and reference chain
+struct HevcDecoder {
+    AVCodecContext* codecContext = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+    // YUV -> BGR at whatever size the sender uses, split across worker threads
+    ImageConverter converter;
+    std::string stream;
+    std::unique_ptr<HevcConcealer> concealer;  // null unless --conceal
 
-    struct sockaddr_in si_me, si_other;
-
-    int s, slen = sizeof(si_other);
-    char buf[65536]; // buffer size to receive encoded data
-
-    // Create a UDP socket
-    if ((s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == SOCKET_ERROR) {
-        std::cerr << "Socket could not be created. Code: " << WSAGetLastError() << "\n";
-        return 1;
+    HevcDecoder(const std::string& stream, ConcealMode conceal) : stream(stream) {
+        if (conceal != ConcealMode::Off) concealer.reset(new HevcConcealer(conceal));
+        const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_HEVC);
+        codecContext = avcodec_alloc_context3(codec);
+        if (!codecContext) {
+            std::cerr << "Could not allocate video codec context\n";
+            exit(1);
+        }
+        if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+            std::cerr << "Could not open codec\n";
+            exit(1);
+        }
+        frame = av_frame_alloc();
+        packet = av_packet_alloc();
+        if (!packet) {
+            std::cerr << "Failed to allocate packet.\n";
+            exit(1);
+        }
     }
 
-    // Zero out the structure
-    memset((char*)&si_me, 0, sizeof(si_me));
+    ~HevcDecoder() {
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        avcodec_free_context(&codecContext);
+    }
 
-    si_me.sin_family = AF_INET;
-    si_me.sin_port = htons(8888);
-    si_me.sin_addr.s_addr = htonl(INADDR_ANY);
-    //inet_pton(AF_INET, "192.168.0.2", &si_me.sin_addr);
+    // Decode thread: H.265 into a recycled BGR image
+    bool decode(const EncodedFrame& encoded, cv::Mat& image) {
+        packet->size = static_cast<int>(encoded.size); // set the actual size of received data
+        packet->data = const_cast<uint8_t*>(encoded.data.data()); // packet data will point to the frame buffer
 
-    
+        // Send packet to the decoder
+        bool decoded = avcodec_send_packet(codecContext, packet) >= 0;
+        if (!decoded && !encoded.partial) {
+            std::cerr << "Error sending a packet for decoding\n";
+        }
+        av_packet_unref(packet); // Reset packet for the next usage
 
-    // Bind socket to port
-    if (bind(s, (struct sockaddr*)&si_me, sizeof(si_me)) == SOCKET_ERROR) {
-        std::cerr << "Bind failed with error code : " << WSAGetLastError() << "\n";
-        closesocket(s);
-        WSACleanup();
-        return 1;
+        // Receive frame from decoder
+        decoded = decoded && avcodec_receive_frame(codecContext, frame) == 0 && converter.toBgr(frame, image);
+        if (!concealer) return decoded;
+        // Slices lost from this frame, or from the references it predicts from, are filled in
+        return concealer->apply(encoded.data.data(), encoded.size, encoded.partial, decoded, image);
     }
 
-    // Initialize FFmpeg decoder
-    const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_HEVC);
-    AVCodecContext* codecContext = avcodec_alloc_context3(codec);
-    if (!codecContext) {
-        std::cerr << "Could not allocate video codec context\n";
-        exit(1);
-    }
-    if (avcodec_open2(codecContext, codec, nullptr) < 0) {
-        std::cerr << "Could not open codec\n";
-        exit(1);
+    void dump(std::ostream& out) const {
+        if (!concealer) return;
+        ConcealStats s = concealer->stats();
+        out << "Concealment " << stream << ": " << s.partial << " incomplete frames, " << s.concealed
+            << " pictures concealed, " << s.blocks << " blocks filled, " << s.frozen << " without a picture\n";
     }
+};
 
-    AVFrame* frame = av_frame_alloc();
-    AVPacket* packet = av_packet_alloc();
-    if (!packet) {
-        std::cerr << "Failed to allocate packet.\n";
-        exit(1);
+// Feeds one station's haptic samples into the sync engine until stopped, and reports the
+// offset achieved once a second
+static void hapticLoop(HapticReceiver& haptics, HapticMonitor& monitor, ClockSync& clock, SyncEngine& sync,
+    uint8_t streamId, const std::atomic<bool>& running) {
+    HapticPacket packet;
+    int64_t arrivalUs;
+    int64_t reportNs = steadyNowNs() + 1000000000LL;
+    // Deadband coded streams are filled in to the full rate as the device shows them
+    std::unique_ptr<DeadbandDecoder> decoder;
+    std::vector<HapticSample> timeline;
+    // The sender sizes its bundles by the queueing this reports
+    HapticFeedbackReporter reporter;
+    uint8_t feedback[c_hapticFeedbackSize];
+    uint8_t request[c_clockMessageSize];
+    while (running.load(std::memory_order_acquire)) {
+        int got = haptics.receive(packet, arrivalUs, 1);
+        if (got < 0) break;
+        if (got && packet.streamId == streamId) {
+            reporter.onPacket(packet, arrivalUs);
+            std::size_t len = reporter.takeReport(arrivalUs, feedback);
+            if (len) haptics.socket().sendTo(feedback, len, haptics.socket().lastSender());
+            len = clock.takeRequest(wallClockMicros(), request);
+            if (len) haptics.socket().sendTo(request, len, haptics.socket().lastSender());
+            timeline.clear();
+            for (int i = 0; i < packet.count; ++i) {
+                const HapticSample& sample = packet.samples[i];
+                if (!monitor.record(sample, arrivalUs, packet.deadband())) continue;
+                if (packet.deadband()) {
+                    if (!decoder) decoder.reset(new DeadbandDecoder(packet.extrapolate() ? Reconstruction::Extrapolate : Reconstruction::Hold));
+                    decoder->update(sample, arrivalUs, timeline);
+                }
+                else {
+                    timeline.push_back(sample);
+                }
+            }
+            for (const HapticSample& sample : timeline) sync.onSample(sample, steadyNowNs());
+        }
+        // Between updates the predicted samples go out as their periods pass, not with the
+        // next update, which may be a refresh interval away
+        if (decoder) {
+            timeline.clear();
+            decoder->tick(wallClockMicros(), timeline);
+            for (const HapticSample& sample : timeline) sync.onSample(sample, steadyNowNs());
+        }
+        sync.expire(steadyNowNs());
+        if (steadyNowNs() >= reportNs) {
+            sync.dump(std::cout);
+            reportNs += 1000000000LL;
+        }
     }
-    cv::Mat image;
-    image.create(1080, 1920, CV_8UC3);
-    // prepare sws context
-    SwsContext* image_convert_ctx = sws_getContext(
-        1920, 1080, AV_PIX_FMT_YUV420P,
-        1920, 1080, AV_PIX_FMT_BGR24,
-        SWS_BILINEAR, NULL, NULL, NULL);
+}
 
+// usage: Server_H265 [min delay ms] [--shards N] [--no-gro] [--conceal off|copy|motion] [--haptic] [--sync haptic|video|none] [--skew MS] [--sync-stream N] [--raw-clocks] [--headless] [--log FILE] [--duration S]
+int main(int argc, char* argv[]) {
+    MultiStreamConfig config;
+    config.pipeline.windowName = "Frame";
+    config.pipeline.interFrames = true;
+    ConcealMode conceal = ConcealMode::Off;
+    bool haptic = false;
+    SyncConfig syncConfig;
+    syncConfig.senderClocks = true;
 
-    while (true) {
-        fflush(stdout);
+    // Frames are played at capture time + base transit + target delay; the optional
+    // numeric argument is the lowest target delay in ms, it grows with the measured jitter.
+    // Every camera sends its own stream id; --shards spreads them over several sockets and
+    // network threads on the same port.
+    for (int i = 1; i < argc; ++i) {
+        if (parseReceiverOption(argc, argv, i, config.pipeline)) continue;
+        std::string arg = argv[i];
+        if (arg == "--shards" && i + 1 < argc) {
+            config.shards = atoi(argv[++i]);
+            continue;
+        }
+        if (arg == "--no-gro") {
+            config.gro = false;
+            continue;
+        }
+        // Frames incomplete at playout are decoded from the slices that arrived
+        if (arg == "--conceal" && i + 1 < argc) {
+            if (!parseConcealMode(argv[++i], conceal)) {
+                std::cerr << "Unknown concealment " << argv[i] << "\n";
+                return 1;
+            }
+            config.conceal = conceal != ConcealMode::Off;
+            continue;
+        }
+        // Haptic samples on port 8001 are played out with the frames of one camera
+        if (arg == "--haptic") {
+            haptic = true;
+            continue;
+        }
+        if (arg == "--sync" && i + 1 < argc) {
+            if (!parseSyncPolicy(argv[++i], syncConfig.policy)) {
+                std::cerr << "Unknown sync policy " << argv[i] << "\n";
+                return 1;
+            }
+            continue;
+        }
+        if (arg == "--skew" && i + 1 < argc) {
+            syncConfig.skewBoundMs = atoi(argv[++i]);
+            continue;
+        }
+        if (arg == "--sync-stream" && i + 1 < argc) {
+            config.syncStream = atoi(argv[++i]);
+            continue;
+        }
+        // Pair on the senders' own capture clocks, for senders already synchronised by PTP
+        if (arg == "--raw-clocks") {
+            syncConfig.senderClocks = false;
+            continue;
+        }
+        char* end = nullptr;
+        long delayMs = strtol(argv[i], &end, 10);
+        if (end == argv[i] || *end != '\0' || delayMs < 0) {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        }
+        config.jitter.minDelayMs = static_cast<int>(delayMs);
+        if (config.jitter.maxDelayMs < config.jitter.minDelayMs) config.jitter.maxDelayMs = config.jitter.minDelayMs;
+    }
+
+    if (!initNetwork()) {
+        std::cerr << "Network initialisation failed.\n";
+        return 1;
+    }
 
-        // Try to receive some data, this is a blocking call
-        int len = recvfrom(s, buf, sizeof(buf), 0, (struct sockaddr*)&si_other, &slen);
-        if (len == SOCKET_ERROR) {
-            std::cerr << "recvfrom() failed with error code : " << WSAGetLastError() << "\n";
-            break;
+    SyncEngine sync(syncConfig);
+    HapticReceiver haptics;
+    HapticMonitor hapticMonitor;
+    // The haptic sender's clock; the camera's is estimated by its stream receiver
+    ClockSync hapticClock(static_cast<uint8_t>(config.syncStream));
+    if (haptic) {
+        if (!haptics.open(nullptr, c_hapticPort, false)) {
+            shutdownNetwork();
+            return 1;
         }
+        haptics.setClockHandler([&hapticClock](const uint8_t* data, std::size_t len, int64_t arrivalUs) {
+            hapticClock.onResponse(data, len, arrivalUs);
+        });
+        hapticMonitor.setClock(&hapticClock);
+        sync.setHapticClock(&hapticClock);
+        config.sync = &sync;
+    }
 
-        //remove timestamp
-        int64_t receivedTimestamp;
-        memcpy(&receivedTimestamp, buf + len - sizeof(int64_t), sizeof(int64_t));
+    // Made on the network threads, one stream at a time
+    std::vector<std::shared_ptr<HevcDecoder>> decoders;
+    MultiStreamReceiver receiver(config,
+        [&](const std::string& stream) {
+            std::shared_ptr<HevcDecoder> decoder(new HevcDecoder(stream, conceal));
+            decoders.push_back(decoder);
+            return [decoder](const EncodedFrame& encoded, cv::Mat& image) { return decoder->decode(encoded, image); };
+        },
+        // Senders started with --rtp
+        []() {
+            std::shared_ptr<RtpDepacketizer<H265Payload>> depacketizer(new RtpDepacketizer<H265Payload>());
+            return [depacketizer](const uint8_t* datagram, std::size_t len, ReassembledFrame& frame) {
+                return depacketizer->push(datagram, len, frame);
+            };
+        });
+    if (!receiver.open()) {
+        shutdownNetwork();
+        return 1;
+    }
 
-        
-        packet->size = len - sizeof(int64_t); // set the actual size of received data
-        packet->data = (uint8_t*)buf; // packet data will point to the buffer
+    std::atomic<bool> hapticRunning{ haptic };
+    std::thread hapticThread;
+    if (haptic) {
+        hapticThread = std::thread(hapticLoop, std::ref(haptics), std::ref(hapticMonitor), std::ref(hapticClock),
+            std::ref(sync), static_cast<uint8_t>(config.syncStream), std::cref(hapticRunning));
+    }
 
-        // Send packet to the decoder
-        if (avcodec_send_packet(codecContext, packet) < 0) {
-            std::cerr << "Error sending a packet for decoding\n";
-            continue;
-        }
+    receiver.run();
+    hapticRunning.store(false, std::memory_order_release);
+    if (hapticThread.joinable()) hapticThread.join();
 
-        // Receive frame from decoder
-        if (avcodec_receive_frame(codecContext, frame) == 0) {
-
-            
-            
-            
-            uint8_t* dest[4] = { image.data };
-            int dest_linesize[4] = { static_cast<int>(image.step[0]) };
-            sws_scale(image_convert_ctx, frame->data, frame->linesize, 0, codecContext->height, dest, dest_linesize);
-            cv::imshow("Frame", image);
-            if (cv::waitKey(5) >= 0) break;
-        }
-        
-        av_packet_unref(packet); // Reset packet for the next usage
+    receiver.dump(std::cout);
+    for (const auto& decoder : decoders) {
+        decoder->dump(std::cout);
+    }
+    if (haptic) {
+        std::cout << "Haptic stream " << config.syncStream << ": ";
+        hapticMonitor.dump(std::cout);
+        sync.dump(std::cout);
+        haptics.socket().close();
     }
-    sws_freeContext(image_convert_ctx);
-    av_packet_free(&packet);
-    closesocket(s);
-    WSACleanup();
-    av_frame_free(&frame);
-    avcodec_free_context(&codecContext);
+
+    receiver.close();
+    shutdownNetwork();
 
     return 0;
 }
@@ -0,0 +1,130 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../common/ClockSync.h"
+#include "../common/FrameTiming.h"
+#include "../common/HapticBundling.h"
+#include "../common/HapticCodec.h"
+#include "../common/HapticTrace.h"
+#include "../common/HapticTransport.h"
+#include "../common/UdpTransport.h"
+
+// Per stream: statistics of what arrived, the full-rate timeline of deadband streams, the
+// queueing feedback its sender sizes bundles by, and the sender's clock
+struct HapticStream {
+    explicit HapticStream(uint8_t id) : clock(id) { monitor.setClock(&clock); }
+
+    HapticMonitor monitor;
+    std::unique_ptr<DeadbandDecoder> decoder;
+    HapticFeedbackReporter reporter;
+    ClockSync clock;
+};
+
+// usage: Server_Haptic [--port N] [--no-busy-poll] [--record FILE] [--stream N] [--duration S]
+int main(int argc, char* argv[]) {
+    uint16_t port = c_hapticPort;
+    bool busyPoll = true;  // a core for the lowest pickup latency
+    int durationSeconds = 0;
+    HapticTrace trace;  // the timeline of one stream, for replay and the codec bench
+    int traceStream = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) port = static_cast<uint16_t>(atoi(argv[++i]));
+        else if (arg == "--no-busy-poll") busyPoll = false;
+        else if (arg == "--duration" && i + 1 < argc) durationSeconds = atoi(argv[++i]);
+        else if (arg == "--stream" && i + 1 < argc) traceStream = atoi(argv[++i]);
+        else if (arg == "--record" && i + 1 < argc) {
+            if (!trace.open(argv[++i])) return 1;
+        }
+    }
+
+    if (!initNetwork()) {
+        std::cerr << "Network initialisation failed.\n";
+        return 1;
+    }
+
+    HapticReceiver receiver;
+    if (!receiver.open(nullptr, port, busyPoll)) {
+        shutdownNetwork();
+        return 1;
+    }
+
+    // Every device sends its own stream id
+    std::map<uint8_t, std::unique_ptr<HapticStream>> streams;
+    std::vector<HapticSample> timeline;
+    HapticPacket packet;
+    int64_t arrivalUs = 0;
+    uint8_t feedback[c_hapticFeedbackSize];
+    uint8_t request[c_clockMessageSize];
+    receiver.setClockHandler([&streams](const uint8_t* data, std::size_t len, int64_t arrivalUs) {
+        auto it = streams.find(data[1]);
+        if (it != streams.end()) it->second->clock.onResponse(data, len, arrivalUs);
+    });
+    catchInterrupt(true);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(durationSeconds);
+    bool sparse = false;  // a deadband stream is around, its predictions are due every period
+    while (!interrupted()) {
+        if (durationSeconds > 0 && std::chrono::steady_clock::now() >= deadline) break;
+        int got = receiver.receive(packet, arrivalUs, sparse ? 1 : 100);
+        if (got < 0) break;
+        // Between updates the predicted samples go out as their periods pass
+        for (const auto& entry : streams) {
+            if (!entry.second->decoder) continue;
+            timeline.clear();
+            entry.second->decoder->tick(wallClockMicros(), timeline);
+            if (trace.isOpen() && entry.first == traceStream) {
+                for (const HapticSample& sample : timeline) trace.write(sample);
+            }
+        }
+        if (!got) continue;
+        std::unique_ptr<HapticStream>& stream = streams[packet.streamId];
+        if (!stream) stream.reset(new HapticStream(packet.streamId));
+        stream->reporter.onPacket(packet, arrivalUs);
+        std::size_t len = stream->reporter.takeReport(arrivalUs, feedback);
+        if (len) receiver.socket().sendTo(feedback, len, receiver.socket().lastSender());
+        len = stream->clock.takeRequest(wallClockMicros(), request);
+        if (len) receiver.socket().sendTo(request, len, receiver.socket().lastSender());
+
+        // A bundle unpacks onto the same per-sample timeline
+        timeline.clear();
+        for (int i = 0; i < packet.count; ++i) {
+            const HapticSample& sample = packet.samples[i];
+            if (!stream->monitor.record(sample, arrivalUs, packet.deadband())) continue;
+            if (packet.deadband()) {
+                if (!stream->decoder) {
+                    stream->decoder.reset(new DeadbandDecoder(packet.extrapolate() ? Reconstruction::Extrapolate : Reconstruction::Hold));
+                    sparse = true;
+                }
+                stream->decoder->update(sample, arrivalUs, timeline);
+            }
+            else {
+                timeline.push_back(sample);
+            }
+        }
+        if (trace.isOpen() && packet.streamId == traceStream) {
+            for (const HapticSample& sample : timeline) trace.write(sample);
+        }
+    }
+    catchInterrupt(false);
+
+    for (const auto& entry : streams) {
+        std::cout << "Haptic stream " << static_cast<int>(entry.first) << ": ";
+        entry.second->monitor.dump(std::cout);
+        if (entry.second->decoder) {
+            std::cout << "Deadband: " << entry.second->decoder->reconstructed() << " samples reconstructed, "
+                << entry.second->decoder->corrected() << " updates after their period was shown\n";
+        }
+    }
+    if (trace.isOpen()) std::cout << trace.records() << " samples recorded\n";
+    dumpReceiverStats(std::cout, receiver.socket().stats());
+    if (receiver.malformed()) std::cout << receiver.malformed() << " datagrams were no haptic samples\n";
+
+    receiver.socket().close();
+    shutdownNetwork();
+    return 0;
+}
@@ -1,147 +1,117 @@
 ﻿#include "VideoStreamer_sw.h"
 #include <iostream>
 
-
-std::queue<int64_t> encodeStartTimes;
-
-VideoStreamer_SW::VideoStreamer_SW() : codecContext(nullptr), sws_ctx(nullptr), avFrame(nullptr), packet(nullptr) {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
+VideoStreamer_SW::VideoStreamer_SW(EncoderKind encoderKind, const FrameSourceConfig& sourceConfig, bool rtp)
+    : sourceConfig(sourceConfig), encoderKind(encoderKind), sws_ctx(nullptr), avFrame(nullptr), rtp(rtp) {
+    initNetwork();
     setupNetwork();
     setupVideo();
 }
 
 VideoStreamer_SW::~VideoStreamer_SW() {
     cleanup();
-    WSACleanup();
+    shutdownNetwork();
 }
 
 void VideoStreamer_SW::setupNetwork() {
-    server.sin_family = AF_INET;
-    server.sin_port = htons(8888);
-    inet_pton(AF_INET, "192.168.1.131", &server.sin_addr);
-    server_size = sizeof(server);
-    sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == SOCKET_ERROR) {
-        std::cerr << "Socket creation failed.\n";
+    if (!transport.open("192.168.1.131", 8888)) {
         exit(1);
     }
 }
 
 void VideoStreamer_SW::setupVideo() {
-    const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    codecContext = avcodec_alloc_context3(codec);
-    codecContext->bit_rate = 1000000;
-    //codecContext->width = 1920;
-    //codecContext->height = 1080;
-    codecContext->width = 640;
-    codecContext->height = 480;
-    codecContext->time_base = { 1, 30 };
-    codecContext->framerate = { 30, 1 };
-    codecContext->gop_size = 15;
-    codecContext->max_b_frames = 1;
-    codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
-
-    if (avcodec_open2(codecContext, codec, NULL) < 0) {
+    source = FrameSource::create(sourceConfig);
+    if (!source) {
+        std::cerr << "Could not open the frame source\n";
+        exit(1);
+    }
+
+    EncoderConfig config;
+    config.codecId = AV_CODEC_ID_H264;
+    config.bitRate = 1000000;
+    config.width = source->width();
+    config.height = source->height();
+    config.fps = source->fps() > 0.0 ? static_cast<int>(source->fps() + 0.5) : 30;
+    config.gopSize = 15;
+
+    encoder = EncoderBackend::create(encoderKind, config);
+    if (!encoder) {
         std::cerr << "Failed to open codec\n";
         exit(1);
     }
+    bandwidth.reset(new BandwidthEstimator(config.bitRate, config.bitRate / 10, config.bitRate * 2));
 
-    sws_ctx = sws_getContext(codecContext->width, codecContext->height, AV_PIX_FMT_BGR24,
-        codecContext->width, codecContext->height, AV_PIX_FMT_YUV420P,
+    sws_ctx = sws_getContext(config.width, config.height, AV_PIX_FMT_BGR24,
+        config.width, config.height, AV_PIX_FMT_YUV420P,
         SWS_BILINEAR, NULL, NULL, NULL);
 
     avFrame = av_frame_alloc();
-    avFrame->format = codecContext->pix_fmt;
-    avFrame->width = codecContext->width;
-    avFrame->height = codecContext->height;
+    avFrame->format = AV_PIX_FMT_YUV420P;
+    avFrame->width = config.width;
+    avFrame->height = config.height;
     av_image_alloc(avFrame->data, avFrame->linesize, avFrame->width, avFrame->height, (AVPixelFormat)avFrame->format, 32);
-
-    packet = av_packet_alloc();
 }
 
 void VideoStreamer_SW::cleanup() {
     av_freep(&avFrame->data[0]);
     av_frame_free(&avFrame);
-    av_packet_free(&packet);
-    avcodec_free_context(&codecContext);
+    encoder.reset();
     sws_freeContext(sws_ctx);
-    closesocket(sock);
-    cv::destroyAllWindows();
+    transport.close();
 }
 
-void VideoStreamer_SW::sendPacketWithTimestamp(SOCKET sock, AVPacket* packet, const sockaddr_in& server, int64_t millis) {
-    size_t new_size = packet->size + sizeof(millis);
-    std::vector<char> new_packet(packet->size + sizeof(millis));
-    memcpy(new_packet.data(), packet->data, packet->size);
-    memcpy(new_packet.data() + packet->size, &millis, sizeof(millis));
-    sendto(sock, new_packet.data(), new_size, 0, (struct sockaddr*)&server, sizeof(server));
+void VideoStreamer_SW::sendPacketWithTimestamp(AVPacket* packet, FrameTiming& timing) {
+    // One datagram per MTU-sized fragment, the whole frame in as few syscalls as possible
+    bool keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+    const std::vector<Fragment>& fragments = rtp
+        ? rtpPacketizer.packetize(packet->data, packet->size, rtpPacketizer.timestampFor(timing.captureMillis))
+        : packetizer.packetize(packet->data, packet->size, timing.captureMillis, keyframe);
+    transport.sendFragments(fragments);
+    timing.sendNs = steadyNowNs();
+    latency.record(timing);
+    if (rtp) return;  // receiver feedback is keyed by native frame ids
+
+    // Receiver feedback retargets the encoder from the next frame on
+    bool retarget = bandwidth->onFrameSent(packetizer.lastFrameId(), timing.sendNs, packet->size, fragments.size());
+    uint8_t report[c_maxFeedbackSize];
+    int len;
+    while ((len = transport.receive(report, sizeof(report))) > 0) {
+        retarget = bandwidth->onFeedback(report, len, steadyNowNs()) || retarget;
+    }
+    if (retarget) encoder->setBitrate(bandwidth->targetBitrate());
 }
 
 
 
 
-bool VideoStreamer_SW::encodeAndSendFrames(cv::VideoCapture& cap) {
-    cv::Mat frame;
-    
-    auto now = std::chrono::system_clock::now();
-    auto duration = now.time_since_epoch();
-    int64_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
-    //std::cout << "Timestamp_before_cap:" << millis << std::endl;
-
-    cap >> frame;  // Capture a new frame
-
-    auto now1 = std::chrono::system_clock::now();
-    auto duration1 = now1.time_since_epoch();
-    int64_t millis1 = std::chrono::duration_cast<std::chrono::milliseconds>(duration1).count();
-    std::cout << "Time_cap_sw:" << millis1 - millis << std::endl;
+bool VideoStreamer_SW::encodeAndSendFrames() {
+    cv::Mat& frame = captureFrame; // reused, so capture stops allocating once sized
 
-    encodeStartTimes.push(millis1); // Push it to the queue
-
-    if (frame.empty()) return false;
-    
+    if (!source->read(frame)) return false;  // Capture a new frame
+    FrameTiming timing = FrameTiming::captured();
 
     uint8_t* inData[1] = { frame.data };
     int inLinesize[1] = { static_cast<int>(frame.step) };
     sws_scale(sws_ctx, inData, inLinesize, 0, frame.rows, avFrame->data, avFrame->linesize);
     avFrame->pts = frame_count++;
+    timing.convertNs = steadyNowNs();
 
-    if (avcodec_send_frame(codecContext, avFrame) < 0) {
-        std::cerr << "Error sending frame for encoding\n";
-        return true;
-    }
-
-    while (avcodec_receive_packet(codecContext, packet) == 0) {
-
-        auto now2 = std::chrono::system_clock::now();
-        auto duration2 = now2.time_since_epoch();
-        int64_t millis2 = std::chrono::duration_cast<std::chrono::milliseconds>(duration2).count();
-
-        auto encode_start = encodeStartTimes.front();
-        encodeStartTimes.pop()
-        std::cout << "Time_encode_sw:" << millis2 - encode_start << std::endl;
-
-        sendPacketWithTimestamp(sock, packet, server, millis2);
-        av_packet_unref(packet);  // Reset packet for the next usage
-    }
+    // The packet's timing is the one of the frame it encodes, matched by pts in the backend
+    encoder->encode(avFrame, timing, [this](AVPacket* packet, FrameTiming& packetTiming) {
+        sendPacketWithTimestamp(packet, packetTiming);
+    });
     return true;
 }
 
 int VideoStreamer_SW::run() {
-    cv::VideoCapture cap(0);
-    //double width = 1920, height = 1080;
-    double width = 640, height = 480;
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, width);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, height);
-    if (!cap.isOpened()) {
-        std::cerr << "Cannot open the video camera.\n";
-        return 1;
-    }
-
-    //cv::namedWindow("Live Video", cv::WINDOW_AUTOSIZE);
-    while (true) {
-        if (!encodeAndSendFrames(cap)) break;
-        if (cv::waitKey(5) >= 0) break;
+    // No local window here, so no waitKey either: it slept up to 5 ms on every frame
+    while (encodeAndSendFrames()) {
     }
+    // Send whatever the encoder still holds
+    encoder->encode(nullptr, FrameTiming(), [this](AVPacket* packet, FrameTiming& packetTiming) {
+        sendPacketWithTimestamp(packet, packetTiming);
+    });
+    latency.dump(std::cout);
+    bandwidth->dump(std::cout);
     return 0;
 }
@@ -1,8 +1,6 @@
 #ifndef VIDEOSTREAMER_SW_H
 #define VIDEOSTREAMER_SW_H
 
-#include <winsock2.h>
-#include <Ws2tcpip.h>
 #include <opencv2/opencv.hpp>
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -10,18 +8,23 @@ extern "C" {
 #include <libavutil/opt.h>
 #include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
-#include <libavutil/hwcontext.h>
-#include <libavutil/hwcontext_cuda.h>
 }
 
-#pragma comment(lib, "ws2_32.lib")
-
 #include <vector>
 #include <chrono>
 
+#include "../common/EncoderBackend.h"
+#include "../common/Packetizer.h"
+#include "../common/UdpTransport.h"
+#include "../common/FrameTiming.h"
+#include "../common/FrameSource.h"
+#include "../common/CongestionControl.h"
+#include "../common/Rtp.h"
+
 class VideoStreamer_SW {
 public:
-    VideoStreamer_SW();
+    explicit VideoStreamer_SW(EncoderKind encoderKind = EncoderKind::Auto,
+        const FrameSourceConfig& sourceConfig = FrameSourceConfig(), bool rtp = false);
     ~VideoStreamer_SW();
     int run();
     void streamFrame(const cv::Mat& frame, const cv::Mat& depth);
@@ -31,19 +34,23 @@ private:
     void setupNetwork();
     void setupVideo();
     void cleanup();
-    int initCuda();
-    void sendPacketWithTimestamp(SOCKET sock, AVPacket* packet, const sockaddr_in& server, int64_t millis);
-    bool encodeAndSendFrames(cv::VideoCapture& cap);
+    void sendPacketWithTimestamp(AVPacket* packet, FrameTiming& timing);
+    bool encodeAndSendFrames();
 
-    AVCodecContext* codecContext;
+    FrameSourceConfig sourceConfig;
+    std::unique_ptr<FrameSource> source;
+    EncoderKind encoderKind;
+    std::unique_ptr<EncoderBackend> encoder;
     SwsContext* sws_ctx;
     AVFrame* avFrame;
-    AVPacket* packet;
-    SOCKET sock;
-    struct sockaddr_in server;
-    int server_size;
     int frame_count = 0;
-    AVBufferRef* hw_device_ctx;
+    Packetizer packetizer;
+    RtpPacketizer<H264Payload> rtpPacketizer;
+    bool rtp;  // RTP instead of the native fragment header
+    UdpSender transport;
+    PipelineLatency latency;
+    std::unique_ptr<BandwidthEstimator> bandwidth;
+    cv::Mat captureFrame;
 };
 
 #endif // VIDEOSTREAMER_H
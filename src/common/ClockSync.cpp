@@ -0,0 +1,196 @@
+#include "ClockSync.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include "ByteOrder.h"
+#include "FrameTiming.h"
+
+// A kept offset this far off the fitted line is a step of the sender's clock
+static const double c_stepUs = 10000.0;
+
+// Responses later than this are dropped, the next request is on its way
+static const int64_t c_responseTimeoutUs = 1000000;
+
+// Kept points with a round trip above slack * the shortest + floor stay out of the fit
+static const double c_rttSlack = 1.5;
+static const double c_rttFloorUs = 50.0;
+
+std::size_t ClockMessage::write(uint8_t* out) const {
+    out[0] = c_clockMagic;
+    out[1] = streamId;
+    out[2] = response ? 1 : 0;
+    out[3] = 0;
+    put32(out + 4, id);
+    put64(out + 8, static_cast<uint64_t>(t1));
+    put64(out + 16, static_cast<uint64_t>(t2));
+    put64(out + 24, static_cast<uint64_t>(t3));
+    return c_clockMessageSize;
+}
+
+bool ClockMessage::read(const uint8_t* in, std::size_t len) {
+    if (len < c_clockMessageSize || in[0] != c_clockMagic || in[2] > 1) return false;
+    streamId = in[1];
+    response = in[2] == 1;
+    id = get32(in + 4);
+    t1 = static_cast<int64_t>(get64(in + 8));
+    t2 = static_cast<int64_t>(get64(in + 16));
+    t3 = static_cast<int64_t>(get64(in + 24));
+    return true;
+}
+
+std::size_t answerClockRequest(const uint8_t* data, std::size_t len, int64_t arrivalUs, uint8_t* out) {
+    ClockMessage message;
+    if (!message.read(data, len) || message.response) return 0;
+    message.response = true;
+    message.t2 = arrivalUs;
+    message.t3 = wallClockMicros();
+    return message.write(out);
+}
+
+ClockSync::ClockSync(uint8_t streamId, int intervalMs) : streamId(streamId), intervalUs(intervalMs * 1000LL) {
+}
+
+std::size_t ClockSync::takeRequest(int64_t nowUs, uint8_t* out) {
+    if (lastRequestUs && nowUs - lastRequestUs < intervalUs) return 0;
+    lastRequestUs = nowUs;
+    ClockMessage message;
+    message.streamId = streamId;
+    message.id = nextId++;
+    message.t1 = nowUs;
+    pendingId = message.id;
+    pendingT1 = nowUs;
+    pending = true;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        counters.requests++;
+    }
+    return message.write(out);
+}
+
+bool ClockSync::onResponse(const uint8_t* data, std::size_t len, int64_t arrivalUs) {
+    ClockMessage message;
+    if (!message.read(data, len) || !message.response) return false;
+    // Only the newest request counts: an older response would be matched to the wrong t1
+    if (!pending || message.id != pendingId || message.t1 != pendingT1) return false;
+    pending = false;
+    if (arrivalUs - message.t1 > c_responseTimeoutUs) return false;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        counters.responses++;
+    }
+
+    double rttUs = double((arrivalUs - message.t1) - (message.t3 - message.t2));
+    double offsetUs = ((message.t2 - message.t1) + (message.t3 - arrivalUs)) / 2.0;
+    if (rttUs < 0.0) rttUs = 0.0;  // the sender's clock ticked backwards in between
+    if (!blockCount || rttUs < blockRttUs) {
+        blockRttUs = rttUs;
+        blockOffsetUs = offsetUs;
+        blockLocalUs = message.t1 + (arrivalUs - message.t1) / 2;
+    }
+    if (++blockCount >= c_block) {
+        addPoint(blockLocalUs, blockOffsetUs, blockRttUs);
+        blockCount = 0;
+    }
+    return true;
+}
+
+void ClockSync::addPoint(int64_t localUs, double offsetUs, double rttUs) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (fitted && std::fabs(offsetUs - (offsetAtRef + slope * double(localUs - refUs))) > c_stepUs) {
+        pointCount = 0;
+        pointNext = 0;
+        counters.steps++;
+    }
+    if (!pointCount) refUs = localUs;
+    pointX[pointNext] = double(localUs - refUs);
+    pointY[pointNext] = offsetUs;
+    pointRtt[pointNext] = rttUs;
+    pointNext = (pointNext + 1) % c_points;
+    if (pointCount < c_points) pointCount++;
+    counters.points++;
+    counters.rttUs = rttUs;
+    fit();
+}
+
+void ClockSync::fit() {
+    // Blocks that only saw queued exchanges are left out: a round trip well above the
+    // window's shortest has an offset error to match
+    double minRtt = pointRtt[0];
+    for (int i = 1; i < pointCount; ++i) minRtt = std::min(minRtt, pointRtt[i]);
+    double maxRtt = c_rttSlack * minRtt + c_rttFloorUs;
+    int used = 0;
+    double meanX = 0.0, meanY = 0.0;
+    for (int i = 0; i < pointCount; ++i) {
+        if (pointRtt[i] > maxRtt) continue;
+        meanX += pointX[i];
+        meanY += pointY[i];
+        used++;
+    }
+    meanX /= used;
+    meanY /= used;
+    double sxx = 0.0, sxy = 0.0;
+    for (int i = 0; i < pointCount; ++i) {
+        if (pointRtt[i] > maxRtt) continue;
+        sxx += (pointX[i] - meanX) * (pointX[i] - meanX);
+        sxy += (pointX[i] - meanX) * (pointY[i] - meanY);
+    }
+    // Drift needs a few points over some seconds; until then the offset alone
+    slope = used >= 3 && sxx > 0.0 ? sxy / sxx : 0.0;
+    offsetAtRef = meanY - slope * meanX;
+    double squares = 0.0;
+    for (int i = 0; i < pointCount; ++i) {
+        if (pointRtt[i] > maxRtt) continue;
+        double residual = pointY[i] - (offsetAtRef + slope * pointX[i]);
+        squares += residual * residual;
+    }
+    fitted = true;
+    counters.synchronised = true;
+    counters.driftPpm = slope * 1e6;
+    counters.residualUs = std::sqrt(squares / used);
+}
+
+bool ClockSync::synchronised() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return fitted;
+}
+
+int64_t ClockSync::remoteToLocal(int64_t remoteUs) const {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!fitted) return remoteUs;
+    // remote = local + offsetAtRef + slope * (local - refUs), solved for local
+    double local = (double(remoteUs - refUs) - offsetAtRef) / (1.0 + slope);
+    return refUs + static_cast<int64_t>(std::llround(local));
+}
+
+int64_t ClockSync::localToRemote(int64_t localUs) const {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!fitted) return localUs;
+    return localUs + static_cast<int64_t>(std::llround(offsetAtRef + slope * double(localUs - refUs)));
+}
+
+ClockSyncStats ClockSync::stats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    ClockSyncStats s = counters;
+    if (fitted) s.offsetUs = offsetAtRef + slope * double(wallClockMicros() - refUs);
+    return s;
+}
+
+void ClockSync::dump(std::ostream& out) const {
+    ClockSyncStats s = stats();
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    out << "Clock " << static_cast<int>(streamId) << ": ";
+    if (!s.synchronised) {
+        out << "not synchronised, " << s.responses << " of " << s.requests << " exchanges answered\n";
+    }
+    else {
+        out << "offset " << s.offsetUs << " us, drift " << std::setprecision(2) << s.driftPpm << " ppm, "
+            << std::setprecision(1) << "residual " << s.residualUs << " us, rtt " << s.rttUs << " us, "
+            << s.points << " points from " << s.responses << " of " << s.requests << " exchanges, "
+            << s.steps << " steps\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
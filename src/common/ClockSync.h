@@ -0,0 +1,115 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+/* Two-way time exchange (network byte order, 32 bytes), NTP style, between a receiver and
+   a sender over the sockets they already share. The receiver asks, the sender answers:
+     0  magic 0xF8
+     1  stream id
+     2  kind                  (0 request, 1 response)
+     3  reserved
+     4  exchange id           (uint32)
+     8  t1                    (int64, microseconds: request sent, receiver's system clock)
+    16  t2                    (int64, request arrived, sender's system clock; 0 in a request)
+    24  t3                    (int64, response sent, sender's system clock; 0 in a request)
+   With t4 the arrival of the response, the round trip is (t4 - t1) - (t3 - t2), and the
+   sender's clock is ahead by ((t2 - t1) + (t3 - t4)) / 2 if both ways take equally long.
+   Senders take t2 from the kernel's receive timestamp, so polling their socket late does
+   not show up as path delay. */
+const uint8_t c_clockMagic = 0xF8;
+const std::size_t c_clockMessageSize = 32;
+
+struct ClockMessage {
+    uint8_t streamId = 0;
+    bool response = false;
+    uint32_t id = 0;
+    int64_t t1 = 0;
+    int64_t t2 = 0;
+    int64_t t3 = 0;
+
+    std::size_t write(uint8_t* out) const;
+    bool read(const uint8_t* in, std::size_t len);
+};
+
+// Sender side: the response to a request that arrived at arrivalUs (system clock), written
+// to out (c_clockMessageSize bytes); 0 when data is no time request
+std::size_t answerClockRequest(const uint8_t* data, std::size_t len, int64_t arrivalUs, uint8_t* out);
+
+struct ClockSyncStats {
+    uint64_t requests;
+    uint64_t responses;
+    uint64_t points;      // exchanges that survived the round-trip filter
+    uint64_t steps;       // restarts after the sender's clock jumped
+    bool synchronised;
+    double offsetUs;      // sender's clock minus the local one, now
+    double driftPpm;      // how fast the offset grows
+    double rttUs;         // round trip of the last point kept
+    double residualUs;    // RMS of the kept offsets around the fitted line
+};
+
+/* Receiver side estimate of one sender's system clock. An exchange runs every interval;
+   of each block of exchanges only the one with the shortest round trip is kept, as
+   queueing on either way skews an offset by up to half its round trip and the shortest
+   has the least of it. A least squares line through the kept offsets over local time
+   gives offset and drift, so the mapping holds between blocks and through a lost one.
+   A kept offset far off the line means the sender's clock was stepped; the fit restarts.
+   Exchanges run on one thread, the conversions may be used from any. */
+class ClockSync {
+public:
+    explicit ClockSync(uint8_t streamId = 0, int intervalMs = 100);
+
+    // Serializes a request into out (c_clockMessageSize bytes) when one is due, else returns 0
+    std::size_t takeRequest(int64_t nowUs, uint8_t* out);
+    // A response that arrived at arrivalUs (local system clock); false when it is none of ours
+    bool onResponse(const uint8_t* data, std::size_t len, int64_t arrivalUs);
+
+    bool synchronised() const;
+    // Between the sender's system clock and the local one, in microseconds; times are
+    // passed through unchanged until the first block is in
+    int64_t remoteToLocal(int64_t remoteUs) const;
+    int64_t localToRemote(int64_t localUs) const;
+
+    ClockSyncStats stats() const;
+    void dump(std::ostream& out) const;
+
+private:
+    static const int c_block = 8;    // exchanges per kept point
+    static const int c_points = 32;  // kept points in the fit, about half a minute
+
+    void addPoint(int64_t localUs, double offsetUs, double rttUs);
+    void fit();
+
+    uint8_t streamId;
+    int64_t intervalUs;
+    int64_t lastRequestUs = 0;
+    uint32_t nextId = 0;
+    int64_t pendingT1 = 0;       // of the newest request, its response is the one taken
+    uint32_t pendingId = 0;
+    bool pending = false;
+
+    // Best exchange of the current block
+    int blockCount = 0;
+    double blockRttUs = 0.0;
+    double blockOffsetUs = 0.0;
+    int64_t blockLocalUs = 0;
+
+    // Kept points, relative to refUs
+    double pointX[c_points];
+    double pointY[c_points];
+    double pointRtt[c_points];
+    int pointCount = 0;
+    int pointNext = 0;
+
+    mutable std::mutex lock;     // the fit and the counters
+    bool fitted = false;
+    int64_t refUs = 0;
+    double offsetAtRef = 0.0;
+    double slope = 0.0;
+    ClockSyncStats counters = {};
+};
+
+#endif // CLOCKSYNC_H
@@ -0,0 +1,396 @@
+#include "Concealment.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// NAL unit types of H.265 (ITU-T H.265 table 7-1)
+static const int c_nalSps = 33;
+static const int c_nalPps = 34;
+static const int c_nalIrapFirst = 16;
+static const int c_nalIrapLast = 23;
+
+// Parameter sets and slice headers are read from the first bytes of a NAL unit only
+static const std::size_t c_headerBytes = 256;
+
+// Motion search around a neighbouring block, in pixels, on every c_sampleStep-th pixel
+static const int c_searchRange = 12;
+static const int c_sampleStep = 4;
+
+bool parseConcealMode(const std::string& name, ConcealMode& mode) {
+    if (name == "off") mode = ConcealMode::Off;
+    else if (name == "copy") mode = ConcealMode::Copy;
+    else if (name == "motion") mode = ConcealMode::Motion;
+    else return false;
+    return true;
+}
+
+// Position of the next 00 00 01 in [pos, end), or end
+static std::size_t nextStartCode(const uint8_t* data, std::size_t pos, std::size_t end) {
+    for (; pos + 3 <= end; ++pos) {
+        if (data[pos + 2] > 1) {
+            pos += 2;  // none of these three bytes can start a start code
+            continue;
+        }
+        if (data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1) return pos;
+    }
+    return end;
+}
+
+std::size_t extractCompleteNals(const PartialFrame& partial, std::vector<uint8_t>& out) {
+    out.clear();
+    const uint8_t* data = partial.frame.data;
+    std::size_t size = partial.frame.size;
+
+    // Runs of fragments that arrived back to back; a NAL unit is whole when it starts
+    // and ends inside one run
+    int i = 0;
+    while (i < partial.fragCount) {
+        if (!partial.have[i]) {
+            ++i;
+            continue;
+        }
+        int j = i;
+        while (j < partial.fragCount && partial.have[j]) ++j;
+        std::size_t begin = i * partial.stride;
+        std::size_t end = std::min<std::size_t>(j * partial.stride, size);
+        i = j;
+
+        std::size_t nal = nextStartCode(data, begin, end);
+        while (nal < end) {
+            std::size_t next = nextStartCode(data, nal + 3, end);
+            // The last unit of a run is cut off, unless the run reaches the end of the frame
+            if (next == end && end != size) break;
+            // The zero byte of a four byte start code belongs to the unit it starts
+            std::size_t from = nal > begin && data[nal - 1] == 0 ? nal - 1 : nal;
+            std::size_t to = next < end && data[next - 1] == 0 ? next - 1 : next;
+            out.insert(out.end(), data + from, data + to);
+            nal = next;
+        }
+    }
+    return out.size();
+}
+
+// Exp-Golomb reader over an RBSP
+struct BitReader {
+    const uint8_t* data;
+    std::size_t bits;
+    std::size_t pos = 0;
+    bool overrun = false;
+
+    BitReader(const uint8_t* data, std::size_t size) : data(data), bits(size * 8) {}
+
+    uint32_t u(int n) {
+        uint32_t value = 0;
+        for (int i = 0; i < n; ++i) {
+            if (pos >= bits) {
+                overrun = true;
+                return 0;
+            }
+            value = (value << 1) | ((data[pos >> 3] >> (7 - (pos & 7))) & 1);
+            pos++;
+        }
+        return value;
+    }
+
+    void skip(int n) {
+        pos += n;
+        if (pos > bits) overrun = true;
+    }
+
+    uint32_t ue() {
+        int zeros = 0;
+        while (!u(1)) {
+            if (overrun || ++zeros > 31) {
+                overrun = true;
+                return 0;
+            }
+        }
+        return ((1u << zeros) - 1) + u(zeros);
+    }
+
+    int32_t se() {
+        uint32_t k = ue();
+        return (k & 1) ? static_cast<int32_t>((k + 1) / 2) : -static_cast<int32_t>(k / 2);
+    }
+};
+
+static void skipProfileTierLevel(BitReader& r, int maxSubLayersMinus1) {
+    r.skip(88);  // general profile space, tier, idc and flags
+    r.skip(8);   // general level
+    bool profilePresent[8];
+    bool levelPresent[8];
+    for (int i = 0; i < maxSubLayersMinus1; ++i) {
+        profilePresent[i] = r.u(1) != 0;
+        levelPresent[i] = r.u(1) != 0;
+    }
+    if (maxSubLayersMinus1 > 0) {
+        for (int i = maxSubLayersMinus1; i < 8; ++i) r.skip(2);
+    }
+    for (int i = 0; i < maxSubLayersMinus1; ++i) {
+        if (profilePresent[i]) r.skip(88);
+        if (levelPresent[i]) r.skip(8);
+    }
+}
+
+static int ceilLog2(int n) {
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+    return bits;
+}
+
+HevcConcealer::HevcConcealer(ConcealMode mode) : mode(mode) {
+}
+
+void HevcConcealer::parse(const uint8_t* data, std::size_t size) {
+    std::size_t nal = nextStartCode(data, 0, size);
+    while (nal < size) {
+        std::size_t next = nextStartCode(data, nal + 3, size);
+        parseNal(data + nal + 3, next - nal - 3);
+        nal = next;
+    }
+}
+
+void HevcConcealer::parseNal(const uint8_t* nal, std::size_t size) {
+    if (size < 3) return;
+    int type = (nal[0] >> 1) & 0x3f;
+    bool slice = type <= 9 || (type >= c_nalIrapFirst && type <= 21);
+    if (!slice && type != c_nalSps && type != c_nalPps) return;
+
+    // Emulation prevention bytes out, after the two byte NAL unit header
+    std::size_t limit = std::min(size, c_headerBytes);
+    rbsp.clear();
+    int zeros = 0;
+    for (std::size_t i = 2; i < limit; ++i) {
+        if (zeros >= 2 && nal[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        rbsp.push_back(nal[i]);
+        zeros = nal[i] == 0 ? zeros + 1 : 0;
+    }
+    BitReader r(rbsp.data(), rbsp.size());
+
+    if (type == c_nalSps) {
+        r.skip(4);  // video parameter set id
+        int maxSubLayersMinus1 = static_cast<int>(r.u(3));
+        r.skip(1);
+        skipProfileTierLevel(r, maxSubLayersMinus1);
+        uint32_t id = r.ue();
+        if (id > 15) return;
+        if (r.ue() == 3) r.skip(1);  // chroma format, separate colour planes
+        Sps parsed;
+        parsed.width = static_cast<int>(r.ue());
+        parsed.height = static_cast<int>(r.ue());
+        if (r.u(1)) {
+            for (int i = 0; i < 4; ++i) r.ue();  // conformance window
+        }
+        r.ue();  // bit depths
+        r.ue();
+        r.ue();  // log2 max picture order count
+        bool orderingInfo = r.u(1) != 0;
+        for (int i = orderingInfo ? 0 : maxSubLayersMinus1; i <= maxSubLayersMinus1; ++i) {
+            r.ue();
+            r.ue();
+            r.ue();
+        }
+        int minCbLog2 = static_cast<int>(r.ue()) + 3;
+        parsed.ctbLog2 = minCbLog2 + static_cast<int>(r.ue());
+        parsed.valid = !r.overrun && parsed.width > 0 && parsed.height > 0 && parsed.ctbLog2 >= 4 && parsed.ctbLog2 <= 6;
+        sps[id] = parsed;
+    }
+    else if (type == c_nalPps) {
+        uint32_t id = r.ue();
+        if (id > 63) return;
+        Pps parsed;
+        parsed.spsId = static_cast<int>(r.ue());
+        parsed.dependentSlices = r.u(1) != 0;
+        r.skip(1);  // output flag present
+        r.skip(3);  // extra slice header bits
+        r.skip(2);  // sign data hiding, cabac init present
+        r.ue();     // default reference indices
+        r.ue();
+        r.se();     // initial QP
+        r.skip(2);  // constrained intra prediction, transform skip
+        if (r.u(1)) r.ue();  // cu QP delta depth
+        r.se();     // chroma QP offsets
+        r.se();
+        r.skip(4);  // slice chroma QP offsets, weighted prediction, transquant bypass
+        parsed.tiles = r.u(1) != 0;
+        parsed.valid = !r.overrun && parsed.spsId <= 15;
+        pps[id] = parsed;
+    }
+    else {
+        bool first = r.u(1) != 0;
+        if (type >= c_nalIrapFirst && type <= c_nalIrapLast) {
+            r.skip(1);  // no output of prior pictures
+            irap = true;
+        }
+        uint32_t id = r.ue();
+        if (id > 63 || !pps[id].valid || !sps[pps[id].spsId].valid) return;
+        const Sps& s = sps[pps[id].spsId];
+        int address = 0;
+        if (!first) {
+            if (pps[id].dependentSlices) r.skip(1);
+            int ctbSizeLog2 = s.ctbLog2;
+            int across = (s.width + (1 << ctbSizeLog2) - 1) >> ctbSizeLog2;
+            int down = (s.height + (1 << ctbSizeLog2) - 1) >> ctbSizeLog2;
+            address = static_cast<int>(r.u(ceilLog2(across * down)));
+        }
+        if (r.overrun) return;
+        ppsId = static_cast<int>(id);
+        addresses.push_back(address);
+    }
+}
+
+bool HevcConcealer::apply(const uint8_t* data, std::size_t size, bool partial, bool decoded, cv::Mat& image) {
+    addresses.clear();
+    ppsId = -1;
+    irap = false;
+    parse(data, size);
+    if (partial) counters.partial++;
+
+    if (ppsId >= 0) {
+        const Sps& s = sps[pps[ppsId].spsId];
+        int blockSize = 1 << s.ctbLog2;
+        int across = (s.width + blockSize - 1) >> s.ctbLog2;
+        int down = (s.height + blockSize - 1) >> s.ctbLog2;
+        if (across != columns || down != rows || blockSize != ctbSize) {
+            columns = across;
+            rows = down;
+            ctbSize = blockSize;
+            tainted.assign(columns * rows, 0);
+            layout.clear();
+        }
+        std::sort(addresses.begin(), addresses.end());
+        if (!partial) {
+            if (irap) std::fill(tainted.begin(), tainted.end(), 0);
+            layout = addresses;
+        }
+        else if (!decoded || pps[ppsId].tiles) {
+            std::fill(tainted.begin(), tainted.end(), 1);
+        }
+        else {
+            // Each slice segment runs up to the next one that arrived, or the next one of
+            // the layout, whichever comes first
+            int count = columns * rows;
+            covered.assign(count, 0);
+            for (std::size_t k = 0; k < addresses.size(); ++k) {
+                int begin = addresses[k];
+                if (begin >= count) continue;
+                int end = k + 1 < addresses.size() ? addresses[k + 1] : count;
+                auto next = std::upper_bound(layout.begin(), layout.end(), begin);
+                if (next != layout.end() && *next < end) end = *next;
+                std::fill(covered.begin() + begin, covered.begin() + std::min(end, count), 1);
+            }
+            for (int i = 0; i < count; ++i) {
+                if (!covered[i]) tainted[i] = 1;
+            }
+        }
+    }
+    else if (partial) {
+        // Not even a slice header survived: the whole picture is lost
+        std::fill(tainted.begin(), tainted.end(), 1);
+    }
+
+    if (!decoded) {
+        if (partial) counters.frozen++;
+        return false;
+    }
+    bool damaged = std::find(tainted.begin(), tainted.end(), 1) != tainted.end();
+    if (damaged && havePrevious && previous.size() == image.size() && previous.type() == image.type()) {
+        fill(image);
+        counters.concealed++;
+    }
+    image.copyTo(previous);
+    havePrevious = true;
+    return true;
+}
+
+cv::Point HevcConcealer::motionOf(const cv::Mat& image, int col, int row) {
+    int index = row * columns + col;
+    if (motionKnown[index]) return motion[index];
+    motionKnown[index] = 1;
+
+    int x = col * ctbSize;
+    int y = row * ctbSize;
+    int w = std::min(ctbSize, image.cols - x);
+    int h = std::min(ctbSize, image.rows - y);
+    cv::Point best(0, 0);
+    long bestSad = -1;
+    // Zero motion first, so it wins ties
+    for (int step = 0; step <= c_searchRange; ++step) {
+        for (int dy = -step; dy <= step; ++dy) {
+            for (int dx = -step; dx <= step; ++dx) {
+                if (std::abs(dx) != step && std::abs(dy) != step) continue;  // ring of this distance only
+                int sx = x + dx;
+                int sy = y + dy;
+                if (sx < 0 || sy < 0 || sx + w > previous.cols || sy + h > previous.rows) continue;
+                long sad = 0;
+                for (int k = 0; k < h && (bestSad < 0 || sad < bestSad); k += c_sampleStep) {
+                    const uint8_t* a = image.ptr<uint8_t>(y + k) + x * 3 + 1;  // green only
+                    const uint8_t* b = previous.ptr<uint8_t>(sy + k) + sx * 3 + 1;
+                    for (int i = 0; i < w; i += c_sampleStep) {
+                        sad += std::abs(a[i * 3] - b[i * 3]);
+                    }
+                }
+                if (bestSad < 0 || sad < bestSad) {
+                    bestSad = sad;
+                    best = cv::Point(dx, dy);
+                }
+            }
+        }
+    }
+    motion[index] = best;
+    return best;
+}
+
+void HevcConcealer::fill(cv::Mat& image) {
+    if (mode == ConcealMode::Motion) {
+        motion.assign(columns * rows, cv::Point());
+        motionKnown.assign(columns * rows, 0);
+    }
+    static const int c_neighbours[4][2] = { { 0, -1 }, { 0, 1 }, { -1, 0 }, { 1, 0 } };
+
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < columns; ++col) {
+            if (!tainted[row * columns + col]) continue;
+            int x = col * ctbSize;
+            int y = row * ctbSize;
+            int w = std::min(ctbSize, image.cols - x);
+            int h = std::min(ctbSize, image.rows - y);
+            if (w <= 0 || h <= 0) continue;
+            counters.blocks++;
+
+            // The lost block most likely moved like the nearest intact blocks in each
+            // direction; a lost slice is a band, so mostly those above and below it
+            int dx = 0;
+            int dy = 0;
+            if (mode == ConcealMode::Motion) {
+                int found = 0;
+                for (const auto& n : c_neighbours) {
+                    int c = col + n[0];
+                    int r = row + n[1];
+                    while (c >= 0 && r >= 0 && c < columns && r < rows && tainted[r * columns + c]) {
+                        c += n[0];
+                        r += n[1];
+                    }
+                    if (c < 0 || r < 0 || c >= columns || r >= rows) continue;
+                    if (c * ctbSize >= image.cols || r * ctbSize >= image.rows) continue;
+                    cv::Point v = motionOf(image, c, r);
+                    dx += v.x;
+                    dy += v.y;
+                    found++;
+                }
+                if (found) {
+                    dx /= found;
+                    dy /= found;
+                }
+            }
+            int sx = std::min(std::max(x + dx, 0), previous.cols - w);
+            int sy = std::min(std::max(y + dy, 0), previous.rows - h);
+            for (int k = 0; k < h; ++k) {
+                memcpy(image.ptr<uint8_t>(y + k) + x * 3, previous.ptr<uint8_t>(sy + k) + sx * 3, w * 3);
+            }
+        }
+    }
+}
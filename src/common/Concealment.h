@@ -0,0 +1,93 @@
+#ifndef CONCEALMENT_H
+#define CONCEALMENT_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Packetizer.h"
+
+enum class ConcealMode {
+    Off,     // incomplete frames are dropped and the picture waits for a keyframe
+    Copy,    // lost regions keep the previous output
+    Motion   // lost regions follow the motion of their neighbours in the previous output
+};
+
+// "off", "copy" or "motion"
+bool parseConcealMode(const std::string& name, ConcealMode& mode);
+
+/* Network side: of an incomplete Annex-B frame (H.264 or H.265) keeps the NAL units of
+   which every byte arrived, each from its start code to the next. Slices decode on their
+   own, so the decoder rebuilds those parts of the picture as usual. Returns the bytes
+   written to out, start codes included; 0 when no NAL unit is whole. */
+std::size_t extractCompleteNals(const PartialFrame& partial, std::vector<uint8_t>& out);
+
+struct ConcealStats {
+    uint64_t partial;    // incomplete frames decoded
+    uint64_t concealed;  // pictures shown with concealed blocks
+    uint64_t blocks;     // coding tree blocks filled in, summed over those pictures
+    uint64_t frozen;     // incomplete frames the decoder made no picture of
+};
+
+/* Decode side, H.265: finds the coding tree blocks no decoded slice covered and fills
+   them from the previous output. Slice segment addresses come from the slice headers,
+   read with the SPS and PPS seen in the stream. Where a slice before a lost one ended is
+   taken from the slice layout of the last complete frame, as encoders keep it fixed.
+   Later frames predict from the decoder's own damaged reference, so blocks stay
+   concealed until the next IRAP picture. Pictures with tiles are concealed whole. */
+class HevcConcealer {
+public:
+    explicit HevcConcealer(ConcealMode mode);
+
+    // After decoding data (decoded false when the decoder gave no picture) into image.
+    // Returns whether image holds a picture to show.
+    bool apply(const uint8_t* data, std::size_t size, bool partial, bool decoded, cv::Mat& image);
+
+    ConcealStats stats() const { return counters; }
+
+private:
+    struct Sps {
+        bool valid = false;
+        int width = 0;
+        int height = 0;
+        int ctbLog2 = 0;
+    };
+    struct Pps {
+        bool valid = false;
+        int spsId = 0;
+        bool dependentSlices = false;
+        bool tiles = false;
+    };
+
+    void parse(const uint8_t* data, std::size_t size);
+    void parseNal(const uint8_t* nal, std::size_t size);
+    void fill(cv::Mat& image);
+    cv::Point motionOf(const cv::Mat& image, int col, int row);
+
+    ConcealMode mode;
+    Sps sps[16];
+    Pps pps[64];
+    std::vector<uint8_t> rbsp;
+
+    // Of the frame being applied
+    std::vector<int> addresses;  // slice segment addresses in coding tree blocks
+    int ppsId = -1;
+    bool irap = false;
+
+    std::vector<int> layout;     // slice segment addresses of the last complete frame
+    int columns = 0;             // coding tree blocks across
+    int rows = 0;
+    int ctbSize = 0;
+    std::vector<uint8_t> covered;
+    std::vector<uint8_t> tainted;
+    std::vector<cv::Point> motion;
+    std::vector<uint8_t> motionKnown;
+    cv::Mat previous;
+    bool havePrevious = false;
+    ConcealStats counters = {};
+};
+
+#endif // CONCEALMENT_H
@@ -0,0 +1,338 @@
+#include "CongestionControl.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "ByteOrder.h"
+#include "Packetizer.h"
+
+// Trendline and overuse detector constants from the GCC draft / WebRTC defaults
+static const double c_smoothing = 0.9;
+static const double c_trendGain = 4.0;
+static const int c_trendDeltaCap = 60;
+static const double c_overuseTimeMs = 10.0;
+static const double c_thresholdUp = 0.0087;
+static const double c_thresholdDown = 0.039;
+static const double c_thresholdMin = 6.0;
+static const double c_thresholdMax = 600.0;
+
+// AIMD rate controller
+static const double c_increasePerSecond = 1.08;
+static const double c_decreaseFactor = 0.85;
+static const double c_maxOvershoot = 1.5;     // growth is capped at this multiple of the delivered rate
+static const double c_lossHigh = 0.10;
+static const int64_t c_decreaseIntervalNs = 200000000;
+static const int64_t c_feedbackTimeoutNs = 1000000000;
+static const int64_t c_minRateSpanUs = 50000;
+
+std::size_t FeedbackReport::write(uint8_t* out) const {
+    std::size_t count = std::min<std::size_t>(entries.size(), c_maxFeedbackEntries);
+    out[0] = c_feedbackMagic;
+    out[1] = streamId;
+    put16(out + 2, static_cast<uint16_t>(count));
+    put32(out + 4, sequence);
+    put32(out + 8, jitterUs);
+    uint8_t* p = out + c_feedbackHeaderSize;
+    for (std::size_t i = 0; i < count; ++i, p += c_feedbackEntrySize) {
+        put32(p, entries[i].frameId);
+        put32(p + 4, entries[i].arrivalUs);
+        put16(p + 8, entries[i].datagrams);
+    }
+    return c_feedbackHeaderSize + count * c_feedbackEntrySize;
+}
+
+bool FeedbackReport::read(const uint8_t* in, std::size_t len) {
+    if (len < c_feedbackHeaderSize || in[0] != c_feedbackMagic) return false;
+    std::size_t count = get16(in + 2);
+    if (count > static_cast<std::size_t>(c_maxFeedbackEntries) || len < c_feedbackHeaderSize + count * c_feedbackEntrySize) {
+        return false;
+    }
+    streamId = in[1];
+    sequence = get32(in + 4);
+    jitterUs = get32(in + 8);
+    entries.resize(count);
+    const uint8_t* p = in + c_feedbackHeaderSize;
+    for (std::size_t i = 0; i < count; ++i, p += c_feedbackEntrySize) {
+        entries[i].frameId = get32(p);
+        entries[i].arrivalUs = get32(p + 4);
+        entries[i].datagrams = get16(p + 8);
+    }
+    return true;
+}
+
+FeedbackReporter::FeedbackReporter(std::chrono::milliseconds interval)
+    : intervalNs(std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count()) {
+    report.entries.reserve(c_maxFeedbackEntries);
+}
+
+FeedbackEntry* FeedbackReporter::entryFor(uint32_t frameId) {
+    // Fragments of one frame arrive together, so the match is almost always the last entry
+    for (auto it = report.entries.rbegin(); it != report.entries.rend(); ++it) {
+        if (it->frameId == frameId) return &*it;
+    }
+    if (report.entries.size() >= static_cast<std::size_t>(c_maxFeedbackEntries)) return nullptr;
+    FeedbackEntry entry = { frameId, 0, 0 };
+    report.entries.push_back(entry);
+    return &report.entries.back();
+}
+
+void FeedbackReporter::onDatagram(const uint8_t* datagram, std::size_t len, int64_t arrivalNs) {
+    FragmentHeader header;
+    // FEC repairs trail the frame and resends come a round trip late; loss and delay
+    // are measured on the fragments as first sent
+    if (!header.read(datagram, len) || header.repair() || header.retransmit()) return;
+    report.streamId = header.streamId;
+
+    if (!haveFrame || seqNewer(header.frameId, newestFrame)) {
+        // First datagram of a new frame: one jitter sample per frame. The capture timestamp
+        // includes the encode time, so encoder variation shows up here as well.
+        int64_t transitUs = arrivalNs / 1000 - header.timestamp * 1000;
+        if (haveFrame) {
+            double d = std::fabs(static_cast<double>(transitUs - lastTransitUs));
+            jitterUs += (d - jitterUs) / 16.0;
+        }
+        lastTransitUs = transitUs;
+        newestFrame = header.frameId;
+        newestFragments = header.fragCount;
+        haveFrame = true;
+    }
+
+    FeedbackEntry* entry = entryFor(header.frameId);
+    if (!entry) return;
+    entry->arrivalUs = static_cast<uint32_t>(arrivalNs / 1000);
+    entry->datagrams++;
+}
+
+std::size_t FeedbackReporter::takeReport(int64_t nowNs, uint8_t* out) {
+    if (report.entries.empty()) return 0;
+    bool full = report.entries.size() >= static_cast<std::size_t>(c_maxFeedbackEntries);
+    if (!full && nowNs - lastReportNs < intervalNs) return 0;
+
+    // A frame still arriving goes into the next report, whole; otherwise the sender would
+    // count the rest of its fragments as lost
+    FeedbackEntry last = report.entries.back();
+    bool holdBack = last.frameId == newestFrame && last.datagrams < newestFragments;
+    if (holdBack) {
+        if (report.entries.size() == 1) return 0;
+        report.entries.pop_back();
+    }
+
+    report.jitterUs = static_cast<uint32_t>(jitterUs);
+    std::size_t len = report.write(out);
+    report.sequence++;
+    report.entries.clear();
+    if (holdBack) report.entries.push_back(last);
+    lastReportNs = nowNs;
+    return len;
+}
+
+BandwidthEstimator::BandwidthEstimator(int64_t startBitrate, int64_t minBitrate, int64_t maxBitrate)
+    : minBitrate(minBitrate), maxBitrate(maxBitrate), bitrate(static_cast<double>(startBitrate)),
+      appliedBitrate(startBitrate) {
+    memset(history, 0, sizeof(history));
+}
+
+const BandwidthEstimator::SentFrame* BandwidthEstimator::sentFrame(uint32_t frameId) const {
+    const SentFrame& frame = history[frameId % c_history];
+    return frame.valid && frame.frameId == frameId ? &frame : nullptr;
+}
+
+bool BandwidthEstimator::onFrameSent(uint32_t frameId, int64_t sendNs, std::size_t bytes, std::size_t datagrams) {
+    SentFrame& frame = history[frameId % c_history];
+    frame.frameId = frameId;
+    frame.sendNs = sendNs;
+    frame.bytes = static_cast<uint32_t>(bytes);
+    frame.datagrams = static_cast<uint16_t>(datagrams);
+    frame.valid = true;
+
+    // The receiver went silent while we keep sending: the link is gone or badly congested.
+    // Never triggers against receivers that do not send feedback at all.
+    if (lastFeedbackNs && sendNs - lastFeedbackNs > c_feedbackTimeoutNs && sendNs - lastTimeoutNs > c_feedbackTimeoutNs) {
+        lastTimeoutNs = sendNs;
+        bitrate = std::max(static_cast<double>(minBitrate), bitrate * 0.5);
+        return commit();
+    }
+    return false;
+}
+
+bool BandwidthEstimator::onFeedback(const uint8_t* data, std::size_t len, int64_t nowNs) {
+    FeedbackReport report;
+    if (!report.read(data, len)) return false;
+    reports++;
+    lastFeedbackNs = nowNs;
+    lastJitterMs = report.jitterUs / 1000.0;
+
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    for (const FeedbackEntry& entry : report.entries) {
+        const SentFrame* frame = sentFrame(entry.frameId);
+        if (!frame) continue;
+        // Late fragments of frames already accounted for
+        if (haveAcked && !seqNewer(entry.frameId, highestAcked)) continue;
+
+        // Frames between the last acknowledged one and this one never arrived at all
+        if (haveAcked && entry.frameId - highestAcked < static_cast<uint32_t>(c_history)) {
+            for (uint32_t id = highestAcked + 1; id != entry.frameId; ++id) {
+                const SentFrame* lost = sentFrame(id);
+                if (lost) sent += lost->datagrams;
+            }
+        }
+        sent += frame->datagrams;
+        received += std::min(entry.datagrams, frame->datagrams);
+        highestAcked = entry.frameId;
+        haveAcked = true;
+
+        updateReceiveRate(entry.arrivalUs, frame->bytes);
+        if (haveGroup) {
+            double sendDeltaMs = (frame->sendNs - groupSendNs) / 1e6;
+            double arrivalDeltaMs = static_cast<int32_t>(entry.arrivalUs - groupArrivalUs) / 1e3;
+            onDelaySample(sendDeltaMs, arrivalDeltaMs);
+        }
+        groupSendNs = frame->sendNs;
+        groupArrivalUs = entry.arrivalUs;
+        haveGroup = true;
+    }
+    if (sent == 0) return false;
+
+    lastLoss = 1.0 - static_cast<double>(received) / sent;
+    adjustRate(lastLoss, nowNs);
+    return commit();
+}
+
+void BandwidthEstimator::onDelaySample(double sendDeltaMs, double arrivalDeltaMs) {
+    arrivalMs += arrivalDeltaMs;
+    deltaCount = std::min(deltaCount + 1, 1000);
+    accumulatedDelay += arrivalDeltaMs - sendDeltaMs;
+    smoothedDelay = c_smoothing * smoothedDelay + (1.0 - c_smoothing) * accumulatedDelay;
+
+    trendX[trendNext] = arrivalMs;
+    trendY[trendNext] = smoothedDelay;
+    trendNext = (trendNext + 1) % c_trendWindow;
+    if (trendCount < c_trendWindow) trendCount++;
+
+    // Least squares slope of the smoothed delay over arrival time: > 0 means a queue is building
+    double slope = prevTrend;
+    if (trendCount == c_trendWindow) {
+        double meanX = 0.0, meanY = 0.0;
+        for (int i = 0; i < c_trendWindow; ++i) {
+            meanX += trendX[i];
+            meanY += trendY[i];
+        }
+        meanX /= c_trendWindow;
+        meanY /= c_trendWindow;
+        double num = 0.0, den = 0.0;
+        for (int i = 0; i < c_trendWindow; ++i) {
+            num += (trendX[i] - meanX) * (trendY[i] - meanY);
+            den += (trendX[i] - meanX) * (trendX[i] - meanX);
+        }
+        if (den != 0.0) slope = num / den;
+    }
+    modifiedTrend = std::min(deltaCount, c_trendDeltaCap) * slope * c_trendGain;
+
+    if (modifiedTrend > threshold) {
+        if (overuseStartMs < 0.0) overuseStartMs = arrivalMs;
+        overuseCount++;
+        if (arrivalMs - overuseStartMs > c_overuseTimeMs && overuseCount > 1 && slope >= prevTrend) {
+            if (state != BandwidthUsage::Overusing) overuses++;
+            state = BandwidthUsage::Overusing;
+        }
+    }
+    else {
+        overuseStartMs = -1.0;
+        overuseCount = 0;
+        state = modifiedTrend < -threshold ? BandwidthUsage::Underusing : BandwidthUsage::Normal;
+    }
+    prevTrend = slope;
+    updateThreshold(modifiedTrend);
+}
+
+void BandwidthEstimator::updateThreshold(double trend) {
+    if (lastThresholdMs < 0.0) lastThresholdMs = arrivalMs;
+    double magnitude = std::fabs(trend);
+    // Single spikes (a keyframe, a Wi-Fi retry burst) must not drag the threshold along
+    if (magnitude > threshold + 15.0) {
+        lastThresholdMs = arrivalMs;
+        return;
+    }
+    double k = magnitude < threshold ? c_thresholdDown : c_thresholdUp;
+    double dt = std::min(arrivalMs - lastThresholdMs, 100.0);
+    threshold += k * (magnitude - threshold) * dt;
+    threshold = std::max(c_thresholdMin, std::min(c_thresholdMax, threshold));
+    lastThresholdMs = arrivalMs;
+}
+
+void BandwidthEstimator::updateReceiveRate(uint32_t arrivalUs, std::size_t bytes) {
+    rateArrivalUs[rateNext] = arrivalUs;
+    rateBytes[rateNext] = static_cast<uint32_t>(bytes);
+    rateNext = (rateNext + 1) % c_rateWindow;
+    if (rateCount < c_rateWindow) rateCount++;
+    if (rateCount < 2) return;
+
+    int oldest = (rateNext - rateCount + c_rateWindow) % c_rateWindow;
+    int64_t spanUs = static_cast<int32_t>(arrivalUs - rateArrivalUs[oldest]);
+    if (spanUs < c_minRateSpanUs) return;
+    uint64_t total = 0;
+    for (int i = 1; i < rateCount; ++i) {
+        total += rateBytes[(oldest + i) % c_rateWindow];
+    }
+    receiveRate = total * 8e6 / spanUs;
+}
+
+void BandwidthEstimator::adjustRate(double lossFraction, int64_t nowNs) {
+    double dt = lastUpdateNs ? std::min((nowNs - lastUpdateNs) / 1e9, 1.0) : 0.0;
+    lastUpdateNs = nowNs;
+    bool mayDecrease = nowNs - lastDecreaseNs > c_decreaseIntervalNs;
+
+    switch (state) {
+    case BandwidthUsage::Overusing:
+        if (mayDecrease) {
+            double measured = receiveRate > 0.0 ? receiveRate : bitrate;
+            bitrate = std::min(bitrate, c_decreaseFactor * measured);
+            lastDecreaseNs = nowNs;
+            mayDecrease = false;
+        }
+        break;
+    case BandwidthUsage::Underusing:
+        // Queues are draining: hold until they are empty
+        break;
+    case BandwidthUsage::Normal: {
+        double grown = bitrate * std::pow(c_increasePerSecond, dt);
+        double cap = receiveRate > 0.0 ? std::max(bitrate, c_maxOvershoot * receiveRate) : grown;
+        bitrate = std::min(grown, cap);
+        break;
+    }
+    }
+
+    if (lossFraction > c_lossHigh && mayDecrease) {
+        bitrate *= 1.0 - 0.5 * lossFraction;
+        lastDecreaseNs = nowNs;
+    }
+    bitrate = std::max(static_cast<double>(minBitrate), std::min(static_cast<double>(maxBitrate), bitrate));
+}
+
+bool BandwidthEstimator::commit() {
+    int64_t target = static_cast<int64_t>(bitrate);
+    // Reconfiguring the encoder for every few percent is not worth it
+    if (std::llabs(target - appliedBitrate) * 20 < appliedBitrate) return false;
+    appliedBitrate = target;
+    return true;
+}
+
+BandwidthStats BandwidthEstimator::stats() const {
+    BandwidthStats s;
+    s.reports = reports;
+    s.overuses = overuses;
+    s.lossFraction = lastLoss;
+    s.jitterMs = lastJitterMs;
+    s.trend = modifiedTrend;
+    s.threshold = threshold;
+    s.receiveRate = static_cast<int64_t>(receiveRate);
+    return s;
+}
+
+void BandwidthEstimator::dump(std::ostream& out) const {
+    out << "bandwidth: target " << appliedBitrate / 1000 << " kbit/s, received "
+        << static_cast<int64_t>(receiveRate) / 1000 << " kbit/s, loss " << lastLoss * 100.0
+        << "%, jitter " << lastJitterMs << " ms, " << reports << " reports, "
+        << overuses << " overuses" << std::endl;
+}
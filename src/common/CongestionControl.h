@@ -0,0 +1,179 @@
+#ifndef CONGESTIONCONTROL_H
+#define CONGESTIONCONTROL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/* Receiver -> sender feedback datagram (network byte order), sent back to the address
+   the video came from:
+     0  magic 0xFB
+     1  stream id
+     2  entry count           (uint16)
+     4  report sequence       (uint32)
+     8  interarrival jitter   (uint32, microseconds)
+    12  entries, 10 bytes each:
+          frame id            (uint32)
+          last arrival        (uint32, receiver steady clock in microseconds, wraps)
+          datagrams received  (uint16)
+   Only arrival times travel back; send times never leave the sender, so the two clocks
+   need no synchronisation. */
+const uint8_t c_feedbackMagic = 0xFB;
+const std::size_t c_feedbackHeaderSize = 12;
+const std::size_t c_feedbackEntrySize = 10;
+const int c_maxFeedbackEntries = 64;
+const std::size_t c_maxFeedbackSize = c_feedbackHeaderSize + c_maxFeedbackEntries * c_feedbackEntrySize;
+
+struct FeedbackEntry {
+    uint32_t frameId;
+    uint32_t arrivalUs;
+    uint16_t datagrams;
+};
+
+struct FeedbackReport {
+    uint8_t streamId = 0;
+    uint32_t sequence = 0;
+    uint32_t jitterUs = 0;
+    std::vector<FeedbackEntry> entries;
+
+    std::size_t write(uint8_t* out) const;
+    bool read(const uint8_t* in, std::size_t len);
+};
+
+/* Receiver side: notes the arrival of every video datagram and every interval turns
+   what it saw into a FeedbackReport. Jitter is the RFC 3550 estimate over frames,
+   based on the millisecond capture timestamps. */
+class FeedbackReporter {
+public:
+    explicit FeedbackReporter(std::chrono::milliseconds interval = std::chrono::milliseconds(50));
+
+    void onDatagram(const uint8_t* datagram, std::size_t len, int64_t arrivalNs);
+
+    // Serializes a report into out (c_maxFeedbackSize bytes) when one is due, else returns 0
+    std::size_t takeReport(int64_t nowNs, uint8_t* out);
+
+private:
+    FeedbackEntry* entryFor(uint32_t frameId);
+
+    int64_t intervalNs;
+    int64_t lastReportNs = 0;
+    FeedbackReport report;
+    uint32_t newestFrame = 0;
+    uint16_t newestFragments = 0;
+    bool haveFrame = false;
+
+    double jitterUs = 0.0;
+    int64_t lastTransitUs = 0;
+};
+
+enum class BandwidthUsage {
+    Normal,
+    Overusing,
+    Underusing
+};
+
+struct BandwidthStats {
+    uint64_t reports;
+    uint64_t overuses;
+    double lossFraction;  // of the last report
+    double jitterMs;
+    double trend;         // modified delay trend, compared against the threshold
+    double threshold;
+    int64_t receiveRate;  // bits/s at the receiver
+};
+
+/* Sender side delay-gradient bandwidth estimator, after Google Congestion Control:
+   frames are the packet groups, a trendline filter over the accumulated one-way delay
+   variation with an adaptive threshold detects overuse, and an AIMD controller moves the
+   target bitrate. Loss above 10% scales it down further. Growing queues are answered
+   by lowering the bitrate well before the access point starts dropping. */
+class BandwidthEstimator {
+public:
+    BandwidthEstimator(int64_t startBitrate, int64_t minBitrate, int64_t maxBitrate);
+
+    // Returns true when a feedback timeout lowered the target
+    bool onFrameSent(uint32_t frameId, int64_t sendNs, std::size_t bytes, std::size_t datagrams);
+
+    // Returns true when the target moved far enough to be worth applying to the encoder
+    bool onFeedback(const uint8_t* data, std::size_t len, int64_t nowNs);
+
+    int64_t targetBitrate() const { return appliedBitrate; }
+    BandwidthUsage usage() const { return state; }
+    BandwidthStats stats() const;
+
+    // One line summary: target, delivered rate, loss, jitter, overuse count
+    void dump(std::ostream& out) const;
+
+private:
+    struct SentFrame {
+        uint32_t frameId;
+        int64_t sendNs;
+        uint32_t bytes;
+        uint16_t datagrams;
+        bool valid;
+    };
+
+    const SentFrame* sentFrame(uint32_t frameId) const;
+    void onDelaySample(double sendDeltaMs, double arrivalDeltaMs);
+    void updateThreshold(double trend);
+    void updateReceiveRate(uint32_t arrivalUs, std::size_t bytes);
+    void adjustRate(double lossFraction, int64_t nowNs);
+    bool commit();
+
+    static const int c_history = 256;
+    static const int c_trendWindow = 20;
+    static const int c_rateWindow = 32;
+
+    SentFrame history[c_history];
+    int64_t minBitrate;
+    int64_t maxBitrate;
+    double bitrate;
+    int64_t appliedBitrate;
+
+    // Previous acknowledged frame
+    bool haveGroup = false;
+    int64_t groupSendNs = 0;
+    uint32_t groupArrivalUs = 0;
+    uint32_t highestAcked = 0;
+    bool haveAcked = false;
+
+    // Trendline filter, on the receiver's time axis
+    double arrivalMs = 0.0;
+    double accumulatedDelay = 0.0;
+    double smoothedDelay = 0.0;
+    double trendX[c_trendWindow];
+    double trendY[c_trendWindow];
+    int trendCount = 0;
+    int trendNext = 0;
+    int deltaCount = 0;
+    double prevTrend = 0.0;
+    double modifiedTrend = 0.0;
+
+    // Overuse detector
+    double threshold = 12.5;
+    double lastThresholdMs = -1.0;
+    double overuseStartMs = -1.0;
+    int overuseCount = 0;
+    BandwidthUsage state = BandwidthUsage::Normal;
+
+    // Receive rate over the last acknowledged frames
+    uint32_t rateArrivalUs[c_rateWindow];
+    uint32_t rateBytes[c_rateWindow];
+    int rateCount = 0;
+    int rateNext = 0;
+    double receiveRate = 0.0;
+
+    int64_t lastUpdateNs = 0;
+    int64_t lastDecreaseNs = 0;
+    int64_t lastFeedbackNs = 0;
+    int64_t lastTimeoutNs = 0;
+
+    uint64_t reports = 0;
+    uint64_t overuses = 0;
+    double lastLoss = 0.0;
+    double lastJitterMs = 0.0;
+};
+
+#endif // CONGESTIONCONTROL_H
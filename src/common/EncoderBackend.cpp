@@ -0,0 +1,332 @@
+#include "EncoderBackend.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+EncoderBackend::EncoderBackend(EncoderKind kind, const char* encoderName)
+    : backendKind(kind), encoderName(encoderName) {
+    std::fill(timingPts, timingPts + c_latencySlots, AV_NOPTS_VALUE);
+}
+
+EncoderBackend::~EncoderBackend() {
+    if (packet) {
+        av_packet_free(&packet);
+    }
+    if (codecContext) {
+        avcodec_free_context(&codecContext);
+    }
+}
+
+std::unique_ptr<EncoderBackend> EncoderBackend::make(EncoderKind kind, AVCodecID codecId) {
+    switch (kind) {
+    case EncoderKind::Nvenc:
+        return std::unique_ptr<EncoderBackend>(new NvencBackend(codecId));
+    case EncoderKind::X264:
+        if (codecId == AV_CODEC_ID_H264) return std::unique_ptr<EncoderBackend>(new X264Backend());
+        break;
+    case EncoderKind::X265:
+        if (codecId == AV_CODEC_ID_HEVC) return std::unique_ptr<EncoderBackend>(new X265Backend());
+        break;
+    case EncoderKind::OpenH264:
+        if (codecId == AV_CODEC_ID_H264) return std::unique_ptr<EncoderBackend>(new OpenH264Backend());
+        break;
+    default:
+        break;
+    }
+    return nullptr;
+}
+
+std::unique_ptr<EncoderBackend> EncoderBackend::create(EncoderKind kind, const EncoderConfig& config) {
+    // Fastest first; the CPU encoders only cover the codec they implement
+    std::vector<EncoderKind> candidates = { EncoderKind::Nvenc, EncoderKind::X264, EncoderKind::OpenH264, EncoderKind::X265 };
+    if (kind != EncoderKind::Auto) {
+        // Only once: a backend that failed to open is not tried again as a fallback
+        candidates.erase(std::remove(candidates.begin(), candidates.end(), kind), candidates.end());
+        candidates.insert(candidates.begin(), kind);
+    }
+
+    for (EncoderKind candidate : candidates) {
+        std::unique_ptr<EncoderBackend> backend = make(candidate, config.codecId);
+        if (!backend) continue;
+        if (backend->open(config)) {
+            if (kind != EncoderKind::Auto && candidate != kind) {
+                std::cerr << "Encoder " << kindName(kind) << " unavailable, falling back to " << backend->name() << "\n";
+            }
+            return backend;
+        }
+    }
+
+    std::cerr << "No usable encoder for " << avcodec_get_name(config.codecId) << "\n";
+    return nullptr;
+}
+
+bool EncoderBackend::parseKind(const std::string& name, EncoderKind& kind) {
+    if (name == "auto") kind = EncoderKind::Auto;
+    else if (name == "nvenc") kind = EncoderKind::Nvenc;
+    else if (name == "x264" || name == "libx264") kind = EncoderKind::X264;
+    else if (name == "x265" || name == "libx265") kind = EncoderKind::X265;
+    else if (name == "openh264" || name == "libopenh264") kind = EncoderKind::OpenH264;
+    else return false;
+    return true;
+}
+
+const char* EncoderBackend::kindName(EncoderKind kind) {
+    switch (kind) {
+    case EncoderKind::Nvenc: return "nvenc";
+    case EncoderKind::X264: return "x264";
+    case EncoderKind::X265: return "x265";
+    case EncoderKind::OpenH264: return "openh264";
+    default: return "auto";
+    }
+}
+
+bool EncoderBackend::open(const EncoderConfig& config) {
+    const AVCodec* codec = avcodec_find_encoder_by_name(encoderName.c_str());
+    if (!codec) {
+        return false;
+    }
+
+    codecContext = avcodec_alloc_context3(codec);
+    if (!codecContext) {
+        std::cerr << "Could not allocate video codec context\n";
+        return false;
+    }
+
+    codecContext->bit_rate = config.bitRate;
+    codecContext->width = config.width;
+    codecContext->height = config.height;
+    codecContext->time_base = { 1, config.fps };
+    codecContext->framerate = { config.fps, 1 };
+    codecContext->gop_size = config.gopSize;
+    codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
+
+    if (config.zeroLatency) {
+        // Each frame must leave the encoder before the next one arrives
+        codecContext->max_b_frames = 0;
+        codecContext->rc_max_rate = config.bitRate;
+        codecContext->rc_buffer_size = static_cast<int>(config.bitRate / config.fps);
+        codecContext->thread_type = FF_THREAD_SLICE;
+        codecContext->thread_count = config.threads;
+        codecContext->slices = config.slices > 0 ? config.slices : config.threads;
+        codecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    }
+    else {
+        codecContext->max_b_frames = 1;
+    }
+
+    if (!setupHardware(config)) {
+        avcodec_free_context(&codecContext);
+        return false;
+    }
+
+    AVDictionary* opts = nullptr;
+    applyOptions(config, &opts);
+
+    if (avcodec_open2(codecContext, codec, &opts) < 0) {
+        std::cerr << "Could not open codec " << encoderName << "\n";
+        av_dict_free(&opts);
+        avcodec_free_context(&codecContext);
+        return false;
+    }
+    av_dict_free(&opts);
+
+    packet = av_packet_alloc();
+    if (!packet) {
+        std::cerr << "Could not allocate packet\n";
+        return false;
+    }
+    return true;
+}
+
+bool EncoderBackend::encode(AVFrame* frame, const FrameTiming& timing, const std::function<void(AVPacket*, FrameTiming&)>& onPacket) {
+    AVFrame* input = nullptr;
+    if (frame) {
+        int index = static_cast<int>(frame->pts & (c_latencySlots - 1));
+        FrameTiming& slot = timings[index];
+        slot = timing;
+        slot.encodeInNs = steadyNowNs();
+        timingPts[index] = frame->pts;
+        input = upload(frame);
+        if (!input) return false;
+        // Callers reuse their frames, so the type is set on every one, not only the forced;
+        // with forced-idr the wrappers turn an I picture into an IDR
+        input->pict_type = keyframeRequested.exchange(false, std::memory_order_relaxed)
+            ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    }
+
+    if (avcodec_send_frame(codecContext, input) < 0) {
+        std::cerr << "Error sending frame for encoding\n";
+        return false;
+    }
+
+    while (avcodec_receive_packet(codecContext, packet) == 0) {
+        FrameTiming out;
+        if (takeTiming(packet->pts, out)) {
+            out.encodeOutNs = steadyNowNs();
+            lastLatencyMs = (out.encodeOutNs - out.encodeInNs) / 1e6;
+            totalLatencyMs += lastLatencyMs;
+            if (lastLatencyMs > maxLatencyMs) maxLatencyMs = lastLatencyMs;
+            encodedFrames++;
+        }
+        else {
+            // No input to match: at least put a sane timestamp on the wire
+            out.captureMillis = wallClockMillis();
+        }
+        onPacket(packet, out);
+        av_packet_unref(packet);
+    }
+    return true;
+}
+
+// The timing of the input with this pts; a packet without a usable pts gets the oldest
+// input still waiting, which is the one an encoder without reordering puts out next
+bool EncoderBackend::takeTiming(int64_t pts, FrameTiming& out) {
+    int index = -1;
+    if (pts != AV_NOPTS_VALUE && timingPts[pts & (c_latencySlots - 1)] == pts) {
+        index = static_cast<int>(pts & (c_latencySlots - 1));
+    }
+    else {
+        for (int i = 0; i < c_latencySlots; ++i) {
+            if (timingPts[i] != AV_NOPTS_VALUE && (index < 0 || timingPts[i] < timingPts[index])) index = i;
+        }
+    }
+    if (index < 0) return false;
+    out = timings[index];
+    timingPts[index] = AV_NOPTS_VALUE;
+    return true;
+}
+
+bool EncoderBackend::setBitrate(int64_t bitRate) {
+    if (!dynamicBitrate()) {
+        if (!bitrateWarned) {
+            std::cerr << encoderName << " cannot change its bitrate while open, staying at "
+                << codecContext->bit_rate / 1000 << " kbit/s\n";
+            bitrateWarned = true;
+        }
+        return false;
+    }
+    codecContext->bit_rate = bitRate;
+    if (codecContext->rc_max_rate) {
+        // Zero-latency mode: keep the single-frame VBV in step with the new rate
+        int fps = codecContext->framerate.num > 0 ? codecContext->framerate.num / std::max(1, codecContext->framerate.den) : 30;
+        codecContext->rc_max_rate = bitRate;
+        codecContext->rc_buffer_size = static_cast<int>(bitRate / std::max(1, fps));
+    }
+    return true;
+}
+
+EncoderStats EncoderBackend::stats() const {
+    EncoderStats s;
+    s.frames = encodedFrames;
+    s.lastMs = lastLatencyMs;
+    s.averageMs = encodedFrames ? totalLatencyMs / encodedFrames : 0.0;
+    s.maxMs = maxLatencyMs;
+    return s;
+}
+
+NvencBackend::NvencBackend(AVCodecID codecId)
+    : EncoderBackend(EncoderKind::Nvenc, codecId == AV_CODEC_ID_HEVC ? "hevc_nvenc" : "h264_nvenc") {
+}
+
+NvencBackend::~NvencBackend() {
+    if (hw_frame) {
+        av_frame_free(&hw_frame);
+    }
+    if (hw_device_ctx) {
+        av_buffer_unref(&hw_device_ctx);
+    }
+}
+
+bool NvencBackend::setupHardware(const EncoderConfig& config) {
+    // Fails quietly on hosts without a CUDA device so create() can fall back
+    if (av_hwdevice_ctx_create(&hw_device_ctx, AV_HWDEVICE_TYPE_CUDA, nullptr, nullptr, 0) < 0) {
+        return false;
+    }
+
+    AVBufferRef* hw_frames_ref = av_hwframe_ctx_alloc(hw_device_ctx);
+    if (!hw_frames_ref) {
+        std::cerr << "Could not allocate hardware frame context\n";
+        return false;
+    }
+
+    AVHWFramesContext* frames_ctx = (AVHWFramesContext*)(hw_frames_ref->data);
+    frames_ctx->format = AV_PIX_FMT_CUDA;
+    frames_ctx->sw_format = AV_PIX_FMT_YUV420P;
+    frames_ctx->width = config.width;
+    frames_ctx->height = config.height;
+    frames_ctx->initial_pool_size = 20;
+
+    if (av_hwframe_ctx_init(hw_frames_ref) < 0) {
+        std::cerr << "Failed to initialize hardware frame context\n";
+        av_buffer_unref(&hw_frames_ref);
+        return false;
+    }
+
+    codecContext->pix_fmt = AV_PIX_FMT_CUDA;
+    codecContext->hw_device_ctx = av_buffer_ref(hw_device_ctx);
+    codecContext->hw_frames_ctx = hw_frames_ref;
+
+    hw_frame = av_frame_alloc();
+    if (!hw_frame) {
+        std::cerr << "Could not allocate CUDA frame\n";
+        return false;
+    }
+    return true;
+}
+
+void NvencBackend::applyOptions(const EncoderConfig& config, AVDictionary** opts) {
+    if (config.zeroLatency) {
+        av_dict_set(opts, "preset", "p1", 0);
+        av_dict_set(opts, "tune", "ull", 0);
+        av_dict_set(opts, "zerolatency", "1", 0);
+        av_dict_set(opts, "rc-lookahead", "0", 0);
+        av_dict_set(opts, "delay", "0", 0);
+        av_dict_set(opts, "rc", "cbr", 0);
+    }
+    else {
+        av_dict_set(opts, "preset", "fast", 0);
+    }
+    av_dict_set(opts, "forced-idr", "1", 0);
+}
+
+AVFrame* NvencBackend::upload(AVFrame* frame) {
+    av_frame_unref(hw_frame);
+    if (av_hwframe_get_buffer(codecContext->hw_frames_ctx, hw_frame, 0) < 0) {
+        std::cerr << "Could not allocate CUDA frame buffer\n";
+        return nullptr;
+    }
+    if (av_hwframe_transfer_data(hw_frame, frame, 0) < 0) {
+        std::cerr << "Error transferring data to CUDA frame\n";
+        return nullptr;
+    }
+    av_frame_copy_props(hw_frame, frame);
+    return hw_frame;
+}
+
+void X264Backend::applyOptions(const EncoderConfig& config, AVDictionary** opts) {
+    if (config.zeroLatency) {
+        av_dict_set(opts, "preset", "ultrafast", 0);
+        av_dict_set(opts, "tune", "zerolatency", 0);
+        av_dict_set(opts, "rc-lookahead", "0", 0);
+        av_dict_set(opts, "x264-params", "sliced-threads=1:sync-lookahead=0", 0);
+    }
+    av_dict_set(opts, "forced-idr", "1", 0);
+}
+
+void X265Backend::applyOptions(const EncoderConfig& config, AVDictionary** opts) {
+    if (config.zeroLatency) {
+        av_dict_set(opts, "preset", "ultrafast", 0);
+        av_dict_set(opts, "tune", "zerolatency", 0);
+        int slices = config.slices > 0 ? config.slices : config.threads;
+        std::string params = "bframes=0:rc-lookahead=0:frame-threads=1:slices=" + std::to_string(slices);
+        av_dict_set(opts, "x265-params", params.c_str(), 0);
+    }
+    av_dict_set(opts, "forced-idr", "1", 0);
+}
+
+void OpenH264Backend::applyOptions(const EncoderConfig& config, AVDictionary** opts) {
+    if (config.zeroLatency) {
+        av_dict_set(opts, "allow_skip_frames", "0", 0);
+        av_dict_set(opts, "rc_mode", "bitrate", 0);
+    }
+}
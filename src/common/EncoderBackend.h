@@ -0,0 +1,155 @@
+#ifndef ENCODERBACKEND_H
+#define ENCODERBACKEND_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libavutil/dict.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/buffer.h>
+}
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "FrameTiming.h"
+
+enum class EncoderKind {
+    Auto,      // first available: nvenc, then the fastest CPU encoder
+    Nvenc,
+    X264,
+    X265,
+    OpenH264
+};
+
+struct EncoderConfig {
+    AVCodecID codecId = AV_CODEC_ID_H264;
+    int width = 640;
+    int height = 480;
+    int fps = 30;
+    int64_t bitRate = 1000000;
+    int gopSize = 15;
+    bool zeroLatency = true;  // no B-frames, no lookahead, single-frame VBV, slice threads
+    int threads = 4;
+    int slices = 0;  // 0 follows threads; more slices let a receiver conceal smaller losses
+};
+
+struct EncoderStats {
+    uint64_t frames;
+    double lastMs;
+    double averageMs;
+    double maxMs;
+};
+
+/* Common interface for every sender's encoder.
+   Callers always hand over YUV420P software frames; hardware backends upload internally. */
+class EncoderBackend {
+public:
+    virtual ~EncoderBackend();
+
+    // Opens the requested backend, falling back to the next available one instead of aborting.
+    // Returns nullptr only if no encoder for config.codecId can be opened.
+    static std::unique_ptr<EncoderBackend> create(EncoderKind kind, const EncoderConfig& config);
+    // "auto", "nvenc", "x264", "x265" or "openh264"; false for any other name
+    static bool parseKind(const std::string& name, EncoderKind& kind);
+    static const char* kindName(EncoderKind kind);
+
+    // Encodes one frame (nullptr flushes) and hands every finished packet to onPacket, along
+    // with the timing record of the frame it came from, matched by pts and with encodeInNs and
+    // encodeOutNs filled in. The packet is unreferenced after the callback returns.
+    bool encode(AVFrame* frame, const FrameTiming& timing, const std::function<void(AVPacket*, FrameTiming&)>& onPacket);
+
+    // Retargets rate control for the following frames without reopening the codec.
+    // Returns false for backends whose FFmpeg wrapper only reads the bitrate at open.
+    bool setBitrate(int64_t bitRate);
+
+    // Makes the next frame passed to encode() an IDR, so a receiver that lost a reference
+    // recovers without waiting for the GOP to end. Safe to call from another thread.
+    void requestKeyframe() { keyframeRequested.store(true, std::memory_order_relaxed); }
+
+    const std::string& name() const { return encoderName; }
+    EncoderKind kind() const { return backendKind; }
+    AVCodecContext* context() const { return codecContext; }
+    EncoderStats stats() const;
+
+protected:
+    EncoderBackend(EncoderKind kind, const char* encoderName);
+
+    bool open(const EncoderConfig& config);
+
+    // Backend specific private options, applied on top of the shared settings
+    virtual void applyOptions(const EncoderConfig& config, AVDictionary** opts) = 0;
+    virtual bool setupHardware(const EncoderConfig&) { return true; }
+    virtual AVFrame* upload(AVFrame* frame) { return frame; }
+    // The wrapper picks up bit_rate/rc_max_rate/rc_buffer_size changes between frames
+    virtual bool dynamicBitrate() const { return false; }
+
+    AVCodecContext* codecContext = nullptr;
+
+private:
+    static std::unique_ptr<EncoderBackend> make(EncoderKind kind, AVCodecID codecId);
+
+    static const int c_latencySlots = 64;
+
+    bool takeTiming(int64_t pts, FrameTiming& out);
+
+    EncoderKind backendKind;
+    std::string encoderName;
+    AVPacket* packet = nullptr;
+    bool bitrateWarned = false;
+    std::atomic<bool> keyframeRequested{ false };
+
+    // Timing per pts slot, so buffered or dropped frames cannot desynchronize it
+    FrameTiming timings[c_latencySlots];
+    int64_t timingPts[c_latencySlots];  // input pts of each slot, AV_NOPTS_VALUE once taken
+    uint64_t encodedFrames = 0;
+    double lastLatencyMs = 0.0;
+    double totalLatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+};
+
+class NvencBackend : public EncoderBackend {
+public:
+    explicit NvencBackend(AVCodecID codecId);
+    ~NvencBackend() override;
+
+protected:
+    void applyOptions(const EncoderConfig& config, AVDictionary** opts) override;
+    bool setupHardware(const EncoderConfig& config) override;
+    AVFrame* upload(AVFrame* frame) override;
+    bool dynamicBitrate() const override { return true; }
+
+private:
+    AVBufferRef* hw_device_ctx = nullptr;
+    AVFrame* hw_frame = nullptr;
+};
+
+class X264Backend : public EncoderBackend {
+public:
+    X264Backend() : EncoderBackend(EncoderKind::X264, "libx264") {}
+
+protected:
+    void applyOptions(const EncoderConfig& config, AVDictionary** opts) override;
+    bool dynamicBitrate() const override { return true; }
+};
+
+class X265Backend : public EncoderBackend {
+public:
+    X265Backend() : EncoderBackend(EncoderKind::X265, "libx265") {}
+
+protected:
+    void applyOptions(const EncoderConfig& config, AVDictionary** opts) override;
+};
+
+class OpenH264Backend : public EncoderBackend {
+public:
+    OpenH264Backend() : EncoderBackend(EncoderKind::OpenH264, "libopenh264") {}
+
+protected:
+    void applyOptions(const EncoderConfig& config, AVDictionary** opts) override;
+};
+
+#endif // ENCODERBACKEND_H
@@ -0,0 +1,372 @@
+#include "Fec.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "ByteOrder.h"
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d), generator 2
+struct GfTables {
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    GfTables() {
+        unsigned x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = static_cast<uint8_t>(x);
+            log[x] = static_cast<uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11d;
+        }
+        // Doubled so a product needs no modulo
+        for (int i = 255; i < 512; ++i) {
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0;
+    }
+};
+
+static const GfTables s_gf;
+
+static uint8_t gfMul(uint8_t a, uint8_t b) {
+    if (!a || !b) return 0;
+    return s_gf.exp[s_gf.log[a] + s_gf.log[b]];
+}
+
+static uint8_t gfInv(uint8_t a) {
+    return s_gf.exp[255 - s_gf.log[a]];
+}
+
+// Coefficient of fragment i in repair j: 1 / (x_j + y_i) with x_j = count + j, y_i = i
+static uint8_t cauchy(int j, int i, int count) {
+    return gfInv(static_cast<uint8_t>((count + j) ^ i));
+}
+
+static void xorRegion(uint8_t* dst, const uint8_t* src, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < n; ++i) {
+        dst[i] ^= src[i];
+    }
+}
+
+/* c * s = c * (s & 0x0f) ^ c * (s & 0xf0), so two 16 entry tables and a byte shuffle
+   multiply 16 or 32 bytes at once. The instruction set is chosen at compile time. */
+void gfMulAddRegion(uint8_t* dst, const uint8_t* src, uint8_t c, std::size_t n) {
+    if (c == 0) return;
+    if (c == 1) {
+        xorRegion(dst, src, n);
+        return;
+    }
+    alignas(16) uint8_t lo[16];
+    alignas(16) uint8_t hi[16];
+    for (int i = 0; i < 16; ++i) {
+        lo[i] = gfMul(c, static_cast<uint8_t>(i));
+        hi[i] = gfMul(c, static_cast<uint8_t>(i << 4));
+    }
+
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i tableLo = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(lo)));
+    const __m256i tableHi = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(hi)));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    for (; i + 32 <= n; i += 32) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i pl = _mm256_shuffle_epi8(tableLo, _mm256_and_si256(s, mask));
+        __m256i ph = _mm256_shuffle_epi8(tableHi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+        d = _mm256_xor_si256(d, _mm256_xor_si256(pl, ph));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), d);
+    }
+#elif defined(__SSSE3__)
+    const __m128i tableLo = _mm_load_si128(reinterpret_cast<const __m128i*>(lo));
+    const __m128i tableHi = _mm_load_si128(reinterpret_cast<const __m128i*>(hi));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i pl = _mm_shuffle_epi8(tableLo, _mm_and_si128(s, mask));
+        __m128i ph = _mm_shuffle_epi8(tableHi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        d = _mm_xor_si128(d, _mm_xor_si128(pl, ph));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), d);
+    }
+#elif defined(__aarch64__)
+    const uint8x16_t tableLo = vld1q_u8(lo);
+    const uint8x16_t tableHi = vld1q_u8(hi);
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t s = vld1q_u8(src + i);
+        uint8x16_t p = veorq_u8(vqtbl1q_u8(tableLo, vandq_u8(s, mask)), vqtbl1q_u8(tableHi, vshrq_n_u8(s, 4)));
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), p));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+    }
+}
+
+bool FecProtection::parse(const std::string& spec) {
+    std::string name = spec.substr(0, spec.find(':'));
+    const char* arg = spec.find(':') == std::string::npos ? nullptr : spec.c_str() + spec.find(':') + 1;
+    char* end = nullptr;
+
+    if (name == "none") {
+        scheme = FecScheme::None;
+        return arg == nullptr;
+    }
+    if (name == "xor" || name == "xor2d") {
+        scheme = FecScheme::Xor;
+        columns = name == "xor2d";
+        if (arg) {
+            long length = strtol(arg, &end, 10);
+            if (*end != '\0' || length < 1 || length > 255) return false;
+            rowLength = static_cast<int>(length);
+        }
+        return true;
+    }
+    if (name == "rs") {
+        scheme = FecScheme::ReedSolomon;
+        if (arg) {
+            double ratio = strtod(arg, &end);
+            if (*end != '\0' || !(ratio > 0.0) || ratio > 4.0) return false;
+            repairRatio = ratio;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool FecConfig::parse(const std::string& spec) {
+    std::size_t slash = spec.find('/');
+    if (!delta.parse(spec.substr(0, slash))) return false;
+    if (slash == std::string::npos) {
+        keyframe = delta;
+        return true;
+    }
+    return keyframe.parse(spec.substr(slash + 1));
+}
+
+FecEncoder::FecEncoder(const FecConfig& config) : config(config) {
+}
+
+// Fragment i as a full stride, the short last one zero-padded
+const uint8_t* FecEncoder::source(const std::vector<Fragment>& fragments, std::size_t i, std::size_t stride) {
+    const Fragment& frag = fragments[i];
+    if (frag.size == stride) return frag.payload;
+    paddedLast.assign(stride, 0);
+    memcpy(paddedLast.data(), frag.payload, frag.size);
+    return paddedLast.data();
+}
+
+const std::vector<Fragment>& FecEncoder::protect(const std::vector<Fragment>& fragments, bool keyframe) {
+    repairs.clear();
+    const FecProtection& protection = keyframe ? config.keyframe : config.delta;
+    if (protection.scheme == FecScheme::None || fragments.empty()) return repairs;
+
+    FragmentHeader header;
+    if (fragments[0].headerSize != c_fragmentHeaderSize || !header.read(fragments[0].header, c_fragmentHeaderSize)) {
+        return repairs; // RTP packets, not protected here
+    }
+    std::size_t count = fragments.size();
+    std::size_t stride = fragments[0].size;
+    if (stride == 0) return repairs;
+
+    FecScheme scheme = protection.scheme;
+    int rowLength = protection.rowLength;
+    std::size_t repairTotal = 0;
+    if (scheme == FecScheme::ReedSolomon) {
+        repairTotal = std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(count * protection.repairRatio)));
+        if (count + repairTotal > static_cast<std::size_t>(c_maxRsSymbols)) {
+            if (count < static_cast<std::size_t>(c_maxRsSymbols)) {
+                repairTotal = c_maxRsSymbols - count;
+            }
+            else {
+                // Too many fragments for GF(2^8) points: XOR rows of the same overhead instead
+                scheme = FecScheme::Xor;
+                rowLength = static_cast<int>(std::min<std::size_t>(255, (count + repairTotal - 1) / repairTotal));
+            }
+        }
+    }
+    std::size_t rows = 0;
+    if (scheme == FecScheme::Xor) {
+        rows = (count + rowLength - 1) / rowLength;
+        repairTotal = rows;
+        if (protection.columns && scheme == protection.scheme) {
+            repairTotal += std::min<std::size_t>(rowLength, count);
+        }
+    }
+    // Repairs are numbered after the fragments in the uint16 fragment index
+    if (count + repairTotal > UINT16_MAX) return repairs;
+
+    std::size_t symbol = c_fecHeaderSize + stride;
+    parity.assign(repairTotal * symbol, 0);
+    for (std::size_t j = 0; j < repairTotal; ++j) {
+        uint8_t* fec = parity.data() + j * symbol;
+        fec[0] = static_cast<uint8_t>(scheme);
+        fec[1] = scheme == FecScheme::Xor ? static_cast<uint8_t>(rowLength) : 0;
+        put16(fec + 2, static_cast<uint16_t>(repairTotal));
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+        const uint8_t* src = source(fragments, i, stride);
+        if (scheme == FecScheme::Xor) {
+            xorRegion(parity.data() + (i / rowLength) * symbol + c_fecHeaderSize, src, stride);
+            if (repairTotal > rows) {
+                xorRegion(parity.data() + (rows + i % rowLength) * symbol + c_fecHeaderSize, src, stride);
+            }
+        }
+        else {
+            // Fragment outer, repair inner: each fragment is read from memory once
+            for (std::size_t j = 0; j < repairTotal; ++j) {
+                gfMulAddRegion(parity.data() + j * symbol + c_fecHeaderSize, src,
+                    cauchy(static_cast<int>(j), static_cast<int>(i), static_cast<int>(count)), stride);
+            }
+        }
+    }
+
+    header.flags |= c_flagRepair;
+    repairs.resize(repairTotal);
+    for (std::size_t j = 0; j < repairTotal; ++j) {
+        Fragment& frag = repairs[j];
+        header.fragIndex = static_cast<uint16_t>(count + j);
+        header.write(frag.header);
+        frag.payload = parity.data() + j * symbol;
+        frag.size = symbol;
+    }
+    repairCount += repairTotal;
+    return repairs;
+}
+
+int FecDecoder::recover(FecScheme scheme, int rowLength, uint16_t count, std::size_t stride,
+    uint8_t* symbols, uint8_t* have, uint16_t repairCount, const uint8_t* repairs, const uint8_t* repairHave) {
+    if (scheme == FecScheme::Xor) {
+        return recoverXor(rowLength, count, stride, symbols, have, repairCount, repairs, repairHave);
+    }
+    if (scheme == FecScheme::ReedSolomon) {
+        return recoverRs(count, stride, symbols, have, repairCount, repairs, repairHave);
+    }
+    return 0;
+}
+
+int FecDecoder::recoverXor(int rowLength, uint16_t count, std::size_t stride, uint8_t* symbols, uint8_t* have,
+    uint16_t repairCount, const uint8_t* repairs, const uint8_t* repairHave) {
+    if (rowLength < 1) return 0;
+    int rows = (count + rowLength - 1) / rowLength;
+    int groups = std::min<int>(repairCount, rows + std::min<int>(rowLength, count));
+
+    // A row or column parity missing exactly one member rebuilds it; that may complete
+    // another group in the other direction, so repeat until nothing changes
+    int rebuilt = 0;
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (int g = 0; g < groups; ++g) {
+            if (!repairHave[g]) continue;
+            int first = g < rows ? g * rowLength : g - rows;
+            int step = g < rows ? 1 : rowLength;
+            int end = g < rows ? std::min<int>(count, first + rowLength) : count;
+
+            int lost = -1;
+            int lostCount = 0;
+            for (int i = first; i < end && lostCount < 2; i += step) {
+                if (!have[i]) {
+                    lost = i;
+                    lostCount++;
+                }
+            }
+            if (lostCount != 1) continue;
+
+            uint8_t* dst = symbols + lost * stride;
+            memcpy(dst, repairs + g * stride, stride);
+            for (int i = first; i < end; i += step) {
+                if (i != lost) xorRegion(dst, symbols + i * stride, stride);
+            }
+            have[lost] = 1;
+            rebuilt++;
+            progress = true;
+        }
+    }
+    return rebuilt;
+}
+
+int FecDecoder::recoverRs(uint16_t count, std::size_t stride, uint8_t* symbols, uint8_t* have,
+    uint16_t repairCount, const uint8_t* repairs, const uint8_t* repairHave) {
+    if (count + repairCount > c_maxRsSymbols) return 0;
+    missing.clear();
+    for (int i = 0; i < count; ++i) {
+        if (!have[i]) missing.push_back(i);
+    }
+    used.clear();
+    for (int j = 0; j < repairCount && used.size() < missing.size(); ++j) {
+        if (repairHave[j]) used.push_back(j);
+    }
+    std::size_t e = missing.size();
+    if (e == 0 || used.size() < e) return 0;
+
+    // What the received fragments contributed is taken out of each repair, leaving
+    // e equations in the e missing fragments
+    scratch.resize(e * stride);
+    for (std::size_t a = 0; a < e; ++a) {
+        memcpy(scratch.data() + a * stride, repairs + used[a] * stride, stride);
+    }
+    for (int i = 0; i < count; ++i) {
+        if (!have[i]) continue;
+        for (std::size_t a = 0; a < e; ++a) {
+            gfMulAddRegion(scratch.data() + a * stride, symbols + i * stride, cauchy(used[a], i, count), stride);
+        }
+    }
+
+    // Invert the e x e Cauchy submatrix by Gauss-Jordan on [M | I]; every square
+    // submatrix of a Cauchy matrix is invertible
+    std::size_t width = 2 * e;
+    matrix.assign(e * width, 0);
+    for (std::size_t a = 0; a < e; ++a) {
+        for (std::size_t b = 0; b < e; ++b) {
+            matrix[a * width + b] = cauchy(used[a], missing[b], count);
+        }
+        matrix[a * width + e + a] = 1;
+    }
+    for (std::size_t col = 0; col < e; ++col) {
+        std::size_t pivot = col;
+        while (pivot < e && matrix[pivot * width + col] == 0) pivot++;
+        if (pivot == e) return 0;
+        if (pivot != col) {
+            std::swap_ranges(matrix.begin() + pivot * width, matrix.begin() + (pivot + 1) * width, matrix.begin() + col * width);
+        }
+        uint8_t* row = matrix.data() + col * width;
+        uint8_t inv = gfInv(row[col]);
+        for (std::size_t b = 0; b < width; ++b) {
+            row[b] = gfMul(row[b], inv);
+        }
+        for (std::size_t a = 0; a < e; ++a) {
+            uint8_t factor = matrix[a * width + col];
+            if (a == col || factor == 0) continue;
+            for (std::size_t b = 0; b < width; ++b) {
+                matrix[a * width + b] ^= gfMul(factor, row[b]);
+            }
+        }
+    }
+
+    for (std::size_t b = 0; b < e; ++b) {
+        uint8_t* dst = symbols + missing[b] * stride;
+        memset(dst, 0, stride);
+        for (std::size_t a = 0; a < e; ++a) {
+            gfMulAddRegion(dst, scratch.data() + a * stride, matrix[b * width + e + a], stride);
+        }
+        have[missing[b]] = 1;
+    }
+    return static_cast<int>(e);
+}
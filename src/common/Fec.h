@@ -0,0 +1,100 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Packetizer.h"
+
+/* Forward error correction over the native fragment stream, so a lost datagram is rebuilt
+   from the ones that did arrive instead of costing every frame up to the next keyframe.
+   Repair datagrams follow a frame's fragments. They carry its fragment header with
+   c_flagRepair set and fragIndex = repair index, then a 4 byte FEC header:
+     0  scheme
+     1  row length            (Xor)
+     2  repair count          (uint16)
+   and one stride long parity symbol, computed over the fragments zero-padded to the stride.
+   Xor: fragments in rows of rowLength, one parity per row, optionally one per column
+   after the rows (2D). Rebuilds one loss per row or column, repeatedly, at XOR cost.
+   ReedSolomon: systematic Cauchy code over GF(2^8). Any fragCount of the fragCount + m
+   datagrams rebuild the frame, whatever the loss pattern, which is what bursts need. */
+const std::size_t c_fecHeaderSize = 4;
+// Cauchy points of fragments and repairs must all be distinct elements of GF(2^8)
+const int c_maxRsSymbols = 256;
+
+enum class FecScheme : uint8_t {
+    None = 0,
+    Xor = 1,
+    ReedSolomon = 2
+};
+
+struct FecProtection {
+    FecScheme scheme = FecScheme::None;
+    int rowLength = 8;         // Xor: fragments per parity row
+    bool columns = false;      // Xor: also a parity per column
+    double repairRatio = 0.2;  // ReedSolomon: repair fragments per fragment, at least one
+
+    // "none", "xor[:L]", "xor2d[:L]" or "rs[:ratio]"
+    bool parse(const std::string& spec);
+};
+
+struct FecConfig {
+    FecProtection keyframe;  // everything up to the next keyframe depends on these
+    FecProtection delta;
+
+    // "<delta>[/<keyframe>]", e.g. "xor/rs:0.5"; one spec applies to both
+    bool parse(const std::string& spec);
+    bool enabled() const { return keyframe.scheme != FecScheme::None || delta.scheme != FecScheme::None; }
+};
+
+// dst ^= c * src over GF(2^8), nibble-table SIMD where the target has it (AVX2, SSSE3, NEON)
+void gfMulAddRegion(uint8_t* dst, const uint8_t* src, uint8_t c, std::size_t n);
+
+class FecEncoder {
+public:
+    explicit FecEncoder(const FecConfig& config = FecConfig());
+
+    void setConfig(const FecConfig& config) { this->config = config; }
+    bool enabled() const { return config.enabled(); }
+
+    // Repair fragments for the data fragments of one frame, empty when it is unprotected.
+    // They point into buffers owned here and stay valid until the next call.
+    const std::vector<Fragment>& protect(const std::vector<Fragment>& fragments, bool keyframe);
+
+    uint64_t repairsSent() const { return repairCount; }
+
+private:
+    const uint8_t* source(const std::vector<Fragment>& fragments, std::size_t i, std::size_t stride);
+
+    FecConfig config;
+    std::vector<uint8_t> parity;      // per repair: FEC header + stride
+    std::vector<uint8_t> paddedLast;  // the short last fragment, zero-padded to the stride
+    std::vector<Fragment> repairs;
+    uint64_t repairCount = 0;
+};
+
+/* Receive side: rebuilds the missing fragments of one frame in place.
+   symbols holds fragment i at i * stride and zeros past the frame's end up to count * stride;
+   repairs holds repair j's parity at j * stride. Returns the number of fragments rebuilt
+   and marks them in have. */
+class FecDecoder {
+public:
+    int recover(FecScheme scheme, int rowLength, uint16_t count, std::size_t stride,
+        uint8_t* symbols, uint8_t* have,
+        uint16_t repairCount, const uint8_t* repairs, const uint8_t* repairHave);
+
+private:
+    int recoverXor(int rowLength, uint16_t count, std::size_t stride, uint8_t* symbols, uint8_t* have,
+        uint16_t repairCount, const uint8_t* repairs, const uint8_t* repairHave);
+    int recoverRs(uint16_t count, std::size_t stride, uint8_t* symbols, uint8_t* have,
+        uint16_t repairCount, const uint8_t* repairs, const uint8_t* repairHave);
+
+    std::vector<uint8_t> scratch;
+    std::vector<uint8_t> matrix;
+    std::vector<int> missing;
+    std::vector<int> used;
+};
+
+#endif // FEC_H
@@ -0,0 +1,49 @@
+#include "FrameLog.h"
+#include <iostream>
+
+#include "ByteOrder.h"
+
+static const char c_magic[8] = { 'R', 'X', 'L', 'O', 'G', '0', '0', '1' };
+
+FrameLog::~FrameLog() {
+    close();
+}
+
+bool FrameLog::open(const std::string& path) {
+    // Large buffer: a record per frame must not turn into a write per frame
+    file.rdbuf()->pubsetbuf(buffer, sizeof(buffer));
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Cannot open frame log " << path << "\n";
+        return false;
+    }
+    file.write(c_magic, sizeof(c_magic));
+    return true;
+}
+
+void FrameLog::close() {
+    if (file.is_open()) file.close();
+}
+
+// Microseconds from complete to a later stage, 0 when the stage was not reached
+static uint32_t sinceComplete(const ReceiveTiming& timing, int64_t ns) {
+    if (!ns || !timing.completeNs || ns < timing.completeNs) return 0;
+    int64_t us = (ns - timing.completeNs) / 1000;
+    return us > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(us);
+}
+
+void FrameLog::write(uint32_t frameId, std::size_t size, bool keyframe, const ReceiveTiming& timing) {
+    if (!file.is_open()) return;
+    uint8_t record[c_recordSize];
+    put32(record, frameId);
+    put32(record + 4, static_cast<uint32_t>(size));
+    put64(record + 8, static_cast<uint64_t>(timing.captureMillis));
+    put64(record + 16, static_cast<uint64_t>(timing.completeWallUs));
+    put32(record + 24, sinceComplete(timing, timing.decodeInNs));
+    put32(record + 28, sinceComplete(timing, timing.decodeOutNs));
+    put32(record + 32, sinceComplete(timing, timing.presentInNs));
+    put32(record + 36, sinceComplete(timing, timing.presentOutNs));
+    record[40] = keyframe ? 1 : 0;
+    file.write(reinterpret_cast<const char*>(record), sizeof(record));
+    written++;
+}
@@ -0,0 +1,45 @@
+#ifndef FRAMELOG_H
+#define FRAMELOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "FrameTiming.h"
+
+/* Binary per-frame log of a receiver, for comparing latency distributions offline.
+   8 byte magic "RXLOG001", then one 41 byte record per presented frame, network byte order:
+     0  frame id                      (uint32)
+     4  frame size in bytes           (uint32)
+     8  capture timestamp             (int64, sender system clock in ms, 0 for RTP)
+    16  complete                      (int64, receiver system clock in us)
+    24  decode start, decode end,
+        present start, present end    (uint32 each, us after complete)
+    40  flags                         (bit 0 keyframe)
+   Dropped frames have no record; they show as gaps in the frame ids. */
+class FrameLog {
+public:
+    static const std::size_t c_recordSize = 41;
+
+    FrameLog() = default;
+    ~FrameLog();
+
+    FrameLog(const FrameLog&) = delete;
+    FrameLog& operator=(const FrameLog&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return file.is_open(); }
+
+    void write(uint32_t frameId, std::size_t size, bool keyframe, const ReceiveTiming& timing);
+
+    uint64_t records() const { return written; }
+
+private:
+    std::ofstream file;
+    char buffer[64 * 1024];
+    uint64_t written = 0;
+};
+
+#endif // FRAMELOG_H
@@ -0,0 +1,238 @@
+#include "FramePool.h"
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+static const std::size_t c_planeAlign = 64;
+static const std::size_t c_hugePageSize = 2 * 1024 * 1024;
+
+static std::size_t alignUp(std::size_t value, std::size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+// The arena outlives every AVBufferRef, nothing to free per buffer
+static void noopFree(void*, uint8_t*) {}
+
+FrameRef::FrameRef(const FrameRef& other) : pool(other.pool), slot(other.slot) {
+    if (pool) pool->addRef(slot);
+}
+
+FrameRef::FrameRef(FrameRef&& other) noexcept : pool(other.pool), slot(other.slot) {
+    other.pool = nullptr;
+    other.slot = -1;
+}
+
+FrameRef& FrameRef::operator=(const FrameRef& other) {
+    if (this != &other) {
+        if (other.pool) other.pool->addRef(other.slot);
+        reset();
+        pool = other.pool;
+        slot = other.slot;
+    }
+    return *this;
+}
+
+FrameRef& FrameRef::operator=(FrameRef&& other) noexcept {
+    if (this != &other) {
+        reset();
+        pool = other.pool;
+        slot = other.slot;
+        other.pool = nullptr;
+        other.slot = -1;
+    }
+    return *this;
+}
+
+void FrameRef::reset() {
+    if (pool) pool->release(slot);
+    pool = nullptr;
+    slot = -1;
+}
+
+cv::Mat& FrameRef::bgr() const {
+    return pool->slots[slot].bgr;
+}
+
+AVFrame* FrameRef::yuv() const {
+    return pool->slots[slot].yuv;
+}
+
+void FrameRef::adopt(const cv::Mat& img) const {
+    FramePool::Slot& s = pool->slots[slot];
+    cv::Mat pooled(pool->frameHeight, pool->frameWidth, CV_8UC3, s.bgrData);
+    if (img.data != s.bgrData) {
+        if (img.size() == pooled.size() && img.type() == pooled.type()) {
+            img.copyTo(pooled);
+        }
+        else if (!img.empty()) {
+            cv::resize(img, pooled, pooled.size());
+        }
+    }
+    s.bgr = pooled;
+}
+
+FramePool::FramePool(int width, int height, int count, bool hugePages)
+    : frameWidth(width), frameHeight(height), slotCount(count) {
+    if (slotCount > c_maxSlots) slotCount = c_maxSlots;
+
+    int yuvLinesize[4];
+    av_image_fill_linesizes(yuvLinesize, AV_PIX_FMT_YUV420P, static_cast<int>(alignUp(width, c_planeAlign)));
+    std::size_t bgrSize = alignUp(static_cast<std::size_t>(width) * height * 3, c_planeAlign);
+    std::size_t ySize = alignUp(static_cast<std::size_t>(yuvLinesize[0]) * height, c_planeAlign);
+    std::size_t uvSize = alignUp(static_cast<std::size_t>(yuvLinesize[1]) * ((height + 1) / 2), c_planeAlign);
+    std::size_t yuvSize = ySize + 2 * uvSize;
+    std::size_t slotSize = bgrSize + yuvSize;
+
+    arena = allocateArena(slotSize * slotCount, hugePages);
+    if (!arena) {
+        std::cerr << "Could not allocate frame pool\n";
+        return;
+    }
+    // Fault every page in now rather than on the first frames
+    memset(arena, 0, arenaSize);
+
+    slots.reset(new Slot[slotCount]);
+    for (int i = 0; i < slotCount; ++i) {
+        Slot& s = slots[i];
+        uint8_t* base = static_cast<uint8_t*>(arena) + slotSize * i;
+        s.bgrData = base;
+        s.bgr = cv::Mat(height, width, CV_8UC3, s.bgrData);
+
+        uint8_t* yuvData = base + bgrSize;
+        s.yuvBuf = av_buffer_create(yuvData, yuvSize, noopFree, nullptr, 0);
+        s.yuv = av_frame_alloc();
+        if (!s.yuvBuf || !s.yuv) {
+            std::cerr << "Could not allocate pooled frame\n";
+            freeArena();
+            return;
+        }
+        s.yuv->format = AV_PIX_FMT_YUV420P;
+        s.yuv->width = width;
+        s.yuv->height = height;
+        s.yuv->data[0] = yuvData;
+        s.yuv->data[1] = yuvData + ySize;
+        s.yuv->data[2] = yuvData + ySize + uvSize;
+        s.yuv->linesize[0] = yuvLinesize[0];
+        s.yuv->linesize[1] = yuvLinesize[1];
+        s.yuv->linesize[2] = yuvLinesize[2];
+        // Refcounted, so avcodec_send_frame takes a reference instead of copying
+        s.yuv->buf[0] = av_buffer_ref(s.yuvBuf);
+    }
+}
+
+FramePool::~FramePool() {
+    freeArena();
+}
+
+bool FramePool::isFree(Slot& slot) const {
+    // One ref held by the pool, one by the slot's AVFrame; more means the encoder still has it
+    return slot.refs.load(std::memory_order_acquire) == 0 && av_buffer_get_ref_count(slot.yuvBuf) <= 2;
+}
+
+FrameRef FramePool::acquire() {
+    if (!arena) return FrameRef();
+
+    for (int n = 0; n < slotCount; ++n) {
+        int i = (cursor + n) % slotCount;
+        Slot& s = slots[i];
+        int expected = 0;
+        if (isFree(s) && s.refs.compare_exchange_strong(expected, 1, std::memory_order_acq_rel)) {
+            cursor = (i + 1) % slotCount;
+            // A failed or resized capture may have left the header pointing elsewhere
+            s.bgr = cv::Mat(frameHeight, frameWidth, CV_8UC3, s.bgrData);
+            return FrameRef(this, i);
+        }
+    }
+    exhausted.fetch_add(1, std::memory_order_relaxed);
+    return FrameRef();
+}
+
+int FramePool::available() const {
+    int count = 0;
+    for (int i = 0; i < slotCount; ++i) {
+        if (isFree(slots[i])) count++;
+    }
+    return count;
+}
+
+void FramePool::addRef(int index) {
+    slots[index].refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FramePool::release(int index) {
+    slots[index].refs.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void* FramePool::allocateArena(std::size_t size, bool hugePages) {
+    void* p = nullptr;
+#ifdef _WIN32
+    if (hugePages) {
+        // Needs SeLockMemoryPrivilege; fall back to normal pages without it
+        SIZE_T large = GetLargePageMinimum();
+        if (large) {
+            std::size_t largeSize = alignUp(size, large);
+            p = VirtualAlloc(nullptr, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (p) {
+                arenaSize = largeSize;
+                hugePagesActive = true;
+            }
+        }
+    }
+    if (!p) {
+        p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        arenaSize = size;
+    }
+#else
+    if (hugePages) {
+        std::size_t hugeSize = alignUp(size, c_hugePageSize);
+        p = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            p = nullptr;
+        }
+        else {
+            arenaSize = hugeSize;
+            hugePagesActive = true;
+        }
+    }
+    if (!p) {
+        arenaSize = alignUp(size, c_hugePageSize);
+        p = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+        // No reserved hugetlb pages: ask for transparent huge pages instead
+        if (hugePages) madvise(p, arenaSize, MADV_HUGEPAGE);
+#endif
+    }
+#endif
+    return p;
+}
+
+void FramePool::freeArena() {
+    if (slots) {
+        for (int i = 0; i < slotCount; ++i) {
+            if (slots[i].yuv) av_frame_free(&slots[i].yuv);
+            if (slots[i].yuvBuf) av_buffer_unref(&slots[i].yuvBuf);
+        }
+        slots.reset();
+    }
+    if (arena) {
+#ifdef _WIN32
+        VirtualFree(arena, 0, MEM_RELEASE);
+#else
+        munmap(arena, arenaSize);
+#endif
+        arena = nullptr;
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <opencv2/opencv.hpp>
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/buffer.h>
+}
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+class FramePool;
+
+// Reference-counted handle to one pooled slot; the slot returns to the pool with its last handle
+class FrameRef {
+public:
+    FrameRef() : pool(nullptr), slot(-1) {}
+    FrameRef(const FrameRef& other);
+    FrameRef(FrameRef&& other) noexcept;
+    FrameRef& operator=(const FrameRef& other);
+    FrameRef& operator=(FrameRef&& other) noexcept;
+    ~FrameRef() { reset(); }
+
+    explicit operator bool() const { return pool != nullptr; }
+    void reset();
+
+    // BGR24 image for capture and drawing, YUV420P frame for conversion and encoding
+    cv::Mat& bgr() const;
+    AVFrame* yuv() const;
+    int index() const { return slot; }
+
+    // Points bgr() back at the pooled memory, resizing img into it if the source
+    // handed back a differently sized image
+    void adopt(const cv::Mat& img) const;
+
+private:
+    friend class FramePool;
+    FrameRef(FramePool* pool, int slot) : pool(pool), slot(slot) {}
+
+    FramePool* pool;
+    int slot;
+};
+
+/* Fixed set of frame buffers shared by the capture, conversion and encode stages.
+   Everything is carved out of one arena allocated (and pre-faulted) up front, optionally
+   backed by huge pages, so steady-state streaming does no per-frame heap allocation. */
+class FramePool {
+public:
+    static const int c_maxSlots = 64;
+
+    FramePool(int width, int height, int count, bool hugePages = false);
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    bool valid() const { return arena != nullptr; }
+
+    // Returns an empty handle when every slot is still in use
+    FrameRef acquire();
+
+    int width() const { return frameWidth; }
+    int height() const { return frameHeight; }
+    int capacity() const { return slotCount; }
+    int available() const;
+    bool usingHugePages() const { return hugePagesActive; }
+    uint64_t exhaustedCount() const { return exhausted.load(std::memory_order_relaxed); }
+
+private:
+    friend class FrameRef;
+
+    struct Slot {
+        std::atomic<int> refs{ 0 };
+        uint8_t* bgrData = nullptr;
+        cv::Mat bgr;
+        AVFrame* yuv = nullptr;
+        AVBufferRef* yuvBuf = nullptr;  // pool-owned; the encoder holding a frame shows up as extra refs
+    };
+
+    bool isFree(Slot& slot) const;
+    void addRef(int index);
+    void release(int index);
+
+    void* allocateArena(std::size_t size, bool hugePages);
+    void freeArena();
+
+    int frameWidth;
+    int frameHeight;
+    int slotCount;
+    std::unique_ptr<Slot[]> slots;
+    int cursor = 0;
+    std::atomic<uint64_t> exhausted{ 0 };
+
+    void* arena = nullptr;
+    std::size_t arenaSize = 0;
+    bool hugePagesActive = false;
+};
+
+#endif // FRAMEPOOL_H
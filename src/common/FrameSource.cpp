@@ -0,0 +1,283 @@
+#include "FrameSource.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+static const double c_defaultFps = 30.0;
+
+static std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    std::size_t start = 0;
+    while (true) {
+        std::size_t end = text.find(separator, start);
+        parts.push_back(text.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos) break;
+        start = end + 1;
+    }
+    return parts;
+}
+
+bool FrameSourceConfig::parse(const std::string& spec) {
+    std::vector<std::string> parts = split(spec, ',');
+    const std::string& head = parts[0];
+    std::size_t colon = head.find(':');
+    std::string kindName = head.substr(0, colon);
+    std::string arg = colon == std::string::npos ? "" : head.substr(colon + 1);
+
+    if (kindName == "camera") {
+        kind = FrameSourceKind::Camera;
+        if (!arg.empty()) device = atoi(arg.c_str());
+    }
+    else if (kindName == "pattern") {
+        kind = FrameSourceKind::Pattern;
+    }
+    else if ((kindName == "y4m" || kindName == "yuv") && !arg.empty()) {
+        kind = kindName == "y4m" ? FrameSourceKind::Y4m : FrameSourceKind::RawYuv;
+        path = arg;
+    }
+    else {
+        std::cerr << "Unknown frame source: " << spec << "\n";
+        return false;
+    }
+
+    for (std::size_t i = 1; i < parts.size(); ++i) {
+        const std::string& option = parts[i];
+        if (option == "loop") loop = true;
+        else if (option == "fps=max") fps = 0.0;
+        else if (option.compare(0, 4, "fps=") == 0) fps = atof(option.c_str() + 4);
+        else if (option.compare(0, 7, "frames=") == 0) frameLimit = atoll(option.c_str() + 7);
+        else {
+            std::cerr << "Unknown frame source option: " << option << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<FrameSource> FrameSource::create(const FrameSourceConfig& config) {
+    std::unique_ptr<FrameSource> source;
+    switch (config.kind) {
+    case FrameSourceKind::Camera: source.reset(new CameraSource(config)); break;
+    case FrameSourceKind::Y4m:
+    case FrameSourceKind::RawYuv: source.reset(new YuvFileSource(config)); break;
+    case FrameSourceKind::Pattern: source.reset(new PatternSource(config)); break;
+    }
+    if (!source || !source->open()) return nullptr;
+    std::cout << "Frame source: " << source->name() << " " << source->width() << "x" << source->height();
+    if (source->paced()) std::cout << " @ " << source->fps() << " fps";
+    std::cout << std::endl;
+    return source;
+}
+
+FrameSource::FrameSource(const FrameSourceConfig& config, const char* sourceName)
+    : config(config), frameWidth(config.width), frameHeight(config.height),
+      frameRate(config.fps < 0.0 ? c_defaultFps : config.fps), sourceName(sourceName) {
+}
+
+bool FrameSource::next() {
+    if (config.frameLimit && frameCount >= config.frameLimit) return false;
+    if (!paced()) return true;
+
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / frameRate));
+    auto now = std::chrono::steady_clock::now();
+    if (!started) {
+        nextDue = now;
+        started = true;
+    }
+    if (nextDue > now) {
+        std::this_thread::sleep_until(nextDue);
+    }
+    else if (now - nextDue > period) {
+        // Fell behind (the consumer stalled): carry on from now instead of bursting to catch up
+        nextDue = now;
+    }
+    nextDue += period;
+    return true;
+}
+
+bool FrameSource::read(cv::Mat& frame) {
+    if (!next() || !readFrame(frame)) return false;
+    frameCount++;
+    return true;
+}
+
+bool FrameSource::skip() {
+    if (!next() || !skipFrame()) return false;
+    frameCount++;
+    return true;
+}
+
+bool CameraSource::open() {
+#ifdef __linux__
+    cap.open(config.device, cv::CAP_V4L2);
+    if (!cap.isOpened()) cap.open(config.device);
+#else
+    cap.open(config.device);
+#endif
+    if (!cap.isOpened()) {
+        std::cerr << "Cannot open the video camera.\n";
+        return false;
+    }
+    cap.set(cv::CAP_PROP_FRAME_WIDTH, config.width);
+    cap.set(cv::CAP_PROP_FRAME_HEIGHT, config.height);
+    if (config.fps > 0.0) cap.set(cv::CAP_PROP_FPS, config.fps);
+    // Keep at most one frame queued in the driver, so every read gets the newest one
+    cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
+
+    frameWidth = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
+    frameHeight = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+    double deviceFps = cap.get(cv::CAP_PROP_FPS);
+    if (deviceFps > 0.0) frameRate = deviceFps;
+    return true;
+}
+
+bool CameraSource::readFrame(cv::Mat& frame) {
+    cap >> frame;
+    return !frame.empty();
+}
+
+YuvFileSource::YuvFileSource(const FrameSourceConfig& config)
+    : FrameSource(config, config.kind == FrameSourceKind::Y4m ? "y4m" : "yuv") {
+}
+
+YuvFileSource::~YuvFileSource() {
+    if (file) fclose(file);
+}
+
+bool YuvFileSource::parseStreamHeader() {
+    char line[512];
+    if (!fgets(line, sizeof(line), file) || strncmp(line, "YUV4MPEG2 ", 10) != 0) {
+        std::cerr << "Not a Y4M file: " << config.path << "\n";
+        return false;
+    }
+    line[strcspn(line, "\n")] = '\0';
+
+    for (const std::string& token : split(line + 10, ' ')) {
+        if (token.empty()) continue;
+        switch (token[0]) {
+        case 'W': frameWidth = atoi(token.c_str() + 1); break;
+        case 'H': frameHeight = atoi(token.c_str() + 1); break;
+        case 'F': {
+            int num = 0, den = 0;
+            if (config.fps < 0.0 && sscanf(token.c_str() + 1, "%d:%d", &num, &den) == 2 && num > 0 && den > 0) {
+                frameRate = static_cast<double>(num) / den;
+            }
+            break;
+        }
+        case 'C': {
+            // 8-bit 4:2:0 only; the chroma siting variants share the layout, C420p10 and up do not
+            std::string colourspace = token.substr(1);
+            if (colourspace != "420" && colourspace != "420jpeg" && colourspace != "420paldv" && colourspace != "420mpeg2") {
+                std::cerr << "Only 8-bit 4:2:0 Y4M is supported, got colourspace " << colourspace << "\n";
+                return false;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+bool YuvFileSource::open() {
+    file = fopen(config.path.c_str(), "rb");
+    if (!file) {
+        std::cerr << "Cannot open " << config.path << "\n";
+        return false;
+    }
+    if (config.kind == FrameSourceKind::Y4m && !parseStreamHeader()) return false;
+    if (frameWidth <= 0 || frameHeight <= 0 || frameWidth % 2 || frameHeight % 2) {
+        std::cerr << "Unsupported frame size " << frameWidth << "x" << frameHeight << "\n";
+        return false;
+    }
+    dataStart = ftell(file);
+    frameBytes = static_cast<std::size_t>(frameWidth) * frameHeight * 3 / 2;
+    i420.create(frameHeight * 3 / 2, frameWidth, CV_8UC1);
+    return true;
+}
+
+bool YuvFileSource::rewind() {
+    return config.loop && fseek(file, dataStart, SEEK_SET) == 0;
+}
+
+bool YuvFileSource::nextFrame(bool decode, cv::Mat* frame) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (config.kind == FrameSourceKind::Y4m) {
+            char marker[256];
+            if (!fgets(marker, sizeof(marker), file)) {
+                if (!rewind()) return false;
+                continue;
+            }
+            if (strncmp(marker, "FRAME", 5) != 0) {
+                std::cerr << "Corrupt Y4M frame header in " << config.path << "\n";
+                return false;
+            }
+        }
+        bool ok = decode ? fread(i420.data, 1, frameBytes, file) == frameBytes
+                         : fseek(file, static_cast<long>(frameBytes), SEEK_CUR) == 0;
+        if (!ok) {
+            if (!rewind()) return false;
+            continue;
+        }
+        if (decode) cv::cvtColor(i420, *frame, cv::COLOR_YUV2BGR_I420);
+        return true;
+    }
+    return false;
+}
+
+bool YuvFileSource::readFrame(cv::Mat& frame) {
+    return nextFrame(true, &frame);
+}
+
+bool YuvFileSource::skipFrame() {
+    return nextFrame(false, nullptr);
+}
+
+bool PatternSource::open() {
+    static const cv::Vec3b palette[8] = {
+        cv::Vec3b(255, 255, 255), cv::Vec3b(0, 255, 255), cv::Vec3b(255, 255, 0), cv::Vec3b(0, 255, 0),
+        cv::Vec3b(255, 0, 255), cv::Vec3b(0, 0, 255), cv::Vec3b(255, 0, 0), cv::Vec3b(16, 16, 16)
+    };
+    if (frameWidth <= 0 || frameHeight <= 0) return false;
+
+    // Bars darken towards the bottom, so the encoder sees gradients and not just flat colour
+    bars.create(frameHeight, frameWidth * 2, CV_8UC3);
+    for (int y = 0; y < frameHeight; ++y) {
+        double shade = 0.4 + 0.6 * (frameHeight - y) / frameHeight;
+        cv::Vec3b* row = bars.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < frameWidth * 2; ++x) {
+            const cv::Vec3b& c = palette[(x * 8 / frameWidth) % 8];
+            row[x] = cv::Vec3b(static_cast<uchar>(c[0] * shade), static_cast<uchar>(c[1] * shade),
+                static_cast<uchar>(c[2] * shade));
+        }
+    }
+    return true;
+}
+
+bool PatternSource::readFrame(cv::Mat& frame) {
+    frame.create(frameHeight, frameWidth, CV_8UC3);
+    int shift = static_cast<int>((index * 4) % frameWidth);
+    bars(cv::Rect(shift, 0, frameWidth, frameHeight)).copyTo(frame);
+
+    // A box bouncing across the frame gives the encoder real motion to search
+    int box = std::max(8, frameHeight / 8);
+    int spanX = std::max(1, frameWidth - box), spanY = std::max(1, frameHeight - box);
+    int x = static_cast<int>((index * 7) % (2 * spanX));
+    int y = static_cast<int>((index * 5) % (2 * spanY));
+    if (x >= spanX) x = 2 * spanX - x;
+    if (y >= spanY) y = 2 * spanY - y;
+    cv::rectangle(frame, cv::Rect(x, y, box, box), cv::Scalar(32, 128, 240), cv::FILLED);
+
+    // Frame index as 16 black/white cells along the top, readable after decoding
+    int cell = std::max(4, frameWidth / 64);
+    for (int bit = 0; bit < 16; ++bit) {
+        cv::Scalar colour = (index >> (15 - bit)) & 1 ? cv::Scalar(255, 255, 255) : cv::Scalar(0, 0, 0);
+        cv::rectangle(frame, cv::Rect(bit * cell, 0, cell, cell), colour, cv::FILLED);
+    }
+    index++;
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class FrameSourceKind {
+    Camera,   // V4L2 on Linux, the default OpenCV backend elsewhere
+    Y4m,      // YUV4MPEG2 file, 4:2:0
+    RawYuv,   // headerless I420 file, frame size taken from the config
+    Pattern   // synthetic moving pattern, no device or file needed
+};
+
+struct FrameSourceConfig {
+    FrameSourceKind kind = FrameSourceKind::Camera;
+    int device = 0;
+    std::string path;
+    int width = 640;
+    int height = 480;
+    double fps = -1.0;     // -1: the source's own rate (camera, Y4M header, else 30); 0: as fast as possible
+    bool loop = false;     // rewind files at the end instead of stopping
+    int64_t frameLimit = 0;  // stop after this many frames, 0 = no limit
+
+    /* "camera[:index]", "pattern", "y4m:PATH" or "yuv:PATH", optionally followed by
+       ",fps=N", ",fps=max", ",loop" and ",frames=N". Fields not given keep the values
+       already set, so callers preset the resolution they encode at. */
+    bool parse(const std::string& spec);
+};
+
+/* Where senders get their BGR frames from. Files and the pattern generator let the
+   whole pipeline run reproducibly without a camera attached. */
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    static std::unique_ptr<FrameSource> create(const FrameSourceConfig& config);
+
+    // Blocks until the next frame is due; false at the end of the source or on failure
+    bool read(cv::Mat& frame);
+    // Consumes the next frame without decoding it where the source allows that
+    bool skip();
+
+    int width() const { return frameWidth; }
+    int height() const { return frameHeight; }
+    double fps() const { return frameRate; }
+    int64_t framesRead() const { return frameCount; }
+    const char* name() const { return sourceName; }
+
+protected:
+    FrameSource(const FrameSourceConfig& config, const char* sourceName);
+
+    virtual bool open() = 0;
+    virtual bool readFrame(cv::Mat& frame) = 0;
+    virtual bool skipFrame() { cv::Mat discard; return readFrame(discard); }
+    // Sources that are paced by their hardware return false
+    virtual bool paced() const { return frameRate > 0.0; }
+
+    FrameSourceConfig config;
+    int frameWidth;
+    int frameHeight;
+    double frameRate;
+
+private:
+    bool next();
+
+    const char* sourceName;
+    int64_t frameCount = 0;
+    std::chrono::steady_clock::time_point nextDue;
+    bool started = false;
+};
+
+class CameraSource : public FrameSource {
+public:
+    explicit CameraSource(const FrameSourceConfig& config) : FrameSource(config, "camera") {}
+
+protected:
+    bool open() override;
+    bool readFrame(cv::Mat& frame) override;
+    bool skipFrame() override { return cap.grab(); }
+    bool paced() const override { return false; }
+
+private:
+    cv::VideoCapture cap;
+};
+
+// Y4M and raw I420 files share everything but the headers
+class YuvFileSource : public FrameSource {
+public:
+    explicit YuvFileSource(const FrameSourceConfig& config);
+    ~YuvFileSource() override;
+
+protected:
+    bool open() override;
+    bool readFrame(cv::Mat& frame) override;
+    bool skipFrame() override;
+
+private:
+    bool parseStreamHeader();
+    bool nextFrame(bool decode, cv::Mat* frame);
+    bool rewind();
+
+    FILE* file = nullptr;
+    long dataStart = 0;
+    std::size_t frameBytes = 0;
+    cv::Mat i420;  // reused read buffer
+};
+
+class PatternSource : public FrameSource {
+public:
+    explicit PatternSource(const FrameSourceConfig& config) : FrameSource(config, "pattern") {}
+
+protected:
+    bool open() override;
+    bool readFrame(cv::Mat& frame) override;
+
+private:
+    cv::Mat bars;  // colour bars twice the frame width, scrolled one step per frame
+    int64_t index = 0;
+};
+
+#endif // FRAMESOURCE_H
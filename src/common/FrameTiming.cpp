@@ -0,0 +1,81 @@
+#include "FrameTiming.h"
+#include <iomanip>
+
+static void recordStage(LatencyHistogram& histogram, int64_t from, int64_t to) {
+    if (from && to) histogram.record(to - from);
+}
+
+// p50/p99/p99.9 table, one row per stage that has samples
+static void dumpStages(std::ostream& out, const LatencyHistogram* stages, int count, const char* (*name)(int)) {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << "stage           count     p50 ms     p99 ms   p99.9 ms     max ms\n";
+    for (int i = 0; i < count; ++i) {
+        const LatencyHistogram& h = stages[i];
+        if (h.count() == 0) continue;
+        out << std::left << std::setw(14) << name(i) << std::right
+            << std::setw(7) << h.count()
+            << std::setw(11) << h.percentile(50.0) / 1e6
+            << std::setw(11) << h.percentile(99.0) / 1e6
+            << std::setw(11) << h.percentile(99.9) / 1e6
+            << std::setw(11) << h.max() / 1e6 << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+const char* PipelineLatency::stageName(Stage stage) {
+    switch (stage) {
+    case Convert: return "convert";
+    case EncodeQueue: return "encode queue";
+    case Encode: return "encode";
+    case Send: return "send";
+    case Total: return "total";
+    default: return "?";
+    }
+}
+
+void PipelineLatency::record(const FrameTiming& timing) {
+    recordStage(stages[Convert], timing.captureNs, timing.convertNs);
+    recordStage(stages[EncodeQueue], timing.convertNs, timing.encodeInNs);
+    recordStage(stages[Encode], timing.encodeInNs, timing.encodeOutNs);
+    recordStage(stages[Send], timing.encodeOutNs, timing.sendNs);
+    recordStage(stages[Total], timing.captureNs, timing.sendNs);
+}
+
+void PipelineLatency::dump(std::ostream& out) const {
+    dumpStages(out, stages, StageCount, [](int i) { return stageName(static_cast<Stage>(i)); });
+}
+
+const char* ReceiveLatency::stageName(Stage stage) {
+    switch (stage) {
+    case DecodeQueue: return "decode queue";
+    case Decode: return "decode";
+    case PresentQueue: return "present queue";
+    case Present: return "present";
+    case Total: return "total";
+    case Network: return "network";
+    case EndToEnd: return "end to end";
+    default: return "?";
+    }
+}
+
+void ReceiveLatency::record(const ReceiveTiming& timing) {
+    if (timing.captureMillis && timing.completeWallUs) {
+        // Negative values (clocks out of step) end up in the lowest bucket
+        int64_t captureUs = timing.captureLocalUs ? timing.captureLocalUs : timing.captureMillis * 1000;
+        int64_t network = (timing.completeWallUs - captureUs) * 1000;
+        stages[Network].record(network);
+        if (timing.presentOutNs) stages[EndToEnd].record(network + timing.presentOutNs - timing.completeNs);
+    }
+    recordStage(stages[DecodeQueue], timing.completeNs, timing.decodeInNs);
+    recordStage(stages[Decode], timing.decodeInNs, timing.decodeOutNs);
+    recordStage(stages[PresentQueue], timing.decodeOutNs, timing.presentInNs);
+    recordStage(stages[Present], timing.presentInNs, timing.presentOutNs);
+    recordStage(stages[Total], timing.completeNs, timing.presentOutNs);
+}
+
+void ReceiveLatency::dump(std::ostream& out) const {
+    dumpStages(out, stages, StageCount, [](int i) { return stageName(static_cast<Stage>(i)); });
+}
@@ -0,0 +1,110 @@
+#ifndef FRAMETIMING_H
+#define FRAMETIMING_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "LatencyHistogram.h"
+
+inline int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline int64_t wallClockMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+inline int64_t wallClockMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/* Lifecycle of one frame on the sender, in steady-clock nanoseconds (0 = not reached).
+   Travels with the frame through the queues and the encoder to its packet, so stage
+   latencies stay correct however many frames the encoder buffers or drops. */
+struct FrameTiming {
+    int64_t captureMillis = 0;  // system clock at capture, the timestamp put on the wire
+    int64_t captureNs = 0;
+    int64_t convertNs = 0;      // BGR -> YUV420P done
+    int64_t encodeInNs = 0;     // handed to the encoder
+    int64_t encodeOutNs = 0;    // packet out of the encoder
+    int64_t sendNs = 0;         // last datagram handed to the kernel
+
+    static FrameTiming captured() {
+        FrameTiming timing;
+        timing.captureMillis = wallClockMillis();
+        timing.captureNs = steadyNowNs();
+        return timing;
+    }
+};
+
+// One histogram per pipeline stage, fed from FrameTiming records
+class PipelineLatency {
+public:
+    enum Stage {
+        Convert,      // capture -> converted, includes waiting in the frame queue
+        EncodeQueue,  // converted -> encoder input
+        Encode,       // encoder input -> packet
+        Send,         // packet -> on the wire, includes waiting in the packet queue
+        Total,        // capture -> on the wire
+        StageCount
+    };
+
+    static const char* stageName(Stage stage);
+
+    // Records every stage whose two timestamps are set
+    void record(const FrameTiming& timing);
+
+    const LatencyHistogram& histogram(Stage stage) const { return stages[stage]; }
+
+    // p50/p99/p99.9 per stage; safe to call while other threads record
+    void dump(std::ostream& out) const;
+
+private:
+    LatencyHistogram stages[StageCount];
+};
+
+/* Lifecycle of one frame on the receiver, steady-clock nanoseconds (0 = not reached).
+   Starts when the last fragment completes the frame. The system clock fields tie it to
+   the sender's capture timestamp; comparing them needs synchronised clocks, or the
+   capture time mapped onto the receiver's clock by a clock estimate (ClockSync.h). */
+struct ReceiveTiming {
+    int64_t captureMillis = 0;   // sender's system clock at capture, 0 for media time (RTP)
+    int64_t captureLocalUs = 0;  // the same on the receiver's clock, 0 while the sender's clock is unknown
+    int64_t completeWallUs = 0;  // receiver's system clock at completeNs
+    int64_t completeNs = 0;      // reassembled on the network thread
+    int64_t decodeInNs = 0;      // taken by the decode thread
+    int64_t decodeOutNs = 0;     // decoded and converted to BGR
+    int64_t presentInNs = 0;     // taken by the presentation thread
+    int64_t presentOutNs = 0;    // imshow done
+};
+
+class ReceiveLatency {
+public:
+    enum Stage {
+        DecodeQueue,   // complete -> decoder, includes jitter buffer hold and queueing
+        Decode,        // decode and colour conversion
+        PresentQueue,  // decoded -> presentation thread
+        Present,       // imshow
+        Total,         // complete -> shown
+        Network,       // capture -> complete, across both system clocks
+        EndToEnd,      // capture -> shown
+        StageCount
+    };
+
+    static const char* stageName(Stage stage);
+
+    void record(const ReceiveTiming& timing);
+
+    const LatencyHistogram& histogram(Stage stage) const { return stages[stage]; }
+
+    void dump(std::ostream& out) const;
+
+private:
+    LatencyHistogram stages[StageCount];
+};
+
+#endif // FRAMETIMING_H
@@ -0,0 +1,149 @@
+#include "HapticBundling.h"
+#include <algorithm>
+#include <iomanip>
+
+#include "ByteOrder.h"
+
+// A larger bundle needs a few reports before its effect on the queue shows
+static const int64_t c_increaseIntervalNs = 200000000;
+
+std::size_t HapticFeedback::write(uint8_t* out) const {
+    out[0] = c_hapticFeedbackMagic;
+    out[1] = streamId;
+    put16(out + 2, received);
+    put16(out + 4, expected);
+    put16(out + 6, meanQueueUs);
+    put16(out + 8, maxQueueUs);
+    put32(out + 10, highest);
+    return c_hapticFeedbackSize;
+}
+
+bool HapticFeedback::read(const uint8_t* in, std::size_t len) {
+    if (len < c_hapticFeedbackSize || in[0] != c_hapticFeedbackMagic) return false;
+    streamId = in[1];
+    received = get16(in + 2);
+    expected = get16(in + 4);
+    meanQueueUs = get16(in + 6);
+    maxQueueUs = get16(in + 8);
+    highest = get32(in + 10);
+    return true;
+}
+
+HapticFeedbackReporter::HapticFeedbackReporter(int intervalMs) : intervalUs(intervalMs * 1000LL) {
+}
+
+void HapticFeedbackReporter::onPacket(const HapticPacket& packet, int64_t arrivalUs) {
+    if (packet.count < 1) return;
+    const HapticSample& last = packet.samples[packet.count - 1];
+    if (!started) {
+        started = true;
+        report.streamId = packet.streamId;
+        reportedThrough = packet.samples[0].sequence - 1;
+        report.highest = reportedThrough;
+        lastReportUs = arrivalUs;
+    }
+    sparse = packet.deadband();
+    received += packet.count;
+    if (seqNewer(last.sequence, report.highest)) report.highest = last.sequence;
+
+    // Smallest transit per second of arrival time, over the last c_baseWindows seconds
+    int64_t transitUs = arrivalUs - last.captureUs;
+    int64_t window = arrivalUs / 1000000;
+    if (baseWindow < 0 || window - baseWindow >= c_baseWindows) {
+        std::fill(baseTransitUs, baseTransitUs + c_baseWindows, transitUs);
+    }
+    else {
+        for (int64_t w = baseWindow + 1; w <= window; ++w) baseTransitUs[w % c_baseWindows] = transitUs;
+    }
+    if (window >= baseWindow) {
+        baseWindow = window;
+        int64_t& current = baseTransitUs[window % c_baseWindows];
+        current = std::min(current, transitUs);
+    }
+    int64_t baseUs = *std::min_element(baseTransitUs, baseTransitUs + c_baseWindows);
+
+    int64_t queueUs = transitUs - baseUs;
+    queueSumUs += queueUs;
+    queueMaxUs = std::max(queueMaxUs, queueUs);
+    datagrams++;
+}
+
+std::size_t HapticFeedbackReporter::takeReport(int64_t nowUs, uint8_t* out) {
+    if (!started || nowUs - lastReportUs < intervalUs) return 0;
+    uint32_t expected = report.highest - reportedThrough;
+    report.received = static_cast<uint16_t>(std::min<uint32_t>(received, 0xFFFF));
+    report.expected = sparse ? 0 : static_cast<uint16_t>(std::min<uint32_t>(expected, 0xFFFF));
+    int64_t meanUs = datagrams ? queueSumUs / datagrams : 0;
+    report.meanQueueUs = static_cast<uint16_t>(std::min<int64_t>(meanUs, 0xFFFF));
+    report.maxQueueUs = static_cast<uint16_t>(std::min<int64_t>(queueMaxUs, 0xFFFF));
+
+    reportedThrough = report.highest;
+    received = 0;
+    queueSumUs = 0;
+    queueMaxUs = 0;
+    datagrams = 0;
+    lastReportUs = nowUs;
+    return report.write(out);
+}
+
+BundleController::BundleController(const BundleConfig& config) : config(config) {
+    int periodUs = 1000000 / config.rateHz;
+    limit = std::min(config.maxSamples, c_maxHapticBundle);
+    limit = static_cast<int>(std::min<int64_t>(limit, 1 + capUs() / periodUs));
+    limit = std::max(limit, 1);
+}
+
+bool BundleController::onFeedback(const uint8_t* data, std::size_t len, int64_t nowNs) {
+    HapticFeedback report;
+    if (!report.read(data, len)) return false;
+    counters.reports++;
+    double loss = 0.0;
+    if (report.expected > report.received) loss = double(report.expected - report.received) / report.expected;
+    counters.lastQueueUs = report.meanQueueUs;
+    counters.lastLoss = loss;
+
+    bool congested = report.meanQueueUs > config.queueThresholdUs || loss > config.lossThreshold;
+    int previous = size;
+    int64_t calmNs = config.calmMs * 1000000LL;
+    if (congested) {
+        counters.congested++;
+        lastCongestedNs = nowNs;
+        if (size < limit && nowNs - lastIncreaseNs >= c_increaseIntervalNs) {
+            size = std::min(size * 2, limit);
+            counters.increases++;
+            lastIncreaseNs = nowNs;
+        }
+    }
+    else if (size > 1 && report.meanQueueUs < config.queueThresholdUs / 2
+             && nowNs - lastCongestedNs >= calmNs && nowNs - lastDecreaseNs >= calmNs) {
+        size--;
+        counters.decreases++;
+        lastDecreaseNs = nowNs;
+    }
+    return size != previous;
+}
+
+void BundleController::onSent(int samples) {
+    sizes[std::min(samples, c_maxHapticBundle)]++;
+    counters.datagrams++;
+    counters.samples += samples;
+}
+
+void BundleController::dump(std::ostream& out) const {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    out << "Bundling: size " << size << " of " << limit << ", "
+        << (counters.datagrams ? double(counters.samples) / counters.datagrams : 0.0) << " samples per datagram, "
+        << counters.reports << " reports (" << counters.congested << " congested), "
+        << counters.increases << " up, " << counters.decreases << " down, last queueing "
+        << std::setprecision(0) << counters.lastQueueUs << " us, loss " << std::setprecision(1)
+        << counters.lastLoss * 100.0 << "%\n";
+    out << "Bundle sizes:";
+    for (int i = 1; i <= c_maxHapticBundle; ++i) {
+        if (sizes[i]) out << " " << i << ":" << sizes[i];
+    }
+    out << "\n";
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,114 @@
+#ifndef HAPTICBUNDLING_H
+#define HAPTICBUNDLING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "HapticTransport.h"
+
+/* Haptic receiver -> sender feedback datagram (network byte order, 14 bytes), sent back
+   to the address the samples came from:
+     0  magic 0xF9
+     1  stream id
+     2  samples received      (uint16, in the interval)
+     4  samples expected      (uint16, 0 for a deadband coded stream: gaps are not losses)
+     6  mean queueing delay   (uint16, microseconds)
+     8  max queueing delay    (uint16, microseconds)
+    10  highest sequence      (uint32)
+   Queueing delay is a datagram's transit above the smallest transit of the last seconds,
+   so the offset between the two clocks drops out. */
+const uint8_t c_hapticFeedbackMagic = 0xF9;
+const std::size_t c_hapticFeedbackSize = 14;
+
+struct HapticFeedback {
+    uint8_t streamId = 0;
+    uint16_t received = 0;
+    uint16_t expected = 0;
+    uint16_t meanQueueUs = 0;
+    uint16_t maxQueueUs = 0;
+    uint32_t highest = 0;
+
+    std::size_t write(uint8_t* out) const;
+    bool read(const uint8_t* in, std::size_t len);
+};
+
+/* Receiver side: notes every haptic datagram and every interval turns what it saw into
+   a HapticFeedback. A bundle's queueing delay is taken from its last sample, the one
+   that did not wait at the sender. */
+class HapticFeedbackReporter {
+public:
+    explicit HapticFeedbackReporter(int intervalMs = 50);
+
+    void onPacket(const HapticPacket& packet, int64_t arrivalUs);
+
+    // Serializes a report into out (c_hapticFeedbackSize bytes) when one is due, else returns 0
+    std::size_t takeReport(int64_t nowUs, uint8_t* out);
+
+private:
+    static const int c_baseWindows = 8;  // seconds the smallest transit is kept for
+
+    int64_t intervalUs;
+    int64_t lastReportUs = 0;
+    HapticFeedback report;
+    bool started = false;
+    bool sparse = false;
+    uint32_t reportedThrough = 0;  // highest sequence of the last report
+    uint32_t received = 0;
+    int64_t queueSumUs = 0;
+    int64_t queueMaxUs = 0;
+    uint32_t datagrams = 0;
+
+    int64_t baseTransitUs[c_baseWindows];
+    int64_t baseWindow = -1;       // arrival second of the newest entry
+};
+
+struct BundleConfig {
+    int maxSamples = 8;           // largest bundle
+    int latencyCapMs = 10;        // no sample waits longer than this at the sender
+    int rateHz = 1000;
+    int queueThresholdUs = 2000;  // mean queueing delay that counts as congestion
+    double lossThreshold = 0.02;
+    int calmMs = 1000;            // how long it has to stay calm before the bundle shrinks
+};
+
+struct BundleStats {
+    uint64_t reports;
+    uint64_t congested;   // reports over the queueing or loss threshold
+    uint64_t increases;
+    uint64_t decreases;
+    uint64_t datagrams;
+    uint64_t samples;
+    double lastQueueUs;   // mean queueing delay of the last report
+    double lastLoss;
+};
+
+/* Sender side: one sample per datagram while the path is calm. When the receiver reports
+   queueing or loss, the per-packet overhead is what fills the Wi-Fi queue, so the bundle
+   size doubles to cut the packet rate; after a calm second it shrinks again by one. The
+   size never grows past what the latency cap allows at the sample rate. */
+class BundleController {
+public:
+    explicit BundleController(const BundleConfig& config);
+
+    // Returns true when the bundle size changed
+    bool onFeedback(const uint8_t* data, std::size_t len, int64_t nowNs);
+    void onSent(int samples);
+
+    int target() const { return size; }
+    int64_t capUs() const { return config.latencyCapMs * 1000LL; }
+    BundleStats stats() const { return counters; }
+    void dump(std::ostream& out) const;
+
+private:
+    BundleConfig config;
+    int limit;
+    int size = 1;
+    int64_t lastIncreaseNs = 0;
+    int64_t lastCongestedNs = 0;
+    int64_t lastDecreaseNs = 0;
+    uint64_t sizes[c_maxHapticBundle + 1] = {};
+    BundleStats counters = {};
+};
+
+#endif // HAPTICBUNDLING_H
@@ -0,0 +1,113 @@
+#include "HapticCodec.h"
+#include <cmath>
+
+#include "ByteOrder.h"
+
+bool parseReconstruction(const std::string& name, Reconstruction& mode) {
+    if (name == "hold") mode = Reconstruction::Hold;
+    else if (name == "extrapolate") mode = Reconstruction::Extrapolate;
+    else return false;
+    return true;
+}
+
+float groupDistance(const float* a, const float* b) {
+    float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+float groupMagnitude(const float* a) {
+    return std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+}
+
+void HapticPredictor::update(const HapticSample& sample) {
+    previous = newest;
+    newest = sample;
+    updates++;
+}
+
+void HapticPredictor::predict(uint32_t sequence, float values[c_hapticChannels]) const {
+    int32_t span = static_cast<int32_t>(newest.sequence - previous.sequence);
+    if (mode == Reconstruction::Hold || updates < 2 || span <= 0) {
+        for (int i = 0; i < c_hapticChannels; ++i) values[i] = newest.values[i];
+        return;
+    }
+    // First order: the slope between the last two updates, per sample period
+    float ahead = static_cast<float>(static_cast<int32_t>(sequence - newest.sequence)) / span;
+    for (int i = 0; i < c_hapticChannels; ++i) {
+        values[i] = newest.values[i] + (newest.values[i] - previous.values[i]) * ahead;
+    }
+}
+
+DeadbandEncoder::DeadbandEncoder(const DeadbandConfig& config) : config(config), predictor(config.mode) {
+}
+
+bool DeadbandEncoder::encode(const HapticSample& sample) {
+    bool send = !predictor.started() || sample.captureUs - predictor.last().captureUs >= config.refreshMs * 1000LL;
+    if (!send) {
+        float predicted[c_hapticChannels];
+        predictor.predict(sample.sequence, predicted);
+        float positionBand = static_cast<float>(config.deadband) * groupMagnitude(predicted) + config.positionFloor;
+        float forceBand = static_cast<float>(config.deadband) * groupMagnitude(predicted + 3) + config.forceFloor;
+        send = groupDistance(sample.values, predicted) > positionBand ||
+            groupDistance(sample.values + 3, predicted + 3) > forceBand;
+    }
+    if (!send) {
+        skipped++;
+        return false;
+    }
+    predictor.update(sample);
+    updates++;
+    return true;
+}
+
+DeadbandDecoder::DeadbandDecoder(Reconstruction mode) : predictor(mode) {
+}
+
+void DeadbandDecoder::predictNext(std::vector<HapticSample>& out) {
+    const HapticSample& last = predictor.last();
+    HapticSample shown;
+    shown.sequence = shownThrough + 1;
+    shown.captureUs = last.captureUs + static_cast<int32_t>(shown.sequence - last.sequence) * periodUs;
+    predictor.predict(shown.sequence, shown.values);
+    out.push_back(shown);
+    shownThrough = shown.sequence;
+    filled++;
+}
+
+std::size_t DeadbandDecoder::update(const HapticSample& sample, int64_t arrivalUs, std::vector<HapticSample>& out) {
+    std::size_t before = out.size();
+    bool show = true;
+    if (predictor.started()) {
+        const HapticSample& last = predictor.last();
+        if (!seqNewer(sample.sequence, last.sequence)) return 0;  // reordered, already replaced
+        uint32_t gap = sample.sequence - last.sequence;
+        if (gap <= c_maxFill) {
+            if (sample.captureUs > last.captureUs) periodUs = (sample.captureUs - last.captureUs) / gap;
+            // Skipped periods that were not due yet go out now, as predicted before the update
+            while (periodUs > 0 && seqNewer(sample.sequence - 1, shownThrough)) predictNext(out);
+            show = seqNewer(sample.sequence, shownThrough);
+        }
+    }
+    predictor.update(sample);
+    anchorUs = arrivalUs;
+    if (!show) {
+        late++;
+        return out.size() - before;
+    }
+    out.push_back(sample);
+    shownThrough = sample.sequence;
+    return out.size() - before;
+}
+
+std::size_t DeadbandDecoder::tick(int64_t nowUs, std::vector<HapticSample>& out) {
+    if (!predictor.started() || periodUs <= 0) return 0;
+    std::size_t before = out.size();
+    const uint32_t newest = predictor.last().sequence;
+    for (;;) {
+        // A sender silent past c_maxFill periods is gone, not holding still
+        uint32_t ahead = shownThrough + 1 - newest;
+        if (ahead > c_maxFill || nowUs < anchorUs + int64_t(ahead) * periodUs + c_graceUs) break;
+        predictNext(out);
+    }
+    return out.size() - before;
+}
@@ -0,0 +1,107 @@
+#ifndef HAPTICCODEC_H
+#define HAPTICCODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "HapticTransport.h"
+
+enum class Reconstruction {
+    Hold,        // the last update until the next one
+    Extrapolate  // on along the line through the last two updates
+};
+
+// "hold" or "extrapolate"
+bool parseReconstruction(const std::string& name, Reconstruction& mode);
+
+struct DeadbandConfig {
+    double deadband = 0.1;        // Weber fraction: a change below 10% of the value is not felt
+    float positionFloor = 0.05f;  // mm, so noise around zero is not sent
+    float forceFloor = 0.01f;     // N
+    Reconstruction mode = Reconstruction::Hold;
+    int refreshMs = 100;          // an update at least this often, so a lost one is not held forever
+};
+
+/* What the receiver shows between updates, from the updates alone. The encoder runs the
+   same predictor, so it knows what the receiver shows without any feedback. */
+class HapticPredictor {
+public:
+    explicit HapticPredictor(Reconstruction mode) : mode(mode) {}
+
+    void update(const HapticSample& sample);
+    // The receiver's value for the sample with this sequence number
+    void predict(uint32_t sequence, float values[c_hapticChannels]) const;
+
+    bool started() const { return updates > 0; }
+    const HapticSample& last() const { return newest; }
+
+private:
+    Reconstruction mode;
+    int updates = 0;
+    HapticSample previous;
+    HapticSample newest;
+};
+
+/* Perceptual deadband (Hinterseer et al.): a sample is sent only when position or force
+   leaves a band around what the receiver predicts, the band being the Weber fraction of
+   the predicted magnitude. Each group is tested as a vector. */
+class DeadbandEncoder {
+public:
+    explicit DeadbandEncoder(const DeadbandConfig& config);
+
+    // True when the sample has to be sent
+    bool encode(const HapticSample& sample);
+
+    Reconstruction mode() const { return config.mode; }
+    uint64_t sent() const { return updates; }
+    uint64_t suppressed() const { return skipped; }
+
+private:
+    DeadbandConfig config;
+    HapticPredictor predictor;
+    uint64_t updates = 0;
+    uint64_t skipped = 0;
+};
+
+/* Rebuilds the full-rate timeline from the updates, in real time: tick() puts out the
+   predicted value of every sample period that has passed since the newest update, as the
+   device shows it, so a quiet stream does not wait up to a refresh for its samples. A
+   period is due when it would have arrived, counted from the newest update's arrival,
+   plus a little grace for jitter. An update replaces the prediction from then on; one
+   that comes after its own period was shown only corrects the periods that follow. The
+   sample period is taken from the capture times of successive updates; until the second
+   is in, the first gap is filled when it arrives. */
+class DeadbandDecoder {
+public:
+    explicit DeadbandDecoder(Reconstruction mode);
+
+    // An update that arrived at arrivalUs (receiver's system clock): appends the skipped
+    // samples not yet due and the update itself to out; returns how many
+    std::size_t update(const HapticSample& sample, int64_t arrivalUs, std::vector<HapticSample>& out);
+    // Appends the predicted samples due by nowUs to out; returns how many
+    std::size_t tick(int64_t nowUs, std::vector<HapticSample>& out);
+
+    uint64_t reconstructed() const { return filled; }
+    uint64_t corrected() const { return late; }
+
+private:
+    static const uint32_t c_maxFill = 1000;   // a longer gap is a restart, not silence
+    static const int64_t c_graceUs = 2000;    // how late an update may be and still be shown itself
+
+    void predictNext(std::vector<HapticSample>& out);
+
+    HapticPredictor predictor;
+    uint32_t shownThrough = 0;   // newest sequence put out
+    int64_t anchorUs = 0;        // arrival of the newest update
+    int64_t periodUs = 0;
+    uint64_t filled = 0;
+    uint64_t late = 0;           // updates whose own period had been shown as predicted
+};
+
+// Euclidean distance and length of one channel group: position (channels 0-2) or force (3-5)
+float groupDistance(const float* a, const float* b);
+float groupMagnitude(const float* a);
+
+#endif // HAPTICCODEC_H
@@ -0,0 +1,76 @@
+#include "HapticDevice.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "HapticTrace.h"
+
+static const double c_pi = 3.14159265358979323846;
+
+// Wall stiffness and how deep the tool reaches into it at most, N/mm and mm
+static const double c_wallStiffness = 0.4;
+static const double c_reach = 6.0;
+
+std::unique_ptr<HapticDevice> HapticDevice::create(const std::string& spec, int rateHz) {
+    std::string kind = spec.substr(0, spec.find(':'));
+    std::unique_ptr<HapticDevice> device;
+    if (kind == "sim") {
+        unsigned seed = spec.size() > kind.size() ? static_cast<unsigned>(strtoul(spec.c_str() + kind.size() + 1, nullptr, 10)) : 1;
+        device.reset(new SimulatedHapticDevice(rateHz, seed));
+    }
+    else if (kind == "trace" && spec.size() > kind.size() + 1) {
+        device.reset(new TraceHapticDevice(spec.substr(kind.size() + 1)));
+    }
+    else {
+        std::cerr << "Unknown haptic device " << spec << "\n";
+        return nullptr;
+    }
+    if (!device->open()) {
+        std::cerr << "Failed to open haptic device " << spec << "\n";
+        return nullptr;
+    }
+    return device;
+}
+
+SimulatedHapticDevice::SimulatedHapticDevice(int rateHz, unsigned seed)
+    : period(1.0 / rateHz), random(seed), noise(0.0f, 0.02f) {
+}
+
+bool SimulatedHapticDevice::read(float values[c_hapticChannels]) {
+    double t = tick++ * period;
+    double x = 40.0 * std::sin(2 * c_pi * 0.31 * t) + 6.0 * std::sin(2 * c_pi * 1.7 * t);
+    double y = 30.0 * std::sin(2 * c_pi * 0.23 * t + 1.0) + 4.0 * std::sin(2 * c_pi * 2.3 * t);
+    // Taps on the wall a bit more than once a second
+    double z = c_reach * std::sin(2 * c_pi * 0.8 * t) + 2.0 * std::sin(2 * c_pi * 3.1 * t) - 1.0;
+
+    double depth = z < 0.0 ? -z : 0.0;
+    double normal = c_wallStiffness * depth;
+    // Sliding friction against the motion along the wall
+    double vx = 2 * c_pi * (40.0 * 0.31 * std::cos(2 * c_pi * 0.31 * t) + 6.0 * 1.7 * std::cos(2 * c_pi * 1.7 * t));
+    double friction = depth > 0.0 ? -0.3 * normal * std::tanh(vx / 20.0) : 0.0;
+
+    values[0] = static_cast<float>(x) + noise(random);
+    values[1] = static_cast<float>(y) + noise(random);
+    values[2] = static_cast<float>(z) + noise(random);
+    values[3] = static_cast<float>(friction) + noise(random) * 0.1f;
+    values[4] = noise(random) * 0.1f;
+    values[5] = static_cast<float>(normal) + noise(random) * 0.1f;
+    return true;
+}
+
+bool TraceHapticDevice::open() {
+    std::vector<HapticSample> samples;
+    if (!HapticTrace::load(path, samples)) return false;
+    values.reserve(samples.size() * c_hapticChannels);
+    for (const HapticSample& sample : samples) {
+        values.insert(values.end(), sample.values, sample.values + c_hapticChannels);
+    }
+    return true;
+}
+
+bool TraceHapticDevice::read(float out[c_hapticChannels]) {
+    if (next >= values.size()) next = 0;
+    for (int i = 0; i < c_hapticChannels; ++i) out[i] = values[next + i];
+    next += c_hapticChannels;
+    return true;
+}
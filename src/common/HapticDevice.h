@@ -0,0 +1,61 @@
+#ifndef HAPTICDEVICE_H
+#define HAPTICDEVICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Position x, y, z (mm) and force x, y, z (N) of a single-point device
+const int c_hapticChannels = 6;
+
+/* Where the haptic sender gets its samples from. read() is called once per sample period
+   from the sender's thread and returns the device's current state; the sender does the
+   pacing, so drivers only need a non-blocking read. */
+class HapticDevice {
+public:
+    virtual ~HapticDevice() {}
+
+    // "sim[:SEED]" or "trace:PATH"; drivers for real devices are added here
+    static std::unique_ptr<HapticDevice> create(const std::string& spec, int rateHz);
+
+    virtual bool open() { return true; }
+    virtual bool read(float values[c_hapticChannels]) = 0;
+    virtual const char* name() const = 0;
+};
+
+/* An operator probing a virtual wall at z = 0: the tool moves along a sum of slow sines
+   with sensor noise, and pushing into the wall returns a spring force. Deterministic for
+   a seed, so runs and recorded traces can be reproduced. */
+class SimulatedHapticDevice : public HapticDevice {
+public:
+    SimulatedHapticDevice(int rateHz, unsigned seed = 1);
+
+    bool read(float values[c_hapticChannels]) override;
+    const char* name() const override { return "simulated"; }
+
+private:
+    double period;
+    int64_t tick = 0;
+    std::mt19937 random;
+    std::normal_distribution<float> noise;
+};
+
+// Replays the values of a recorded trace (HapticTrace.h) at the sender's rate, looping
+class TraceHapticDevice : public HapticDevice {
+public:
+    explicit TraceHapticDevice(const std::string& path) : path(path) {}
+
+    bool open() override;
+    bool read(float values[c_hapticChannels]) override;
+    const char* name() const override { return "trace"; }
+
+private:
+    std::string path;
+    std::vector<float> values;  // c_hapticChannels per sample
+    std::size_t next = 0;
+};
+
+#endif // HAPTICDEVICE_H
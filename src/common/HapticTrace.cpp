@@ -0,0 +1,56 @@
+#include "HapticTrace.h"
+#include <cstdio>
+#include <iostream>
+
+HapticTrace::~HapticTrace() {
+    close();
+}
+
+bool HapticTrace::open(const std::string& path) {
+    file.open(path, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Cannot open haptic trace " << path << "\n";
+        return false;
+    }
+    file << "sequence,capture_us,px,py,pz,fx,fy,fz\n";
+    return true;
+}
+
+void HapticTrace::close() {
+    if (file.is_open()) file.close();
+}
+
+void HapticTrace::write(const HapticSample& sample) {
+    char line[256];
+    int len = snprintf(line, sizeof(line), "%u,%lld,%.4f,%.4f,%.4f,%.5f,%.5f,%.5f\n", sample.sequence,
+        static_cast<long long>(sample.captureUs), sample.values[0], sample.values[1], sample.values[2],
+        sample.values[3], sample.values[4], sample.values[5]);
+    file.write(line, len);
+    written++;
+}
+
+bool HapticTrace::load(const std::string& path, std::vector<HapticSample>& samples) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "Cannot open haptic trace " << path << "\n";
+        return false;
+    }
+    samples.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        HapticSample sample;
+        long long captureUs;
+        // The header and anything else that is no sample is skipped
+        if (sscanf(line.c_str(), "%u,%lld,%f,%f,%f,%f,%f,%f", &sample.sequence, &captureUs, &sample.values[0],
+                &sample.values[1], &sample.values[2], &sample.values[3], &sample.values[4], &sample.values[5]) != 8) {
+            continue;
+        }
+        sample.captureUs = captureUs;
+        samples.push_back(sample);
+    }
+    if (samples.empty()) {
+        std::cerr << "No samples in haptic trace " << path << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef HAPTICTRACE_H
+#define HAPTICTRACE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "HapticTransport.h"
+
+/* Recorded haptic samples as CSV, one line per sample after a header line:
+     sequence,capture_us,px,py,pz,fx,fy,fz
+   Written by Server_Haptic --record, replayed by the "trace:" device and read by the
+   codec bench. */
+class HapticTrace {
+public:
+    HapticTrace() = default;
+    ~HapticTrace();
+
+    HapticTrace(const HapticTrace&) = delete;
+    HapticTrace& operator=(const HapticTrace&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return file.is_open(); }
+
+    void write(const HapticSample& sample);
+
+    uint64_t records() const { return written; }
+
+    // Reads a whole trace; false if the file is missing or holds no sample
+    static bool load(const std::string& path, std::vector<HapticSample>& samples);
+
+private:
+    std::ofstream file;
+    uint64_t written = 0;
+};
+
+#endif // HAPTICTRACE_H
@@ -0,0 +1,302 @@
+#include "HapticTransport.h"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "ByteOrder.h"
+#include "ClockSync.h"
+#include "FrameTiming.h"
+#include "HapticBundling.h"
+#include "HapticCodec.h"
+
+// Microseconds the NIC queue is polled for on an empty read
+static const int c_busyPollUs = 50;
+
+static void putValues(uint8_t* out, const float* values) {
+    for (int i = 0; i < c_hapticChannels; ++i) {
+        uint32_t bits;
+        memcpy(&bits, &values[i], sizeof(bits));
+        put32(out + 4 * i, bits);
+    }
+}
+
+static void getValues(const uint8_t* in, float* values) {
+    for (int i = 0; i < c_hapticChannels; ++i) {
+        uint32_t bits = get32(in + 4 * i);
+        memcpy(&values[i], &bits, sizeof(bits));
+    }
+}
+
+std::size_t HapticPacket::write(uint8_t* out) const {
+    const HapticSample& first = samples[0];
+    bool bundle = count > 1;
+    out[0] = c_hapticMagic;
+    out[1] = streamId;
+    out[2] = bundle ? flags | c_hapticFlagBundle : flags & ~c_hapticFlagBundle;
+    out[3] = c_hapticChannels;
+    put32(out + 4, first.sequence);
+    put64(out + 8, static_cast<uint64_t>(first.captureUs));
+    if (!bundle) {
+        putValues(out + c_hapticHeaderSize, first.values);
+        return c_hapticPacketSize;
+    }
+    uint8_t* p = out + c_hapticHeaderSize;
+    for (int i = 0; i < count; ++i, p += c_hapticRecordSize) {
+        // The sender flushes well before either delta could overflow
+        put16(p, static_cast<uint16_t>(samples[i].sequence - first.sequence));
+        put16(p + 2, static_cast<uint16_t>(samples[i].captureUs - first.captureUs));
+        putValues(p + 4, samples[i].values);
+    }
+    return c_hapticHeaderSize + count * c_hapticRecordSize;
+}
+
+bool HapticPacket::read(const uint8_t* in, std::size_t len) {
+    if (len < c_hapticPacketSize || in[0] != c_hapticMagic || in[3] != c_hapticChannels) return false;
+    streamId = in[1];
+    flags = in[2];
+    uint32_t sequence = get32(in + 4);
+    int64_t captureUs = static_cast<int64_t>(get64(in + 8));
+    if (!(flags & c_hapticFlagBundle)) {
+        count = 1;
+        samples[0].sequence = sequence;
+        samples[0].captureUs = captureUs;
+        getValues(in + c_hapticHeaderSize, samples[0].values);
+        return true;
+    }
+    std::size_t records = (len - c_hapticHeaderSize) / c_hapticRecordSize;
+    if (records > static_cast<std::size_t>(c_maxHapticBundle) || c_hapticHeaderSize + records * c_hapticRecordSize != len) {
+        return false;
+    }
+    count = static_cast<int>(records);
+    const uint8_t* p = in + c_hapticHeaderSize;
+    for (int i = 0; i < count; ++i, p += c_hapticRecordSize) {
+        samples[i].sequence = sequence + get16(p);
+        samples[i].captureUs = captureUs + get16(p + 2);
+        getValues(p + 4, samples[i].values);
+    }
+    return true;
+}
+
+SamplePacer::SamplePacer(int rateHz, int spinUs) : periodNs(1000000000LL / rateHz), spinNs(spinUs * 1000LL) {
+}
+
+int64_t SamplePacer::wait() {
+    int64_t now = steadyNowNs();
+    if (!nextNs) {
+        nextNs = now;
+        return now;
+    }
+    nextNs += periodNs;
+    if (now - nextNs >= periodNs) {
+        int64_t missed = (now - nextNs) / periodNs;
+        skippedTicks += missed;
+        nextNs += missed * periodNs;
+    }
+    if (nextNs - now > spinNs) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(nextNs - spinNs - now));
+    }
+    while (steadyNowNs() < nextNs) {}
+    return nextNs;
+}
+
+HapticSender::HapticSender(HapticDevice& device, const HapticSenderConfig& config)
+    : device(device), config(config), pacer(config.rateHz) {
+    packet.streamId = config.streamId;
+}
+
+bool HapticSender::open(const char* host, uint16_t port) {
+    if (!transport.open(host, port, false)) return false;
+    marked = setTrafficClass(transport.socket(), config.dscp);
+    if (!marked) std::cerr << "Could not mark haptic datagrams with DSCP " << config.dscp << "\n";
+    return true;
+}
+
+void HapticSender::setBundling(BundleController* controller) {
+    bundling = controller;
+}
+
+void HapticSender::setEncoder(DeadbandEncoder* deadband) {
+    encoder = deadband;
+    packet.flags = 0;
+    if (deadband) {
+        packet.flags = c_hapticFlagDeadband;
+        if (deadband->mode() == Reconstruction::Extrapolate) packet.flags |= c_hapticFlagExtrapolate;
+    }
+}
+
+bool HapticSender::step() {
+    int64_t tickNs = pacer.wait();
+    pollFeedback();
+    HapticSample& sample = packet.samples[packet.count];
+    sample.sequence = sequence++;
+    sample.captureUs = wallClockMicros();
+    if (!device.read(sample.values)) return false;
+    bool taken = !encoder || encoder->encode(sample);
+    if (taken) packet.count++;
+    if (!packet.count) return true;
+    if (!bundling) {
+        flush(tickNs);
+        return true;
+    }
+    // Full, or the oldest sample would wait past the cap for the next one. A deadband
+    // bundle also goes when the encoder skips a sample: it only groups runs of changes, so
+    // its last sample is never older than a period and the receiver's queueing holds.
+    int64_t periodUs = 1000000 / config.rateHz;
+    if (!taken || packet.count >= bundling->target()
+        || sample.captureUs + periodUs - packet.samples[0].captureUs > bundling->capUs()) {
+        flush(tickNs);
+    }
+    return true;
+}
+
+void HapticSender::flush(int64_t tickNs) {
+    std::size_t len = packet.write(buffer);
+    if (!transport.send(buffer, len)) sendErrors++;
+    wakeup.record(steadyNowNs() - tickNs);
+    if (bundling) bundling->onSent(packet.count);
+    packet.count = 0;
+}
+
+void HapticSender::pollFeedback() {
+    int len;
+    int64_t arrivalUs;
+    while ((len = transport.receive(feedback, sizeof(feedback), &arrivalUs)) > 0) {
+        if (feedback[0] == c_clockMagic) {
+            uint8_t response[c_clockMessageSize];
+            std::size_t responseLen = answerClockRequest(feedback, len, arrivalUs, response);
+            if (responseLen) transport.send(response, responseLen);
+        }
+        else if (bundling) {
+            bundling->onFeedback(feedback, len, steadyNowNs());
+        }
+    }
+}
+
+static void dumpMicros(std::ostream& out, const char* name, const LatencyHistogram& h) {
+    out << std::left << std::setw(16) << name << std::right
+        << std::setw(8) << h.count()
+        << std::setw(11) << h.percentile(50.0) / 1e3
+        << std::setw(11) << h.percentile(99.0) / 1e3
+        << std::setw(11) << h.percentile(99.9) / 1e3
+        << std::setw(11) << h.max() / 1e3 << "\n";
+}
+
+void HapticSender::dump(std::ostream& out) const {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    out << "Haptic sender (" << device.name() << ", " << config.rateHz << " Hz): " << sequence
+        << " samples, " << pacer.skipped() << " periods skipped, " << sendErrors << " send errors, "
+        << (marked ? "DSCP " + std::to_string(config.dscp) : std::string("unmarked")) << "\n";
+    if (encoder) {
+        uint64_t samples = encoder->sent() + encoder->suppressed();
+        out << "Deadband: " << encoder->sent() << " samples sent, "
+            << (samples ? 100.0 * encoder->suppressed() / samples : 0.0) << "% suppressed\n";
+    }
+    if (bundling) bundling->dump(out);
+    out << "                   count     p50 us     p99 us   p99.9 us     max us\n";
+    dumpMicros(out, "tick to send", wakeup);
+    out.flags(flags);
+    out.precision(precision);
+}
+
+bool HapticMonitor::record(const HapticSample& sample, int64_t arrivalUs, bool sparse) {
+    if (!started) {
+        started = true;
+        highest = sample.sequence;
+        seen = 1;
+    }
+    else if (seqNewer(sample.sequence, highest)) {
+        uint32_t gap = sample.sequence - highest;
+        if (!sparse) counters.lost += gap - 1;
+        seen = gap < 64 ? (seen << gap) | 1 : 1;
+        highest = sample.sequence;
+    }
+    else {
+        uint32_t age = highest - sample.sequence;
+        if (age >= 64) return false;
+        if ((seen >> age) & 1) {
+            counters.duplicates++;
+            return false;
+        }
+        seen |= 1ull << age;
+        counters.reordered++;
+        if (counters.lost && !sparse) counters.lost--;
+    }
+
+    // Jitter from the raw clocks: a correction that moves as the fit settles would show up in it
+    int64_t transitUs = arrivalUs - sample.captureUs;
+    int64_t oneWayUs = clock && clock->synchronised() ? arrivalUs - clock->remoteToLocal(sample.captureUs) : transitUs;
+    if (oneWayUs < 0) counters.clockBehind++;
+    oneWay.record(oneWayUs * 1000);
+    if (counters.samples) {
+        int64_t change = transitUs - lastTransitUs;
+        if (change < 0) change = -change;
+        jitter += (change - jitter) / 16.0;
+        transitChange.record(change * 1000);
+        interval.record((arrivalUs - lastArrivalUs) * 1000);
+    }
+    lastTransitUs = transitUs;
+    lastArrivalUs = arrivalUs;
+    counters.samples++;
+    counters.jitterUs = jitter;
+    return true;
+}
+
+void HapticMonitor::dump(std::ostream& out) const {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    out << counters.samples << " samples, " << counters.lost << " lost, " << counters.reordered << " reordered, "
+        << counters.duplicates << " duplicates, jitter " << counters.jitterUs << " us (RFC 3550)\n";
+    out << "                   count     p50 us     p99 us   p99.9 us     max us\n";
+    dumpMicros(out, "one way", oneWay);
+    dumpMicros(out, "transit change", transitChange);
+    dumpMicros(out, "interval", interval);
+    if (clock) clock->dump(out);
+    if (counters.clockBehind) {
+        out << counters.clockBehind << " samples arrived before their capture time: the clocks are apart, "
+            << "one way latency is off by their offset\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+bool HapticReceiver::open(const char* host, uint16_t port, bool busyPoll) {
+    if (!transport.open(host, port)) return false;
+    this->busyPoll = busyPoll;
+    // Bundling feedback goes back in the same queue as the samples
+    setTrafficClass(transport.socket(), c_dscpExpedited);
+    if (busyPoll && !transport.setBusyPoll(c_busyPollUs)) {
+        std::cerr << "SO_BUSY_POLL not permitted, spinning on the socket only\n";
+    }
+    return true;
+}
+
+int HapticReceiver::receive(HapticPacket& packet, int64_t& arrivalUs, int timeoutMs) {
+    int64_t deadlineNs = steadyNowNs() + timeoutMs * 1000000LL;
+    for (;;) {
+        int len;
+        if (busyPoll) {
+            len = transport.poll(buffer, sizeof(buffer));
+        }
+        else {
+            // Clock messages do not restart the wait: only what is left of the timeout
+            int64_t leftNs = deadlineNs - steadyNowNs();
+            int leftMs = leftNs > 0 ? static_cast<int>((leftNs + 999999) / 1000000) : 0;
+            len = transport.receive(buffer, sizeof(buffer), leftMs);
+        }
+        if (len < 0) return -1;
+        if (len > 0) {
+            arrivalUs = wallClockMicros();
+            if (packet.read(buffer, len)) return 1;
+            if (buffer[0] == c_clockMagic && clockHandler) clockHandler(buffer, len, arrivalUs);
+            else rejected++;
+            if (steadyNowNs() >= deadlineNs) return 0;
+            continue;
+        }
+        if (!busyPoll || steadyNowNs() >= deadlineNs) return 0;
+    }
+}
@@ -0,0 +1,197 @@
+#ifndef HAPTICTRANSPORT_H
+#define HAPTICTRANSPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+
+#include "HapticDevice.h"
+#include "LatencyHistogram.h"
+#include "UdpTransport.h"
+
+/* One haptic sample per datagram (network byte order, 40 bytes):
+     0  magic 0xFA
+     1  stream id
+     2  flags                 (bit 0: deadband coded, samples in between were not sent;
+                               bit 1: the receiver extrapolates between them, else holds;
+                               bit 2: a bundle, see below)
+     3  channel count         (c_hapticChannels)
+     4  sequence              (uint32, one per sample period)
+     8  capture timestamp     (int64, microseconds, sender's system clock)
+    16  channels              (float32 each, sent as its IEEE 754 bits)
+   A bundle carries consecutive samples in one datagram: the header holds the first one's
+   sequence and capture time, and a 28-byte record per sample follows instead of the
+   channels:
+     0  sequence delta        (uint16, to the header's sequence)
+     2  capture delta         (uint16, microseconds after the header's capture time)
+     4  channels
+   Nothing is resent: a sample a period late is already replaced by the next one. */
+const uint8_t c_hapticMagic = 0xFA;
+const uint8_t c_hapticFlagDeadband = 0x1;
+const uint8_t c_hapticFlagExtrapolate = 0x2;
+const uint8_t c_hapticFlagBundle = 0x4;
+const std::size_t c_hapticHeaderSize = 16;
+const std::size_t c_hapticPacketSize = c_hapticHeaderSize + 4 * c_hapticChannels;
+const std::size_t c_hapticRecordSize = 4 + 4 * c_hapticChannels;
+const int c_maxHapticBundle = 32;
+const std::size_t c_maxHapticPacketSize = c_hapticHeaderSize + c_maxHapticBundle * c_hapticRecordSize;
+const uint16_t c_hapticPort = 8001;
+
+struct HapticSample {
+    uint32_t sequence = 0;
+    int64_t captureUs = 0;
+    float values[c_hapticChannels] = {};
+};
+
+struct HapticPacket {
+    uint8_t streamId = 0;
+    uint8_t flags = 0;
+    int count = 0;  // samples in the datagram, more than one as a bundle
+    HapticSample samples[c_maxHapticBundle];
+
+    bool deadband() const { return (flags & c_hapticFlagDeadband) != 0; }
+    bool extrapolate() const { return (flags & c_hapticFlagExtrapolate) != 0; }
+
+    // out holds c_maxHapticPacketSize bytes; sets the bundle flag as count needs
+    std::size_t write(uint8_t* out) const;
+    bool read(const uint8_t* in, std::size_t len);
+};
+
+/* Absolute-deadline pacing: sleeps until spinUs before each tick and spins the rest, as
+   a sleep alone wakes tens of microseconds late and would drift. A caller more than a
+   period behind skips the missed ticks instead of catching up in a burst. */
+class SamplePacer {
+public:
+    explicit SamplePacer(int rateHz, int spinUs = 150);
+
+    // Blocks until the next tick and returns its steady-clock time
+    int64_t wait();
+
+    uint64_t skipped() const { return skippedTicks; }
+
+private:
+    int64_t periodNs;
+    int64_t spinNs;
+    int64_t nextNs = 0;
+    uint64_t skippedTicks = 0;
+};
+
+class DeadbandEncoder;
+class BundleController;
+class ClockSync;
+
+struct HapticSenderConfig {
+    int rateHz = 1000;
+    int dscp = c_dscpExpedited;
+    uint8_t streamId = 0;
+};
+
+/* Samples a device at a fixed rate and sends each sample in its own datagram, marked
+   with the configured DSCP so Wi-Fi puts it into the voice queue. With bundling the
+   samples are collected into bundles of the controller's size instead. Time requests
+   from the receiver (ClockSync.h) are answered every period. */
+class HapticSender {
+public:
+    HapticSender(HapticDevice& device, const HapticSenderConfig& config);
+
+    bool open(const char* host, uint16_t port);
+
+    // Only the samples the encoder picks are sent (HapticCodec.h); nullptr sends all
+    void setEncoder(DeadbandEncoder* deadband);
+    // Bundle size from the receiver's feedback (HapticBundling.h); nullptr sends each sample alone
+    void setBundling(BundleController* controller);
+
+    // Waits for the next period, then samples and sends if needed; false when the device failed
+    bool step();
+
+    UdpSender& socket() { return transport; }
+    void dump(std::ostream& out) const;
+
+private:
+    void flush(int64_t tickNs);
+    void pollFeedback();
+
+    HapticDevice& device;
+    HapticSenderConfig config;
+    UdpSender transport;
+    SamplePacer pacer;
+    DeadbandEncoder* encoder = nullptr;
+    BundleController* bundling = nullptr;
+    bool marked = false;
+    uint32_t sequence = 0;
+    HapticPacket packet;  // the bundle being collected
+    uint8_t buffer[c_maxHapticPacketSize];
+    uint8_t feedback[64];
+    uint64_t sendErrors = 0;
+    LatencyHistogram wakeup;  // tick to send
+};
+
+struct HapticReceiveStats {
+    uint64_t samples;
+    uint64_t lost;        // sequence gaps, less the samples that turned up late
+    uint64_t reordered;
+    uint64_t duplicates;
+    uint64_t clockBehind; // arrivals before their capture time: the clocks are apart
+    double jitterUs;      // RFC 3550 interarrival jitter
+};
+
+/* Sequence and timing analysis of one stream. One-way latency is capture to arrival
+   across both system clocks, with the capture time mapped onto the local clock once the
+   clock is synchronised; jitter is the change in transit time between consecutive
+   arrivals, which the clock offset cancels out of. */
+class HapticMonitor {
+public:
+    // The sender's clock as estimated from time exchanges; nullptr compares the raw clocks
+    void setClock(const ClockSync* sender) { clock = sender; }
+
+    // Returns false for a duplicate or a sample too old to tell. Sequence gaps of a
+    // sparse (deadband coded) stream are samples not sent, not losses.
+    bool record(const HapticSample& sample, int64_t arrivalUs, bool sparse = false);
+
+    HapticReceiveStats stats() const { return counters; }
+    const LatencyHistogram& latency() const { return oneWay; }
+    void dump(std::ostream& out) const;
+
+private:
+    const ClockSync* clock = nullptr;
+    bool started = false;
+    uint32_t highest = 0;
+    uint64_t seen = 0;  // bit i: sample highest - i arrived
+    int64_t lastTransitUs = 0;
+    int64_t lastArrivalUs = 0;
+    double jitter = 0.0;
+    LatencyHistogram oneWay;
+    LatencyHistogram transitChange;
+    LatencyHistogram interval;
+    HapticReceiveStats counters = {};
+};
+
+/* Receiving side. With busy polling the thread spins on non-blocking reads, each of which
+   also polls the NIC queue (SO_BUSY_POLL), so a sample is picked up within microseconds
+   instead of after an interrupt and a wakeup. Costs a core. */
+class HapticReceiver {
+public:
+    // Gets the time responses (ClockSync.h) that arrive between the samples
+    using ClockHandler = std::function<void(const uint8_t* data, std::size_t len, int64_t arrivalUs)>;
+
+    bool open(const char* host, uint16_t port, bool busyPoll);
+    void setClockHandler(ClockHandler handler) { clockHandler = std::move(handler); }
+
+    // Waits up to timeoutMs for the next sample. Returns 1 with packet and arrivalUs
+    // (receiver's system clock) set, 0 on timeout, -1 on error.
+    int receive(HapticPacket& packet, int64_t& arrivalUs, int timeoutMs);
+
+    UdpReceiver& socket() { return transport; }
+    bool busyPolling() const { return busyPoll; }
+    uint64_t malformed() const { return rejected; }
+
+private:
+    UdpReceiver transport;
+    ClockHandler clockHandler;
+    bool busyPoll = false;
+    uint8_t buffer[c_maxHapticPacketSize + 1];  // one more, so an oversized datagram shows
+    uint64_t rejected = 0;
+};
+
+#endif // HAPTICTRANSPORT_H
@@ -0,0 +1,156 @@
+#include "ImageConverter.h"
+#include <algorithm>
+#include <iostream>
+
+// Thinner bands cost more in per-call overhead than the threads save
+static const int c_minBandRows = 64;
+static const int c_maxThreads = 4;
+
+ImageConverter::ImageConverter(int threads, int flags) : flags(flags) {
+    if (threads <= 0) {
+        threads = std::min(c_maxThreads, std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / 2));
+    }
+    for (int i = 1; i < threads; ++i) {
+        workers.emplace_back(&ImageConverter::worker, this, i);
+    }
+}
+
+ImageConverter::~ImageConverter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+    for (std::thread& t : workers) t.join();
+
+    for (Entry& entry : cache) {
+        for (Band& band : entry.bands) sws_freeContext(band.context);
+    }
+}
+
+ImageConverter::Entry* ImageConverter::lookup(int width, int height, AVPixelFormat srcFormat, AVPixelFormat dstFormat) {
+    for (Entry& entry : cache) {
+        if (entry.width == width && entry.height == height && entry.srcFormat == srcFormat && entry.dstFormat == dstFormat) {
+            entry.lastUse = ++useCounter;
+            return &entry;
+        }
+    }
+
+    const AVPixFmtDescriptor* srcDesc = av_pix_fmt_desc_get(srcFormat);
+    const AVPixFmtDescriptor* dstDesc = av_pix_fmt_desc_get(dstFormat);
+    if (!srcDesc || !dstDesc) return nullptr;
+
+    Entry entry;
+    entry.width = width;
+    entry.height = height;
+    entry.srcFormat = srcFormat;
+    entry.dstFormat = dstFormat;
+    entry.srcChromaShift = srcDesc->log2_chroma_h;
+    entry.dstChromaShift = dstDesc->log2_chroma_h;
+    entry.lastUse = ++useCounter;
+
+    // Band borders fall on chroma rows of both formats
+    int align = 1 << std::max(entry.srcChromaShift, entry.dstChromaShift);
+    int count = std::max(1, std::min(threads(), height / c_minBandRows));
+    int bandRows = height / count / align * align;
+    if (bandRows == 0) {
+        count = 1;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        Band band;
+        band.firstRow = i * bandRows;
+        band.rows = i + 1 < count ? bandRows : height - band.firstRow;
+        band.context = sws_getContext(width, band.rows, srcFormat, width, band.rows, dstFormat, flags, nullptr, nullptr, nullptr);
+        if (!band.context) {
+            std::cerr << "No conversion from " << av_get_pix_fmt_name(srcFormat) << " to " << av_get_pix_fmt_name(dstFormat)
+                      << " at " << width << "x" << height << "\n";
+            for (Band& created : entry.bands) sws_freeContext(created.context);
+            return nullptr;
+        }
+        entry.bands.push_back(band);
+    }
+
+    if (cache.size() >= c_maxEntries) {
+        // Evict the least recently used size; only happens when the stream keeps changing
+        auto oldest = std::min_element(cache.begin(), cache.end(),
+            [](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+        for (Band& band : oldest->bands) sws_freeContext(band.context);
+        cache.erase(oldest);
+    }
+    cache.push_back(entry);
+    return &cache.back();
+}
+
+void ImageConverter::convertBand(const Job& job, int index) const {
+    const Band& band = job.entry->bands[index];
+    const uint8_t* src[4] = {};
+    uint8_t* dst[4] = {};
+    for (int p = 0; p < 4; ++p) {
+        // Planes 1 and 2 are chroma, subsampled vertically; 0 (and packed data) and alpha are not
+        bool chroma = p == 1 || p == 2;
+        if (job.src[p]) {
+            int row = chroma ? band.firstRow >> job.entry->srcChromaShift : band.firstRow;
+            src[p] = job.src[p] + static_cast<std::ptrdiff_t>(row) * job.srcStride[p];
+        }
+        if (job.dst[p]) {
+            int row = chroma ? band.firstRow >> job.entry->dstChromaShift : band.firstRow;
+            dst[p] = job.dst[p] + static_cast<std::ptrdiff_t>(row) * job.dstStride[p];
+        }
+    }
+    sws_scale(band.context, src, job.srcStride, 0, band.rows, dst, job.dstStride);
+}
+
+bool ImageConverter::convert(const uint8_t* const src[], const int srcStride[], AVPixelFormat srcFormat,
+    int width, int height,
+    uint8_t* const dst[], const int dstStride[], AVPixelFormat dstFormat) {
+    if (width <= 0 || height <= 0) return false;
+    Entry* entry = lookup(width, height, srcFormat, dstFormat);
+    if (!entry) return false;
+
+    Job current = { entry, src, srcStride, dst, dstStride };
+    if (entry->bands.size() == 1) {
+        convertBand(current, 0);
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = current;
+        pending = static_cast<int>(workers.size());
+        ++generation;
+    }
+    start.notify_all();
+    convertBand(current, 0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    return true;
+}
+
+bool ImageConverter::toBgr(const AVFrame* frame, cv::Mat& image) {
+    image.create(frame->height, frame->width, CV_8UC3);
+    uint8_t* dst[4] = { image.data };
+    int dstStride[4] = { static_cast<int>(image.step[0]) };
+    return convert(frame->data, frame->linesize, static_cast<AVPixelFormat>(frame->format),
+        frame->width, frame->height, dst, dstStride, AV_PIX_FMT_BGR24);
+}
+
+void ImageConverter::worker(int band) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        start.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        Job current = job;
+        lock.unlock();
+
+        if (band < static_cast<int>(current.entry->bands.size())) {
+            convertBand(current, band);
+        }
+
+        lock.lock();
+        if (--pending == 0) done.notify_one();
+    }
+}
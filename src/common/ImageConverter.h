@@ -0,0 +1,86 @@
+#ifndef IMAGECONVERTER_H
+#define IMAGECONVERTER_H
+
+#include <opencv2/opencv.hpp>
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Pixel format conversion sized from the data itself, for decoder output of any resolution.
+   SwsContexts are cached by (width, height, source format, destination format), so a
+   resolution change costs one context setup instead of a wrong or crashing conversion.
+   Same-size conversions are cut into horizontal bands, one per worker thread, each band
+   with its own context; the calling thread converts the first band itself. */
+class ImageConverter {
+public:
+    // threads <= 0 picks from the core count, 1 converts on the calling thread only
+    explicit ImageConverter(int threads = 0, int flags = SWS_BILINEAR);
+    ~ImageConverter();
+
+    ImageConverter(const ImageConverter&) = delete;
+    ImageConverter& operator=(const ImageConverter&) = delete;
+
+    // frame -> BGR24 at the frame's own size; image is only reallocated when that changes
+    bool toBgr(const AVFrame* frame, cv::Mat& image);
+
+    bool convert(const uint8_t* const src[], const int srcStride[], AVPixelFormat srcFormat,
+        int width, int height,
+        uint8_t* const dst[], const int dstStride[], AVPixelFormat dstFormat);
+
+    int threads() const { return static_cast<int>(workers.size()) + 1; }
+
+private:
+    struct Band {
+        SwsContext* context;
+        int firstRow;
+        int rows;
+    };
+
+    struct Entry {
+        int width;
+        int height;
+        AVPixelFormat srcFormat;
+        AVPixelFormat dstFormat;
+        int srcChromaShift;  // log2 of the vertical chroma subsampling
+        int dstChromaShift;
+        std::vector<Band> bands;
+        uint64_t lastUse;
+    };
+
+    struct Job {
+        const Entry* entry;
+        const uint8_t* const* src;
+        const int* srcStride;
+        uint8_t* const* dst;
+        const int* dstStride;
+    };
+
+    Entry* lookup(int width, int height, AVPixelFormat srcFormat, AVPixelFormat dstFormat);
+    void convertBand(const Job& job, int band) const;
+    void worker(int band);
+
+    static const std::size_t c_maxEntries = 8;
+
+    int flags;
+    std::vector<Entry> cache;
+    uint64_t useCounter = 0;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    Job job = {};
+    uint64_t generation = 0;
+    int pending = 0;
+    bool stopping = false;
+};
+
+#endif // IMAGECONVERTER_H
@@ -0,0 +1,167 @@
+#include "JitterBuffer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "ByteOrder.h"
+
+// Target delay in multiples of the interarrival jitter
+static const double c_jitterFactor = 4.0;
+// Fraction of the gap closed per frame when the target delay comes down
+static const double c_delayDecay = 0.01;
+// Margin added on top of the lateness of a frame that missed its deadline
+static const double c_lateMarginMs = 5.0;
+// A frame this far behind the last played one, or a transit jump this large, means the
+// sender restarted: start over instead of discarding everything as late
+static const uint32_t c_resyncFrames = 300;
+static const int64_t c_resyncMs = 5000;
+
+JitterBuffer::JitterBuffer(const JitterBufferConfig& config)
+    : config(config), slots(config.capacity), targetDelayMs(config.minDelayMs) {
+}
+
+void JitterBuffer::updateDelay(int64_t transitMs) {
+    transits[transitNext] = transitMs;
+    transitNext = (transitNext + 1) % c_transitWindow;
+    if (transitCount < c_transitWindow) ++transitCount;
+    baseTransitMs = *std::min_element(transits, transits + transitCount);
+
+    // RFC 3550 interarrival jitter, on frames
+    if (haveTransit) {
+        double d = static_cast<double>(std::llabs(transitMs - lastTransitMs));
+        jitterMs += (d - jitterMs) / 16.0;
+    }
+    lastTransitMs = transitMs;
+    haveTransit = true;
+
+    if (!config.adaptive) return;
+    double desired = std::min<double>(config.maxDelayMs, std::max<double>(config.minDelayMs, c_jitterFactor * jitterMs));
+    if (desired > targetDelayMs) {
+        targetDelayMs = desired;
+    }
+    else {
+        targetDelayMs += (desired - targetDelayMs) * c_delayDecay;
+    }
+}
+
+int64_t JitterBuffer::playoutTime(int64_t timestamp) const {
+    return timestamp + baseTransitMs + static_cast<int64_t>(targetDelayMs);
+}
+
+bool JitterBuffer::insert(const ReassembledFrame& frame, int64_t arrivalMs) {
+    release();
+    int64_t transitMs = arrivalMs - frame.timestamp;
+
+    bool restarted = played && !seqNewer(frame.frameId, lastPlayed) && lastPlayed - frame.frameId > c_resyncFrames;
+    bool jumped = haveTransit && std::llabs(transitMs - lastTransitMs) > c_resyncMs;
+    if (restarted || jumped) {
+        for (Slot& slot : slots) slot.used = false;
+        held = 0;
+        played = false;
+        haveTransit = false;
+        transitCount = 0;
+        transitNext = 0;
+        jitterMs = 0.0;
+        targetDelayMs = config.minDelayMs;
+    }
+
+    ++counters.inserted;
+    updateDelay(transitMs);
+
+    // Its successor already went to the decoder
+    if (played && !seqNewer(frame.frameId, lastPlayed)) {
+        ++counters.late;
+        return false;
+    }
+
+    int64_t playoutMs = playoutTime(frame.timestamp);
+    if (playoutMs < arrivalMs) {
+        ++counters.late;
+        if (config.adaptive) {
+            double needed = targetDelayMs + static_cast<double>(arrivalMs - playoutMs) + c_lateMarginMs;
+            targetDelayMs = std::min<double>(config.maxDelayMs, needed);
+        }
+        return false;
+    }
+
+    Slot* free = nullptr;
+    for (Slot& slot : slots) {
+        if (slot.used && slot.frame.frameId == frame.frameId) {
+            ++counters.duplicates;
+            return false;
+        }
+        if (!slot.used && !free) free = &slot;
+    }
+    if (!free) {
+        ++counters.overflow;
+        return false;
+    }
+
+    // The slot buffers only ever grow, so steady state copies without allocating
+    free->data.resize(frame.size + c_decoderPadding);
+    memcpy(free->data.data(), frame.data, frame.size);
+    memset(free->data.data() + frame.size, 0, c_decoderPadding);
+    free->frame = frame;
+    free->frame.data = free->data.data();
+    free->playoutMs = playoutMs;
+    free->arrivalMs = arrivalMs;
+    free->used = true;
+    ++held;
+    return true;
+}
+
+JitterBuffer::Slot* JitterBuffer::earliest() {
+    Slot* first = nullptr;
+    for (Slot& slot : slots) {
+        if (!slot.used || &slot == pendingRelease) continue;
+        if (!first || seqNewer(first->frame.frameId, slot.frame.frameId)) first = &slot;
+    }
+    return first;
+}
+
+const JitterBuffer::Slot* JitterBuffer::earliest() const {
+    return const_cast<JitterBuffer*>(this)->earliest();
+}
+
+void JitterBuffer::release() {
+    if (pendingRelease) {
+        pendingRelease->used = false;
+        pendingRelease = nullptr;
+        --held;
+    }
+}
+
+bool JitterBuffer::pop(int64_t nowMs, ReassembledFrame& frame, int64_t* arrivalMs) {
+    release();
+    Slot* slot = earliest();
+    if (!slot || slot->playoutMs > nowMs) return false;
+
+    if (played) counters.missing += slot->frame.frameId - lastPlayed - 1;
+    played = true;
+    lastPlayed = slot->frame.frameId;
+    ++counters.played;
+
+    frame = slot->frame;
+    if (arrivalMs) *arrivalMs = slot->arrivalMs;
+    pendingRelease = slot;
+    return true;
+}
+
+const ReassembledFrame* JitterBuffer::peek(int64_t nowMs) const {
+    const Slot* slot = earliest();
+    if (!slot || slot->playoutMs > nowMs) return nullptr;
+    return &slot->frame;
+}
+
+int64_t JitterBuffer::waitMs(int64_t nowMs) const {
+    const Slot* slot = earliest();
+    if (!slot) return -1;
+    return std::max<int64_t>(0, slot->playoutMs - nowMs);
+}
+
+JitterBufferStats JitterBuffer::stats() const {
+    JitterBufferStats s = counters;
+    s.jitterMs = jitterMs;
+    s.targetDelayMs = targetDelayMs;
+    return s;
+}
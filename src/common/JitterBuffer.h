@@ -0,0 +1,93 @@
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Packetizer.h"
+
+struct JitterBufferConfig {
+    int minDelayMs = 20;    // target delay never goes below this
+    int maxDelayMs = 250;   // nor above this
+    bool adaptive = true;   // follow the measured jitter, else stay at minDelayMs
+    int capacity = 32;      // frames held at most
+};
+
+struct JitterBufferStats {
+    uint64_t inserted;
+    uint64_t played;
+    uint64_t late;        // arrived after their playout deadline, discarded
+    uint64_t missing;     // frame ids skipped at playout, never arrived in time
+    uint64_t duplicates;
+    uint64_t overflow;    // dropped because every slot was taken
+    double jitterMs;
+    double targetDelayMs;
+};
+
+/* Playout buffer between reassembly and the decoder.
+   Every frame gets a playout time: its capture timestamp mapped onto the local clock
+   through the smallest transit seen recently, plus the target delay. Frames leave in
+   frame id order once their time has come, so reordering is undone and bursts are
+   smoothed into a steady presentation latency. Frames that arrive after their deadline
+   are discarded rather than played late. The target delay follows the interarrival
+   jitter: it rises at once and decays slowly. */
+class JitterBuffer {
+public:
+    explicit JitterBuffer(const JitterBufferConfig& config = JitterBufferConfig());
+
+    // Copies the frame in. Returns false if it was discarded (late, duplicate, no room).
+    bool insert(const ReassembledFrame& frame, int64_t arrivalMs);
+
+    // Next frame whose playout time has come; its data stays valid until the next call
+    // to insert() or pop(). arrivalMs, if given, receives the time it was inserted with.
+    bool pop(int64_t nowMs, ReassembledFrame& frame, int64_t* arrivalMs = nullptr);
+    // The frame pop() would return, left in the buffer; nullptr when none is due yet
+    const ReassembledFrame* peek(int64_t nowMs) const;
+
+    // Milliseconds until the next frame is due, 0 if one is due now, -1 if empty
+    int64_t waitMs(int64_t nowMs) const;
+
+    std::size_t size() const { return held; }
+    JitterBufferStats stats() const;
+
+private:
+    struct Slot {
+        bool used = false;
+        ReassembledFrame frame;
+        int64_t playoutMs = 0;
+        int64_t arrivalMs = 0;
+        std::vector<uint8_t> data;  // frame plus decoder padding
+    };
+
+    void updateDelay(int64_t transitMs);
+    int64_t playoutTime(int64_t timestamp) const;
+    Slot* earliest();
+    const Slot* earliest() const;
+    void release();
+
+    static const int c_transitWindow = 256;
+
+    JitterBufferConfig config;
+    std::vector<Slot> slots;
+    std::size_t held = 0;
+    Slot* pendingRelease = nullptr;
+
+    bool played = false;
+    uint32_t lastPlayed = 0;
+
+    // Base transit: minimum of (arrival - capture) over the last frames
+    int64_t transits[c_transitWindow];
+    int transitCount = 0;
+    int transitNext = 0;
+    int64_t baseTransitMs = 0;
+    bool haveTransit = false;
+    int64_t lastTransitMs = 0;
+
+    double jitterMs = 0.0;
+    double targetDelayMs;
+
+    JitterBufferStats counters = {};
+};
+
+#endif // JITTERBUFFER_H
@@ -0,0 +1,93 @@
+#include "JpegDecoder.h"
+#include <iostream>
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+bool jpegDimensions(const uint8_t* data, std::size_t size, int& width, int& height) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+    std::size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return false;
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            ++pos;  // fill byte
+            continue;
+        }
+        std::size_t length = (static_cast<std::size_t>(data[pos + 2]) << 8) | data[pos + 3];
+        // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (pos + 9 > size) return false;
+            height = (data[pos + 5] << 8) | data[pos + 6];
+            width = (data[pos + 7] << 8) | data[pos + 8];
+            return width > 0 && height > 0;
+        }
+        if (marker == 0xDA) return false;  // scan started without a frame header
+        pos += 2 + length;
+    }
+    return false;
+}
+
+JpegDecoder::JpegDecoder() {
+#ifdef HAVE_TURBOJPEG
+    handle = tjInitDecompress();
+    if (!handle) std::cerr << "TurboJPEG initialisation failed, falling back to OpenCV\n";
+#endif
+}
+
+JpegDecoder::~JpegDecoder() {
+#ifdef HAVE_TURBOJPEG
+    if (handle) tjDestroy(static_cast<tjhandle>(handle));
+#endif
+}
+
+void JpegDecoder::setTargetSize(int width, int height) {
+    targetWidth = width;
+    targetHeight = height;
+}
+
+int JpegDecoder::scaleFor(int width, int height) const {
+    if (targetWidth <= 0 && targetHeight <= 0) return 1;
+    // Largest reduction that still covers the target, so display never upscales
+    for (int denominator = 4; denominator > 1; denominator /= 2) {
+        int scaledWidth = (width + denominator - 1) / denominator;
+        int scaledHeight = (height + denominator - 1) / denominator;
+        if ((targetWidth <= 0 || scaledWidth >= targetWidth) && (targetHeight <= 0 || scaledHeight >= targetHeight)) {
+            return denominator;
+        }
+    }
+    return 1;
+}
+
+bool JpegDecoder::decode(const uint8_t* data, std::size_t size, cv::Mat& image) {
+#ifdef HAVE_TURBOJPEG
+    if (handle) {
+        tjhandle tj = static_cast<tjhandle>(handle);
+        int width, height, subsampling, colorspace;
+        if (tjDecompressHeader3(tj, data, static_cast<unsigned long>(size), &width, &height, &subsampling, &colorspace) != 0) {
+            return false;
+        }
+        lastScale = scaleFor(width, height);
+        tjscalingfactor factor = { 1, lastScale };
+        int scaledWidth = TJSCALED(width, factor);
+        int scaledHeight = TJSCALED(height, factor);
+
+        image.create(scaledHeight, scaledWidth, CV_8UC3);
+        if (tjDecompress2(tj, data, static_cast<unsigned long>(size), image.data, scaledWidth,
+                static_cast<int>(image.step[0]), scaledHeight, TJPF_BGR, TJFLAG_FASTDCT) != 0) {
+            // Warnings (a truncated frame, say) still leave a usable image
+            return tjGetErrorCode(tj) == TJERR_WARNING;
+        }
+        return true;
+    }
+#endif
+    int width, height;
+    lastScale = jpegDimensions(data, size, width, height) ? scaleFor(width, height) : 1;
+    int flags = lastScale == 4 ? cv::IMREAD_REDUCED_COLOR_4
+        : lastScale == 2 ? cv::IMREAD_REDUCED_COLOR_2
+        : cv::IMREAD_COLOR;
+    cv::Mat buffer(1, static_cast<int>(size), CV_8UC1, const_cast<uint8_t*>(data));
+    cv::imdecode(buffer, flags, &image);  // reuses image's memory when the size matches
+    return !image.empty();
+}
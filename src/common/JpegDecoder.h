@@ -0,0 +1,50 @@
+#ifndef JPEGDECODER_H
+#define JPEGDECODER_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__has_include)
+#if __has_include(<turbojpeg.h>)
+#define HAVE_TURBOJPEG 1
+#endif
+#endif
+
+// Reads the frame size from the SOF marker without decoding anything
+bool jpegDimensions(const uint8_t* data, std::size_t size, int& width, int& height);
+
+/* JPEG -> BGR decoding straight from the received buffer into a caller-owned image, which
+   keeps its memory from frame to frame. When the display is smaller than the stream the
+   IDCT itself scales by 1/2 or 1/4, so the full-size image is never produced.
+   Uses TurboJPEG when turbojpeg.h is on the include path, else OpenCV's
+   IMREAD_REDUCED_COLOR_* modes, which scale the same way inside libjpeg. */
+class JpegDecoder {
+public:
+    JpegDecoder();
+    ~JpegDecoder();
+
+    JpegDecoder(const JpegDecoder&) = delete;
+    JpegDecoder& operator=(const JpegDecoder&) = delete;
+
+    // Largest size worth decoding to; 0 leaves that dimension unconstrained
+    void setTargetSize(int width, int height);
+
+    bool decode(const uint8_t* data, std::size_t size, cv::Mat& image);
+
+    // Denominator used for the last frame: 1, 2 or 4
+    int scale() const { return lastScale; }
+
+private:
+    int scaleFor(int width, int height) const;
+
+    int targetWidth = 0;
+    int targetHeight = 0;
+    int lastScale = 1;
+#ifdef HAVE_TURBOJPEG
+    void* handle = nullptr;  // tjhandle
+#endif
+};
+
+#endif // JPEGDECODER_H
@@ -0,0 +1,85 @@
+#include "LatencyHistogram.h"
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < c_bucketCount; ++i) {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    minValue.store(INT64_MAX, std::memory_order_relaxed);
+    maxValue.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::indexOf(int64_t value) {
+    if (value < c_subBucketCount) return static_cast<int>(value);
+
+    int msb = 63;
+    while (!(static_cast<uint64_t>(value) >> msb)) --msb;
+    // Leading one dropped, the next c_subBucketBits bits pick the linear sub-bucket
+    int shift = msb - c_subBucketBits;
+    int sub = static_cast<int>((value >> shift) & (c_subBucketCount - 1));
+    return (shift + 1) * c_subBucketCount + sub;
+}
+
+int64_t LatencyHistogram::highestEquivalent(int index) {
+    if (index < c_subBucketCount) return index;
+    int shift = index / c_subBucketCount - 1;
+    int sub = index % c_subBucketCount;
+    int64_t lower = static_cast<int64_t>(c_subBucketCount + sub) << shift;
+    return lower + (int64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(int64_t ns) {
+    if (ns < 0) ns = 0;
+    const int64_t limit = (int64_t(1) << c_maxValueBits) - 1;
+    if (ns > limit) ns = limit;
+
+    counts[indexOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+
+    int64_t seen = minValue.load(std::memory_order_relaxed);
+    while (ns < seen && !minValue.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+    seen = maxValue.load(std::memory_order_relaxed);
+    while (ns > seen && !maxValue.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+}
+
+int64_t LatencyHistogram::min() const {
+    int64_t value = minValue.load(std::memory_order_relaxed);
+    return value == INT64_MAX ? 0 : value;
+}
+
+double LatencyHistogram::mean() const {
+    uint64_t n = count();
+    return n ? static_cast<double>(sum.load(std::memory_order_relaxed)) / n : 0.0;
+}
+
+int64_t LatencyHistogram::percentile(double p) const {
+    // Counts may move while we walk them; the answer is for a snapshot close to now
+    uint64_t n = 0;
+    for (int i = 0; i < c_bucketCount; ++i) {
+        n += counts[i].load(std::memory_order_relaxed);
+    }
+    if (n == 0) return 0;
+
+    if (p < 0.0) p = 0.0;
+    if (p > 100.0) p = 100.0;
+    uint64_t target = static_cast<uint64_t>(std::ceil(p / 100.0 * n));
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < c_bucketCount; ++i) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            int64_t value = highestEquivalent(i);
+            int64_t top = max();
+            return value < top ? value : top;
+        }
+    }
+    return max();
+}
@@ -0,0 +1,43 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/* HDR-style log-linear histogram of nanosecond values.
+   Every power of two is split into 64 linear sub-buckets, so any reported value is within
+   1.6% of the recorded one. record() is a handful of relaxed atomic adds: any number of
+   threads can record while another one reads percentiles. */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(int64_t ns);
+    void reset();
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    int64_t min() const;
+    int64_t max() const { return maxValue.load(std::memory_order_relaxed); }
+    double mean() const;
+
+    // p in [0, 100]; returns the highest value equivalent to the bucket holding it
+    int64_t percentile(double p) const;
+
+private:
+    static const int c_subBucketBits = 6;
+    static const int c_subBucketCount = 1 << c_subBucketBits;
+    static const int c_maxValueBits = 36;  // ~68 s, anything above is clamped
+    static const int c_bucketCount = (c_maxValueBits - c_subBucketBits + 1) * c_subBucketCount;
+
+    static int indexOf(int64_t value);
+    static int64_t highestEquivalent(int index);
+
+    std::atomic<uint64_t> counts[c_bucketCount];
+    std::atomic<uint64_t> total;
+    std::atomic<int64_t> sum;
+    std::atomic<int64_t> minValue;
+    std::atomic<int64_t> maxValue;
+};
+
+#endif // LATENCYHISTOGRAM_H
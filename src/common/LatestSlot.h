@@ -0,0 +1,48 @@
+#ifndef LATESTSLOT_H
+#define LATESTSLOT_H
+
+#include <atomic>
+
+/* Single-producer/single-consumer latest-value slot (triple buffer).
+   The producer fills back() and publishes it; the consumer only ever sees the newest
+   published value and anything it missed is overwritten, never queued. Neither side
+   blocks or allocates: the three buffers are reused, so for cv::Mat they keep their
+   memory once sized. */
+template<typename T>
+class LatestSlot {
+public:
+    LatestSlot() : middle(1), backIndex(0), frontIndex(2) {}
+
+    LatestSlot(const LatestSlot&) = delete;
+    LatestSlot& operator=(const LatestSlot&) = delete;
+
+    // Producer side: the buffer to fill before publish()
+    T& back() { return buffers[backIndex]; }
+
+    void publish() {
+        int previous = middle.exchange(backIndex | c_fresh, std::memory_order_acq_rel);
+        backIndex = previous & c_indexMask;
+    }
+
+    // Consumer side: swaps in the newest published value, false if nothing new arrived
+    bool take() {
+        if (!(middle.load(std::memory_order_acquire) & c_fresh)) return false;
+        int previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & c_indexMask;
+        return true;
+    }
+
+    // Consumer side: the value returned by the last successful take()
+    T& front() { return buffers[frontIndex]; }
+
+private:
+    static const int c_indexMask = 0x3;
+    static const int c_fresh = 0x4;
+
+    T buffers[3];
+    std::atomic<int> middle;
+    int backIndex;   // producer only
+    int frontIndex;  // consumer only
+};
+
+#endif // LATESTSLOT_H
@@ -0,0 +1,249 @@
+#include "MultiStreamReceiver.h"
+#include <chrono>
+#include <iostream>
+
+#include "FrameTiming.h"
+#include "Rtp.h"
+
+// Longest a shard waits for a datagram, so shutdown is noticed without traffic
+static const int64_t c_maxWaitMs = 100;
+
+// Quiet time after which another shard may take a stream over
+static const int64_t c_handoverNs = 500 * 1000000LL;
+
+// One thread shows every window and cannot block on all the present rings; this is
+// well below a frame interval
+static const std::chrono::milliseconds c_presentPoll(2);
+
+MultiStreamReceiver::MultiStreamReceiver(const MultiStreamConfig& config, DecoderFactory decoders, RtpFactory rtpAssemblers)
+    : config(config), decoders(std::move(decoders)), rtpAssemblers(std::move(rtpAssemblers)) {
+}
+
+MultiStreamReceiver::~MultiStreamReceiver() {
+    close();
+}
+
+bool MultiStreamReceiver::open() {
+    int count = config.shards > 1 ? config.shards : 1;
+    for (int i = 0; i < count; ++i) {
+        shards.emplace_back(new Shard());
+        if (!shards.back()->socket.open(config.host, config.port, count > 1, config.gro)) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MultiStreamReceiver::close() {
+    for (auto& shard : shards) {
+        shard->socket.close();
+    }
+}
+
+MultiStreamReceiver::Stream* MultiStreamReceiver::create(int key, int shard) {
+    Stream* stream = new Stream();
+    streams.emplace_back(stream);
+    byKey[key] = stream;
+
+    stream->key = key;
+    stream->label = key == c_rtpStream ? "rtp" : std::to_string(key);
+    stream->owner = shard;
+    ReceivePipelineConfig pipelineConfig = config.pipeline;
+    pipelineConfig.windowName += " " + stream->label;
+    if (!pipelineConfig.logPath.empty()) pipelineConfig.logPath += "." + stream->label;
+    stream->pipeline.reset(new ReceivePipeline(pipelineConfig, decoders(stream->label)));
+    stream->receiver.reset(new StreamReceiver(shards[shard]->socket, *stream->pipeline, config.jitter,
+        static_cast<uint8_t>(key), config.conceal));
+    stream->pipeline->setSenderClock(&stream->receiver->senderClock());
+    if (key == c_rtpStream) stream->rtp = rtpAssemblers();
+    if (config.sync && key == config.syncStream) {
+        stream->receiver->setSync(config.sync);
+        config.sync->setVideoClock(&stream->receiver->senderClock());
+    }
+    stream->pipeline->start();
+    return stream;
+}
+
+MultiStreamReceiver::Stream* MultiStreamReceiver::claim(int key, int shard, int64_t nowNs) {
+    Stream* stream;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stream = byKey[key];
+        if (!stream) stream = create(key, shard);
+    }
+    {
+        std::lock_guard<std::mutex> guard(stream->busy);
+        if (stream->owner != shard) {
+            if (nowNs - stream->lastNs < c_handoverNs) return nullptr;
+            stream->owner = shard;
+            stream->receiver->moveTo(shards[shard]->socket);
+            handovers.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    shards[shard]->cache[key] = stream;
+    shards[shard]->owned.push_back(stream);
+    return stream;
+}
+
+void MultiStreamReceiver::release(Shard& shard, Stream* stream) {
+    shard.cache[stream->key] = nullptr;
+    for (std::size_t i = 0; i < shard.owned.size(); ++i) {
+        if (shard.owned[i] == stream) {
+            shard.owned[i] = shard.owned.back();
+            shard.owned.pop_back();
+            break;
+        }
+    }
+}
+
+void MultiStreamReceiver::networkLoop(int index) {
+    Shard& shard = *shards[index];
+    std::vector<Stream*> lost;
+
+    while (active.load(std::memory_order_acquire)) {
+        // Wait no longer than until the first stream has a frame or a request due
+        int64_t nowNs = steadyNowNs();
+        int64_t waitMs = c_maxWaitMs;
+        lost.clear();
+        for (Stream* stream : shard.owned) {
+            std::lock_guard<std::mutex> guard(stream->busy);
+            if (stream->owner != index) {
+                lost.push_back(stream);
+                continue;
+            }
+            int64_t wait = stream->receiver->waitMs(nowNs);
+            if (wait >= 0 && wait < waitMs) waitMs = wait;
+        }
+        for (Stream* stream : lost) {
+            release(shard, stream);
+        }
+
+        int count = shard.socket.receiveBatch(static_cast<int>(waitMs));
+        if (count < 0) {
+            std::cerr << "Receive failed.\n";
+            active.store(false, std::memory_order_release);
+            break;
+        }
+
+        // Runs of datagrams of one stream, as GRO hands them over, take its lock once
+        int64_t arrivalNs = steadyNowNs();
+        Stream* current = nullptr;
+        std::unique_lock<std::mutex> held;
+        for (int i = 0; i < count; ++i) {
+            const ReceivedDatagram& datagram = shard.socket.datagram(i);
+            // RTP and native fragments are told apart by their first byte, as are the
+            // senders' answers to time requests
+            bool rtp = isRtpPacket(datagram.data, datagram.len);
+            int key = c_rtpStream;
+            if (datagram.data[0] == c_clockMagic && datagram.len >= c_clockMessageSize) {
+                key = datagram.data[1];
+            }
+            else if (!rtp) {
+                FragmentHeader header;
+                if (!header.read(datagram.data, datagram.len)) {
+                    shard.unrecognised++;
+                    continue;
+                }
+                key = header.streamId;
+            }
+            else if (!rtpAssemblers) {
+                shard.unrecognised++;
+                continue;
+            }
+
+            Stream* stream = shard.cache[key];
+            if (!stream || stream != current) {
+                if (held) held.unlock();
+                current = nullptr;
+                if (!stream) stream = claim(key, index, arrivalNs);
+                if (!stream) {
+                    shard.refused++;
+                    continue;
+                }
+                held = std::unique_lock<std::mutex>(stream->busy);
+                if (stream->owner != index) {
+                    held.unlock();
+                    release(shard, stream);
+                    shard.refused++;
+                    continue;
+                }
+                current = stream;
+            }
+
+            current->lastNs = arrivalNs;
+            if (!rtp) {
+                current->receiver->onDatagram(datagram.data, datagram.len, *datagram.from, arrivalNs);
+            }
+            else if (current->rtp(datagram.data, datagram.len, current->assembled)) {
+                current->receiver->onFrame(current->assembled, arrivalNs);
+            }
+        }
+        if (held) held.unlock();
+
+        for (Stream* stream : shard.owned) {
+            std::lock_guard<std::mutex> guard(stream->busy);
+            if (stream->owner == index) stream->receiver->poll();
+        }
+    }
+}
+
+void MultiStreamReceiver::run() {
+    catchInterrupt(true);
+    active.store(true, std::memory_order_release);
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        shards[i]->thread = std::thread(&MultiStreamReceiver::networkLoop, this, static_cast<int>(i));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config.pipeline.durationSeconds);
+    std::vector<Stream*> visible;
+    while (active.load(std::memory_order_acquire) && !interrupted()) {
+        if (config.pipeline.durationSeconds > 0 && std::chrono::steady_clock::now() >= deadline) break;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            visible.clear();
+            for (auto& stream : streams) visible.push_back(stream.get());
+        }
+        int shown = 0;
+        for (Stream* stream : visible) {
+            shown += stream->pipeline->presentReady();
+        }
+#ifndef HEADLESS
+        if (!config.pipeline.headless) {
+            // Pumps every window at once
+            int wait = shown ? 1 : static_cast<int>(c_presentPoll.count());
+            if (cv::waitKey(wait) >= 0) break;
+            continue;
+        }
+#endif
+        if (!shown) std::this_thread::sleep_for(c_presentPoll);
+    }
+
+    active.store(false, std::memory_order_release);
+    for (auto& shard : shards) {
+        if (shard->thread.joinable()) shard->thread.join();
+    }
+    for (auto& stream : streams) {
+        stream->pipeline->finish();
+    }
+    catchInterrupt(false);
+}
+
+void MultiStreamReceiver::dump(std::ostream& out) const {
+    uint64_t unrecognised = 0;
+    uint64_t refused = 0;
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        if (shards.size() > 1) out << "shard " << i << " ";
+        dumpReceiverStats(out, shards[i]->socket.stats());
+        unrecognised += shards[i]->unrecognised;
+        refused += shards[i]->refused;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    out << "streams: " << streams.size() << ", handovers " << handovers.load() << ", unrecognised datagrams "
+        << unrecognised << ", refused while owned elsewhere " << refused << "\n";
+    for (const auto& stream : streams) {
+        out << "Stream " << stream->label << ":\n";
+        stream->receiver->dump(out);
+        stream->pipeline->dump(out);
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef MULTISTREAMRECEIVER_H
+#define MULTISTREAMRECEIVER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "JitterBuffer.h"
+#include "Packetizer.h"
+#include "ReceivePipeline.h"
+#include "StreamReceiver.h"
+#include "SyncEngine.h"
+#include "UdpTransport.h"
+
+struct MultiStreamConfig {
+    ReceivePipelineConfig pipeline;  // per stream; window name and log path get the stream id appended
+    JitterBufferConfig jitter;
+    const char* host = nullptr;      // nullptr binds every interface
+    uint16_t port = 8888;
+    int shards = 1;                  // sockets sharing the port (SO_REUSEPORT), a network thread each
+    bool gro = true;
+    bool conceal = false;            // incomplete frames go to the decoder, see Concealment.h
+    SyncEngine* sync = nullptr;      // aligns the stream syncStream with a haptic stream
+    int syncStream = 0;
+};
+
+/* One receiver for several cameras on one port. Every stream id gets its own
+   StreamReceiver and decode pipeline; the windows are all shown from the caller's thread.
+     shard sockets -> demux by stream id -> per stream reassembly/jitter -> decode thread
+   Each shard reads its socket in recvmmsg batches with GRO, so the receive cost per
+   datagram does not depend on the stream count. SO_REUSEPORT hashes a sender's
+   addresses to one shard, so a stream normally stays on the shard that first saw it;
+   a stream whose datagrams show up on another shard is handed over once its old shard
+   has been quiet for a while (a sender restarted on a new source port).
+   RTP carries no stream id: RTP senders all share one stream. */
+class MultiStreamReceiver {
+public:
+    // One decoder per stream, made when its first datagram arrives; stream as in dump()
+    using DecoderFactory = std::function<ReceivePipeline::Decoder(const std::string& stream)>;
+    // Puts RTP packets together into frames, as RtpDepacketizer::push
+    using RtpAssembler = std::function<bool(const uint8_t* datagram, std::size_t len, ReassembledFrame& frame)>;
+    using RtpFactory = std::function<RtpAssembler()>;
+
+    MultiStreamReceiver(const MultiStreamConfig& config, DecoderFactory decoders, RtpFactory rtpAssemblers = nullptr);
+    ~MultiStreamReceiver();
+
+    MultiStreamReceiver(const MultiStreamReceiver&) = delete;
+    MultiStreamReceiver& operator=(const MultiStreamReceiver&) = delete;
+
+    bool open();
+    void close();
+
+    // Runs the shards and the decoders on their own threads and presents on the calling
+    // thread until a key, Ctrl-C or the duration
+    void run();
+
+    // Per shard socket counters, then each stream's receive and decode summary
+    void dump(std::ostream& out) const;
+
+private:
+    static const int c_rtpStream = 256;
+    static const int c_streamKeys = 257;
+
+    struct Stream {
+        int key = 0;
+        std::string label;
+        std::unique_ptr<ReceivePipeline> pipeline;
+        std::unique_ptr<StreamReceiver> receiver;
+        RtpAssembler rtp;
+        ReassembledFrame assembled;
+        std::mutex busy;   // held by the owning shard while it works on the stream
+        int owner = 0;
+        int64_t lastNs = 0;
+    };
+
+    struct Shard {
+        UdpReceiver socket;
+        std::thread thread;
+        Stream* cache[c_streamKeys] = {};  // streams this shard owns, by key
+        std::vector<Stream*> owned;
+        uint64_t unrecognised = 0;         // neither native fragments nor RTP
+        uint64_t refused = 0;              // for a stream another shard still owns
+    };
+
+    void networkLoop(int index);
+    Stream* claim(int key, int shard, int64_t nowNs);
+    Stream* create(int key, int shard);
+    void release(Shard& shard, Stream* stream);
+
+    MultiStreamConfig config;
+    DecoderFactory decoders;
+    RtpFactory rtpAssemblers;
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    mutable std::mutex lock;  // streams and byKey; the network threads only take it for a new stream
+    std::vector<std::unique_ptr<Stream>> streams;
+    Stream* byKey[c_streamKeys] = {};
+    std::atomic<bool> active{ false };
+    std::atomic<uint64_t> handovers{ 0 };
+};
+
+#endif // MULTISTREAMRECEIVER_H
@@ -0,0 +1,319 @@
+#include "Nack.h"
+#include <algorithm>
+#include <cstring>
+
+#include "ByteOrder.h"
+
+std::size_t NackMessage::write(uint8_t* out) const {
+    std::size_t count = std::min<std::size_t>(entries.size(), c_maxNackEntries);
+    out[0] = c_nackMagic;
+    out[1] = streamId;
+    put16(out + 2, static_cast<uint16_t>(count));
+    put16(out + 4, deadlineMs);
+    uint8_t* p = out + c_nackHeaderSize;
+    for (std::size_t i = 0; i < count; ++i, p += c_nackEntrySize) {
+        put32(p, entries[i].frameId);
+        put16(p + 4, entries[i].fragIndex);
+        put16(p + 6, entries[i].bitmap);
+    }
+    return c_nackHeaderSize + count * c_nackEntrySize;
+}
+
+bool NackMessage::read(const uint8_t* in, std::size_t len) {
+    if (len < c_nackHeaderSize || in[0] != c_nackMagic) return false;
+    std::size_t count = get16(in + 2);
+    if (count > static_cast<std::size_t>(c_maxNackEntries) || len < c_nackHeaderSize + count * c_nackEntrySize) {
+        return false;
+    }
+    streamId = in[1];
+    deadlineMs = get16(in + 4);
+    entries.resize(count);
+    const uint8_t* p = in + c_nackHeaderSize;
+    for (std::size_t i = 0; i < count; ++i, p += c_nackEntrySize) {
+        entries[i].frameId = get32(p);
+        entries[i].fragIndex = get16(p + 4);
+        entries[i].bitmap = get16(p + 6);
+    }
+    return true;
+}
+
+NackGenerator::NackGenerator(const NackConfig& config) : config(config) {
+}
+
+NackGenerator::Tracked* NackGenerator::track(uint32_t frameId, uint16_t fragCount, int64_t arrivalNs) {
+    if (!haveFrame || seqNewer(frameId, newestFrame)) {
+        if (haveFrame) {
+            // Everything of the frames before has been sent by now: the rest of the newest
+            // one is missing, and so is every frame skipped over
+            Tracked& last = window[newestFrame % c_window];
+            if (last.active && last.frameId == newestFrame && last.fragCount) {
+                last.expected = last.fragCount;
+                schedule(last, arrivalNs);
+            }
+            // Longer gaps are left to a keyframe
+            if (frameId - newestFrame <= static_cast<uint32_t>(c_window / 2)) {
+                for (uint32_t id = newestFrame + 1; id != frameId; ++id) {
+                    Tracked& lost = window[id % c_window];
+                    lost = Tracked();
+                    lost.active = true;
+                    lost.frameId = id;
+                    lost.firstNs = arrivalNs;
+                    schedule(lost, arrivalNs);
+                }
+            }
+        }
+        newestFrame = frameId;
+        haveFrame = true;
+    }
+    else if (newestFrame - frameId >= static_cast<uint32_t>(c_window)) {
+        return nullptr;
+    }
+
+    Tracked& frame = window[frameId % c_window];
+    if (!frame.active || frame.frameId != frameId) {
+        frame.active = true;
+        frame.complete = false;
+        frame.frameId = frameId;
+        frame.fragCount = 0;
+        frame.expected = 0;
+        frame.retries = 0;
+        frame.firstNs = arrivalNs;
+        frame.nextNackNs = 0;
+        frame.lastNackNs = 0;
+    }
+    if (!frame.fragCount) {
+        frame.fragCount = fragCount;
+        // Bitmap words are reused; only the ones in use are cleared
+        frame.have.assign((fragCount + 63) / 64, 0);
+        // A frame requested whole is being resent whole
+        if (frame.nextNackNs || frame.retries) frame.expected = fragCount;
+    }
+    return &frame;
+}
+
+void NackGenerator::schedule(Tracked& frame, int64_t nowNs) {
+    if (frame.complete || frame.nextNackNs) return;
+    frame.nextNackNs = nowNs + config.reorderUs * 1000LL;
+}
+
+bool NackGenerator::missing(const Tracked& frame, int index) const {
+    return ((frame.have[index >> 6] >> (index & 63)) & 1) == 0;
+}
+
+int64_t NackGenerator::retryNs() const {
+    // A resend takes a round trip plus the sender's turnaround; never spin under a millisecond
+    if (!rttNs) return config.retryMs * 1000000LL;
+    return std::max<int64_t>(2 * rttNs, 1000000);
+}
+
+void NackGenerator::onDatagram(const uint8_t* datagram, std::size_t len, int64_t arrivalNs) {
+    FragmentHeader header;
+    if (!header.read(datagram, len)) return;
+    streamId = header.streamId;
+
+    Tracked* frame = track(header.frameId, header.fragCount, arrivalNs);
+    if (!frame || frame->fragCount != header.fragCount) return;
+
+    // Resends that come too late still tell the round trip, which sets the deadline
+    if (header.retransmit()) {
+        counters.retransmitted++;
+        if (frame->lastNackNs) {
+            int64_t sample = arrivalNs - frame->lastNackNs;
+            rttNs = rttNs ? rttNs + (sample - rttNs) / 8 : sample;
+        }
+    }
+    if (frame->complete) return;
+
+    // FEC repairs trail the fragments, all of them should be in
+    if (header.repair()) {
+        frame->expected = frame->fragCount;
+        schedule(*frame, arrivalNs);
+        return;
+    }
+
+    frame->have[header.fragIndex >> 6] |= 1ull << (header.fragIndex & 63);
+    if (!header.retransmit() && header.fragIndex >= frame->expected) {
+        if (header.fragIndex > frame->expected) schedule(*frame, arrivalNs);
+        frame->expected = header.fragIndex + 1;
+    }
+}
+
+void NackGenerator::onFrameComplete(uint32_t frameId) {
+    Tracked& frame = window[frameId % c_window];
+    if (!frame.active || frame.frameId != frameId) return;
+    if (!frame.complete && frame.retries) counters.repaired++;
+    frame.complete = true;
+    frame.nextNackNs = 0;
+}
+
+std::size_t NackGenerator::takeNack(int64_t nowNs, uint8_t* out) {
+    message.entries.clear();
+    int64_t deadlineNs = config.deadlineMs * 1000000LL - rttNs / 2;
+
+    for (Tracked& frame : window) {
+        if (!frame.active || frame.complete || !frame.nextNackNs || nowNs < frame.nextNackNs) continue;
+        if (frame.retries >= config.maxRetries || nowNs - frame.firstNs > deadlineNs) {
+            // A resend would arrive after the frame was due
+            frame.complete = true;
+            frame.nextNackNs = 0;
+            counters.abandoned++;
+            continue;
+        }
+
+        std::size_t before = message.entries.size();
+        if (!frame.fragCount) {
+            message.entries.push_back({ frame.frameId, c_nackWholeFrame, 0 });
+            counters.requested++;
+        }
+        for (int i = 0; i < frame.expected && frame.fragCount; ++i) {
+            if (!missing(frame, i)) continue;
+            NackEntry entry = { frame.frameId, static_cast<uint16_t>(i), 0 };
+            counters.requested++;
+            for (int n = 0; n < 16 && i + 1 + n < frame.expected; ++n) {
+                if (missing(frame, i + 1 + n)) {
+                    entry.bitmap |= static_cast<uint16_t>(1u << n);
+                    counters.requested++;
+                }
+            }
+            message.entries.push_back(entry);
+            if (message.entries.size() >= static_cast<std::size_t>(c_maxNackEntries)) break;
+            i += 16;
+        }
+        if (message.entries.size() == before) {
+            frame.nextNackNs = 0;  // the gap filled in meanwhile
+            continue;
+        }
+        frame.retries++;
+        frame.lastNackNs = nowNs;
+        frame.nextNackNs = nowNs + retryNs();
+        if (message.entries.size() >= static_cast<std::size_t>(c_maxNackEntries)) break;
+    }
+    if (message.entries.empty()) return 0;
+
+    message.streamId = streamId;
+    message.deadlineMs = static_cast<uint16_t>(std::min<int64_t>(std::max<int64_t>(deadlineNs / 1000000, 0), UINT16_MAX));
+    counters.messages++;
+    return message.write(out);
+}
+
+int64_t NackGenerator::waitMs(int64_t nowNs) const {
+    int64_t next = 0;
+    for (const Tracked& frame : window) {
+        if (frame.active && !frame.complete && frame.nextNackNs && (!next || frame.nextNackNs < next)) {
+            next = frame.nextNackNs;
+        }
+    }
+    if (!next) return -1;
+    return next <= nowNs ? 0 : (next - nowNs + 999999) / 1000000;
+}
+
+NackStats NackGenerator::stats() const {
+    NackStats s = counters;
+    s.rttMs = rttNs / 1e6;
+    return s;
+}
+
+RetransmitCache::RetransmitCache(std::size_t capacityBytes, int frameCount)
+    : frames(frameCount), capacity(capacityBytes) {
+}
+
+void RetransmitCache::store(const std::vector<Fragment>& fragments, int64_t sendNs) {
+    FragmentHeader header;
+    if (fragments.empty() || fragments[0].headerSize != c_fragmentHeaderSize ||
+        !header.read(fragments[0].header, c_fragmentHeaderSize) || header.repair()) {
+        return;
+    }
+    std::size_t size = header.frameSize;
+    if (size > capacity) return;
+
+    Frame& frame = frames[next];
+    next = (next + 1) % frames.size();
+    if (frame.valid) {
+        bytes -= frame.size;
+        frame.valid = false;
+    }
+    // Oldest first until the frame fits; next now points at the oldest
+    for (std::size_t i = 0; bytes + size > capacity && i < frames.size(); ++i) {
+        Frame& old = frames[(next + i) % frames.size()];
+        if (old.valid) {
+            bytes -= old.size;
+            old.valid = false;
+        }
+    }
+
+    if (frame.data.size() < size) frame.data.resize(size);
+    std::size_t stride = fragments[0].size;
+    for (std::size_t i = 0; i < fragments.size(); ++i) {
+        memcpy(frame.data.data() + i * stride, fragments[i].payload, fragments[i].size);
+    }
+    frame.valid = true;
+    frame.frameId = header.frameId;
+    frame.header = header;
+    frame.sendNs = sendNs;
+    frame.count = static_cast<uint16_t>(fragments.size());
+    frame.stride = stride;
+    frame.size = size;
+    bytes += size;
+}
+
+RetransmitCache::Frame* RetransmitCache::find(uint32_t frameId) {
+    for (Frame& frame : frames) {
+        if (frame.valid && frame.frameId == frameId) return &frame;
+    }
+    return nullptr;
+}
+
+void RetransmitCache::resend(Frame& frame, int index) {
+    if (index >= frame.count) return;
+    Fragment frag;
+    FragmentHeader header = frame.header;
+    header.flags |= c_flagRetransmit;
+    header.fragIndex = static_cast<uint16_t>(index);
+    header.write(frag.header);
+    std::size_t offset = index * frame.stride;
+    frag.payload = frame.data.data() + offset;
+    frag.size = index + 1 == frame.count ? frame.size - offset : frame.stride;
+    resends.push_back(frag);
+    counters.resent++;
+}
+
+const std::vector<Fragment>& RetransmitCache::onNack(const uint8_t* data, std::size_t len, int64_t nowNs) {
+    resends.clear();
+    if (!request.read(data, len)) return resends;
+    counters.nacks++;
+
+    for (const NackEntry& entry : request.entries) {
+        Frame* frame = find(entry.frameId);
+        uint64_t asked = 1;
+        if (entry.fragIndex == c_nackWholeFrame) {
+            asked = frame ? frame->count : 1;
+        }
+        else {
+            for (int n = 0; n < 16; ++n) asked += (entry.bitmap >> n) & 1;
+        }
+        if (!frame) {
+            counters.evicted += asked;
+            continue;
+        }
+        // Too late for the receiver's playout: sending would only cost bandwidth
+        if (nowNs - frame->sendNs > request.deadlineMs * 1000000LL) {
+            counters.late += asked;
+            continue;
+        }
+
+        if (entry.fragIndex == c_nackWholeFrame) {
+            for (int i = 0; i < frame->count; ++i) resend(*frame, i);
+            continue;
+        }
+        resend(*frame, entry.fragIndex);
+        for (int n = 0; n < 16; ++n) {
+            if ((entry.bitmap >> n) & 1) resend(*frame, entry.fragIndex + 1 + n);
+        }
+    }
+    return resends;
+}
+
+void RetransmitCache::dump(std::ostream& out) const {
+    out << "retransmit: " << counters.nacks << " NACKs, resent " << counters.resent << " fragments, "
+        << counters.late << " too late, " << counters.evicted << " no longer cached" << std::endl;
+}
@@ -0,0 +1,161 @@
+#ifndef NACK_H
+#define NACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "Packetizer.h"
+
+/* Receiver -> sender retransmission request (network byte order), on the feedback path:
+     0  magic 0xFC
+     1  stream id
+     2  entry count           (uint16)
+     4  deadline              (uint16, ms after a frame was sent that a resend still plays)
+     6  entries, 8 bytes each:
+          frame id            (uint32)
+          fragment index      (uint16, 0xffff: every fragment, the frame was lost whole)
+          bitmap              (uint16, bit n: fragment index + 1 + n as well)
+   As in the generic NACK of RFC 4585 one entry covers up to 17 fragments. Resent
+   fragments carry c_flagRetransmit and are otherwise the original datagrams. */
+const uint8_t c_nackMagic = 0xFC;
+const std::size_t c_nackHeaderSize = 6;
+const std::size_t c_nackEntrySize = 8;
+const int c_maxNackEntries = 64;
+// Within c_maxFeedbackSize, so senders read either kind of feedback into one buffer
+const std::size_t c_maxNackSize = c_nackHeaderSize + c_maxNackEntries * c_nackEntrySize;
+const uint16_t c_nackWholeFrame = 0xffff;
+
+struct NackEntry {
+    uint32_t frameId;
+    uint16_t fragIndex;
+    uint16_t bitmap;
+};
+
+struct NackMessage {
+    uint8_t streamId = 0;
+    uint16_t deadlineMs = 0;
+    std::vector<NackEntry> entries;
+
+    std::size_t write(uint8_t* out) const;
+    bool read(const uint8_t* in, std::size_t len);
+};
+
+struct NackConfig {
+    int reorderUs = 1000;   // before the first request, so reordering and FEC repairs get a chance
+    int retryMs = 10;       // between requests for the same frame until a round trip was measured
+    int maxRetries = 3;
+    int deadlineMs = 100;   // a frame is given up this long after its first datagram, see setDeadline()
+};
+
+struct NackStats {
+    uint64_t messages;
+    uint64_t requested;      // fragments asked for, a whole lost frame counts once
+    uint64_t retransmitted;  // resent fragments that arrived
+    uint64_t repaired;       // frames completed after a request
+    uint64_t abandoned;      // frames given up at the deadline or after maxRetries
+    double rttMs;            // request to resent fragment
+};
+
+/* Receiver side: a sliding window over the most recent frames, with a bitmap of the
+   fragments seen of each. Fragments leave the sender in order, so a skipped index, the
+   start of a newer frame or a trailing FEC repair shows what is missing. Requests are
+   timed by the measured round trip and stop once a resend could no longer play. */
+class NackGenerator {
+public:
+    explicit NackGenerator(const NackConfig& config = NackConfig());
+
+    void onDatagram(const uint8_t* datagram, std::size_t len, int64_t arrivalNs);
+    void onFrameComplete(uint32_t frameId);
+
+    // Playout delay of the receiver: how long a frame may take to be completed
+    void setDeadline(int deadlineMs) { config.deadlineMs = deadlineMs; }
+
+    // Serializes a request into out (c_maxNackSize bytes) when one is due, else returns 0
+    std::size_t takeNack(int64_t nowNs, uint8_t* out);
+
+    // Milliseconds until the next request is due, -1 when none is pending
+    int64_t waitMs(int64_t nowNs) const;
+
+    NackStats stats() const;
+
+private:
+    static const int c_window = 64;
+
+    struct Tracked {
+        bool active = false;
+        bool complete = false;
+        uint32_t frameId = 0;
+        uint16_t fragCount = 0;  // 0 while no datagram of the frame arrived
+        int expected = 0;        // fragments below this index should be in
+        int retries = 0;
+        int64_t firstNs = 0;
+        int64_t nextNackNs = 0;  // 0 when nothing is to be requested
+        int64_t lastNackNs = 0;
+        std::vector<uint64_t> have;
+    };
+
+    Tracked* track(uint32_t frameId, uint16_t fragCount, int64_t arrivalNs);
+    void schedule(Tracked& frame, int64_t nowNs);
+    bool missing(const Tracked& frame, int index) const;
+    int64_t retryNs() const;
+
+    NackConfig config;
+    Tracked window[c_window];
+    uint8_t streamId = 0;
+    uint32_t newestFrame = 0;
+    bool haveFrame = false;
+    int64_t rttNs = 0;
+    NackMessage message;
+    NackStats counters = {};
+};
+
+struct RetransmitStats {
+    uint64_t nacks;
+    uint64_t resent;
+    uint64_t late;     // asked for past the receiver's deadline
+    uint64_t evicted;  // asked for after leaving the cache
+};
+
+/* Sender side: a copy of the fragments of the last frames, bounded in frames and bytes.
+   The buffers are reused, so steady state does not allocate. */
+class RetransmitCache {
+public:
+    explicit RetransmitCache(std::size_t capacityBytes = 8 * 1024 * 1024, int frameCount = 64);
+
+    // Native fragments of one frame; RTP packets are not cached
+    void store(const std::vector<Fragment>& fragments, int64_t sendNs);
+
+    // Fragments to resend for a NACK, valid until the next call; empty when the
+    // datagram is no NACK or nothing it asks for can still arrive in time
+    const std::vector<Fragment>& onNack(const uint8_t* data, std::size_t len, int64_t nowNs);
+
+    RetransmitStats stats() const { return counters; }
+    void dump(std::ostream& out) const;
+
+private:
+    struct Frame {
+        bool valid = false;
+        uint32_t frameId = 0;
+        FragmentHeader header;
+        int64_t sendNs = 0;
+        uint16_t count = 0;
+        std::size_t stride = 0;
+        std::size_t size = 0;
+        std::vector<uint8_t> data;
+    };
+
+    Frame* find(uint32_t frameId);
+    void resend(Frame& frame, int index);
+
+    std::vector<Frame> frames;
+    std::size_t next = 0;
+    std::size_t capacity;
+    std::size_t bytes = 0;
+    NackMessage request;
+    std::vector<Fragment> resends;
+    RetransmitStats counters = {};
+};
+
+#endif // NACK_H
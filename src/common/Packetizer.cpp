@@ -0,0 +1,269 @@
+#include "Packetizer.h"
+#include <cstring>
+
+#include "ByteOrder.h"
+#include "Fec.h"
+
+static uint64_t frameKey(uint8_t streamId, uint32_t frameId) {
+    return (static_cast<uint64_t>(streamId) << 32) | frameId;
+}
+
+void FragmentHeader::write(uint8_t* out) const {
+    out[0] = static_cast<uint8_t>((c_fragmentVersion << 4) | (flags & 0x0f));
+    out[1] = streamId;
+    put16(out + 2, fragIndex);
+    put16(out + 4, fragCount);
+    put32(out + 6, frameId);
+    put32(out + 10, frameSize);
+    put64(out + 14, static_cast<uint64_t>(timestamp));
+}
+
+bool FragmentHeader::read(const uint8_t* in, std::size_t len) {
+    if (len < c_fragmentHeaderSize || (in[0] >> 4) != c_fragmentVersion) return false;
+    flags = in[0] & 0x0f;
+    streamId = in[1];
+    fragIndex = get16(in + 2);
+    fragCount = get16(in + 4);
+    frameId = get32(in + 6);
+    frameSize = get32(in + 10);
+    timestamp = static_cast<int64_t>(get64(in + 14));
+    // Data fragments number below the count, repair datagrams from it on
+    return fragCount != 0 && (repair() ? fragIndex >= fragCount : fragIndex < fragCount);
+}
+
+std::size_t Fragment::serialize(uint8_t* out) const {
+    memcpy(out, header, headerSize);
+    memcpy(out + headerSize, payload, size);
+    return headerSize + size;
+}
+
+Packetizer::Packetizer(uint8_t streamId, std::size_t mtu) : streamId(streamId) {
+    payloadSize = mtu - c_ipUdpOverhead - c_fragmentHeaderSize;
+}
+
+const std::vector<Fragment>& Packetizer::packetize(const uint8_t* data, std::size_t size, int64_t timestamp, bool keyframe) {
+    // Spread the frame evenly instead of leaving a tiny last fragment
+    std::size_t count = size == 0 ? 1 : (size + payloadSize - 1) / payloadSize;
+    std::size_t stride = size == 0 ? 0 : (size + count - 1) / count;
+
+    FragmentHeader header;
+    header.flags = keyframe ? c_flagKeyframe : 0;
+    header.streamId = streamId;
+    header.fragCount = static_cast<uint16_t>(count);
+    header.frameId = nextFrameId++;
+    header.frameSize = static_cast<uint32_t>(size);
+    header.timestamp = timestamp;
+
+    fragments.resize(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        Fragment& frag = fragments[i];
+        header.fragIndex = static_cast<uint16_t>(i);
+        header.write(frag.header);
+        std::size_t offset = i * stride;
+        frag.payload = data + offset;
+        frag.size = offset + stride > size ? size - offset : stride;
+    }
+    return fragments;
+}
+
+Reassembler::Reassembler(int slotCount, std::chrono::milliseconds timeout, std::size_t maxFrameSize)
+    : slots(slotCount), timeout(timeout), maxFrameSize(maxFrameSize) {
+    for (int i = 0; i < c_recentFrames; ++i) {
+        recentKeys[i] = UINT64_MAX;
+    }
+}
+
+Reassembler::~Reassembler() = default;
+
+Reassembler::Slot* Reassembler::find(uint8_t streamId, uint32_t frameId) {
+    for (Slot& slot : slots) {
+        if (slot.active && slot.header.streamId == streamId && slot.header.frameId == frameId) return &slot;
+    }
+    return nullptr;
+}
+
+Reassembler::Slot* Reassembler::claim(const FragmentHeader& header) {
+    Slot* victim = nullptr;
+    for (Slot& slot : slots) {
+        if (!slot.active) {
+            victim = &slot;
+            break;
+        }
+        if (!victim || slot.firstArrival < victim->firstArrival) victim = &slot;
+    }
+    if (victim->active) counters.evicted++;
+
+    victim->active = true;
+    victim->header = header;
+    victim->header.flags &= ~(c_flagRepair | c_flagRetransmit);
+    victim->stride = (header.frameSize + header.fragCount - 1) / header.fragCount;
+    victim->received = 0;
+    victim->firstArrival = std::chrono::steady_clock::now();
+    // Buffers only ever grow, so steady state does not allocate. Room for whole strides,
+    // zero past the frame, as FEC rebuilds the short last fragment padded to a stride.
+    std::size_t symbols = victim->stride * header.fragCount;
+    if (victim->buffer.size() < symbols + c_decoderPadding) {
+        victim->buffer.resize(symbols + c_decoderPadding);
+    }
+    memset(victim->buffer.data() + header.frameSize, 0, symbols - header.frameSize);
+    victim->have.assign(header.fragCount, 0);
+    victim->fecScheme = FecScheme::None;
+    victim->repairCount = 0;
+    victim->repairsReceived = 0;
+    return victim;
+}
+
+bool Reassembler::recentlyCompleted(uint8_t streamId, uint32_t frameId) const {
+    uint64_t key = frameKey(streamId, frameId);
+    for (int i = 0; i < c_recentFrames; ++i) {
+        if (recentKeys[i] == key) return true;
+    }
+    return false;
+}
+
+void Reassembler::evictExpired() {
+    auto now = std::chrono::steady_clock::now();
+    for (Slot& slot : slots) {
+        if (slot.active && now - slot.firstArrival > timeout) {
+            slot.active = false;
+            counters.evicted++;
+        }
+    }
+}
+
+bool Reassembler::push(const uint8_t* datagram, std::size_t len, ReassembledFrame& frame) {
+    if (releasePending >= 0) {
+        slots[releasePending].active = false;
+        releasePending = -1;
+    }
+    counters.datagrams++;
+    evictExpired();
+
+    FragmentHeader header;
+    if (!header.read(datagram, len) || header.frameSize > maxFrameSize) {
+        counters.malformed++;
+        return false;
+    }
+
+    if (recentlyCompleted(header.streamId, header.frameId)) {
+        // Repairs of a frame that arrived whole are expected, not duplicates
+        if (header.repair()) {
+            counters.repairs++;
+        }
+        else {
+            counters.duplicates++;
+        }
+        return false;
+    }
+
+    Slot* slot = find(header.streamId, header.frameId);
+    if (!slot) slot = claim(header);
+
+    std::size_t payloadLen = len - c_fragmentHeaderSize;
+    if (header.frameSize != slot->header.frameSize || header.fragCount != slot->header.fragCount) {
+        counters.malformed++;
+        return false;
+    }
+    if (header.repair()) {
+        if (!pushRepair(*slot, header, datagram + c_fragmentHeaderSize, payloadLen)) return false;
+    }
+    else {
+        std::size_t offset = header.fragIndex * slot->stride;
+        if (offset + payloadLen > slot->header.frameSize) {
+            counters.malformed++;
+            return false;
+        }
+        if (slot->have[header.fragIndex]) {
+            counters.duplicates++;
+            return false;
+        }
+        memcpy(slot->buffer.data() + offset, datagram + c_fragmentHeaderSize, payloadLen);
+        slot->have[header.fragIndex] = 1;
+        slot->received++;
+    }
+
+    // Enough repairs in to stand in for what is missing: rebuild it now rather than
+    // waiting for a retransmission
+    if (slot->received < slot->header.fragCount && slot->repairsReceived > 0) {
+        int rebuilt = fec->recover(slot->fecScheme, slot->fecRowLength, slot->header.fragCount, slot->stride,
+            slot->buffer.data(), slot->have.data(), slot->repairCount, slot->repairs.data(), slot->repairHave.data());
+        slot->received += static_cast<uint16_t>(rebuilt);
+        counters.recovered += rebuilt;
+    }
+    if (slot->received < slot->header.fragCount) return false;
+
+    memset(slot->buffer.data() + slot->header.frameSize, 0, c_decoderPadding);
+    recentKeys[recentNext] = frameKey(header.streamId, header.frameId);
+    recentNext = (recentNext + 1) % c_recentFrames;
+    counters.completed++;
+
+    frame.streamId = slot->header.streamId;
+    frame.frameId = slot->header.frameId;
+    frame.timestamp = slot->header.timestamp;
+    frame.wallClock = true;
+    frame.keyframe = slot->header.keyframe();
+    frame.data = slot->buffer.data();
+    frame.size = slot->header.frameSize;
+    releasePending = static_cast<int>(slot - slots.data());
+    return true;
+}
+
+bool Reassembler::salvage(uint8_t streamId, uint32_t frameId, PartialFrame& partial) {
+    Slot* slot = find(streamId, frameId);
+    if (!slot || slot->received == 0) return false;
+    if (releasePending >= 0) slots[releasePending].active = false;
+
+    recentKeys[recentNext] = frameKey(streamId, frameId);
+    recentNext = (recentNext + 1) % c_recentFrames;
+    counters.salvaged++;
+
+    partial.frame.streamId = streamId;
+    partial.frame.frameId = frameId;
+    partial.frame.timestamp = slot->header.timestamp;
+    partial.frame.wallClock = true;
+    partial.frame.keyframe = slot->header.keyframe();
+    partial.frame.data = slot->buffer.data();
+    partial.frame.size = slot->header.frameSize;
+    partial.stride = slot->stride;
+    partial.fragCount = slot->header.fragCount;
+    partial.have = slot->have.data();
+    releasePending = static_cast<int>(slot - slots.data());
+    return true;
+}
+
+// Stores one repair symbol; the FEC header must agree with the frame's earlier repairs
+bool Reassembler::pushRepair(Slot& slot, const FragmentHeader& header, const uint8_t* payload, std::size_t len) {
+    if (len != c_fecHeaderSize + slot.stride || slot.stride == 0) {
+        counters.malformed++;
+        return false;
+    }
+    FecScheme scheme = static_cast<FecScheme>(payload[0]);
+    int rowLength = payload[1];
+    uint16_t repairCount = get16(payload + 2);
+    int index = header.fragIndex - header.fragCount;
+    if ((scheme != FecScheme::Xor && scheme != FecScheme::ReedSolomon) || index < 0 || index >= repairCount ||
+        (slot.repairCount && (scheme != slot.fecScheme || rowLength != slot.fecRowLength || repairCount != slot.repairCount))) {
+        counters.malformed++;
+        return false;
+    }
+
+    if (!slot.repairCount) {
+        if (!fec) fec.reset(new FecDecoder());
+        slot.fecScheme = scheme;
+        slot.fecRowLength = rowLength;
+        slot.repairCount = repairCount;
+        if (slot.repairs.size() < repairCount * slot.stride) {
+            slot.repairs.resize(repairCount * slot.stride);
+        }
+        slot.repairHave.assign(repairCount, 0);
+    }
+    if (slot.repairHave[index]) {
+        counters.duplicates++;
+        return false;
+    }
+    memcpy(slot.repairs.data() + index * slot.stride, payload + c_fecHeaderSize, slot.stride);
+    slot.repairHave[index] = 1;
+    slot.repairsReceived++;
+    counters.repairs++;
+    return true;
+}
@@ -0,0 +1,173 @@
+#ifndef PACKETIZER_H
+#define PACKETIZER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/* Wire header in front of every video datagram (network byte order, 22 bytes):
+     0  version:4 | flags:4
+     1  stream id
+     2  fragment index        (uint16)
+     4  fragment count        (uint16)
+     6  frame id              (uint32)
+    10  frame size in bytes   (uint32)
+    14  capture timestamp     (int64, sender clock)
+   Every fragment but the last carries the same payload size, so a receiver can place any
+   fragment at index * ceil(frameSize / count) without waiting for the others.
+   Repair datagrams (see Fec.h) set c_flagRepair and number on from fragment count, which
+   receivers without FEC reject as malformed. Fragments resent on a NACK (see Nack.h)
+   set c_flagRetransmit. */
+const std::size_t c_fragmentHeaderSize = 22;
+const std::size_t c_defaultMtu = 1500;
+const std::size_t c_ipUdpOverhead = 28;
+const uint8_t c_fragmentVersion = 1;
+const uint8_t c_flagKeyframe = 0x1;
+const uint8_t c_flagRepair = 0x2;
+const uint8_t c_flagRetransmit = 0x4;
+
+// Zeroed bytes after every reassembled frame, as FFmpeg's parsers may read past the end
+const std::size_t c_decoderPadding = 64;
+
+struct FragmentHeader {
+    uint8_t flags = 0;
+    uint8_t streamId = 0;
+    uint16_t fragIndex = 0;
+    uint16_t fragCount = 0;
+    uint32_t frameId = 0;
+    uint32_t frameSize = 0;
+    int64_t timestamp = 0;
+
+    bool keyframe() const { return (flags & c_flagKeyframe) != 0; }
+    bool repair() const { return (flags & c_flagRepair) != 0; }
+    bool retransmit() const { return (flags & c_flagRetransmit) != 0; }
+
+    void write(uint8_t* out) const;
+    bool read(const uint8_t* in, std::size_t len);
+};
+
+struct Fragment {
+    uint8_t header[c_fragmentHeaderSize];
+    std::size_t headerSize = c_fragmentHeaderSize;  // RTP packets use fewer of the header bytes
+    const uint8_t* payload;  // points into the encoded frame, nothing is copied
+    std::size_t size;
+
+    // Header + payload into one contiguous datagram, returns its length
+    std::size_t serialize(uint8_t* out) const;
+};
+
+// Splits encoded frames into MTU-sized datagrams
+class Packetizer {
+public:
+    explicit Packetizer(uint8_t streamId = 0, std::size_t mtu = c_defaultMtu);
+
+    // Fragments stay valid until the next call and reference data directly
+    const std::vector<Fragment>& packetize(const uint8_t* data, std::size_t size, int64_t timestamp, bool keyframe);
+
+    std::size_t maxPayload() const { return payloadSize; }
+    std::size_t maxDatagramSize() const { return payloadSize + c_fragmentHeaderSize; }
+    uint32_t lastFrameId() const { return nextFrameId - 1; }
+
+private:
+    uint8_t streamId;
+    std::size_t payloadSize;
+    uint32_t nextFrameId = 0;
+    std::vector<Fragment> fragments;
+};
+
+struct ReassembledFrame {
+    uint8_t streamId;
+    uint32_t frameId;
+    int64_t timestamp;
+    bool wallClock;       // timestamp is the sender's system clock in ms, not media time (RTP)
+    bool keyframe;
+    const uint8_t* data;  // followed by c_decoderPadding zero bytes
+    std::size_t size;
+};
+
+struct ReassemblyStats {
+    uint64_t datagrams;
+    uint64_t completed;
+    uint64_t evicted;     // incomplete frames dropped on timeout or for lack of slots
+    uint64_t duplicates;
+    uint64_t malformed;
+    uint64_t repairs;     // FEC repair datagrams
+    uint64_t recovered;   // lost fragments rebuilt from them
+    uint64_t salvaged;    // incomplete frames handed out for error concealment
+};
+
+// An incomplete frame: fragment i sits at i * stride in frame.data and arrived if have[i]
+struct PartialFrame {
+    ReassembledFrame frame;
+    std::size_t stride;
+    uint16_t fragCount;
+    const uint8_t* have;
+};
+
+enum class FecScheme : uint8_t;
+class FecDecoder;
+
+/* Receiver side: writes each fragment's payload straight into its frame's padded
+   decoder buffer. A fixed set of in-progress slots is reused, and frames still
+   incomplete after the timeout are evicted. Lost fragments are rebuilt from FEC
+   repairs as soon as enough have arrived, without asking the sender. */
+class Reassembler {
+public:
+    Reassembler(int slotCount = 8, std::chrono::milliseconds timeout = std::chrono::milliseconds(100),
+        std::size_t maxFrameSize = 8 * 1024 * 1024);
+    ~Reassembler();
+
+    // Returns true when this datagram completed a frame. The frame's data stays
+    // valid until the next call to push().
+    bool push(const uint8_t* datagram, std::size_t len, ReassembledFrame& frame);
+
+    // Drops incomplete frames older than the timeout; also done on every push()
+    void evictExpired();
+
+    // Hands out a frame that is still incomplete, for error concealment, and finishes it:
+    // its late fragments count as duplicates. Valid until the next call to push().
+    bool salvage(uint8_t streamId, uint32_t frameId, PartialFrame& partial);
+
+    ReassemblyStats stats() const { return counters; }
+
+private:
+    struct Slot {
+        bool active = false;
+        FragmentHeader header;
+        std::size_t stride = 0;
+        uint16_t received = 0;
+        std::chrono::steady_clock::time_point firstArrival;
+        std::vector<uint8_t> buffer;
+        std::vector<uint8_t> have;
+
+        // FEC, set by the first repair datagram of the frame
+        FecScheme fecScheme;
+        int fecRowLength = 0;
+        uint16_t repairCount = 0;
+        uint16_t repairsReceived = 0;
+        std::vector<uint8_t> repairs;     // repair j's parity at j * stride
+        std::vector<uint8_t> repairHave;
+    };
+
+    Slot* find(uint8_t streamId, uint32_t frameId);
+    Slot* claim(const FragmentHeader& header);
+    bool recentlyCompleted(uint8_t streamId, uint32_t frameId) const;
+    bool pushRepair(Slot& slot, const FragmentHeader& header, const uint8_t* payload, std::size_t len);
+
+    static const int c_recentFrames = 32;
+
+    std::vector<Slot> slots;
+    std::chrono::milliseconds timeout;
+    std::size_t maxFrameSize;
+    int releasePending = -1;
+    std::unique_ptr<FecDecoder> fec;  // created with the first repair, unprotected streams skip it
+
+    uint64_t recentKeys[c_recentFrames];
+    int recentNext = 0;
+
+    ReassemblyStats counters = {};
+};
+
+#endif // PACKETIZER_H
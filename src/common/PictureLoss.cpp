@@ -0,0 +1,79 @@
+#include "PictureLoss.h"
+
+#include "ByteOrder.h"
+
+PictureLossReporter::PictureLossReporter(int repeatMs) : repeatNs(repeatMs * 1000000LL) {
+}
+
+void PictureLossReporter::onLoss(uint32_t frameId, int64_t nowNs) {
+    if (lost) return;  // the keyframe that ends the outstanding loss ends this one too
+    lost = true;
+    lostFrame = frameId;
+    sequence++;
+    lastRequestNs = nowNs - repeatNs;  // due at once
+    counters.losses++;
+}
+
+void PictureLossReporter::onKeyframe(uint32_t frameId) {
+    if (!lost || seqNewer(lostFrame, frameId)) return;
+    lost = false;
+    counters.recovered++;
+}
+
+std::size_t PictureLossReporter::takeRequest(uint8_t streamId, int64_t nowNs, uint8_t* out) {
+    // Repeats cover a lost request or a lost keyframe
+    if (!lost || nowNs - lastRequestNs < repeatNs) return 0;
+    lastRequestNs = nowNs;
+    counters.requests++;
+    out[0] = c_pictureLossMagic;
+    out[1] = streamId;
+    put16(out + 2, sequence);
+    put32(out + 4, lostFrame);
+    return c_pictureLossSize;
+}
+
+KeyframeRequestHandler::KeyframeRequestHandler(int minIntervalMs) : minIntervalNs(minIntervalMs * 1000000LL) {
+}
+
+bool KeyframeRequestHandler::onRequest(const uint8_t* data, std::size_t len, int64_t nowNs) {
+    if (len < c_pictureLossSize || data[0] != c_pictureLossMagic) return false;
+    uint16_t sequence = get16(data + 2);
+    uint32_t lostFrame = get32(data + 4);
+    if (haveSequence && sequence == lastSequence && pending) return true;  // a repeat, already queued
+    lastSequence = sequence;
+    haveSequence = true;
+    counters.requests++;
+
+    if (keyframeSent && !seqNewer(lostFrame, lastKeyframe) && nowNs - lastKeyframeNs < minIntervalNs) {
+        // The keyframe is on its way; a repeat only means the receiver has not seen it yet
+        counters.answered++;
+        return true;
+    }
+    pending = true;
+    requestedAfter = lostFrame;
+    return true;
+}
+
+void KeyframeRequestHandler::onKeyframeSent(uint32_t frameId, int64_t nowNs) {
+    keyframeSent = true;
+    lastKeyframe = frameId;
+    lastKeyframeNs = nowNs;
+    if (pending && !seqNewer(requestedAfter, frameId)) pending = false;
+}
+
+bool KeyframeRequestHandler::takeKeyframe(int64_t nowNs) {
+    if (!pending) return false;
+    if (lastForcedNs && nowNs - lastForcedNs < minIntervalNs) {
+        counters.deferred++;
+        return false;
+    }
+    pending = false;
+    lastForcedNs = nowNs;
+    counters.forced++;
+    return true;
+}
+
+void KeyframeRequestHandler::dump(std::ostream& out) const {
+    out << "picture loss: " << counters.requests << " requests, " << counters.forced << " keyframes forced, "
+        << counters.answered << " already answered, " << counters.deferred << " frames deferred" << std::endl;
+}
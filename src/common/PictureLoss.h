@@ -0,0 +1,88 @@
+#ifndef PICTURELOSS_H
+#define PICTURELOSS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/* Receiver -> sender picture loss indication (network byte order), on the feedback path:
+     0  magic 0xFD
+     1  stream id
+     2  request sequence      (uint16, repeats of one loss keep the number)
+     4  lost frame id         (uint32, the first frame the decoder is missing)
+   Like the RTCP PLI of RFC 4585, but naming the frame, so the sender can tell whether a
+   keyframe already went out after it. The answer is an IDR on the next frame. */
+const uint8_t c_pictureLossMagic = 0xFD;
+const std::size_t c_pictureLossSize = 8;
+
+struct PictureLossStats {
+    uint64_t losses;     // reference chain breaks seen
+    uint64_t requests;   // datagrams sent, repeats included
+    uint64_t recovered;  // keyframes that ended a loss
+};
+
+/* Receiver side: one outstanding loss at a time. Losses while one is outstanding are
+   covered by the same keyframe and only coalesce; the request is repeated every
+   repeatMs until a keyframe from after the lost frame arrives. */
+class PictureLossReporter {
+public:
+    explicit PictureLossReporter(int repeatMs = 100);
+
+    void onLoss(uint32_t frameId, int64_t nowNs);
+    void onKeyframe(uint32_t frameId);
+
+    // Serializes a request into out (c_pictureLossSize bytes) when one is due, else returns 0
+    std::size_t takeRequest(uint8_t streamId, int64_t nowNs, uint8_t* out);
+
+    bool pending() const { return lost; }
+    PictureLossStats stats() const { return counters; }
+
+private:
+    int64_t repeatNs;
+    bool lost = false;
+    uint32_t lostFrame = 0;
+    uint16_t sequence = 0;
+    int64_t lastRequestNs = 0;
+    PictureLossStats counters = {};
+};
+
+struct KeyframeStats {
+    uint64_t requests;
+    uint64_t forced;     // IDRs inserted
+    uint64_t answered;   // requests a keyframe already sent after the loss covered
+    uint64_t deferred;   // requests held back by the minimum interval
+};
+
+/* Sender side: turns picture loss requests into forced keyframes, at most one per
+   minIntervalMs. A keyframe sent after the lost frame, periodic or forced, answers
+   every request naming an earlier frame, so bursts of losses and repeats coalesce.
+   Only for minIntervalMs though: a request still repeated after that means the
+   keyframe itself was lost. */
+class KeyframeRequestHandler {
+public:
+    explicit KeyframeRequestHandler(int minIntervalMs = 200);
+
+    // Returns false when the datagram is no picture loss indication
+    bool onRequest(const uint8_t* data, std::size_t len, int64_t nowNs);
+    void onKeyframeSent(uint32_t frameId, int64_t nowNs);
+
+    // True once when the next frame should be forced to an IDR
+    bool takeKeyframe(int64_t nowNs);
+
+    KeyframeStats stats() const { return counters; }
+    void dump(std::ostream& out) const;
+
+private:
+    int64_t minIntervalNs;
+    bool pending = false;
+    bool keyframeSent = false;
+    uint32_t lastKeyframe = 0;
+    int64_t lastKeyframeNs = 0;
+    uint32_t requestedAfter = 0;
+    uint16_t lastSequence = 0;
+    bool haveSequence = false;
+    int64_t lastForcedNs = 0;
+    KeyframeStats counters = {};
+};
+
+#endif // PICTURELOSS_H
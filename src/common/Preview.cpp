@@ -0,0 +1,111 @@
+#include "Preview.h"
+#include <algorithm>
+
+#ifndef HEADLESS
+
+static const int c_fontFace = cv::FONT_HERSHEY_SIMPLEX;
+static const double c_fontScale = 1.0;
+static const int c_thickness = 1;
+static const int c_margin = 10;
+
+// Text rendered once onto its own opaque strip, ready to be copied into frames
+static cv::Mat renderGlyphs(const std::string& text, int width, int height, int baseline) {
+    cv::Mat strip(height, width, CV_8UC3, cv::Scalar(0, 0, 0));
+    cv::putText(strip, text, cv::Point(0, height - baseline), c_fontFace, c_fontScale,
+        cv::Scalar(0, 0, 255), c_thickness);
+    return strip;
+}
+
+TimestampOverlay::TimestampOverlay() {
+    int baseline = 0;
+    cv::Size digitSize(0, 0);
+    for (char c = '0'; c <= '9'; ++c) {
+        cv::Size size = cv::getTextSize(std::string(1, c), c_fontFace, c_fontScale, c_thickness, &baseline);
+        digitSize.width = std::max(digitSize.width, size.width);
+        digitSize.height = std::max(digitSize.height, size.height);
+    }
+    int height = digitSize.height + baseline + 2;
+
+    cv::Size prefixSize = cv::getTextSize("Timestamp: ", c_fontFace, c_fontScale, c_thickness, &baseline);
+    cv::Size suffixSize = cv::getTextSize(" ms", c_fontFace, c_fontScale, c_thickness, &baseline);
+    prefix = renderGlyphs("Timestamp: ", prefixSize.width, height, baseline);
+    suffix = renderGlyphs(" ms", suffixSize.width, height, baseline);
+    for (char c = '0'; c <= '9'; ++c) {
+        digits.push_back(renderGlyphs(std::string(1, c), digitSize.width, height, baseline));
+    }
+}
+
+void TimestampOverlay::draw(cv::Mat& frame, int64_t millis) const {
+    char text[24];
+    int count = 0;
+    uint64_t value = millis < 0 ? 0 : static_cast<uint64_t>(millis);
+    do {
+        text[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value && count < static_cast<int>(sizeof(text)));
+
+    int x = c_margin;
+    int y = c_margin;
+    auto blit = [&](const cv::Mat& glyph) {
+        if (x + glyph.cols > frame.cols || y + glyph.rows > frame.rows) return;
+        cv::Mat target = frame(cv::Rect(x, y, glyph.cols, glyph.rows));
+        glyph.copyTo(target);
+        x += glyph.cols;
+    };
+    blit(prefix);
+    while (count > 0) blit(digits[text[--count] - '0']);
+    blit(suffix);
+}
+
+Preview::Preview(const std::string& windowName, double previewFps)
+    : windowName(windowName),
+      period(previewFps > 0.0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(1.0 / previewFps)) : std::chrono::steady_clock::duration::zero()) {
+}
+
+Preview::~Preview() {
+    stop();
+}
+
+void Preview::start() {
+    if (!enabled() || running) return;
+    running = true;
+    thread = std::thread(&Preview::render, this);
+}
+
+void Preview::stop() {
+    running = false;
+    if (thread.joinable()) thread.join();
+}
+
+void Preview::offer(const cv::Mat& frame, int64_t timestampMillis) {
+    if (!running) return;
+    auto now = std::chrono::steady_clock::now();
+    if (now < nextOffer) return;
+    nextOffer = now + period;
+
+    // The only per-frame cost on the pipeline: one copy into a reused buffer, at preview rate
+    Frame& target = slot.back();
+    frame.copyTo(target.image);
+    target.millis = timestampMillis;
+    slot.publish();
+}
+
+void Preview::render() {
+    cv::namedWindow(windowName, cv::WINDOW_AUTOSIZE);
+    while (running) {
+        if (slot.take()) {
+            Frame& frame = slot.front();
+            overlay.draw(frame.image, frame.millis);
+            cv::imshow(windowName, frame.image);
+        }
+        // Also pumps the GUI event loop; the wait doubles as the render thread's pacing
+        int waitMs = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(period).count());
+        if (cv::waitKey(std::max(1, waitMs / 2)) >= 0) {
+            keyPressed = true;
+        }
+    }
+    cv::destroyWindow(windowName);
+}
+
+#endif // HEADLESS
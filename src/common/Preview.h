@@ -0,0 +1,87 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <string>
+
+/* Local preview window, kept off the capture/encode path.
+   offer() is called from the pipeline: it returns at once unless a preview frame is due
+   (previewFps, far below the stream rate) and then only copies the frame into a
+   latest-value slot. Drawing, imshow and waitKey all happen on the preview's own thread.
+   Build with HEADLESS defined and the preview compiles down to empty inline calls. */
+#ifdef HEADLESS
+
+class Preview {
+public:
+    explicit Preview(const std::string&, double = 0.0) {}
+    void start() {}
+    void stop() {}
+    void offer(const cv::Mat&, int64_t) {}
+    bool closeRequested() const { return false; }
+    bool enabled() const { return false; }
+};
+
+#else
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "LatestSlot.h"
+
+// Renders "Timestamp: <millis> ms" by copying pre-rendered glyphs, no text layout per frame
+class TimestampOverlay {
+public:
+    TimestampOverlay();
+    void draw(cv::Mat& frame, int64_t millis) const;
+
+private:
+    cv::Mat prefix;               // "Timestamp: "
+    cv::Mat suffix;               // " ms"
+    std::vector<cv::Mat> digits;  // "0" .. "9", all the same width
+};
+
+class Preview {
+public:
+    // previewFps <= 0 disables the preview
+    explicit Preview(const std::string& windowName, double previewFps = 10.0);
+    ~Preview();
+
+    Preview(const Preview&) = delete;
+    Preview& operator=(const Preview&) = delete;
+
+    void start();
+    void stop();
+
+    // Pipeline side; never blocks
+    void offer(const cv::Mat& frame, int64_t timestampMillis);
+
+    // A key was pressed in the preview window
+    bool closeRequested() const { return keyPressed.load(std::memory_order_relaxed); }
+    bool enabled() const { return period.count() > 0; }
+
+private:
+    struct Frame {
+        cv::Mat image;
+        int64_t millis = 0;
+    };
+
+    void render();
+
+    std::string windowName;
+    std::chrono::steady_clock::duration period;
+    std::chrono::steady_clock::time_point nextOffer;  // pipeline thread only
+
+    LatestSlot<Frame> slot;
+    TimestampOverlay overlay;
+    std::thread thread;
+    std::atomic<bool> running{ false };
+    std::atomic<bool> keyPressed{ false };
+};
+
+#endif // HEADLESS
+
+#endif // PREVIEW_H
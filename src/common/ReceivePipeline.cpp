@@ -0,0 +1,212 @@
+#include "ReceivePipeline.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Idle wait of the presentation thread, so a key press is noticed without traffic
+static const std::chrono::milliseconds c_idleWait(100);
+
+bool parseReceiverOption(int argc, char* argv[], int& i, ReceivePipelineConfig& config) {
+    std::string arg = argv[i];
+    if (arg == "--headless") {
+        config.headless = true;
+    }
+    else if (arg == "--log" && i + 1 < argc) {
+        config.logPath = argv[++i];
+    }
+    else if (arg == "--duration" && i + 1 < argc) {
+        config.durationSeconds = atoi(argv[++i]);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+ReceivePipeline::ReceivePipeline(const ReceivePipelineConfig& config, Decoder decoder)
+    : config(config), decoder(std::move(decoder)),
+      decodeRing(config.decodeQueue, OverflowPolicy::DropOldest,
+          [this](EncodedFrame&) {
+              // Later inter frames reference the dropped one
+              if (this->config.interFrames) needKeyframe.store(true, std::memory_order_relaxed);
+          }),
+      spareBuffers(config.decodeQueue + 2, OverflowPolicy::DropNewest),
+      presentRing(config.presentQueue, OverflowPolicy::DropOldest),
+      spareImages(config.presentQueue + 2, OverflowPolicy::DropNewest) {
+}
+
+ReceivePipeline::~ReceivePipeline() {
+    finish();
+}
+
+void ReceivePipeline::submit(const ReassembledFrame& frame, int64_t completeNs, bool partial) {
+    EncodedFrame encoded;
+    // Only the first frames allocate; afterwards buffers come back from the decoder
+    spareBuffers.tryPop(encoded.data);
+    encoded.data.resize(frame.size + c_decoderPadding);
+    memcpy(encoded.data.data(), frame.data, frame.size);
+    memset(encoded.data.data() + frame.size, 0, c_decoderPadding);
+    encoded.size = frame.size;
+    encoded.frameId = frame.frameId;
+    encoded.timestamp = frame.timestamp;
+    encoded.keyframe = frame.keyframe;
+    encoded.partial = partial;
+    encoded.timing.captureMillis = frame.wallClock ? frame.timestamp : 0;
+    encoded.timing.completeNs = completeNs;
+    encoded.timing.completeWallUs = wallClockMicros() - (steadyNowNs() - completeNs) / 1000;
+    if (frame.wallClock && senderClock && senderClock->synchronised()) {
+        encoded.timing.captureLocalUs = senderClock->remoteToLocal(frame.timestamp * 1000);
+    }
+    decodeRing.push(std::move(encoded));
+}
+
+void ReceivePipeline::run(const std::function<void()>& network) {
+    catchInterrupt(true);
+    start();
+    std::thread networkThread(network);
+
+    present();
+
+    stop();
+    networkThread.join();
+    finish();
+    catchInterrupt(false);
+}
+
+void ReceivePipeline::start() {
+    if (!config.logPath.empty()) frameLog.open(config.logPath);
+    active.store(true, std::memory_order_release);
+    decodeThread = std::thread(&ReceivePipeline::decodeLoop, this);
+}
+
+void ReceivePipeline::finish() {
+    stop();
+    if (decodeThread.joinable()) decodeThread.join();
+    frameLog.close();
+}
+
+void ReceivePipeline::stop() {
+    active.store(false, std::memory_order_release);
+    decodeRing.close();
+    presentRing.close();
+}
+
+void ReceivePipeline::decodeLoop() {
+    EncodedFrame frame;
+    while (decodeRing.pop(frame)) {
+        frame.timing.decodeInNs = steadyNowNs();
+        bool usable = true;
+        if (config.interFrames && needKeyframe.load(std::memory_order_relaxed)) {
+            if (frame.keyframe) {
+                needKeyframe.store(false, std::memory_order_relaxed);
+            }
+            else {
+                skipped.fetch_add(1, std::memory_order_relaxed);
+                usable = false;
+            }
+        }
+
+        if (usable) {
+            DecodedFrame decoded;
+            spareImages.tryPop(decoded.image);
+            if (decoder(frame, decoded.image)) {
+                decoded.frameId = frame.frameId;
+                decoded.size = frame.size;
+                decoded.keyframe = frame.keyframe;
+                decoded.timestamp = frame.timestamp;
+                decoded.timing = frame.timing;
+                decoded.timing.decodeOutNs = steadyNowNs();
+                presentRing.push(std::move(decoded));
+            }
+            else {
+                undecoded.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        spareBuffers.push(std::move(frame.data));
+    }
+}
+
+void ReceivePipeline::present() {
+    double lastTime = static_cast<double>(cv::getTickCount());
+    int frameCount = 0;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config.durationSeconds);
+
+    DecodedFrame frame;
+    while (running()) {
+        if (interrupted() || (config.durationSeconds > 0 && std::chrono::steady_clock::now() >= deadline)) {
+            stop();
+            break;
+        }
+        if (!presentRing.popFor(frame, c_idleWait)) {
+#ifndef HEADLESS
+            if (!config.headless && cv::waitKey(1) >= 0) stop();
+#endif
+            continue;
+        }
+        show(frame);
+#ifndef HEADLESS
+        // Only pumps the window; frames are paced upstream
+        if (!config.headless && cv::waitKey(1) >= 0) stop();
+#endif
+
+        if (config.printFps && ++frameCount % 10 == 0) {
+            double currentTime = static_cast<double>(cv::getTickCount());
+            double fps = 10.0 / ((currentTime - lastTime) / cv::getTickFrequency());
+            lastTime = currentTime;
+            std::cout << "FPS: " << fps << std::endl;
+        }
+    }
+}
+
+int ReceivePipeline::presentReady() {
+    DecodedFrame frame;
+    int shown = 0;
+    while (presentRing.tryPop(frame)) {
+        show(frame);
+        shown++;
+    }
+    return shown;
+}
+
+void ReceivePipeline::show(DecodedFrame& frame) {
+    frame.timing.presentInNs = steadyNowNs();
+#ifndef HEADLESS
+    if (!config.headless) cv::imshow(config.windowName, frame.image);
+#endif
+    frame.timing.presentOutNs = steadyNowNs();
+    stageLatency.record(frame.timing);
+    frameLog.write(frame.frameId, frame.size, frame.keyframe, frame.timing);
+    presented.fetch_add(1, std::memory_order_relaxed);
+    spareImages.push(std::move(frame.image));
+}
+
+ReceivePipelineStats ReceivePipeline::stats() const {
+    ReceivePipelineStats s;
+    s.decodeRing = decodeRing.stats();
+    s.presentRing = presentRing.stats();
+    s.undecoded = undecoded.load(std::memory_order_relaxed);
+    s.skipped = skipped.load(std::memory_order_relaxed);
+    s.presented = presented.load(std::memory_order_relaxed);
+    return s;
+}
+
+static void dumpRing(std::ostream& out, const char* name, const RingStats& ring) {
+    out << name << ": " << ring.pushed << " queued, " << ring.dropped << " dropped, high watermark "
+        << ring.highWatermark << "/" << ring.capacity << "\n";
+}
+
+void ReceivePipeline::dump(std::ostream& out, const ReceiverStats& network) const {
+    dumpReceiverStats(out, network);
+    dump(out);
+}
+
+void ReceivePipeline::dump(std::ostream& out) const {
+    ReceivePipelineStats s = stats();
+    dumpRing(out, "decode ring", s.decodeRing);
+    dumpRing(out, "present ring", s.presentRing);
+    out << (config.headless ? "decoded " : "presented ") << s.presented << ", no image " << s.undecoded
+        << ", skipped until keyframe " << s.skipped << "\n";
+    if (frameLog.records()) out << "frame log: " << frameLog.records() << " records in " << config.logPath << "\n";
+    stageLatency.dump(out);
+}
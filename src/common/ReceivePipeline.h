@@ -0,0 +1,139 @@
+#ifndef RECEIVEPIPELINE_H
+#define RECEIVEPIPELINE_H
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ClockSync.h"
+#include "FrameLog.h"
+#include "FrameTiming.h"
+#include "Packetizer.h"
+#include "SpscRing.h"
+#include "UdpTransport.h"
+
+// A complete encoded frame on its way to the decoder
+struct EncodedFrame {
+    std::vector<uint8_t> data;  // frame plus c_decoderPadding zero bytes; recycled
+    std::size_t size = 0;
+    uint32_t frameId = 0;
+    int64_t timestamp = 0;
+    bool keyframe = false;
+    bool partial = false;  // only the slices that arrived whole, see Concealment.h
+    ReceiveTiming timing;
+};
+
+struct DecodedFrame {
+    cv::Mat image;  // BGR; recycled
+    uint32_t frameId = 0;
+    std::size_t size = 0;  // encoded bytes
+    bool keyframe = false;
+    int64_t timestamp = 0;
+    ReceiveTiming timing;
+};
+
+struct ReceivePipelineConfig {
+    std::string windowName = "Received Frame";
+    std::size_t decodeQueue = 8;   // encoded frames waiting for the decoder
+    std::size_t presentQueue = 2;  // decoded images waiting for the display
+    bool interFrames = false;      // after dropping a frame, resume decoding at a keyframe
+    bool printFps = false;         // "FPS: n" every 10 presented frames
+#ifdef HEADLESS
+    bool headless = true;          // no window: decode and measure only
+#else
+    bool headless = false;
+#endif
+    std::string logPath;           // binary per-frame log (FrameLog.h), empty for none
+    int durationSeconds = 0;       // stop after this long; 0 runs until a key or Ctrl-C
+};
+
+// Consumes --headless, --log <file> and --duration <s> at argv[i]; false if argv[i] is none of them
+bool parseReceiverOption(int argc, char* argv[], int& i, ReceivePipelineConfig& config);
+
+struct ReceivePipelineStats {
+    RingStats decodeRing;
+    RingStats presentRing;
+    uint64_t undecoded;  // frames the decoder produced no image for
+    uint64_t skipped;    // inter frames skipped while waiting for a keyframe
+    uint64_t presented;
+};
+
+/* Receiver split into three threads joined by bounded rings:
+     network -> decode ring -> decode -> present ring -> presentation (the caller's thread)
+   The network stage only reads the socket and copies complete frames into recycled
+   buffers; it never waits for the decoder. When decoding or display fall behind, the
+   oldest queued frame is dropped and counted here instead of datagrams piling up and
+   overflowing the socket buffer. */
+class ReceivePipeline {
+public:
+    // Decodes one frame into image, which keeps its memory between calls; false when no
+    // image came out
+    using Decoder = std::function<bool(const EncodedFrame& frame, cv::Mat& image)>;
+
+    ReceivePipeline(const ReceivePipelineConfig& config, Decoder decoder);
+    ~ReceivePipeline();
+
+    ReceivePipeline(const ReceivePipeline&) = delete;
+    ReceivePipeline& operator=(const ReceivePipeline&) = delete;
+
+    // Network thread: copies a complete frame in, never blocks. completeNs is when it was
+    // complete, which may be earlier than now when a jitter buffer held it.
+    void submit(const ReassembledFrame& frame, int64_t completeNs, bool partial = false);
+    // Capture times are mapped onto the local clock with the sender's clock estimate
+    // (ClockSync.h) for the network latency; set before start()
+    void setSenderClock(const ClockSync* clock) { senderClock = clock; }
+
+    // Runs network (which loops while running()) and the decoder on their own threads and
+    // presents on the calling thread until a key, Ctrl-C, the duration or stop()
+    void run(const std::function<void()>& network);
+    void stop();
+
+    // For a receiver that shows several pipelines from one thread: start() runs only the
+    // decoder, presentReady() shows whatever is decoded without waiting and returns how
+    // many frames that was, finish() stops and joins. Key presses are the caller's.
+    void start();
+    int presentReady();
+    void finish();
+    bool running() const { return active.load(std::memory_order_acquire); }
+    // A dropped frame broke the reference chain and inter frames are skipped
+    bool waitingForKeyframe() const { return needKeyframe.load(std::memory_order_relaxed); }
+
+    ReceivePipelineStats stats() const;
+    const ReceiveLatency& latency() const { return stageLatency; }
+
+    // Socket and ring counters and the per stage latency table
+    void dump(std::ostream& out, const ReceiverStats& network) const;
+    void dump(std::ostream& out) const;
+
+private:
+    void decodeLoop();
+    void present();
+    void show(DecodedFrame& frame);
+
+    ReceivePipelineConfig config;
+    Decoder decoder;
+    const ClockSync* senderClock = nullptr;
+
+    SpscRing<EncodedFrame> decodeRing;
+    SpscRing<std::vector<uint8_t>> spareBuffers;  // decoder -> network
+    SpscRing<DecodedFrame> presentRing;
+    SpscRing<cv::Mat> spareImages;                // presentation -> decoder
+
+    ReceiveLatency stageLatency;
+    FrameLog frameLog;
+    std::thread decodeThread;
+    std::atomic<bool> active{ false };
+    std::atomic<bool> needKeyframe{ false };
+    std::atomic<uint64_t> undecoded{ 0 };
+    std::atomic<uint64_t> skipped{ 0 };
+    std::atomic<uint64_t> presented{ 0 };
+};
+
+#endif // RECEIVEPIPELINE_H
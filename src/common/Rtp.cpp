@@ -0,0 +1,64 @@
+#include "Rtp.h"
+#include <random>
+
+void RtpHeader::write(uint8_t* out) const {
+    out[0] = static_cast<uint8_t>(c_rtpVersion << 6);  // no padding, no extension, no CSRCs
+    out[1] = static_cast<uint8_t>((marker ? 0x80 : 0) | (payloadType & 0x7f));
+    put16(out + 2, sequence);
+    put32(out + 4, timestamp);
+    put32(out + 8, ssrc);
+}
+
+std::size_t RtpHeader::read(const uint8_t* in, std::size_t len) {
+    if (!isRtpPacket(in, len)) return 0;
+    marker = (in[1] & 0x80) != 0;
+    payloadType = in[1] & 0x7f;
+    sequence = get16(in + 2);
+    timestamp = get32(in + 4);
+    ssrc = get32(in + 8);
+
+    std::size_t offset = c_rtpHeaderSize + 4 * (in[0] & 0x0f);
+    if (in[0] & 0x10) {
+        // Header extension: 4 byte header, then its length in 32-bit words
+        if (len < offset + 4) return 0;
+        offset += 4 + 4 * static_cast<std::size_t>(get16(in + offset + 2));
+    }
+    if (in[0] & 0x20) {
+        // Padding: the last byte counts the padding bytes
+        std::size_t padding = in[len - 1];
+        if (padding == 0 || len < offset + padding) return 0;
+        len -= padding;
+    }
+    if (offset > len) return 0;
+    payloadSize = len - offset;
+    return offset;
+}
+
+void splitAnnexB(const uint8_t* data, std::size_t size, std::vector<NalUnit>& nals) {
+    const uint8_t* start = nullptr;
+    std::size_t i = 0;
+    while (i + 3 <= size) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            if (start) {
+                // Trailing zeros belong to the next start code (00 00 00 01)
+                const uint8_t* end = data + i;
+                while (end > start && end[-1] == 0) --end;
+                nals.push_back(NalUnit{ start, static_cast<std::size_t>(end - start) });
+            }
+            i += 3;
+            start = data + i;
+        }
+        else {
+            // Neither of the next two positions can start a code if this byte is > 1
+            i += data[i + 2] > 1 ? 3 : 1;
+        }
+    }
+    if (start && start < data + size) {
+        nals.push_back(NalUnit{ start, static_cast<std::size_t>(data + size - start) });
+    }
+}
+
+uint32_t rtpRandom32() {
+    static std::random_device device;
+    return device();
+}
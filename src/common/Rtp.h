@@ -0,0 +1,457 @@
+#ifndef RTP_H
+#define RTP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ByteOrder.h"
+#include "Packetizer.h"
+
+/* RTP packetization of H.264 (RFC 6184) and H.265 (RFC 7798) access units.
+   Small NAL units (parameter sets, SEI) are aggregated into STAP-A / AP packets, large
+   ones are split into FU-A / FU packets of equal size, anything else goes out as a single
+   NAL unit packet. The last packet of an access unit carries the marker bit, which is
+   what the XDP frame dropper (src/ebpf/frame_drop) keys on.
+   Packets reuse Fragment, so UdpSender sends them exactly like native fragments: the RTP
+   and FU headers live in the fragment header, the payload points into the encoder's
+   packet. Only aggregated NAL units are copied. */
+const std::size_t c_rtpHeaderSize = 12;
+const uint8_t c_rtpVersion = 2;
+const uint8_t c_rtpDynamicPayloadType = 96;
+const uint32_t c_rtpVideoClockRate = 90000;
+
+struct RtpHeader {
+    bool marker = false;
+    uint8_t payloadType = c_rtpDynamicPayloadType;
+    uint16_t sequence = 0;
+    uint32_t timestamp = 0;
+    uint32_t ssrc = 0;
+    std::size_t payloadSize = 0;  // set by read(), padding excluded
+
+    void write(uint8_t* out) const;
+    // Returns the payload offset, 0 if this is not an RTP packet we can handle
+    std::size_t read(const uint8_t* in, std::size_t len);
+};
+
+// The first byte tells RTP (version 2) and our native fragments (version 1) apart
+inline bool isRtpPacket(const uint8_t* datagram, std::size_t len) {
+    return len >= c_rtpHeaderSize && (datagram[0] >> 6) == c_rtpVersion;
+}
+
+struct NalUnit {
+    const uint8_t* data;  // starts at the NAL header, start code stripped
+    std::size_t size;
+};
+
+// Splits an Annex-B byte stream at its 3- and 4-byte start codes
+void splitAnnexB(const uint8_t* data, std::size_t size, std::vector<NalUnit>& nals);
+
+// Random SSRC and timestamp base, as RFC 3550 asks for
+uint32_t rtpRandom32();
+
+/* Codec specifics, resolved at compile time: the packetizer and depacketizer are
+   templates over one of these, so the per-packet header code has no codec branches. */
+struct H264Payload {
+    static const std::size_t c_nalHeaderSize = 1;
+    static const std::size_t c_fuHeaderSize = 2;         // FU indicator + FU header
+    static const std::size_t c_aggregateHeaderSize = 1;  // STAP-A NAL header
+    static const int c_aggregateType = 24;               // STAP-A
+    static const int c_fragmentType = 28;                // FU-A
+
+    static int nalType(const uint8_t* nal) { return nal[0] & 0x1f; }
+    static bool isKeyframe(int type) { return type == 5 || type == 7 || type == 8; }  // IDR, SPS, PPS
+
+    static void fuHeader(const uint8_t* nal, bool start, bool end, uint8_t* out) {
+        out[0] = static_cast<uint8_t>((nal[0] & 0xe0) | c_fragmentType);
+        out[1] = static_cast<uint8_t>((start ? 0x80 : 0) | (end ? 0x40 : 0) | (nal[0] & 0x1f));
+    }
+    // F is the OR of the aggregated units' F bits, NRI their maximum
+    static void beginAggregate(uint8_t* out) { out[0] = c_aggregateType; }
+    static void addToAggregate(uint8_t* out, const uint8_t* nal) {
+        out[0] = static_cast<uint8_t>((out[0] & 0x80) | (nal[0] & 0x80) | std::max(out[0] & 0x60, nal[0] & 0x60) | c_aggregateType);
+    }
+
+    // Depacketizer: the NAL header a fragmented unit is rebuilt with
+    static bool fuStart(const uint8_t* payload) { return (payload[1] & 0x80) != 0; }
+    static bool fuEnd(const uint8_t* payload) { return (payload[1] & 0x40) != 0; }
+    static void fuNalHeader(const uint8_t* payload, uint8_t* out) {
+        out[0] = static_cast<uint8_t>((payload[0] & 0xe0) | (payload[1] & 0x1f));
+    }
+};
+
+struct H265Payload {
+    static const std::size_t c_nalHeaderSize = 2;
+    static const std::size_t c_fuHeaderSize = 3;         // payload header + FU header
+    static const std::size_t c_aggregateHeaderSize = 2;  // AP payload header
+    static const int c_aggregateType = 48;               // AP
+    static const int c_fragmentType = 49;                // FU
+
+    static int nalType(const uint8_t* nal) { return (nal[0] >> 1) & 0x3f; }
+    static bool isKeyframe(int type) { return (type >= 16 && type <= 21) || (type >= 32 && type <= 34); }  // IRAP, VPS/SPS/PPS
+
+    static void fuHeader(const uint8_t* nal, bool start, bool end, uint8_t* out) {
+        out[0] = static_cast<uint8_t>((nal[0] & 0x81) | (c_fragmentType << 1));
+        out[1] = nal[1];
+        out[2] = static_cast<uint8_t>((start ? 0x80 : 0) | (end ? 0x40 : 0) | nalType(nal));
+    }
+    // F is the OR of the aggregated units' F bits, LayerId and TID their minimum
+    static void beginAggregate(uint8_t* out) {
+        out[0] = static_cast<uint8_t>((c_aggregateType << 1) | 0x01);
+        out[1] = 0xff;
+    }
+    static void addToAggregate(uint8_t* out, const uint8_t* nal) {
+        int layer = std::min(((out[0] & 0x01) << 5) | (out[1] >> 3), ((nal[0] & 0x01) << 5) | (nal[1] >> 3));
+        int tid = std::min(out[1] & 0x07, nal[1] & 0x07);
+        out[0] = static_cast<uint8_t>((out[0] & 0x80) | (nal[0] & 0x80) | (c_aggregateType << 1) | (layer >> 5));
+        out[1] = static_cast<uint8_t>(((layer & 0x1f) << 3) | tid);
+    }
+
+    static bool fuStart(const uint8_t* payload) { return (payload[2] & 0x80) != 0; }
+    static bool fuEnd(const uint8_t* payload) { return (payload[2] & 0x40) != 0; }
+    static void fuNalHeader(const uint8_t* payload, uint8_t* out) {
+        out[0] = static_cast<uint8_t>((payload[0] & 0x81) | ((payload[2] & 0x3f) << 1));
+        out[1] = payload[1];
+    }
+};
+
+template<typename Codec>
+class RtpPacketizer {
+public:
+    explicit RtpPacketizer(std::size_t mtu = c_defaultMtu, uint8_t payloadType = c_rtpDynamicPayloadType)
+        : payloadType(payloadType), maxPayload(mtu - c_ipUdpOverhead - c_rtpHeaderSize),
+          sequence(static_cast<uint16_t>(rtpRandom32())), ssrc(rtpRandom32()), timestampBase(rtpRandom32()) {
+    }
+
+    // 90 kHz media timestamp of a frame captured at captureMillis
+    uint32_t timestampFor(int64_t captureMillis) const {
+        return timestampBase + static_cast<uint32_t>(captureMillis * (c_rtpVideoClockRate / 1000));
+    }
+
+    // Packets of one Annex-B access unit, valid until the next call
+    const std::vector<Fragment>& packetize(const uint8_t* data, std::size_t size, uint32_t timestamp) {
+        packets.clear();
+        nals.clear();
+        splitAnnexB(data, size, nals);
+        // Aggregates point into this buffer, so it must never reallocate during a frame
+        aggregates.clear();
+        aggregates.reserve(size + (2 + Codec::c_aggregateHeaderSize) * nals.size());
+        pending = 0;
+
+        for (const NalUnit& nal : nals) {
+            if (nal.size < Codec::c_nalHeaderSize) continue;
+            if (nal.size > maxPayload) {
+                flushAggregate(timestamp);
+                fragment(nal, timestamp);
+            }
+            else if (pending && aggregateSize + 2 + nal.size <= maxPayload) {
+                addToAggregate(nal);
+            }
+            else {
+                flushAggregate(timestamp);
+                startAggregate(nal);
+            }
+        }
+        flushAggregate(timestamp);
+
+        if (!packets.empty()) {
+            packets.back().header[1] |= 0x80;  // marker: last packet of the access unit
+        }
+        return packets;
+    }
+
+    uint32_t ssrcId() const { return ssrc; }
+    uint16_t nextSequence() const { return sequence; }
+
+private:
+    Fragment& newPacket(uint32_t timestamp) {
+        packets.emplace_back();
+        Fragment& packet = packets.back();
+        RtpHeader header;
+        header.payloadType = payloadType;
+        header.sequence = sequence++;
+        header.timestamp = timestamp;
+        header.ssrc = ssrc;
+        header.write(packet.header);
+        packet.headerSize = c_rtpHeaderSize;
+        return packet;
+    }
+
+    // FU-A / FU: spread the NAL unit evenly, the original NAL header becomes the FU header
+    void fragment(const NalUnit& nal, uint32_t timestamp) {
+        const uint8_t* body = nal.data + Codec::c_nalHeaderSize;
+        std::size_t bodySize = nal.size - Codec::c_nalHeaderSize;
+        std::size_t chunk = maxPayload - Codec::c_fuHeaderSize;
+        std::size_t count = (bodySize + chunk - 1) / chunk;
+        std::size_t stride = (bodySize + count - 1) / count;
+        for (std::size_t i = 0; i < count; ++i) {
+            Fragment& packet = newPacket(timestamp);
+            Codec::fuHeader(nal.data, i == 0, i + 1 == count, packet.header + c_rtpHeaderSize);
+            packet.headerSize = c_rtpHeaderSize + Codec::c_fuHeaderSize;
+            std::size_t offset = i * stride;
+            packet.payload = body + offset;
+            packet.size = offset + stride > bodySize ? bodySize - offset : stride;
+        }
+    }
+
+    // Units are held back until it is known whether a second one fits with them
+    void startAggregate(const NalUnit& nal) {
+        first = nal;
+        pending = 1;
+        aggregateSize = Codec::c_aggregateHeaderSize + 2 + nal.size;
+    }
+
+    void addToAggregate(const NalUnit& nal) {
+        if (pending == 1) {
+            aggregateStart = aggregates.size();
+            aggregates.resize(aggregates.size() + Codec::c_aggregateHeaderSize);
+            Codec::beginAggregate(&aggregates[aggregateStart]);
+            appendToAggregate(first);
+        }
+        appendToAggregate(nal);
+        pending++;
+        aggregateSize += 2 + nal.size;
+    }
+
+    void appendToAggregate(const NalUnit& nal) {
+        Codec::addToAggregate(&aggregates[aggregateStart], nal.data);
+        std::size_t at = aggregates.size();
+        aggregates.resize(at + 2 + nal.size);
+        put16(&aggregates[at], static_cast<uint16_t>(nal.size));
+        memcpy(&aggregates[at + 2], nal.data, nal.size);
+    }
+
+    void flushAggregate(uint32_t timestamp) {
+        if (pending == 0) return;
+        Fragment& packet = newPacket(timestamp);
+        if (pending == 1) {
+            // A lone unit goes out as a single NAL unit packet, no copy
+            packet.payload = first.data;
+            packet.size = first.size;
+        }
+        else {
+            packet.payload = &aggregates[aggregateStart];
+            packet.size = aggregates.size() - aggregateStart;
+        }
+        pending = 0;
+    }
+
+    uint8_t payloadType;
+    std::size_t maxPayload;
+    uint16_t sequence;
+    uint32_t ssrc;
+    uint32_t timestampBase;
+
+    std::vector<Fragment> packets;
+    std::vector<NalUnit> nals;
+    std::vector<uint8_t> aggregates;
+    std::size_t aggregateStart = 0;
+    std::size_t aggregateSize = 0;
+    NalUnit first = { nullptr, 0 };
+    int pending = 0;
+};
+
+struct RtpStats {
+    uint64_t packets;
+    uint64_t frames;
+    uint64_t lost;        // sequence numbers never seen
+    uint64_t discarded;   // frames dropped because a packet of theirs was lost
+    uint64_t malformed;
+    uint64_t restarts;    // new SSRC or sequence jump: the sender was restarted
+};
+
+/* Receiver side: rebuilds Annex-B access units (start codes included, zero padded for
+   FFmpeg's parsers) from RTP packets. A frame is complete at its marker bit, or when the
+   next timestamp shows up and its marker was lost. Frames with a sequence gap are
+   dropped whole instead of being handed to the decoder half-built. A new SSRC or a
+   sequence jump of thousands of packets is a restarted sender, which picks a fresh
+   random sequence base: the partial frame is dropped and numbering starts over. */
+template<typename Codec>
+class RtpDepacketizer {
+public:
+    explicit RtpDepacketizer(std::size_t maxFrameSize = 8 * 1024 * 1024) : maxFrameSize(maxFrameSize) {
+        building.reserve(64 * 1024);
+        done.reserve(64 * 1024);
+    }
+
+    // Returns true when a frame is complete; its data stays valid until the next call
+    bool push(const uint8_t* datagram, std::size_t len, ReassembledFrame& frame) {
+        RtpHeader header;
+        std::size_t offset = header.read(datagram, len);
+        if (!offset || header.payloadSize == 0) {
+            counters.malformed++;
+            return false;
+        }
+        counters.packets++;
+
+        if (started && (header.ssrc != ssrc ||
+            std::abs(static_cast<int16_t>(header.sequence - expectedSequence)) > c_maxSequenceJump)) {
+            restart();
+        }
+        ssrc = header.ssrc;
+
+        bool gap = false;
+        if (started) {
+            int16_t delta = static_cast<int16_t>(header.sequence - expectedSequence);
+            if (delta < 0) return false;  // late or duplicate, its frame is gone already
+            if (delta > 0) {
+                counters.lost += delta;
+                gap = true;
+                broken = true;
+            }
+        }
+        expectedSequence = static_cast<uint16_t>(header.sequence + 1);
+
+        bool completed = false;
+        if (started && header.timestamp != timestamp) {
+            // The previous frame's marker never came. The missing packets may have belonged
+            // to either frame, so a gap here spoils both.
+            if (!building.empty() || broken) completed = finish(frame);
+            broken = gap;
+        }
+        if (!started || header.timestamp != timestamp) {
+            extendedTimestamp += started ? static_cast<int32_t>(header.timestamp - timestamp) : 0;
+            timestamp = header.timestamp;
+            started = true;
+        }
+
+        append(datagram + offset, header.payloadSize);
+
+        if (header.marker) {
+            if (completed) {
+                // Two frames in one push only happens when a marker got lost; keep the newer
+                counters.frames--;
+                counters.discarded++;
+            }
+            completed = finish(frame);
+        }
+        return completed;
+    }
+
+    RtpStats stats() const { return counters; }
+
+private:
+    static const int c_maxSequenceJump = 3000;
+
+    // Forgets the old sender's partial frame; the next packet starts a new sequence
+    void restart() {
+        if (!building.empty() || broken) counters.discarded++;
+        building.clear();
+        broken = false;
+        inFragment = false;
+        keyframe = false;
+        started = false;
+        counters.restarts++;
+    }
+
+    void startCode() {
+        static const uint8_t code[4] = { 0, 0, 0, 1 };
+        building.insert(building.end(), code, code + 4);
+    }
+
+    void appendNal(const uint8_t* nal, std::size_t size) {
+        if (size < Codec::c_nalHeaderSize) {
+            broken = true;
+            return;
+        }
+        if (Codec::isKeyframe(Codec::nalType(nal))) keyframe = true;
+        startCode();
+        building.insert(building.end(), nal, nal + size);
+    }
+
+    void append(const uint8_t* payload, std::size_t size) {
+        if (size < Codec::c_nalHeaderSize) {
+            counters.malformed++;
+            broken = true;
+            return;
+        }
+        if (building.size() + size + 64 > maxFrameSize) {
+            broken = true;
+            return;
+        }
+        int type = Codec::nalType(payload);
+        if (type == Codec::c_aggregateType) {
+            std::size_t at = Codec::c_aggregateHeaderSize;
+            while (at + 2 <= size) {
+                std::size_t nalSize = get16(payload + at);
+                at += 2;
+                if (at + nalSize > size) {
+                    counters.malformed++;
+                    broken = true;
+                    return;
+                }
+                appendNal(payload + at, nalSize);
+                at += nalSize;
+            }
+        }
+        else if (type == Codec::c_fragmentType) {
+            if (size <= Codec::c_fuHeaderSize) {
+                counters.malformed++;
+                broken = true;
+                return;
+            }
+            if (Codec::fuStart(payload)) {
+                uint8_t nalHeader[Codec::c_nalHeaderSize];
+                Codec::fuNalHeader(payload, nalHeader);
+                if (Codec::isKeyframe(Codec::nalType(nalHeader))) keyframe = true;
+                startCode();
+                building.insert(building.end(), nalHeader, nalHeader + Codec::c_nalHeaderSize);
+                inFragment = true;
+            }
+            else if (!inFragment) {
+                // Missed the start of this unit
+                broken = true;
+                return;
+            }
+            building.insert(building.end(), payload + Codec::c_fuHeaderSize, payload + size);
+            if (Codec::fuEnd(payload)) inFragment = false;
+        }
+        else {
+            appendNal(payload, size);
+        }
+    }
+
+    bool finish(ReassembledFrame& frame) {
+        bool ok = !broken && !inFragment && !building.empty();
+        if (ok) {
+            done.swap(building);
+            done.insert(done.end(), c_decoderPadding, 0);
+            frame.streamId = 0;
+            frame.frameId = nextFrameId++;
+            frame.timestamp = extendedTimestamp / (c_rtpVideoClockRate / 1000);
+            frame.wallClock = false;
+            frame.keyframe = keyframe;
+            frame.data = done.data();
+            frame.size = done.size() - c_decoderPadding;
+            counters.frames++;
+        }
+        else if (!building.empty() || broken) {
+            counters.discarded++;
+        }
+        building.clear();
+        broken = false;
+        inFragment = false;
+        keyframe = false;
+        return ok;
+    }
+
+    std::size_t maxFrameSize;
+    std::vector<uint8_t> building;
+    std::vector<uint8_t> done;
+
+    bool started = false;
+    uint32_t ssrc = 0;
+    uint16_t expectedSequence = 0;
+    uint32_t timestamp = 0;
+    int64_t extendedTimestamp = 0;
+    bool broken = false;
+    bool inFragment = false;
+    bool keyframe = false;
+    uint32_t nextFrameId = 0;
+    RtpStats counters = {};
+};
+
+#endif // RTP_H
@@ -0,0 +1,249 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+const std::size_t c_cacheLineSize = 64;
+
+// What push() does when the ring is full
+enum class OverflowPolicy {
+    DropOldest,  // evict the oldest queued item, keep latency bounded
+    DropNewest,  // reject the item being pushed
+    Block        // wait for the consumer (back-pressure)
+};
+
+struct RingStats {
+    uint64_t pushed;
+    uint64_t popped;
+    uint64_t dropped;
+    std::size_t occupancy;
+    std::size_t highWatermark;
+    std::size_t capacity;
+};
+
+/* Bounded single-producer/single-consumer ring.
+   Every slot carries a sequence number, so the only multi-writer index is head:
+   it is claimed by CAS from both the consumer and (under DropOldest) the producer
+   evicting the oldest item. Indices and slots are padded to separate cache lines. */
+template <typename T>
+class SpscRing {
+public:
+    SpscRing(std::size_t capacity, OverflowPolicy policy,
+        std::function<void(T&)> dropHandler = nullptr)
+        : policy(policy), dropHandler(std::move(dropHandler)) {
+        std::size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask = cap - 1;
+        slots.reset(new Slot[cap]);
+        for (std::size_t i = 0; i < cap; ++i) {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer side. Returns false if the item was not queued (dropped or closed).
+    bool push(T item) {
+        while (true) {
+            if (closed.load(std::memory_order_acquire)) {
+                drop(item);
+                return false;
+            }
+
+            std::size_t pos = tail.value.load(std::memory_order_relaxed);
+            Slot& slot = slots[pos & mask];
+            std::size_t seq = slot.seq.load(std::memory_order_acquire);
+
+            if (seq == pos) {
+                slot.value = std::move(item);
+                slot.seq.store(pos + 1, std::memory_order_release);
+                tail.value.store(pos + 1, std::memory_order_seq_cst);
+                pushedCount.value.fetch_add(1, std::memory_order_relaxed);
+                updateWatermark(pos + 1 - head.value.load(std::memory_order_relaxed));
+                wake(consumerWaiting);
+                return true;
+            }
+
+            if (pos - head.value.load(std::memory_order_acquire) <= mask) {
+                // Consumer claimed the slot but is still moving the value out
+                std::this_thread::yield();
+                continue;
+            }
+
+            switch (policy) {
+            case OverflowPolicy::DropNewest:
+                drop(item);
+                return false;
+            case OverflowPolicy::DropOldest: {
+                T oldest;
+                if (tryPop(oldest, false)) drop(oldest);
+                break;
+            }
+            case OverflowPolicy::Block:
+                park(producerWaiting, [this] { return !full(); });
+                break;
+            }
+        }
+    }
+
+    // Consumer side, non-blocking
+    bool tryPop(T& out) {
+        return tryPop(out, true);
+    }
+
+    // Consumer side, waits until an item arrives or the ring is closed
+    bool pop(T& out) {
+        while (true) {
+            if (tryPop(out, true)) return true;
+            if (closed.load(std::memory_order_acquire)) return false;
+            park(consumerWaiting, [this] { return !empty(); });
+        }
+    }
+
+    // Consumer side, gives up after timeout so the caller can do periodic work
+    bool popFor(T& out, std::chrono::milliseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (true) {
+            if (tryPop(out, true)) return true;
+            auto now = std::chrono::steady_clock::now();
+            if (closed.load(std::memory_order_acquire) || now >= deadline) return false;
+            park(consumerWaiting, [this] { return !empty(); }, std::chrono::duration_cast<std::chrono::microseconds>(deadline - now));
+        }
+    }
+
+    // Wakes every waiter; later pushes are dropped, pops drain what is left
+    void close() {
+        closed.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(waitMutex);
+        waitCondVar.notify_all();
+    }
+
+    // True once close() was called; items may still be queued
+    bool isClosed() const {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return tail.value.load() == head.value.load();
+    }
+
+    bool full() const {
+        return size() > mask;
+    }
+
+    std::size_t size() const {
+        std::size_t h = head.value.load();
+        std::size_t t = tail.value.load();
+        return t > h ? t - h : 0;
+    }
+
+    std::size_t capacity() const { return mask + 1; }
+
+    RingStats stats() const {
+        RingStats s;
+        s.pushed = pushedCount.value.load(std::memory_order_relaxed);
+        s.popped = poppedCount.value.load(std::memory_order_relaxed);
+        s.dropped = droppedCount.value.load(std::memory_order_relaxed);
+        s.occupancy = size();
+        s.highWatermark = watermark.value.load(std::memory_order_relaxed);
+        s.capacity = capacity();
+        return s;
+    }
+
+private:
+    struct alignas(c_cacheLineSize) Slot {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
+    template <typename V>
+    struct alignas(c_cacheLineSize) Padded {
+        std::atomic<V> value{ 0 };
+    };
+
+    bool tryPop(T& out, bool countAsPopped) {
+        std::size_t pos = head.value.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            std::size_t seq = slot.seq.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+
+            if (diff == 0) {
+                if (head.value.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst)) {
+                    out = std::move(slot.value);
+                    slot.value = T();
+                    slot.seq.store(pos + mask + 1, std::memory_order_release);
+                    if (countAsPopped) poppedCount.value.fetch_add(1, std::memory_order_relaxed);
+                    wake(producerWaiting);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = head.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void drop(T& item) {
+        droppedCount.value.fetch_add(1, std::memory_order_relaxed);
+        if (dropHandler) dropHandler(item);
+    }
+
+    void updateWatermark(std::size_t occupancy) {
+        std::size_t prev = watermark.value.load(std::memory_order_relaxed);
+        while (occupancy > prev &&
+            !watermark.value.compare_exchange_weak(prev, occupancy, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Waiters only touch the mutex when the ring is empty/full, never on the fast path
+    template <typename Pred>
+    void park(std::atomic<bool>& waiting, Pred ready, std::chrono::microseconds limit = std::chrono::milliseconds(10)) {
+        std::unique_lock<std::mutex> lock(waitMutex);
+        waiting.store(true, std::memory_order_seq_cst);
+        if (!ready() && !closed.load(std::memory_order_acquire)) {
+            waitCondVar.wait_for(lock, std::min<std::chrono::microseconds>(limit, std::chrono::milliseconds(10)));
+        }
+        waiting.store(false, std::memory_order_relaxed);
+    }
+
+    void wake(std::atomic<bool>& waiting) {
+        if (waiting.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            waitCondVar.notify_all();
+        }
+    }
+
+    Padded<std::size_t> head;
+    Padded<std::size_t> tail;
+    Padded<uint64_t> pushedCount;
+    Padded<uint64_t> poppedCount;
+    Padded<uint64_t> droppedCount;
+    Padded<std::size_t> watermark;
+
+    std::unique_ptr<Slot[]> slots;
+    std::size_t mask;
+    OverflowPolicy policy;
+    std::function<void(T&)> dropHandler;
+
+    std::atomic<bool> closed{ false };
+    std::atomic<bool> consumerWaiting{ false };
+    std::atomic<bool> producerWaiting{ false };
+    std::mutex waitMutex;
+    std::condition_variable waitCondVar;
+};
+
+#endif // SPSCRING_H
@@ -0,0 +1,138 @@
+#include "StreamReceiver.h"
+
+#include "ByteOrder.h"
+#include "Concealment.h"
+#include "FrameTiming.h"
+
+// Incomplete frames handed to the decoder per gap; longer gaps wait for the keyframe
+static const uint32_t c_maxSalvaged = 4;
+
+StreamReceiver::StreamReceiver(UdpReceiver& socket, ReceivePipeline& pipeline, const JitterBufferConfig& jitterConfig,
+    uint8_t streamId, bool conceal)
+    : socket(&socket), pipeline(pipeline), conceal(conceal), jitterBuffer(jitterConfig), clock(streamId),
+      streamId(streamId) {
+}
+
+void StreamReceiver::reply(const uint8_t* data, std::size_t len) {
+    if (havePeer) socket->sendTo(data, len, peer);
+}
+
+void StreamReceiver::onDatagram(const uint8_t* data, std::size_t len, const sockaddr_in& from, int64_t arrivalNs) {
+    if (data[0] == c_clockMagic) {
+        clock.onResponse(data, len, wallClockMicros() - (steadyNowNs() - arrivalNs) / 1000);
+        return;
+    }
+    peer = from;
+    havePeer = true;
+
+    feedback.onDatagram(data, len, arrivalNs);
+    std::size_t reportLen = feedback.takeReport(arrivalNs, report);
+    if (reportLen) {
+        reply(report, reportLen);
+    }
+
+    // Wait until every fragment of a frame is in; it lands in a zero-padded buffer
+    nack.onDatagram(data, len, arrivalNs);
+    if (reassembler.push(data, len, assembled)) {
+        nack.onFrameComplete(assembled.frameId);
+        jitterBuffer.insert(assembled, arrivalNs / 1000000);
+    }
+}
+
+void StreamReceiver::onFrame(const ReassembledFrame& frame, int64_t arrivalNs) {
+    jitterBuffer.insert(frame, arrivalNs / 1000000);
+}
+
+int64_t StreamReceiver::waitMs(int64_t nowNs) const {
+    int64_t wait = syncHolding ? 1 : jitterBuffer.waitMs(nowNs / 1000000);
+    int64_t nackWait = nack.waitMs(nowNs);
+    if (nackWait >= 0 && (wait < 0 || nackWait < wait)) wait = nackWait;
+    return wait;
+}
+
+void StreamReceiver::salvage(uint8_t stream, uint32_t until) {
+    if (until - nextFrameId > c_maxSalvaged) return;
+    for (uint32_t id = nextFrameId; id != until; ++id) {
+        PartialFrame partial;
+        if (!reassembler.salvage(stream, id, partial) || !extractCompleteNals(partial, salvaged)) continue;
+        ReassembledFrame frame = partial.frame;
+        frame.data = salvaged.data();
+        frame.size = salvaged.size();
+        pipeline.submit(frame, steadyNowNs(), true);
+    }
+}
+
+bool StreamReceiver::syncAllows() {
+    const ReassembledFrame* next = sync ? jitterBuffer.peek(steadyNowNs() / 1000000) : nullptr;
+    syncHolding = next && next->wallClock && !sync->frameReady(next->timestamp * 1000, steadyNowNs());
+    return !syncHolding;
+}
+
+void StreamReceiver::poll() {
+    // A resend is of use only until the frame's playout time
+    nack.setDeadline(static_cast<int>(jitterBuffer.stats().targetDelayMs));
+    std::size_t nackLen = nack.takeNack(steadyNowNs(), report);
+    if (nackLen) {
+        reply(report, nackLen);
+    }
+
+    // Every frame whose playout time has come, in frame order
+    ReassembledFrame playout;
+    int64_t arrivalMs;
+    while (syncAllows() && jitterBuffer.pop(steadyNowNs() / 1000000, playout, &arrivalMs)) {
+        // A frame that never came (past FEC and NACK) breaks the reference chain,
+        // as does starting in the middle of a GOP. RTP senders take no feedback.
+        if (playout.wallClock) {
+            // What did arrive of the frames skipped over goes to the decoder first
+            if (conceal && playing && seqNewer(playout.frameId, nextFrameId)) {
+                salvage(playout.streamId, playout.frameId);
+            }
+            if (playout.keyframe) {
+                pictureLoss.onKeyframe(playout.frameId);
+            }
+            else if (!playing || playout.frameId != nextFrameId) {
+                pictureLoss.onLoss(playing ? nextFrameId : playout.frameId, steadyNowNs());
+            }
+            nextFrameId = playout.frameId + 1;
+            streamId = playout.streamId;
+            playing = true;
+            if (sync) sync->onFrame(playout.timestamp * 1000, steadyNowNs());
+        }
+        pipeline.submit(playout, arrivalMs * 1000000);
+    }
+    // The decode ring dropped a frame; once, as the flag stays up until the decoder
+    // reaches a keyframe
+    bool waiting = pipeline.waitingForKeyframe();
+    if (playing && waiting && !decoderWaiting) {
+        pictureLoss.onLoss(nextFrameId, steadyNowNs());
+    }
+    decoderWaiting = waiting;
+    std::size_t lossLen = pictureLoss.takeRequest(streamId, steadyNowNs(), report);
+    if (lossLen) {
+        reply(report, lossLen);
+    }
+    // Only native senders answer; RTP ones never set the peer
+    std::size_t clockLen = havePeer ? clock.takeRequest(wallClockMicros(), report) : 0;
+    if (clockLen) {
+        reply(report, clockLen);
+    }
+}
+
+void StreamReceiver::dump(std::ostream& out) const {
+    ReassemblyStats reassembly = reassembler.stats();
+    out << "Reassembly: completed " << reassembly.completed << ", evicted " << reassembly.evicted
+        << ", FEC repairs " << reassembly.repairs << ", recovered " << reassembly.recovered << " fragments, "
+        << reassembly.salvaged << " incomplete frames salvaged\n";
+    NackStats nackStats = nack.stats();
+    out << "NACK: " << nackStats.messages << " requests for " << nackStats.requested << " fragments, "
+        << nackStats.retransmitted << " resent, " << nackStats.repaired << " frames repaired, "
+        << nackStats.abandoned << " given up, rtt " << nackStats.rttMs << " ms\n";
+    PictureLossStats lossStats = pictureLoss.stats();
+    out << "Picture loss: " << lossStats.losses << " losses, " << lossStats.requests << " keyframe requests, "
+        << lossStats.recovered << " recovered\n";
+    JitterBufferStats jitterStats = jitterBuffer.stats();
+    out << "Jitter buffer: played " << jitterStats.played << ", late " << jitterStats.late
+        << ", missing " << jitterStats.missing << ", overflow " << jitterStats.overflow
+        << ", jitter " << jitterStats.jitterMs << " ms, target delay " << jitterStats.targetDelayMs << " ms\n";
+    clock.dump(out);
+}
@@ -0,0 +1,82 @@
+#ifndef STREAMRECEIVER_H
+#define STREAMRECEIVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "ClockSync.h"
+#include "CongestionControl.h"
+#include "JitterBuffer.h"
+#include "Nack.h"
+#include "Packetizer.h"
+#include "PictureLoss.h"
+#include "ReceivePipeline.h"
+#include "SyncEngine.h"
+#include "UdpTransport.h"
+
+/* Receive side of one video stream, between the socket and its decoder: reassembly with
+   FEC recovery, the jitter buffer, and what goes back to the sender (arrival reports for
+   the bitrate, NACKs for lost fragments, picture loss for a broken reference chain, time
+   requests for an estimate of its clock).
+   Lives on one network thread; replies leave through the socket the stream arrives on,
+   to the address it last came from. */
+class StreamReceiver {
+public:
+    // conceal: frames still incomplete at playout go to the decoder with their whole
+    // slices (Concealment.h) instead of being skipped
+    StreamReceiver(UdpReceiver& socket, ReceivePipeline& pipeline, const JitterBufferConfig& jitterConfig,
+        uint8_t streamId, bool conceal = false);
+
+    // A native fragment, FEC repair or time response of this stream
+    void onDatagram(const uint8_t* data, std::size_t len, const sockaddr_in& from, int64_t arrivalNs);
+    // A frame put together elsewhere (RTP); such senders take no feedback
+    void onFrame(const ReassembledFrame& frame, int64_t arrivalNs);
+
+    // Sends the requests that are due and hands every due frame to the decoder
+    void poll();
+    // Milliseconds until poll() has something to do, -1 when nothing is pending
+    int64_t waitMs(int64_t nowNs) const;
+
+    // The sender now arrives on another socket, e.g. it restarted on a new source port
+    // that SO_REUSEPORT hashes elsewhere
+    void moveTo(UdpReceiver& other) { socket = &other; }
+
+    // Frames leaving the jitter buffer are aligned with a haptic stream
+    void setSync(SyncEngine* engine) { sync = engine; }
+
+    // The sender's system clock, as far as the time exchanges tell
+    const ClockSync& senderClock() const { return clock; }
+
+    // Reassembly, NACK, picture loss and jitter buffer lines
+    void dump(std::ostream& out) const;
+
+private:
+    void reply(const uint8_t* data, std::size_t len);
+    void salvage(uint8_t stream, uint32_t until);
+    bool syncAllows();
+
+    UdpReceiver* socket;
+    ReceivePipeline& pipeline;
+    sockaddr_in peer;
+    bool havePeer = false;
+
+    Reassembler reassembler;
+    ReassembledFrame assembled;
+    bool conceal;
+    std::vector<uint8_t> salvaged;
+    JitterBuffer jitterBuffer;
+    SyncEngine* sync = nullptr;
+    bool syncHolding = false;         // the due frame waits for its haptic samples
+    FeedbackReporter feedback;        // arrival times back to the sender, which adapts its bitrate
+    NackGenerator nack;               // requests lost fragments again while they can still play
+    PictureLossReporter pictureLoss;  // asks for an IDR once a reference is gone for good
+    ClockSync clock;                  // offset and drift of the sender's clock
+    uint32_t nextFrameId = 0;
+    uint8_t streamId = 0;
+    bool playing = false;
+    bool decoderWaiting = false;
+    uint8_t report[c_maxFeedbackSize];
+};
+
+#endif // STREAMRECEIVER_H
@@ -0,0 +1,215 @@
+#include "SyncEngine.h"
+#include <algorithm>
+#include <iomanip>
+
+bool parseSyncPolicy(const std::string& name, SyncPolicy& policy) {
+    if (name == "haptic") policy = SyncPolicy::HapticWaits;
+    else if (name == "video") policy = SyncPolicy::VideoWaits;
+    else if (name == "none") policy = SyncPolicy::None;
+    else return false;
+    return true;
+}
+
+static const char* policyName(SyncPolicy policy) {
+    switch (policy) {
+    case SyncPolicy::HapticWaits: return "haptic waits";
+    case SyncPolicy::VideoWaits: return "video waits";
+    default: return "no waiting";
+    }
+}
+
+SyncEngine::SyncEngine(const SyncConfig& config, Sink sink)
+    : config(config), sink(std::move(sink)), boundNs(config.skewBoundMs * 1000000LL) {
+    // Twice the samples a skew bound holds, plus room for bursts
+    std::size_t size = 64;
+    while (size < static_cast<std::size_t>(2 * config.skewBoundMs * 1000LL / config.periodUs + 64)) size *= 2;
+    ring.resize(size);
+    arrivals.resize(size);
+    batch.reserve(size);
+    mask = size - 1;
+}
+
+int64_t SyncEngine::tickOf(int64_t captureUs) const {
+    // Rounded, as capture times scatter a little around the sender's period
+    int64_t offset = captureUs - baseUs + config.periodUs / 2;
+    return offset >= 0 ? offset / config.periodUs : -((-offset + config.periodUs - 1) / config.periodUs);
+}
+
+void SyncEngine::releaseAlone(Slot& slot) {
+    slot.held = false;
+    lastReleasedUs = released ? std::max(lastReleasedUs, slot.sample.captureUs) : slot.sample.captureUs;
+    released = true;
+    if (sink) sink(&slot.sample, 1, 0);
+}
+
+void SyncEngine::setVideoClock(const ClockSync* clock) {
+    std::lock_guard<std::mutex> guard(lock);
+    videoClock = clock;
+}
+
+void SyncEngine::setHapticClock(const ClockSync* clock) {
+    std::lock_guard<std::mutex> guard(lock);
+    hapticClock = clock;
+}
+
+bool SyncEngine::clocksReady() const {
+    if (!config.senderClocks) return true;
+    return videoClock && hapticClock && videoClock->synchronised() && hapticClock->synchronised();
+}
+
+void SyncEngine::onSample(const HapticSample& received, int64_t nowNs) {
+    std::lock_guard<std::mutex> guard(lock);
+    counters.samples++;
+    if (!clocksReady()) {
+        counters.unclocked++;
+        return;
+    }
+    HapticSample sample = received;
+    if (config.senderClocks) sample.captureUs = hapticClock->remoteToLocal(sample.captureUs);
+    lastArrivalNs = nowNs;
+    if (!started) {
+        started = true;
+        baseUs = sample.captureUs;
+    }
+    int64_t tick = tickOf(sample.captureUs);
+    newestTick = std::max(newestTick, tick);
+
+    Slot* slot = &ring[tick & mask];
+    if (config.policy != SyncPolicy::HapticWaits || tick <= releasedThrough) {
+        // Played at once: nothing waits for video, or its frame is gone already
+        if (config.policy == SyncPolicy::HapticWaits) counters.late++;
+        Slot alone;
+        alone.sample = sample;
+        releaseAlone(alone);
+        return;
+    }
+    if (slot->held) {
+        if (slot->tick == tick) counters.collisions++;
+        else counters.expired++;
+        releaseAlone(*slot);
+    }
+    slot->held = true;
+    slot->tick = tick;
+    slot->arrivalNs = nowNs;
+    slot->sample = sample;
+
+    if (arrivalCount == arrivals.size()) {
+        Slot& oldest = ring[arrivals[arrivalHead] & mask];
+        if (oldest.held && oldest.tick == arrivals[arrivalHead]) {
+            counters.expired++;
+            releaseAlone(oldest);
+        }
+        arrivalHead = (arrivalHead + 1) & mask;
+        arrivalCount--;
+    }
+    arrivals[(arrivalHead + arrivalCount) & mask] = tick;
+    arrivalCount++;
+    expireLocked(nowNs);
+}
+
+void SyncEngine::expire(int64_t nowNs) {
+    std::lock_guard<std::mutex> guard(lock);
+    expireLocked(nowNs);
+}
+
+void SyncEngine::expireLocked(int64_t nowNs) {
+    // Entries whose sample already went out with a frame are skipped over
+    while (arrivalCount) {
+        int64_t tick = arrivals[arrivalHead];
+        Slot& slot = ring[tick & mask];
+        if (slot.held && slot.tick == tick) {
+            if (nowNs - slot.arrivalNs <= boundNs) break;
+            counters.expired++;
+            releaseAlone(slot);
+            releasedThrough = std::max(releasedThrough, tick);
+        }
+        arrivalHead = (arrivalHead + 1) & mask;
+        arrivalCount--;
+    }
+}
+
+bool SyncEngine::frameReady(int64_t captureUs, int64_t nowNs) {
+    std::lock_guard<std::mutex> guard(lock);
+    // Without a haptic stream, or with one gone quiet, video plays on its own
+    if (config.policy != SyncPolicy::VideoWaits || !started || nowNs - lastArrivalNs > boundNs) return true;
+    if (config.senderClocks) captureUs = videoClock->remoteToLocal(captureUs);
+    if (newestTick >= tickOf(captureUs)) {
+        holding = false;
+        return true;
+    }
+    if (!holding || heldCaptureUs != captureUs) {
+        holding = true;
+        heldCaptureUs = captureUs;
+        holdStartNs = nowNs;
+        counters.framesHeld++;
+    }
+    if (nowNs - holdStartNs > boundNs) {
+        holding = false;
+        counters.holdTimeouts++;
+        return true;
+    }
+    return false;
+}
+
+void SyncEngine::onFrame(int64_t captureUs, int64_t nowNs) {
+    std::lock_guard<std::mutex> guard(lock);
+    counters.frames++;
+    if (!clocksReady()) return;
+    if (config.senderClocks) captureUs = videoClock->remoteToLocal(captureUs);
+    if (started && config.policy == SyncPolicy::HapticWaits) {
+        expireLocked(nowNs);
+        int64_t end = tickOf(captureUs);
+        if (end > releasedThrough) {
+            // Older ticks than the ring holds were released or overwritten long ago
+            int64_t first = std::max(releasedThrough + 1, end - static_cast<int64_t>(ring.size()) + 1);
+            batch.clear();
+            for (int64_t tick = first; tick <= end; ++tick) {
+                Slot& slot = ring[tick & mask];
+                if (!slot.held || slot.tick != tick) continue;
+                slot.held = false;
+                batch.push_back(slot.sample);
+            }
+            releasedThrough = end;
+            if (!batch.empty()) {
+                counters.paired += batch.size();
+                lastReleasedUs = released ? std::max(lastReleasedUs, batch.back().captureUs) : batch.back().captureUs;
+                released = true;
+                if (sink) sink(batch.data(), batch.size(), captureUs);
+            }
+        }
+    }
+    if (!released) return;
+
+    int64_t offsetUs = lastReleasedUs - captureUs;
+    int64_t magnitudeUs = offsetUs < 0 ? -offsetUs : offsetUs;
+    offsets.record(magnitudeUs * 1000);
+    if (magnitudeUs > config.skewBoundMs * 1000LL) counters.outOfBound++;
+    counters.offsetMs = offsetUs / 1000.0;
+    counters.meanOffsetMs = offsets.count() == 1 ? counters.offsetMs
+        : counters.meanOffsetMs + (counters.offsetMs - counters.meanOffsetMs) / 16.0;
+}
+
+SyncStats SyncEngine::stats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return counters;
+}
+
+void SyncEngine::dump(std::ostream& out) const {
+    SyncStats s = stats();
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2) << std::showpos;
+    out << "Sync (" << policyName(config.policy) << ", bound " << std::noshowpos << config.skewBoundMs << std::showpos
+        << " ms): offset " << s.offsetMs << " ms, mean " << s.meanOffsetMs << std::noshowpos
+        << " ms, |offset| p50 " << offsets.percentile(50.0) / 1e6 << " p99 " << offsets.percentile(99.0) / 1e6
+        << " max " << offsets.max() / 1e6 << " ms\n";
+    out << "  " << s.frames << " frames, " << s.samples << " samples: " << s.paired << " with their frame, "
+        << s.expired << " past the bound, " << s.late << " late, " << s.collisions << " collisions; "
+        << s.framesHeld << " frames held, " << s.holdTimeouts << " timed out, " << s.outOfBound << " out of bound\n";
+    if (config.senderClocks) {
+        out << "  on the local clock via the senders' clock estimates, " << s.unclocked
+            << " samples dropped before both were known\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
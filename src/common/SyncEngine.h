@@ -0,0 +1,124 @@
+#ifndef SYNCENGINE_H
+#define SYNCENGINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ClockSync.h"
+#include "HapticTransport.h"
+#include "LatencyHistogram.h"
+
+enum class SyncPolicy {
+    HapticWaits,  // samples are held back for the frame of their window: haptics as late as video
+    VideoWaits,   // a due frame is held until the samples of its window are in
+    None          // neither waits; only the offset is measured
+};
+
+// "haptic", "video" or "none": the stream that waits for the other
+bool parseSyncPolicy(const std::string& name, SyncPolicy& policy);
+
+struct SyncConfig {
+    SyncPolicy policy = SyncPolicy::HapticWaits;
+    int skewBoundMs = 50;   // the longest either stream is held for the other
+    int periodUs = 1000;    // haptic sample period
+    bool senderClocks = false;  // both streams mapped onto the local clock with the senders' clock estimates
+};
+
+struct SyncStats {
+    uint64_t frames;
+    uint64_t samples;
+    uint64_t paired;        // samples released with the frame of their window
+    uint64_t expired;       // held past the skew bound and released alone
+    uint64_t late;          // arrived after their frame had been released
+    uint64_t collisions;    // two samples in one period, the earlier one released alone
+    uint64_t framesHeld;    // frames that waited for haptics
+    uint64_t holdTimeouts;  // of those, released at the skew bound without their samples
+    uint64_t outOfBound;    // frames released with an offset beyond the skew bound
+    uint64_t unclocked;     // samples dropped while a sender's clock was not yet known
+    double offsetMs;        // newest haptic sample released minus the frame's capture time, last frame
+    double meanOffsetMs;    // smoothed over about 16 frames
+};
+
+/* Receiver-side alignment of one video stream with one haptic stream, both on the
+   senders' capture clocks. A video frame leaving the jitter buffer is released together
+   with the haptic samples captured in its window, (previous frame's capture, this
+   frame's capture]. Samples wait in a ring indexed by capture time in sample periods,
+   so storing one and finding a window's are O(1) per sample, and a FIFO in arrival order
+   expires samples held past the skew bound. The offset achieved is measured at every
+   frame: the capture time of the newest sample released so far minus the frame's.
+   With senderClocks both capture times are first mapped onto the local clock, so the
+   offset holds for unsynchronised senders too; nothing is paired until both clocks are in.
+   Samples arrive on the haptic thread, frames on the video network thread; the sink runs
+   under the engine's lock on either and must not block. */
+class SyncEngine {
+public:
+    // Released samples, in capture order; frameCaptureUs is 0 for samples released alone
+    using Sink = std::function<void(const HapticSample* samples, std::size_t count, int64_t frameCaptureUs)>;
+
+    explicit SyncEngine(const SyncConfig& config, Sink sink = nullptr);
+
+    // The senders' clocks, for senderClocks; may be set while streams run
+    void setVideoClock(const ClockSync* clock);
+    void setHapticClock(const ClockSync* clock);
+
+    void onSample(const HapticSample& sample, int64_t nowNs);
+    // Releases the samples held past the skew bound; call with nothing arriving too
+    void expire(int64_t nowNs);
+
+    // Video side, for the next due frame: false while it should wait for its samples
+    bool frameReady(int64_t captureUs, int64_t nowNs);
+    // The frame is played; its window's samples go to the sink
+    void onFrame(int64_t captureUs, int64_t nowNs);
+
+    SyncStats stats() const;
+    void dump(std::ostream& out) const;
+
+private:
+    struct Slot {
+        bool held = false;
+        int64_t tick = 0;
+        int64_t arrivalNs = 0;
+        HapticSample sample;
+    };
+
+    int64_t tickOf(int64_t captureUs) const;
+    bool clocksReady() const;
+    void releaseAlone(Slot& slot);
+    void expireLocked(int64_t nowNs);
+
+    SyncConfig config;
+    Sink sink;
+    int64_t boundNs;
+    mutable std::mutex lock;
+    const ClockSync* videoClock = nullptr;
+    const ClockSync* hapticClock = nullptr;
+
+    std::vector<Slot> ring;          // by capture tick
+    std::vector<int64_t> arrivals;   // held ticks in arrival order
+    std::size_t arrivalHead = 0;
+    std::size_t arrivalCount = 0;
+    std::size_t mask;
+    std::vector<HapticSample> batch;
+
+    bool started = false;
+    int64_t baseUs = 0;              // capture time of tick 0
+    int64_t releasedThrough = -1;    // every tick up to here went to a frame or expired
+    int64_t newestTick = -1;
+    int64_t lastArrivalNs = 0;
+    bool released = false;
+    int64_t lastReleasedUs = 0;      // capture time of the newest sample released
+
+    bool holding = false;
+    int64_t heldCaptureUs = 0;
+    int64_t holdStartNs = 0;
+
+    LatencyHistogram offsets;        // |offset| per frame
+    SyncStats counters = {};
+};
+
+#endif // SYNCENGINE_H
@@ -0,0 +1,593 @@
+#include "UdpTransport.h"
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#include "FrameTiming.h"
+
+#ifndef _WIN32
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+// Room for the drop counter and the GRO segment size of one message
+static const std::size_t c_controlSize = CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(int));
+#endif
+
+static const int c_sendBufferSize = 4 * 1024 * 1024;
+static const int c_receiveBufferSize = 8 * 1024 * 1024;
+
+// Per message of a batch: the largest datagram, which is also the largest GRO coalesces
+static const std::size_t c_batchBufferSize = 65536;
+
+// Kernel limits for one GSO send: segment count and total UDP payload
+static const std::size_t c_maxGsoSegments = 64;
+static const std::size_t c_maxGsoBytes = 65000;
+
+bool initNetwork() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    return true;
+#endif
+}
+
+void shutdownNetwork() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+static std::atomic<bool> s_interrupted{ false };
+
+static void onInterrupt(int) {
+    s_interrupted.store(true);
+}
+
+void catchInterrupt(bool enable) {
+    if (enable) s_interrupted.store(false);
+    std::signal(SIGINT, enable ? onInterrupt : SIG_DFL);
+}
+
+bool interrupted() {
+    return s_interrupted.load();
+}
+
+bool setTrafficClass(SOCKET sock, int dscp) {
+#ifdef _WIN32
+    // IP_TOS is ignored; DSCP marking needs a Group Policy QoS rule or the qWAVE API
+    (void)sock;
+    (void)dscp;
+    return false;
+#else
+    int tos = dscp << 2;
+    bool marked = setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == 0;
+
+    // 802.1d user priority as in RFC 8325: EF and VOICE-ADMIT are voice (6), the rest
+    // their class selector. mac80211 takes 256 + priority as the user priority itself,
+    // where older kernels would map EF to 5 (AC_VI) by its top bits; that needs
+    // CAP_NET_ADMIN, so otherwise the plain priority only orders the local qdiscs.
+    int userPriority = dscp == c_dscpExpedited || dscp == 44 ? 6 : dscp >> 3;
+    int priority = 256 + userPriority;
+    if (setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) != 0) {
+        priority = userPriority < 6 ? userPriority : 6;
+        marked = setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) == 0 && marked;
+    }
+    return marked;
+#endif
+}
+
+UdpSender::UdpSender() {
+    memset(&dest, 0, sizeof(dest));
+}
+
+UdpSender::~UdpSender() {
+    close();
+}
+
+bool UdpSender::open(const char* host, uint16_t port, bool useGso) {
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &dest.sin_addr) != 1) {
+        std::cerr << "Invalid destination address " << host << "\n";
+        return false;
+    }
+
+    sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) {
+        std::cerr << "Socket creation failed.\n";
+        return false;
+    }
+
+    // A keyframe goes out as one burst; give it room in the socket buffer
+    int sndbuf = c_sendBufferSize;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&sndbuf), sizeof(sndbuf));
+
+#ifndef _WIN32
+    // Probe once; the per-message cmsg is what is actually used
+    int segment = 0;
+    gso = useGso && setsockopt(sock, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == 0;
+    // Arrival times of what comes back, for the clock exchange (ClockSync.h)
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+#else
+    (void)useGso;
+#endif
+    return true;
+}
+
+void UdpSender::close() {
+    if (sock != INVALID_SOCKET) {
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+}
+
+int UdpSender::receive(uint8_t* buffer, std::size_t size, int64_t* arrivalUs) {
+    if (sock == INVALID_SOCKET) return 0;
+#ifdef _WIN32
+    u_long pending = 0;
+    if (ioctlsocket(sock, FIONREAD, &pending) != 0 || pending == 0) return 0;
+    int len = recv(sock, reinterpret_cast<char*>(buffer), static_cast<int>(size), 0);
+    if (arrivalUs) *arrivalUs = wallClockMicros();
+#else
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+    char control[CMSG_SPACE(sizeof(struct timeval))];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    int len = static_cast<int>(recvmsg(sock, &hdr, MSG_DONTWAIT));
+    if (len > 0 && arrivalUs) {
+        // The kernel's stamp, not when this thread got round to reading
+        *arrivalUs = wallClockMicros();
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr); cm; cm = CMSG_NXTHDR(&hdr, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
+                struct timeval stamp;
+                memcpy(&stamp, CMSG_DATA(cm), sizeof(stamp));
+                *arrivalUs = stamp.tv_sec * 1000000LL + stamp.tv_usec;
+            }
+        }
+    }
+#endif
+    // Errors here are ICMP "port unreachable" and the like, not worth reporting
+    return len > 0 ? len : 0;
+}
+
+bool UdpSender::send(const uint8_t* data, std::size_t len) {
+    counters.syscalls++;
+    if (sendto(sock, reinterpret_cast<const char*>(data), static_cast<int>(len), 0,
+            reinterpret_cast<const sockaddr*>(&dest), sizeof(dest)) == SOCKET_ERROR) {
+        counters.errors++;
+        return false;
+    }
+    counters.datagrams++;
+    counters.bytes += len;
+    return true;
+}
+
+int UdpSender::sendFragments(const std::vector<Fragment>& fragments) {
+    if (fragments.empty()) return 0;
+    counters.frames++;
+#ifndef _WIN32
+    if (gso && fragments.size() > 1) {
+        return sendSegmented(fragments);
+    }
+#endif
+    return sendBatched(fragments, 0);
+}
+
+#ifdef _WIN32
+
+int UdpSender::sendBatched(const std::vector<Fragment>& fragments, std::size_t first) {
+    int sent = 0;
+    for (std::size_t i = first; i < fragments.size(); ++i) {
+        const Fragment& fragment = fragments[i];
+        WSABUF bufs[2];
+        bufs[0].buf = const_cast<char*>(reinterpret_cast<const char*>(fragment.header));
+        bufs[0].len = static_cast<ULONG>(fragment.headerSize);
+        bufs[1].buf = const_cast<char*>(reinterpret_cast<const char*>(fragment.payload));
+        bufs[1].len = static_cast<ULONG>(fragment.size);
+
+        DWORD bytes = 0;
+        counters.syscalls++;
+        if (WSASendTo(sock, bufs, 2, &bytes, 0, reinterpret_cast<const sockaddr*>(&dest), sizeof(dest), nullptr, nullptr) == SOCKET_ERROR) {
+            counters.errors++;
+            continue;
+        }
+        counters.datagrams++;
+        counters.bytes += bytes;
+        sent++;
+    }
+    return sent;
+}
+
+#else
+
+int UdpSender::sendBatched(const std::vector<Fragment>& fragments, std::size_t first) {
+    std::size_t count = fragments.size() - first;
+    // Only grows, so steady state does not allocate
+    if (iovs.size() < 2 * count) iovs.resize(2 * count);
+    if (msgs.size() < count) msgs.resize(count);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        const Fragment& fragment = fragments[first + i];
+        iovs[2 * i].iov_base = const_cast<uint8_t*>(fragment.header);
+        iovs[2 * i].iov_len = fragment.headerSize;
+        iovs[2 * i + 1].iov_base = const_cast<uint8_t*>(fragment.payload);
+        iovs[2 * i + 1].iov_len = fragment.size;
+
+        struct msghdr& hdr = msgs[i].msg_hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = &dest;
+        hdr.msg_namelen = sizeof(dest);
+        hdr.msg_iov = &iovs[2 * i];
+        hdr.msg_iovlen = 2;
+    }
+
+    std::size_t sent = 0;
+    while (sent < count) {
+        counters.syscalls++;
+        int n = sendmmsg(sock, &msgs[sent], static_cast<unsigned int>(count - sent), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            counters.errors++;
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            counters.bytes += msgs[sent + i].msg_len;
+        }
+        sent += n;
+    }
+    counters.datagrams += sent;
+    return static_cast<int>(sent);
+}
+
+int UdpSender::sendSegmented(const std::vector<Fragment>& fragments) {
+    // GSO needs every datagram but the last of a send to have the same size. Native
+    // fragments always do; RTP packets of frames with several NAL units may not.
+    std::size_t segmentSize = fragments[0].headerSize + fragments[0].size;
+    for (std::size_t i = 1; i < fragments.size(); ++i) {
+        std::size_t datagram = fragments[i].headerSize + fragments[i].size;
+        if (datagram > segmentSize || (datagram < segmentSize && i + 1 < fragments.size())) {
+            return sendBatched(fragments, 0);
+        }
+    }
+    std::size_t perSend = c_maxGsoBytes / segmentSize;
+    if (perSend > c_maxGsoSegments) perSend = c_maxGsoSegments;
+    if (perSend < 2) return sendBatched(fragments, 0);
+
+    if (iovs.size() < 2 * fragments.size()) iovs.resize(2 * fragments.size());
+    for (std::size_t i = 0; i < fragments.size(); ++i) {
+        iovs[2 * i].iov_base = const_cast<uint8_t*>(fragments[i].header);
+        iovs[2 * i].iov_len = fragments[i].headerSize;
+        iovs[2 * i + 1].iov_base = const_cast<uint8_t*>(fragments[i].payload);
+        iovs[2 * i + 1].iov_len = fragments[i].size;
+    }
+
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    int sent = 0;
+    for (std::size_t first = 0; first < fragments.size(); first += perSend) {
+        std::size_t count = fragments.size() - first < perSend ? fragments.size() - first : perSend;
+
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = &dest;
+        hdr.msg_namelen = sizeof(dest);
+        hdr.msg_iov = &iovs[2 * first];
+        hdr.msg_iovlen = 2 * count;
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t gsoSize = static_cast<uint16_t>(segmentSize);
+        memcpy(CMSG_DATA(cm), &gsoSize, sizeof(gsoSize));
+
+        counters.syscalls++;
+        ssize_t n = sendmsg(sock, &hdr, 0);
+        if (n < 0) {
+            if (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP) {
+                // No checksum offload or an old kernel: stay on sendmmsg from now on
+                std::cerr << "UDP GSO unavailable, falling back to sendmmsg\n";
+                gso = false;
+                return sent + sendBatched(fragments, first);
+            }
+            counters.errors++;
+            continue;
+        }
+        counters.bytes += static_cast<uint64_t>(n);
+        counters.datagrams += count;
+        sent += static_cast<int>(count);
+    }
+    return sent;
+}
+
+#endif
+
+UdpReceiver::UdpReceiver() {
+    memset(&sender, 0, sizeof(sender));
+}
+
+UdpReceiver::~UdpReceiver() {
+    close();
+}
+
+bool UdpReceiver::open(const char* host, uint16_t port, bool reusePort, bool useGro) {
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    if (!host) {
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+    }
+    else if (inet_pton(AF_INET, host, &local.sin_addr) != 1) {
+        std::cerr << "Invalid listen address " << host << "\n";
+        return false;
+    }
+
+    sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) {
+        std::cerr << "Socket creation failed.\n";
+        return false;
+    }
+
+    // Room for a few keyframe bursts while the network thread is descheduled
+    int rcvbuf = c_receiveBufferSize;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&rcvbuf), sizeof(rcvbuf));
+
+#ifndef _WIN32
+    int on = 1;
+    counters.dropsReported = setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == 0;
+    gro = useGro && setsockopt(sock, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+    if (reusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+        std::cerr << "SO_REUSEPORT unavailable.\n";
+        close();
+        return false;
+    }
+#else
+    // Windows lets sockets share a port but delivers to one of them only
+    (void)useGro;
+    if (reusePort) {
+        std::cerr << "SO_REUSEPORT unavailable.\n";
+        close();
+        return false;
+    }
+#endif
+
+    if (bind(sock, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) == SOCKET_ERROR) {
+        std::cerr << "Bind to port " << port << " failed.\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void UdpReceiver::close() {
+    if (sock != INVALID_SOCKET) {
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+}
+
+int UdpReceiver::wait(int timeoutMs) {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    timeval timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+    int ready = select(static_cast<int>(sock) + 1, &readable, nullptr, nullptr, &timeout);
+    if (ready < 0) {
+#ifndef _WIN32
+        if (errno == EINTR) return 0;
+#endif
+        counters.errors++;
+        return -1;
+    }
+    return ready;
+}
+
+bool UdpReceiver::setBusyPoll(int us) {
+#ifdef _WIN32
+    (void)us;
+    return false;
+#else
+    return setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) == 0;
+#endif
+}
+
+int UdpReceiver::receive(uint8_t* buffer, std::size_t size, int timeoutMs) {
+    int ready = wait(timeoutMs);
+    if (ready <= 0) return ready;
+    return read(buffer, size, true);
+}
+
+int UdpReceiver::poll(uint8_t* buffer, std::size_t size) {
+    return read(buffer, size, false);
+}
+
+int UdpReceiver::read(uint8_t* buffer, std::size_t size, bool block) {
+#ifdef _WIN32
+    if (!block) {
+        u_long pending = 0;
+        if (ioctlsocket(sock, FIONREAD, &pending) != 0 || pending == 0) return 0;
+    }
+    int senderLen = sizeof(sender);
+    int len = recvfrom(sock, reinterpret_cast<char*>(buffer), static_cast<int>(size), 0,
+        reinterpret_cast<sockaddr*>(&sender), &senderLen);
+    if (len == SOCKET_ERROR) {
+        // WSAECONNRESET is an ICMP port unreachable for an earlier reply; keep going
+        if (WSAGetLastError() == WSAECONNRESET) return 0;
+        counters.errors++;
+        return -1;
+    }
+#else
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+    char control[CMSG_SPACE(sizeof(uint32_t))];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = &sender;
+    hdr.msg_namelen = sizeof(sender);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    int len = static_cast<int>(recvmsg(sock, &hdr, block ? 0 : MSG_DONTWAIT));
+    if (len < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == ECONNREFUSED) return 0;
+        counters.errors++;
+        return -1;
+    }
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr); cm; cm = CMSG_NXTHDR(&hdr, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+            // Cumulative for the socket's lifetime
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+            counters.kernelDrops = drops;
+        }
+    }
+#endif
+    haveSender = true;
+    counters.datagrams++;
+    counters.syscalls++;
+    counters.bytes += static_cast<uint64_t>(len);
+    return len;
+}
+
+#ifdef _WIN32
+
+int UdpReceiver::receiveBatch(int timeoutMs) {
+    // No recvmmsg: one datagram per call
+    if (buffers.empty()) buffers.resize(c_batchBufferSize);
+    int len = receive(buffers.data(), buffers.size(), timeoutMs);
+    if (len <= 0) return len;
+    received.clear();
+    received.push_back({ buffers.data(), static_cast<std::size_t>(len), &sender });
+    return 1;
+}
+
+#else
+
+int UdpReceiver::receiveBatch(int timeoutMs) {
+    if (msgs.empty()) {
+        buffers.resize(c_receiveBatch * c_batchBufferSize);
+        senders.resize(c_receiveBatch);
+        iovs.resize(c_receiveBatch);
+        msgs.resize(c_receiveBatch);
+        controls.resize(c_receiveBatch * c_controlSize);
+    }
+    // The kernel rewrites the lengths, so every call sets them up again
+    auto prepare = [this]() {
+        for (int i = 0; i < c_receiveBatch; ++i) {
+            iovs[i].iov_base = buffers.data() + i * c_batchBufferSize;
+            iovs[i].iov_len = c_batchBufferSize;
+            struct msghdr& hdr = msgs[i].msg_hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_name = &senders[i];
+            hdr.msg_namelen = sizeof(sockaddr_in);
+            hdr.msg_iov = &iovs[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = controls.data() + i * c_controlSize;
+            hdr.msg_controllen = c_controlSize;
+        }
+    };
+
+    // Under load the socket is never empty: read first and only wait when it is
+    prepare();
+    int got = recvmmsg(sock, msgs.data(), c_receiveBatch, MSG_DONTWAIT, nullptr);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        int ready = wait(timeoutMs);
+        if (ready <= 0) return ready;
+        prepare();
+        got = recvmmsg(sock, msgs.data(), c_receiveBatch, MSG_DONTWAIT, nullptr);
+    }
+    if (got < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED) return 0;
+        counters.errors++;
+        return -1;
+    }
+    counters.syscalls++;
+
+    received.clear();
+    for (int i = 0; i < got; ++i) {
+        struct msghdr& hdr = msgs[i].msg_hdr;
+        std::size_t len = msgs[i].msg_len;
+        if (hdr.msg_flags & MSG_TRUNC) {
+            counters.errors++;
+            continue;
+        }
+        std::size_t segment = len;
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr); cm; cm = CMSG_NXTHDR(&hdr, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t drops;
+                memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+                counters.kernelDrops = drops;
+            }
+            else if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                int size;
+                memcpy(&size, CMSG_DATA(cm), sizeof(size));
+                if (size > 0) segment = static_cast<std::size_t>(size);
+            }
+        }
+
+        // A super-datagram holds the sender's datagrams back to back, all but the last
+        // of the segment size
+        const uint8_t* data = buffers.data() + i * c_batchBufferSize;
+        if (segment < len) counters.coalesced++;
+        for (std::size_t offset = 0; offset < len; offset += segment) {
+            std::size_t size = len - offset < segment ? len - offset : segment;
+            received.push_back({ data + offset, size, &senders[i] });
+        }
+        counters.bytes += len;
+        sender = senders[i];
+        haveSender = true;
+    }
+    counters.datagrams += received.size();
+    return static_cast<int>(received.size());
+}
+
+#endif
+
+bool UdpReceiver::reply(const uint8_t* data, std::size_t len) {
+    if (!haveSender) return false;
+    return sendTo(data, len, sender);
+}
+
+bool UdpReceiver::sendTo(const uint8_t* data, std::size_t len, const sockaddr_in& to) {
+    return sendto(sock, reinterpret_cast<const char*>(data), static_cast<int>(len), 0,
+        reinterpret_cast<const sockaddr*>(&to), sizeof(to)) != SOCKET_ERROR;
+}
+
+void dumpReceiverStats(std::ostream& out, const ReceiverStats& network) {
+    out << "socket: " << network.datagrams << " datagrams in " << network.syscalls << " receive calls ("
+        << network.coalesced << " GRO coalesced), " << network.errors << " errors, kernel drops ";
+    if (network.dropsReported) {
+        out << network.kernelDrops << "\n";
+    }
+    else {
+        out << "not reported on this platform\n";
+    }
+}
@@ -0,0 +1,187 @@
+#ifndef UDPTRANSPORT_H
+#define UDPTRANSPORT_H
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <Ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+inline int closesocket(SOCKET s) { return ::close(s); }
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "Packetizer.h"
+
+// WSAStartup/WSACleanup on Windows, nothing elsewhere
+bool initNetwork();
+void shutdownNetwork();
+
+// Ctrl-C ends a receiver normally, so the summary and the frame log still get written.
+// ReceivePipeline::run() installs the handler itself; other receive loops do it here.
+void catchInterrupt(bool enable);
+bool interrupted();
+
+// Expedited Forwarding, the DSCP of interactive real-time traffic
+const int c_dscpExpedited = 46;
+
+/* Marks a socket's datagrams with a DSCP, and on Linux with the matching SO_PRIORITY, so
+   local queueing disciplines and Wi-Fi WMM (EF: AC_VO) put them ahead of bulk traffic.
+   Returns false when the marking could not be set; Windows leaves DSCP to QoS policy. */
+bool setTrafficClass(SOCKET sock, int dscp);
+
+struct TransportStats {
+    uint64_t frames;
+    uint64_t datagrams;
+    uint64_t syscalls;
+    uint64_t bytes;
+    uint64_t errors;
+};
+
+/* Sends the fragments of one frame without copying them together.
+   Linux: header and payload go out as a two-entry iovec, all datagrams of a frame in one
+   sendmmsg, or as UDP GSO super-datagrams (UDP_SEGMENT) when the kernel supports it.
+   Windows: one gathered WSASendTo per datagram. */
+class UdpSender {
+public:
+    UdpSender();
+    ~UdpSender();
+
+    UdpSender(const UdpSender&) = delete;
+    UdpSender& operator=(const UdpSender&) = delete;
+
+    bool open(const char* host, uint16_t port, bool useGso = true);
+    void close();
+
+    // Returns the number of datagrams handed to the kernel
+    int sendFragments(const std::vector<Fragment>& fragments);
+    // One small datagram, e.g. a haptic sample
+    bool send(const uint8_t* data, std::size_t len);
+
+    // Non-blocking read of a datagram sent back to this socket, such as receiver feedback.
+    // Returns its length, 0 when nothing is waiting. arrivalUs gets the system clock time
+    // the datagram arrived at, from the kernel where it can tell.
+    int receive(uint8_t* buffer, std::size_t size, int64_t* arrivalUs = nullptr);
+
+    SOCKET socket() const { return sock; }
+    const sockaddr_in& destination() const { return dest; }
+    bool gsoEnabled() const { return gso; }
+    TransportStats stats() const { return counters; }
+
+private:
+    int sendBatched(const std::vector<Fragment>& fragments, std::size_t first);
+#ifndef _WIN32
+    int sendSegmented(const std::vector<Fragment>& fragments);
+    std::vector<struct iovec> iovs;
+    std::vector<struct mmsghdr> msgs;
+#endif
+
+    SOCKET sock = INVALID_SOCKET;
+    sockaddr_in dest;
+    bool gso = false;
+    TransportStats counters = {};
+};
+
+struct ReceiverStats {
+    uint64_t datagrams;
+    uint64_t syscalls;     // receive calls that returned data
+    uint64_t coalesced;    // GRO super-datagrams, each split back into several datagrams
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t kernelDrops;  // datagrams the kernel dropped on a full socket buffer
+    bool dropsReported;    // false where the platform has no such counter (Windows)
+};
+
+// The socket line of the receiver summary
+void dumpReceiverStats(std::ostream& out, const ReceiverStats& network);
+
+// One datagram out of receiveBatch(), pointing into the receiver's buffers
+struct ReceivedDatagram {
+    const uint8_t* data;
+    std::size_t len;
+    const sockaddr_in* from;
+};
+
+/* Receiving socket for the video receivers, with a large kernel buffer and a timed wait.
+   Linux: SO_RXQ_OVFL makes every datagram carry the socket's drop counter, so buffer
+   overflows become visible instead of showing up as unexplained fragment loss.
+   receiveBatch() drains the socket with recvmmsg, and with UDP_GRO the kernel hands over
+   a burst of same-sized fragments of one flow as a single super-datagram, so the syscall
+   count follows the batches and not the packet rate. With reusePort several receivers
+   bind one port (SO_REUSEPORT) and the kernel spreads senders across them by address. */
+class UdpReceiver {
+public:
+    UdpReceiver();
+    ~UdpReceiver();
+
+    UdpReceiver(const UdpReceiver&) = delete;
+    UdpReceiver& operator=(const UdpReceiver&) = delete;
+
+    // host nullptr binds every interface; useGro only with receiveBatch(), which splits
+    // the coalesced datagrams again
+    bool open(const char* host, uint16_t port, bool reusePort = false, bool useGro = false);
+    void close();
+
+    // Waits up to timeoutMs for one datagram. Returns its length, 0 on timeout, -1 on error.
+    int receive(uint8_t* buffer, std::size_t size, int timeoutMs);
+    // Takes a datagram if one is queued, without waiting; 0 when none is
+    int poll(uint8_t* buffer, std::size_t size);
+
+    // Linux SO_BUSY_POLL: reads on an empty socket poll the NIC queue for up to us
+    // microseconds instead of waiting for its interrupt. Raising it above the
+    // net.core.busy_read sysctl needs CAP_NET_ADMIN.
+    bool setBusyPoll(int us);
+
+    // Waits up to timeoutMs, then takes whatever is queued, up to c_receiveBatch messages.
+    // Returns the number of datagrams now in datagram(), valid until the next call; 0 on
+    // timeout, -1 on error.
+    int receiveBatch(int timeoutMs);
+    const ReceivedDatagram& datagram(int i) const { return received[i]; }
+
+    // Sends back to whoever sent the last datagram, e.g. feedback to the video sender
+    bool reply(const uint8_t* data, std::size_t len);
+    bool sendTo(const uint8_t* data, std::size_t len, const sockaddr_in& to);
+
+    SOCKET socket() const { return sock; }
+    const sockaddr_in& lastSender() const { return sender; }
+    bool groEnabled() const { return gro; }
+    ReceiverStats stats() const { return counters; }
+
+    static const int c_receiveBatch = 16;
+
+private:
+    int wait(int timeoutMs);
+    int read(uint8_t* buffer, std::size_t size, bool block);
+
+    SOCKET sock = INVALID_SOCKET;
+    sockaddr_in sender;
+    bool haveSender = false;
+    bool gro = false;
+    // Batch buffers, allocated on the first receiveBatch()
+    std::vector<uint8_t> buffers;
+    std::vector<sockaddr_in> senders;
+    std::vector<ReceivedDatagram> received;
+#ifndef _WIN32
+    std::vector<struct iovec> iovs;
+    std::vector<struct mmsghdr> msgs;
+    std::vector<char> controls;
+#endif
+    ReceiverStats counters = {};
+};
+
+#endif // UDPTRANSPORT_H
@@ -1,21 +1,11 @@
 #include "VideoStreamer.h"
 #include <iostream>
-#include <cuda_runtime.h>
 
-#define CAMERA 0
-
-std::queue<int64_t> encodeStartTime;
-
-int64_t getCurrentTimeMillis() {
-    auto v_timestamp = std::chrono::system_clock::now();
-    auto v_epoch = v_timestamp.time_since_epoch();
-    int64_t v_millis = std::chrono::duration_cast<std::chrono::milliseconds>(v_epoch).count();
-    return v_millis;
-}
-
-VideoStreamer::VideoStreamer() : codecContext(nullptr), sws_ctx(nullptr), avFrame(nullptr), packet(nullptr) {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
+VideoStreamer::VideoStreamer(EncoderKind encoderKind, bool hugePages, const FrameSourceConfig& sourceConfig, double previewFps, bool rtp,
+    const FecConfig& fecConfig)
+    : hugePages(hugePages), preview("Live Stream", previewFps), sourceConfig(sourceConfig), encoderKind(encoderKind), sws_ctx(nullptr), rtp(rtp),
+      fec(fecConfig) {
+    initNetwork();
     setupNetwork();
     setupVideo();
 }
@@ -23,374 +13,243 @@ VideoStreamer::VideoStreamer() : codecContext(nullptr), sws_ctx(nullptr), avFram
 VideoStreamer::~VideoStreamer() {
     // stop the thread
     running = false;
-    frameQueueCondVar.notify_all();
-    packetQueueCondVar.notify_all();
+    frameQueue.close();
+    packetQueue.close();
 
     if (captureThread.joinable()) captureThread.join();
     if (encodeThread.joinable()) encodeThread.join();
     if (sendThread.joinable()) sendThread.join();
+    preview.stop();
 
-    if (avFrame) {
-        av_freep(&avFrame->data[0]);
-        av_frame_free(&avFrame);
-    }
-    if (packet) {
-        av_packet_free(&packet);
-    }
-    if (codecContext) {
-        avcodec_free_context(&codecContext);
+    TimedPacket pending;
+    while (packetQueue.tryPop(pending)) {
+        av_packet_free(&pending.first);
     }
+
+    encoder.reset();
     if (sws_ctx) {
         sws_freeContext(sws_ctx);
     }
-    if (sock != INVALID_SOCKET) {
-        closesocket(sock);
-    }
-    cv::destroyAllWindows();
-#ifdef _WIN32
-    WSACleanup();
-#endif
+    transport.close();
+    shutdownNetwork();
 }
 
 void VideoStreamer::setupNetwork() {
-    server.sin_family = AF_INET;
-    server.sin_port = htons(8888);
-    inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
-    server_size = sizeof(server);
-    sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == SOCKET_ERROR) {
-        std::cerr << "Socket creation failed.\n";
+    if (!transport.open("127.0.0.1", 8888)) {
         exit(1);
     }
 }
 
 void VideoStreamer::setupVideo() {
-
-    // Find the encoder
-    const AVCodec* codec = avcodec_find_encoder_by_name("h264_nvenc");
-    if (!codec) {
-        std::cerr << "Codec not found\n";
-        exit(1);
-    }
-
-    // Allocate the codec context
-    codecContext = avcodec_alloc_context3(codec);
-    if (!codecContext) {
-        std::cerr << "Could not allocate video codec context\n";
-        exit(1);
-    }
-
-    // Set codec parameters
-    codecContext->bit_rate = 4000000;
-    codecContext->width = 640;
-    codecContext->height = 480;
-    codecContext->time_base = { 1, 30 };
-    codecContext->framerate = { 30, 1 };
-    codecContext->gop_size = 10;
-    codecContext->max_b_frames = 1;
-    codecContext->pix_fmt = AV_PIX_FMT_CUDA;
-
-    // Initialize CUDA
-    if (initCuda() < 0) {
-        std::cerr << "Could not initialize CUDA\n";
-        exit(1);
-    }
-
-    // Allocate and initialize the hardware frames context
-    AVBufferRef* hw_device_ctx = nullptr;
-    if (av_hwdevice_ctx_create(&hw_device_ctx, AV_HWDEVICE_TYPE_CUDA, nullptr, nullptr, 0) < 0) {
-        std::cerr << "Failed to create a CUDA device context\n";
-        exit(1);
-    }
-    
-    codecContext->hw_device_ctx = av_buffer_ref(hw_device_ctx);
-
-    AVBufferRef* hw_frames_ref = av_hwframe_ctx_alloc(codecContext->hw_device_ctx);
-    if (!hw_frames_ref) {
-        std::cerr << "Could not allocate hardware frame context\n";
+    source = FrameSource::create(sourceConfig);
+    if (!source) {
+        std::cerr << "Could not open the frame source\n";
         exit(1);
     }
 
-    AVHWFramesContext* frames_ctx = (AVHWFramesContext*)(hw_frames_ref->data);
-    frames_ctx->format = AV_PIX_FMT_CUDA;
-    frames_ctx->sw_format = AV_PIX_FMT_YUV420P;
-    frames_ctx->width = codecContext->width;
-    frames_ctx->height = codecContext->height;
-    frames_ctx->initial_pool_size = 20;
-
-    int err = av_hwframe_ctx_init(hw_frames_ref);
-    if (err < 0) {
-        std::cerr << "Failed to initialize hardware frame context\n";
-        av_buffer_unref(&hw_frames_ref);
+    // Encode at whatever resolution the source delivers
+    EncoderConfig config;
+    config.codecId = AV_CODEC_ID_H264;
+    config.width = source->width();
+    config.height = source->height();
+    config.fps = source->fps() > 0.0 ? static_cast<int>(source->fps() + 0.5) : 30;
+    config.bitRate = 4000000;
+    config.gopSize = 10;
+
+    // Falls back to the fastest CPU encoder when NVENC is not available
+    encoder = EncoderBackend::create(encoderKind, config);
+    if (!encoder) {
+        std::cerr << "Could not open any encoder\n";
         exit(1);
     }
-
-    codecContext->hw_frames_ctx = av_buffer_ref(hw_frames_ref);
-    if (!codecContext->hw_frames_ctx) {
-        std::cerr << "Failed to set hardware frame context\n";
-        av_buffer_unref(&hw_frames_ref);
+    std::cout << "Using encoder " << encoder->name() << std::endl;
+    bandwidth.reset(new BandwidthEstimator(config.bitRate, config.bitRate / 10, config.bitRate * 2));
+
+    sws_ctx = sws_getContext(config.width, config.height, AV_PIX_FMT_BGR24,
+        config.width, config.height, AV_PIX_FMT_YUV420P,
+        SWS_BILINEAR, NULL, NULL, NULL);
+    if (!sws_ctx) {
+        std::cerr << "Could not create conversion context\n";
         exit(1);
     }
-    av_buffer_unref(&hw_frames_ref);
 
-    // Set encoder options
-    AVDictionary* opts = nullptr;
-    av_dict_set(&opts, "fast", "fast", 0);
-
-    // Open the codec
-    if (avcodec_open2(codecContext, codec, &opts) < 0) {
-        std::cerr << "Could not open codec\n";
-        av_dict_free(&opts);
+    // Enough slots for a full frame ring plus the frame being captured, converted and
+    // still referenced by the encoder
+    int poolSize = static_cast<int>(frameQueue.capacity()) + 4;
+    framePool.reset(new FramePool(config.width, config.height, poolSize, hugePages));
+    if (!framePool->valid()) {
+        std::cerr << "Could not allocate frame pool\n";
         exit(1);
     }
-
-    // Release dictionary
-    av_dict_free(&opts);
-
-    avFrame = av_frame_alloc();
-    if (!avFrame) {
-        std::cerr << "Could not allocate video frame\n";
-        exit(1);
-    }
-
-    avFrame->format = AV_PIX_FMT_YUV420P;
-    avFrame->width = codecContext->width;
-    avFrame->height = codecContext->height;
-
-    if (av_image_alloc(avFrame->data, avFrame->linesize, avFrame->width, avFrame->height, AV_PIX_FMT_YUV420P, 32) < 0) {
-        std::cerr << "Could not allocate raw picture buffer\n";
-        exit(1);
-    }
-
-    packet = av_packet_alloc();
-    if (!packet) {
-        std::cerr << "Could not allocate packet\n";
-        exit(1);
+    if (hugePages && !framePool->usingHugePages()) {
+        std::cerr << "Huge pages unavailable, frame pool uses normal pages\n";
     }
 }
 
-void VideoStreamer::addTimestampToFrame(cv::Mat& frame, int64_t millis) {
-    std::stringstream ss;
-    ss << "Timestamp: " << millis << " ms";
-    cv::Point textOrg(10, 30);
-    double fontScale = 1;
-    cv::Scalar textColor(0, 0, 255);
-    int fontFace = cv::FONT_HERSHEY_SIMPLEX;
-    int thickness = 1;
-    cv::putText(frame, ss.str(), textOrg, fontFace, fontScale, textColor, thickness);
-}
-
-
-int VideoStreamer::initCuda() {
-    int err = av_hwdevice_ctx_create(&hw_device_ctx, AV_HWDEVICE_TYPE_CUDA, nullptr, nullptr, 0);
-    if (err < 0) {
-        std::cerr << "Error: Could not create CUDA device context\n";
-        return err;
+void VideoStreamer::sendPacketWithTimestamp(AVPacket* packet, FrameTiming& timing) {
+    // One datagram per MTU-sized fragment, the whole frame in as few syscalls as possible
+    bool keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+    const std::vector<Fragment>& fragments = rtp
+        ? rtpPacketizer.packetize(packet->data, packet->size, rtpPacketizer.timestampFor(timing.captureMillis))
+        : packetizer.packetize(packet->data, packet->size, timing.captureMillis, keyframe);
+    transport.sendFragments(fragments);
+    // FEC repairs right behind, in their own batch as they are sized differently
+    std::size_t bytes = packet->size;
+    if (!rtp) {
+        const std::vector<Fragment>& repairs = fec.protect(fragments, keyframe);
+        if (!repairs.empty()) {
+            transport.sendFragments(repairs);
+            bytes += repairs.size() * repairs[0].size;
+        }
     }
-    codecContext->hw_device_ctx = av_buffer_ref(hw_device_ctx);
-    if (!codecContext->hw_device_ctx) {
-        std::cerr << "Error: Could not reference CUDA device context\n";
-        return AVERROR(ENOMEM);
+    timing.sendNs = steadyNowNs();
+    latency.record(timing);
+
+    // Receiver feedback is keyed by native frame ids, RTP streams keep their start bitrate
+    if (rtp) return;
+    retransmits.store(fragments, timing.sendNs);
+    if (keyframe) keyframeRequests.onKeyframeSent(packetizer.lastFrameId(), timing.sendNs);
+    if (bandwidth->onFrameSent(packetizer.lastFrameId(), timing.sendNs, bytes, fragments.size())) {
+        pendingBitrate = bandwidth->targetBitrate();
     }
-    return 0;
+    pollFeedback();
 }
 
-
-void VideoStreamer::sendPacketWithTimestamp(SOCKET sock, AVPacket* packet, const sockaddr_in& server, int64_t millis) {
-    size_t new_size = packet->size + sizeof(millis);
-    std::vector<char> new_packet(packet->size + sizeof(millis));
-    memcpy(new_packet.data(), packet->data, packet->size);
-    memcpy(new_packet.data() + packet->size, &millis, sizeof(millis));
-    sendto(sock, new_packet.data(), new_size, 0, (struct sockaddr*)&server, sizeof(server));
+void VideoStreamer::pollFeedback() {
+    uint8_t report[c_maxFeedbackSize];
+    int len;
+    int64_t arrivalUs;
+    while ((len = transport.receive(report, sizeof(report), &arrivalUs)) > 0) {
+        if (report[0] == c_nackMagic) {
+            transport.sendFragments(retransmits.onNack(report, len, steadyNowNs()));
+        }
+        else if (report[0] == c_clockMagic) {
+            uint8_t response[c_clockMessageSize];
+            std::size_t responseLen = answerClockRequest(report, len, arrivalUs, response);
+            if (responseLen) transport.send(response, responseLen);
+        }
+        else if (report[0] == c_pictureLossMagic) {
+            keyframeRequests.onRequest(report, len, steadyNowNs());
+        }
+        else if (bandwidth->onFeedback(report, len, steadyNowNs())) {
+            pendingBitrate = bandwidth->targetBitrate();
+        }
+    }
+    // The encode thread picks the request up with its next frame
+    if (keyframeRequests.takeKeyframe(steadyNowNs())) encoder->requestKeyframe();
 }
 
 bool VideoStreamer::encodeFrames() {
-    // Pre-allocate CUDA frames and other necessary resources
-    
-    /* ʹopencvʹ֡оʹFFmpegCUDA֡ͻȽBGRʽOpenCV
-    MatתΪYUV420PʽAVFrameȻYUV420P֡תΪCUDAʽӲ֡CUDA֡
-    ͵б룬ɵAVPacket*/
-    // cv::cuda::GpuMat gpuFrame;
-
-    AVFrame* hw_frame = av_frame_alloc();
-    if (!hw_frame) {
-        std::cerr << "Could not allocate CUDA frame\n";
-        return false;
-    }
-    hw_frame->format = AV_PIX_FMT_CUDA;
-    hw_frame->width = codecContext->width;
-    hw_frame->height = codecContext->height;
-
-    if (av_hwframe_get_buffer(codecContext->hw_frames_ctx, hw_frame, 0) < 0) {
-        std::cerr << "Could not allocate CUDA frame buffer\n";
-        av_frame_free(&hw_frame);
-        return false;
-    }
-    
-    AVFrame* sw_frame = av_frame_alloc();
-    if (!sw_frame) {
-        std::cerr << "Could not allocate software frame\n";
-        av_frame_free(&hw_frame);
-        return false;
-    }
-    sw_frame->format = AV_PIX_FMT_YUV420P;
-    sw_frame->width = codecContext->width;
-    sw_frame->height = codecContext->height;
-
-    if (av_image_alloc(sw_frame->data, sw_frame->linesize, sw_frame->width, sw_frame->height, AV_PIX_FMT_YUV420P, 32) < 0) {
-        std::cerr << "Could not allocate raw picture buffer\n";
-        av_frame_free(&sw_frame);
-        av_frame_free(&hw_frame);
-        return false;
-    }
+    auto queuePacket = [this](AVPacket* packet, FrameTiming& packetTiming) {
+        AVPacket* pkt_ref = av_packet_alloc();
+        if (!pkt_ref) {
+            std::cerr << "Could not allocate AVPacket\n";
+            return;
+        }
+        if (av_packet_ref(pkt_ref, packet) < 0) {
+            std::cerr << "Could not reference AVPacket\n";
+            av_packet_free(&pkt_ref);
+            return;
+        }
+        // Blocks while the sender is behind; the frame ring absorbs the stall
+        packetQueue.push(TimedPacket(pkt_ref, packetTiming));
+    };
 
     while (running) {
-        std::unique_lock<std::mutex> frame_lock(frameQueueMutex);
-        frameQueueCondVar.wait(frame_lock, [this] { return !frameQueue.empty() || !running; });
-
-        if (!running) break;
+        std::pair<FrameRef, FrameTiming> frameWithTiming;
+        if (!frameQueue.pop(frameWithTiming)) break;
 
-        std::pair<cv::Mat, int64_t> frameWithTimestamp = frameQueue.front();
-        frameQueue.pop();
-        frame_lock.unlock();
+        FrameRef slot = std::move(frameWithTiming.first);
+        cv::Mat& frame = slot.bgr();
+        FrameTiming& timing = frameWithTiming.second;
 
-        cv::Mat frame = frameWithTimestamp.first;
-        int64_t timestamp = frameWithTimestamp.second;
-        addTimestampToFrame(frame, timestamp);
-
-        cv::imshow("Live Stream", frame); // show the frame locally
-        if (cv::waitKey(1) >= 0) {
+        // Show the frame locally; returns at once unless a preview frame is due
+        preview.offer(frame, timing.captureMillis);
+        if (preview.closeRequested()) {
             running = false;
+            frameQueue.close();
+            packetQueue.close();
             break;
         }
 
-        // Convert cv::Mat to AVFrame (software frame)
-        sw_frame->format = AV_PIX_FMT_BGR24;
-        sw_frame->width = frame.cols;
-        sw_frame->height = frame.rows;
-
-        // Ensure the AVFrame buffer is allocated
-        if (av_frame_get_buffer(sw_frame, 32) < 0) {
-            std::cerr << "Could not allocate buffer for software frame\n";
-            av_frame_free(&hw_frame);
-            av_frame_free(&sw_frame);
-            return false;
-        }
+        // Convert BGR cv::Mat into the slot's pooled YUV420P frame every backend takes
+        AVFrame* yuvFrame = slot.yuv();
+        uint8_t* inData[1] = { frame.data };
+        int inLinesize[1] = { static_cast<int>(frame.step) };
+        sws_scale(sws_ctx, inData, inLinesize, 0, frame.rows, yuvFrame->data, yuvFrame->linesize);
+        yuvFrame->pts = frame_count++;
+        timing.convertNs = steadyNowNs();
 
-        // Copy cv::Mat data to AVFrame
-        av_image_fill_arrays(sw_frame->data, sw_frame->linesize, frame.data, AV_PIX_FMT_BGR24, frame.cols, frame.rows, 1);
+        // Receiver feedback moved the target: takes effect from this frame on
+        int64_t bitrate = pendingBitrate.exchange(0);
+        if (bitrate) encoder->setBitrate(bitrate);
 
-        // Transfer the software frame to CUDA frame
-        if (av_hwframe_transfer_data(hw_frame, sw_frame, 0) < 0) {
-            std::cerr << "Error transferring data to CUDA frame\n";
-            av_frame_free(&hw_frame);
-            av_frame_free(&sw_frame);
-            return false;
-        }
-
-        hw_frame->pts = frame_count++;
-
-        if (avcodec_send_frame(codecContext, hw_frame) < 0) {
-            std::cerr << "Error sending frame for encoding\n";
-            av_frame_free(&hw_frame);
-            return true;
-        }
-
-        while (avcodec_receive_packet(codecContext, packet) == 0) {
-            AVPacket* pkt_ref = av_packet_alloc();
-            if (!pkt_ref) {
-                std::cerr << "Could not allocate AVPacket\n";
-                av_packet_unref(packet);
-                break;
-            }
-        
-            // Copy cv::Mat data to AVFrame
-            av_image_fill_arrays(sw_frame->data, sw_frame->linesize, frame.data, AV_PIX_FMT_BGR24, frame.cols, frame.rows, 1);
-
-            // Transfer the software frame to CUDA frame
-            if (av_hwframe_transfer_data(hw_frame, sw_frame, 0) < 0) {
-                std::cerr << "Error transferring data to CUDA frame\n";
-                av_frame_free(&hw_frame);
-                av_frame_free(&sw_frame);
-                return false;
-            }
-            
-            if (av_packet_ref(pkt_ref, packet) < 0) {
-                std::cerr << "Could not reference AVPacket\n";
-                av_packet_free(&pkt_ref);
-                av_packet_unref(packet);
-                break;
-            }
-
-            {
-                std::unique_lock<std::mutex> pkt_lock(packetQueueMutex);
-                packetQueue.push(pkt_ref);
-            }
-
-            packetQueueCondVar.notify_one();
-            av_packet_unref(packet);  // Reset packet for the next usage
-        }
+        encoder->encode(yuvFrame, timing, queuePacket);
     }
 
-    av_frame_free(&hw_frame);
-    av_frame_free(&sw_frame);
+    // The source ran out: flush the frames still inside the encoder, then let the sender finish
+    if (running) {
+        encoder->encode(nullptr, FrameTiming(), queuePacket);
+    }
+    packetQueue.close();
     return true;
 }
 
 bool VideoStreamer::sendPackets() {
     while (running) {
-        AVPacket* pkt = nullptr;
-
-        {
-            std::unique_lock<std::mutex> pkt_lock(packetQueueMutex);
-            packetQueueCondVar.wait(pkt_lock, [this] { return !packetQueue.empty() || !running; });
-
-            if (!running) break;
-
-            pkt = packetQueue.front();
-            packetQueue.pop();
+        TimedPacket item;
+        // A NACK is answered within a millisecond, not at the next frame: on a LAN the
+        // resend then arrives long before the frame is due
+        if (!packetQueue.popFor(item, std::chrono::milliseconds(1))) {
+            if (packetQueue.isClosed() && packetQueue.empty()) break;
+            if (!rtp) pollFeedback();
+            continue;
         }
 
-        packetQueueCondVar.notify_one();
-
-        if (pkt) {
-            int64_t timestamp = getCurrentTimeMillis();
-            sendPacketWithTimestamp(sock, pkt, server, timestamp);
-            av_packet_free(&pkt);
+        if (item.first) {
+            // The wire carries the capture time, not the moment the packet left the queue
+            sendPacketWithTimestamp(item.first, item.second);
+            av_packet_free(&item.first);
         }
     }
     return true;
 }
 
-/* Capture the frame from camera and send to the frame_queue */
+/* Capture frames from the source and send them to the frame_queue */
 void VideoStreamer::captureFrames() {
-    cv::VideoCapture cap;
-    cap.open(CAMERA);
-    double width = 640, height = 480;
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, width);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, height);
-
-    if (!cap.isOpened()) {
-        std::cerr << "Cannot open the video camera.\n";
-    }
-
     while (running) {
-        cv::Mat frame;
-        cap >> frame;  // Capture a new frame
-        if (frame.empty()) continue;
+        FrameRef slot = framePool->acquire();
+        if (!slot) {
+            // Every buffer is queued or in the encoder: skip this frame, keep the camera fresh
+            if (!source->skip()) break;
+            continue;
+        }
+
+        cv::Mat& frame = slot.bgr();
+        if (!source->read(frame)) break;  // Capture straight into the pooled buffer
+        slot.adopt(frame);
 
-        int64_t timestamp = getCurrentTimeMillis();
+        FrameTiming timing = FrameTiming::captured();
 
-        std::unique_lock<std::mutex> frame_lock(frameQueueMutex);
-        frameQueue.push(std::make_pair(frame, timestamp));
-        frame_lock.unlock();
-        frameQueueCondVar.notify_one();
+        // Never blocks: when the encoder falls behind the oldest frame is dropped
+        frameQueue.push(std::make_pair(std::move(slot), timing));
     }
+    // End of the source: the encoder drains what is queued and then stops
+    frameQueue.close();
+}
+
+void VideoStreamer::printQueueStats(const char* name, const RingStats& stats) {
+    std::cout << name << ": pushed " << stats.pushed
+        << ", popped " << stats.popped
+        << ", dropped " << stats.dropped
+        << ", occupancy " << stats.occupancy << "/" << stats.capacity
+        << ", high watermark " << stats.highWatermark << std::endl;
 }
 
 int VideoStreamer::run() {
     avformat_network_init();
 
+    preview.start();
     captureThread = std::thread(&VideoStreamer::captureFrames, this);
     encodeThread = std::thread(&VideoStreamer::encodeFrames, this);
     sendThread = std::thread(&VideoStreamer::sendPackets, this);
@@ -398,6 +257,27 @@ int VideoStreamer::run() {
     captureThread.join();
     encodeThread.join();
     sendThread.join();
+    preview.stop();
+
+    printQueueStats("frameQueue", frameQueue.stats());
+    printQueueStats("packetQueue", packetQueue.stats());
+    std::cout << "framePool: " << framePool->capacity() << " slots, exhausted "
+        << framePool->exhaustedCount() << " times" << std::endl;
+
+    EncoderStats stats = encoder->stats();
+    std::cout << encoder->name() << ": " << stats.frames << " frames, encode latency avg "
+        << stats.averageMs << " ms, max " << stats.maxMs << " ms" << std::endl;
+
+    bandwidth->dump(std::cout);
+    retransmits.dump(std::cout);
+    keyframeRequests.dump(std::cout);
+
+    TransportStats net = transport.stats();
+    std::cout << "transport" << (transport.gsoEnabled() ? " (GSO)" : "") << ": " << net.frames << " frames, "
+        << net.datagrams << " datagrams in " << net.syscalls << " syscalls, "
+        << net.errors << " errors" << std::endl;
+
+    latency.dump(std::cout);
 
     // Cleanup network functionality
     avformat_network_deinit();
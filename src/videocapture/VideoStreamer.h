@@ -2,8 +2,6 @@
 #ifndef VIDEOSTREAMER_H
 #define VIDEOSTREAMER_H
 
-#include <winsock2.h>
-#include <Ws2tcpip.h>
 #include <opencv2/opencv.hpp>
 
 // FFmpeg
@@ -15,60 +13,84 @@ extern "C" {
 #include <libavutil/opt.h>
 #include <libavutil/dict.h>
 #include <libavutil/imgutils.h>
-#include <libavutil/hwcontext.h>
-#include <libavutil/hwcontext_cuda.h>
-#include <libavutil/buffer.h>
 }
 
-#pragma comment(lib, "ws2_32.lib")
-
 #include <chrono>
 #include <thread>
-#include <queue>
-#include <mutex>
-#include <condition_variable>
+#include <atomic>
+
+#include "../common/SpscRing.h"
+#include "../common/EncoderBackend.h"
+#include "../common/Packetizer.h"
+#include "../common/FramePool.h"
+#include "../common/UdpTransport.h"
+#include "../common/FrameTiming.h"
+#include "../common/FrameSource.h"
+#include "../common/Preview.h"
+#include "../common/CongestionControl.h"
+#include "../common/Rtp.h"
+#include "../common/Fec.h"
+#include "../common/Nack.h"
+#include "../common/PictureLoss.h"
+#include "../common/ClockSync.h"
 
-int64_t getCurrentTimeMillis();
+// Encoded packet plus the lifecycle record of the frame it came from
+typedef std::pair<AVPacket*, FrameTiming> TimedPacket;
 
 class VideoStreamer {
 public:
-    VideoStreamer();
+    explicit VideoStreamer(EncoderKind encoderKind = EncoderKind::Auto, bool hugePages = false,
+        const FrameSourceConfig& sourceConfig = FrameSourceConfig(), double previewFps = 10.0, bool rtp = false,
+        const FecConfig& fecConfig = FecConfig());
     ~VideoStreamer();
     int run();
 
 private:
     void setupNetwork();
     void setupVideo();
-    int initCuda();
 
-    void addTimestampToFrame(cv::Mat& frame, int64_t millis);
-    void sendPacketWithTimestamp(SOCKET sock, AVPacket* packet, const sockaddr_in& server, int64_t millis);
+    void sendPacketWithTimestamp(AVPacket* packet, FrameTiming& timing);
+    void pollFeedback();
 
     void captureFrames(); // thread 0
     bool encodeFrames(); // thread 1
     bool sendPackets(); // thread 2
 
-    std::queue<std::pair<cv::Mat, int64_t>> frameQueue;
-    std::queue<AVPacket*> packetQueue;
-    std::mutex frameQueueMutex;
-    std::mutex packetQueueMutex;
-    std::condition_variable frameQueueCondVar;
-    std::condition_variable packetQueueCondVar;
+    void printQueueStats(const char* name, const RingStats& stats);
+
+    // Declared before the rings so it outlives the frames still queued in them
+    std::unique_ptr<FramePool> framePool;
+    bool hugePages;
+    Preview preview;
+
+    // Bounded hand-off between the threads: stale frames are dropped while the
+    // encoder is stalled, encoded packets apply back-pressure to the encoder.
+    SpscRing<std::pair<FrameRef, FrameTiming>> frameQueue{ 4, OverflowPolicy::DropOldest };
+    SpscRing<TimedPacket> packetQueue{ 8, OverflowPolicy::Block, [](TimedPacket& item) { av_packet_free(&item.first); } };
     std::atomic<bool> running{ true };
 
     std::thread captureThread;
     std::thread encodeThread;
     std::thread sendThread;
 
-    AVCodecContext* codecContext;
+    FrameSourceConfig sourceConfig;
+    std::unique_ptr<FrameSource> source;
+    EncoderKind encoderKind;
+    std::unique_ptr<EncoderBackend> encoder;
     SwsContext* sws_ctx;
-    AVFrame* avFrame;
-    AVPacket* packet;
-    SOCKET sock;
-    struct sockaddr_in server;
-    int server_size;
     int frame_count = 0;
-    AVBufferRef* hw_device_ctx;
+    Packetizer packetizer;
+    RtpPacketizer<H264Payload> rtpPacketizer;
+    bool rtp;  // RTP instead of the native fragment header
+    FecEncoder fec;  // repairs behind native fragments only
+    RetransmitCache retransmits;  // native fragments of the last frames, resent on NACKs
+    KeyframeRequestHandler keyframeRequests;  // picture loss at the receiver -> forced IDR
+    UdpSender transport;
+    PipelineLatency latency;
+
+    // Owned by the send thread; the encode thread applies the bitrate it hands over
+    std::unique_ptr<BandwidthEstimator> bandwidth;
+    std::atomic<int64_t> pendingBitrate{ 0 };
 };
 
 #endif // VIDEOSTREAMER_H
\ No newline at end of file
@@ -8,9 +8,37 @@
 //	return 0;
 //}
 
+#include <cstdlib>
+#include <iostream>
 #include "VideoStreamer.h"
 
-int main() {
-    VideoStreamer streamer;
+// usage: VideoStreamer [nvenc|x264|x265|openh264] [--huge-pages] [--source camera[:N]|pattern|y4m:FILE|yuv:FILE[,fps=N|max][,loop][,frames=N]] [--preview-fps N] [--rtp] [--fec SPEC]
+int main(int argc, char** argv) {
+    EncoderKind encoder = EncoderKind::Auto;
+    bool hugePages = false;
+    FrameSourceConfig source;
+    double previewFps = 10.0;  // 0 disables the local preview window
+    bool rtp = false;          // RTP/H.264 (RFC 6184) instead of the native fragments
+    FecConfig fec;             // "<delta>[/<keyframe>]", each none, xor[:L], xor2d[:L] or rs[:ratio]
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--huge-pages") hugePages = true;
+        else if (arg == "--rtp") rtp = true;
+        else if (arg == "--source" && i + 1 < argc) {
+            if (!source.parse(argv[++i])) return 1;
+        }
+        else if (arg == "--preview-fps" && i + 1 < argc) previewFps = atof(argv[++i]);
+        else if (arg == "--fec" && i + 1 < argc) {
+            if (!fec.parse(argv[++i])) {
+                std::cerr << "Bad FEC spec " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        else if (!EncoderBackend::parseKind(arg, encoder)) {
+            std::cerr << "Unknown encoder or option " << arg << "\n";
+            return 1;
+        }
+    }
+    VideoStreamer streamer(encoder, hugePages, source, previewFps, rtp, fec);
     return streamer.run();
 }
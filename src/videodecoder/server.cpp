@@ -1,101 +1,78 @@
 ﻿#include <iostream>
-#include <winsock2.h>
-#include <Ws2tcpip.h>
 #include <opencv2/opencv.hpp>
 
-#pragma comment(lib, "ws2_32.lib") // Link with Winsock library
+#include "../common/JpegDecoder.h"
+#include "../common/Packetizer.h"
+#include "../common/ReceivePipeline.h"
+#include "../common/UdpTransport.h"
 
-void initializeWinsock() {
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        std::cerr << "Failed to initialize Winsock." << std::endl;
-        exit(EXIT_FAILURE);
-    }
-}
-
-SOCKET createSocket() {
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == INVALID_SOCKET) {
-        std::cerr << "Socket creation failed with error: " << WSAGetLastError() << std::endl;
-        WSACleanup();
-        exit(EXIT_FAILURE);
-    }
-    return sock;
-}
-
-void bindSocket(SOCKET sock, struct sockaddr_in& server) {
-    if (bind(sock, (struct sockaddr*)&server, sizeof(server)) == SOCKET_ERROR) {
-        std::cerr << "Bind failed with error: " << WSAGetLastError() << std::endl;
-        closesocket(sock);
-        WSACleanup();
-        exit(EXIT_FAILURE);
-    }
-}
-
-void displayFrameRate(int& frame_count, double& last_time, double& fps) {
-    frame_count++;
-    if (frame_count % 10 == 0) { // Calculate FPS every 10 frames
-        double current_time = static_cast<double>(cv::getTickCount());
-        double delta_time = (current_time - last_time) / cv::getTickFrequency();
-        fps = 10.0 / delta_time;
-        last_time = current_time;
-        std::cout << "FPS: " << fps << std::endl;
-    }
-}
+// Longest the network thread waits for a datagram before checking for shutdown
+const int c_receiveTimeoutMs = 100;
 
-void receiveAndDisplayFrames(SOCKET sock) {
-    struct sockaddr_in client;
-    int client_size = sizeof(client);
-    char buffer[65536];
-    double last_time = static_cast<double>(cv::getTickCount());
-    int frame_count = 0;
-    double fps = 0.0;
-
-    while (true) {
-        int received_len = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr*)&client, &client_size);
-        if (received_len == SOCKET_ERROR) {
-            std::cerr << "Receive failed with error: " << WSAGetLastError() << std::endl;
-            break;
+void receiveAndDisplayFrames(UdpReceiver& receiver, JpegDecoder& jpeg, const ReceivePipelineConfig& config) {
+    // Straight from the frame buffer into the recycled image, no intermediate copy
+    ReceivePipeline pipeline(config, [&](const EncodedFrame& frame, cv::Mat& image) {
+        if (!jpeg.decode(frame.data.data(), frame.size, image)) {
+            std::cerr << "Failed to decode frame." << std::endl;
+            return false;
         }
-
-        if (received_len < sizeof(int64_t)) {
-            std::cerr << "Received packet is too small." << std::endl;
-            continue;
+        return true;
+    });
+
+    // Network thread: reassembly only, decoding and display run behind the rings
+    pipeline.run([&]() {
+        uint8_t buffer[65536];
+        Reassembler reassembler;
+        ReassembledFrame assembled;
+        while (pipeline.running()) {
+            int received_len = receiver.receive(buffer, sizeof(buffer), c_receiveTimeoutMs);
+            if (received_len < 0) {
+                std::cerr << "Receive failed." << std::endl;
+                pipeline.stop();
+                break;
+            }
+
+            // Collect fragments until the whole JPEG is in
+            if (received_len > 0 && reassembler.push(buffer, received_len, assembled)) {
+                pipeline.submit(assembled, steadyNowNs());
+            }
         }
+    });
 
-        // Extract the timestamp
-        int64_t timestamp;
-        memcpy(&timestamp, buffer + received_len - sizeof(int64_t), sizeof(int64_t));
+    pipeline.dump(std::cout, receiver.stats());
+}
 
-        // Extract the image data
-        std::vector<uchar> data(buffer, buffer + received_len - sizeof(int64_t));
-        cv::Mat frame = cv::imdecode(data, cv::IMREAD_COLOR); // Decode image
-        if (frame.empty()) {
-            std::cerr << "Failed to decode frame." << std::endl;
-            continue;
+int main(int argc, char* argv[]) {
+    ReceivePipelineConfig config;
+    config.windowName = "Received Frame";
+    config.printFps = true;
+
+    // --preview WxH: decode at 1/2 or 1/4 size when the window is that much smaller;
+    // --headless, --log <file>, --duration <s> for unattended latency runs
+    JpegDecoder jpeg;
+    for (int i = 1; i < argc; ++i) {
+        int previewWidth = 0, previewHeight = 0;
+        if (parseReceiverOption(argc, argv, i, config)) continue;
+        if (std::string(argv[i]) == "--preview" && i + 1 < argc && sscanf(argv[++i], "%dx%d", &previewWidth, &previewHeight) == 2) {
+            jpeg.setTargetSize(previewWidth, previewHeight);
         }
-
-        displayFrameRate(frame_count, last_time, fps);
-
-        cv::imshow("Received Frame", frame);
-        if (cv::waitKey(5) >= 0) break;
     }
-}
-int main() {
-    initializeWinsock();
 
-    struct sockaddr_in server;
-    server.sin_family = AF_INET;
-    server.sin_port = htons(8888);
-    inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
+    if (!initNetwork()) {
+        std::cerr << "Failed to initialize Winsock." << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    SOCKET sock = createSocket();
-    bindSocket(sock, server);
+    UdpReceiver receiver;
+    if (!receiver.open("127.0.0.1", 8888)) {
+        shutdownNetwork();
+        return EXIT_FAILURE;
+    }
 
-    receiveAndDisplayFrames(sock);
+    receiveAndDisplayFrames(receiver, jpeg, config);
 
-    closesocket(sock);
-    WSACleanup(); // Cleanup Winsock
+    receiver.close();
+    shutdownNetwork();
 
     return 0;
 }